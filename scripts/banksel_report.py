@@ -0,0 +1,113 @@
+#! /usr/bin/env python3
+#
+# Bank switching report
+#
+# Counts the bank select instructions (BANKSEL / MOVLB) SDCC emitted in every
+# function of two pic16 assembly listings of the same file, typically usbcdc.c
+# built with the hot USB state placed by SDCC (before) and placed in the access
+# bank (after). See 'make banksel-report' in src/Makefile
+#
+# Usage: banksel_report.py <before .asm> <after .asm> [function ...]
+#
+# Counts are static (instructions in the listing, not executed ones), each
+# bank select costs 1 word and 1 instruction cycle (83ns at 12 MIPS)
+#
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+import re
+import sys
+
+
+# Functions reported by default: the interrupt handler and its callees, per
+# transaction (endpoint 0 and data endpoint) first
+DEFAULT_FUNCTIONS = [
+    'usb_handler',
+    'usb_service',
+    'control_out_handler',
+    'control_in_handler',
+    'ep0_send',
+    'ep0_send_packet',
+    'ep0_receive_packet',
+    'ep0_status_in',
+    'ep0_arm_setup',
+    'data_out_handler',
+    'data_in_handler',
+    'data_arm_out',
+    'data_rx_push',
+    'data_tx_kick',
+    'handle_urstif',
+]
+
+# SDCC pic16 function code section: "S_<module>__<function>	code"
+FUNCTION_SECTION = re.compile(r'^S_\w+?__(\w+)\s+code\b')
+
+# Bank select instructions
+BANK_SELECT = re.compile(r'^\s+(BANKSEL|MOVLB)\b', re.IGNORECASE)
+
+# Any instruction (indented mnemonic, not a directive or comment)
+INSTRUCTION = re.compile(r'^\s+[A-Za-z]+\b')
+DIRECTIVES = ('global', 'extern', 'code', 'udata', 'idata', 'res', 'db',
+              'org', 'end', 'radix', 'list', 'include', 'config')
+
+
+def count(path):
+    """ Returns {function: (bank selects, instructions)} """
+    counts = {}
+    function = None
+
+    with open(path) as listing:
+        for line in listing:
+            line = line.split(';', 1)[0].rstrip()
+
+            match = FUNCTION_SECTION.match(line)
+            if match:
+                function = match.group(1)
+                counts.setdefault(function, [0, 0])
+                continue
+
+            if function is None or not INSTRUCTION.match(line):
+                continue
+            if line.split()[0].lower() in DIRECTIVES:
+                continue
+
+            counts[function][1] += 1
+            if BANK_SELECT.match(line):
+                counts[function][0] += 1
+
+    return counts
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.stderr.write('Usage: %s <before .asm> <after .asm> [function ...]\n'
+                         % argv[0])
+        return 1
+
+    before = count(argv[1])
+    after = count(argv[2])
+    functions = argv[3:] or DEFAULT_FUNCTIONS
+
+    print('%-26s %8s %8s %8s   %s' %
+          ('function', 'before', 'after', 'delta', 'instructions (after)'))
+    total_before = total_after = 0
+    for function in functions:
+        if function not in before or function not in after:
+            print('%-26s %8s %8s %8s' % (function, '-', '-', '-'))
+            continue
+        b = before[function][0]
+        a, instructions = after[function]
+        total_before += b
+        total_after += a
+        print('%-26s %8d %8d %+8d   %d' % (function, b, a, a - b, instructions))
+
+    print('%-26s %8d %8d %+8d' % ('total', total_before, total_after,
+                                  total_after - total_before))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
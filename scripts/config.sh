@@ -7,9 +7,10 @@ REMOTE_PROGRAMING_HOST=$SECRET_HOST
 REMOTE_PROGRAMING_USER=$SECRET_USER
 REMOTE_PROGRAMING_PASSWD=$SECRET_PASSWD
 
-# Compiled firmware
+# Compiled firmware, FIRMWARE in the environment overrides it (e.g.
+# benchmark.hex, see 'make flash-benchmark')
 BINDIR="$(dirname "$0")/../bin"
-FIRMWARE='example.hex'
+FIRMWARE="${FIRMWARE:-example.hex}"
 
 # Debugging serial device
 DEBUG_DEV='/dev/ttyUSB0'
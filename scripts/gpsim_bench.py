@@ -0,0 +1,152 @@
+#! /usr/bin/env python3
+#
+# Cycle benchmarks under gpsim
+#
+# Runs the benchmark firmware (src/bench.c) in gpsim until bench_done(),
+# rebuilds its UART output from the TXREG writes gpsim logs and keeps the
+# "BENCH <name> <cycles>" lines. See 'make bench' in src/Makefile
+#
+# Usage: gpsim_bench.py <bench.cod> <results> [baseline]
+#
+# The results file has one "<name> <cycles>" line per case, in run order, so
+# it can be diffed and kept as the baseline ('make bench-baseline'). With a
+# baseline every case is compared with it, cases over BENCH_TOLERANCE cycles
+# slower are flagged and make the exit status 2. A baseline given but missing
+# makes it 3, nothing was compared. The cost of the endpoint table dispatch
+# (DISPATCH cases) follows the table
+#
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+
+# gpsim run limit, seconds
+TIMEOUT = 300
+
+# Cycles slower than the baseline still reported as equal
+BENCH_TOLERANCE = 0
+
+# gpsim session: the log gets every TXREG write, the run stops at bench_done()
+COMMANDS = '''load {cod}
+log on {log}
+log w TXREG
+break e _bench_done
+run
+log off
+quit
+'''
+
+# Logged register write, e.g. "wrote: 0x42 to txreg(0x0FAD)"
+TXREG_WRITE = re.compile(r'(?:wrote|write)\D*?0x([0-9a-fA-F]{1,2})\b.*?'
+                         r'(?:txreg|0x0?fad)', re.IGNORECASE)
+
+# Endpoint table dispatch cost: the case through USB_EP_HANDLERS minus the
+# same handler called directly (see bench_data_endpoint() in src/bench.c)
+DISPATCH = [('dispatch.data_out.64', 'data_out_handler.64'),
+            ('dispatch.data_in.64', 'data_in_handler.64')]
+
+# Benchmark output line
+RESULT = re.compile(r'^BENCH (\S+) (\d+)$')
+
+
+def run(cod):
+    """ Returns the firmware UART output """
+    with tempfile.TemporaryDirectory() as directory:
+        log = os.path.join(directory, 'bench.log')
+        commands = os.path.join(directory, 'bench.stc')
+        with open(commands, 'w') as script:
+            script.write(COMMANDS.format(cod=os.path.abspath(cod), log=log))
+
+        subprocess.run(['gpsim', '-i', '-c', commands], check=True,
+                       timeout=TIMEOUT, stdout=subprocess.DEVNULL)
+
+        output = []
+        with open(log, errors='replace') as lines:
+            for line in lines:
+                match = TXREG_WRITE.search(line)
+                if match:
+                    output.append(chr(int(match.group(1), 16)))
+        return ''.join(output)
+
+
+def parse(output):
+    """ Returns [(name, cycles)] """
+    results = []
+    for line in output.splitlines():
+        match = RESULT.match(line.strip())
+        if match and match.group(1) != 'end':
+            results.append((match.group(1), int(match.group(2))))
+    if 'BENCH end' not in output:
+        sys.stderr.write('bench: incomplete run (no "BENCH end")\n')
+    return results
+
+
+def load(path):
+    """ Returns {name: cycles} of a results file """
+    results = {}
+    with open(path) as lines:
+        for line in lines:
+            fields = line.split()
+            if len(fields) == 2 and not line.startswith('#'):
+                results[fields[0]] = int(fields[1])
+    return results
+
+
+def main(argv):
+    if len(argv) < 3:
+        sys.stderr.write('Usage: %s <bench.cod> <results> [baseline]\n'
+                         % argv[0])
+        return 1
+
+    results = parse(run(argv[1]))
+    if not results:
+        sys.stderr.write('bench: no results\n')
+        return 1
+
+    with open(argv[2], 'w') as output:
+        output.write('# Instruction cycles under gpsim, see src/bench.c\n')
+        for name, cycles in results:
+            output.write('%s %d\n' % (name, cycles))
+
+    baseline = {}
+    status = 0
+    if len(argv) > 3:
+        if os.path.exists(argv[3]):
+            baseline = load(argv[3])
+        else:
+            sys.stderr.write("bench: no baseline %s, take it with "
+                             "'make bench-baseline'\n" % argv[3])
+            status = 3
+
+    print('%-36s %8s %8s %8s' % ('case', 'baseline', 'cycles', 'delta'))
+    for name, cycles in results:
+        if name not in baseline:
+            print('%-36s %8s %8d' % (name, '-', cycles))
+            continue
+        delta = cycles - baseline[name]
+        flag = ''
+        if delta > BENCH_TOLERANCE:
+            flag = '  slower'
+            status = max(status, 2)
+        print('%-36s %8d %8d %+8d%s' % (name, baseline[name], cycles, delta,
+                                        flag))
+
+    cycles = dict(results)
+    for table, direct in DISPATCH:
+        if table in cycles and direct in cycles:
+            print('dispatch cost %-22s %8d' % (direct,
+                                              cycles[table] - cycles[direct]))
+
+    return status
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
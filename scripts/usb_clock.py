@@ -0,0 +1,116 @@
+#! /usr/bin/env python3
+#
+# Device clock against the host frame clock
+#
+# Reads the SOF samples of a device (GET_TIMESTAMPS vendor request, see
+# src/usb_vendor.h) and prints them, the device instruction cycles per frame
+# with its error in ppm, and the frame and phase the device is at. The
+# firmware must be built with USB_FRAME_CLOCK=1
+#
+# Usage: usb_clock.py [vid:pid]
+#
+# vid:pid defaults to the CDC personality (04d8:0111). Needs pyusb (and access
+# to the device node)
+#
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+import struct
+import sys
+
+import usb.core
+
+
+VENDOR_ID = 0x04D8
+PRODUCT_ID = 0x0111
+
+# Vendor requests (src/usb_vendor.h)
+REQ_GET_TIMESTAMPS = 0x06
+
+# bmRequestType: vendor, device, IN
+REQ_TYPE_IN = 0xC0
+
+# Reply entry: extended frame number, Timer 1 (little endian)
+ENTRY = struct.Struct('<IH')
+
+# Instruction cycles in a frame at 48 MHz (USB_FRAME_CYCLES)
+FRAME_CYCLES = 12000
+
+# Timer 1 wraps every 65536 cycles, samples further apart are ambiguous
+MAX_FRAMES = 65536 // FRAME_CYCLES
+
+# Largest reply asked for, the firmware sends its whole table
+MAX_REPLY = 255
+
+
+def cycles_per_frame(samples):
+    """ Average Timer 1 cycles per frame over consecutive SOF samples """
+    frames = cycles = 0
+    for (frame0, timer0), (frame1, timer1) in zip(samples, samples[1:]):
+        if not 0 < frame1 - frame0 <= MAX_FRAMES:
+            continue
+        frames += frame1 - frame0
+        cycles += (timer1 - timer0) & 0xFFFF
+    return cycles / frames if frames else None
+
+
+def main(argv):
+    args = argv[1:]
+
+    vendor, product = VENDOR_ID, PRODUCT_ID
+    if args:
+        try:
+            vendor, product = (int(value, 16) for value in args[0].split(':'))
+        except ValueError:
+            sys.stderr.write('Usage: %s [vid:pid]\n' % argv[0])
+            return 1
+
+    device = usb.core.find(idVendor=vendor, idProduct=product)
+    if device is None:
+        sys.stderr.write('clock: no %04x:%04x device\n' % (vendor, product))
+        return 1
+
+    try:
+        reply = bytes(device.ctrl_transfer(REQ_TYPE_IN, REQ_GET_TIMESTAMPS, 0,
+                                           0, MAX_REPLY))
+    except usb.core.USBError:
+        sys.stderr.write('clock: request stalled (no USB_FRAME_CLOCK?)\n')
+        return 1
+
+    entries = [ENTRY.unpack_from(reply, offset)
+               for offset in range(0, len(reply) - ENTRY.size + 1, ENTRY.size)]
+    if len(entries) < 2:
+        sys.stderr.write('clock: short reply (%d bytes)\n' % len(reply))
+        return 1
+    # Unused sample slots are zero
+    samples = [entry for entry in entries[:-1] if entry != (0, 0)]
+    now_frame, now_timer = entries[-1]
+
+    print('%-8s %10s %8s' % ('sample', 'frame', 'timer'))
+    for index, (frame, timer) in enumerate(samples):
+        print('%-8d %10d %8d' % (index, frame, timer))
+
+    cycles = cycles_per_frame(samples)
+    if cycles is None:
+        print('cycles/frame: not enough consecutive samples')
+    else:
+        print('cycles/frame: %.1f (%+.0f ppm)' % (
+            cycles, (cycles / FRAME_CYCLES - 1) * 1e6))
+
+    # Phase against the last SOF handled, SOFs not handled yet are whole frames
+    last = [timer for frame, timer in samples if frame == now_frame]
+    if not last:
+        print('now: frame %d, no sample of it' % now_frame)
+        return 0
+    phase = (now_timer - last[-1]) & 0xFFFF
+    print('now: frame %d, phase %d cycles' % (now_frame + phase // FRAME_CYCLES,
+                                             phase % FRAME_CYCLES))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,86 @@
+#! /usr/bin/env python3
+#
+# Worst case cycles per call
+#
+# Reads the USB_CYCLES maxima of a device (GET_CYCLES vendor request, see
+# src/usb_vendor.h) and prints, per entry point: worst case instruction
+# cycles and microseconds. The firmware must be built with USB_CYCLES=1
+#
+# Usage: usb_cycles.py [--clear] [vid:pid]
+#
+# vid:pid defaults to the CDC personality (04d8:0111). --clear starts the
+# maxima over after printing them. Needs pyusb (and access to the device node)
+#
+# usb_handler() is the interrupt service time in interrupt mode (the whole
+# handler, or only the queueing one with USB_DEFERRED_EVENTS), usb_task() the
+# poll in polling mode and usb_process_events() the deferred main loop side.
+# Entry points the build does not have stay at 0
+#
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+import struct
+import sys
+
+import usb.core
+
+
+VENDOR_ID = 0x04D8
+PRODUCT_ID = 0x0111
+
+# Vendor requests (src/usb_vendor.h)
+REQ_GET_CYCLES = 0x04
+REQ_CLEAR_CYCLES = 0x05
+
+# bmRequestType: vendor, device, IN / OUT
+REQ_TYPE_IN = 0xC0
+REQ_TYPE_OUT = 0x40
+
+# Reply slots (USB_CYCLES_* in src/usb_vendor.h)
+SLOTS = ['usb_handler', 'usb_task', 'usb_process_events']
+
+# Instruction cycles per microsecond (48MHz clock)
+CYCLES_PER_US = 12
+
+
+def main(argv):
+    args = argv[1:]
+    clear = '--clear' in args
+    args = [arg for arg in args if arg != '--clear']
+
+    vendor, product = VENDOR_ID, PRODUCT_ID
+    if args:
+        try:
+            vendor, product = (int(value, 16) for value in args[0].split(':'))
+        except ValueError:
+            sys.stderr.write('Usage: %s [--clear] [vid:pid]\n' % argv[0])
+            return 1
+
+    device = usb.core.find(idVendor=vendor, idProduct=product)
+    if device is None:
+        sys.stderr.write('cycles: no %04x:%04x device\n' % (vendor, product))
+        return 1
+
+    try:
+        reply = bytes(device.ctrl_transfer(REQ_TYPE_IN, REQ_GET_CYCLES, 0, 0,
+                                           2 * len(SLOTS)))
+    except usb.core.USBError:
+        sys.stderr.write('cycles: request stalled (no USB_CYCLES?)\n')
+        return 1
+
+    print('%-20s %8s %8s' % ('entry', 'max', 'us'))
+    for slot in range(min(len(SLOTS), len(reply) // 2)):
+        worst, = struct.unpack_from('<H', reply, slot * 2)
+        print('%-20s %8d %8.1f' % (SLOTS[slot], worst, worst / CYCLES_PER_US))
+
+    if clear:
+        device.ctrl_transfer(REQ_TYPE_OUT, REQ_CLEAR_CYCLES, 0, 0)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
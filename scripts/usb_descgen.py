@@ -0,0 +1,704 @@
+#! /usr/bin/env python3
+#
+# USB descriptors generator
+#
+# Reads a declarative device specification (see src/usb_device.spec) and
+# writes the descriptors blob, the GET_DESCRIPTOR index table and the
+# endpoint setup code used by usbcdc.c, once per device personality
+#
+# Usage: usb_descgen.py <spec> <output .c> <output .h>
+#
+# Every length field (bLength, wTotalLength, bNumInterfaces, bNumEndpoints,
+# string indexes) is computed here, so nothing is hand counted anymore
+#
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+import os
+import shlex
+import sys
+
+
+# Descriptor types (USB 2.0 specification: page 251 table 9-5)
+DESC_TYPE_DEVICE = 0x01
+DESC_TYPE_CONFIGURATION = 0x02
+DESC_TYPE_STRING = 0x03
+DESC_TYPE_INTERFACE = 0x04
+DESC_TYPE_ENDPOINT = 0x05
+
+# CDC functional descriptors (CDC specification: page 16 table 11, 12)
+CDC_CS_INTERFACE = 0x24
+CDC_FUNCTIONAL_HEADER = 0x00
+CDC_FUNCTIONAL_CALL_MANAGEMENT = 0x01
+CDC_FUNCTIONAL_ACM = 0x02
+CDC_FUNCTIONAL_UNION = 0x06
+
+# Endpoint transfer types (USB 2.0 specification: page 269 table 9-13)
+EP_TYPES = {
+    'control': 0x00,
+    'isochronous': 0x01,
+    'bulk': 0x02,
+    'interrupt': 0x03,
+}
+
+# Configuration attributes (USB 2.0 specification: page 265 table 9-10)
+CONFIGURATION_ATTRIBUTES = {
+    'buspowered': 0x80,
+    'selfpowered': 0x40,
+    'remotewakeup': 0x20,
+}
+
+# Maximum number of endpoints on the PIC18F4550 SIE
+MAX_ENDPOINTS = 16
+
+
+class SpecError(Exception):
+    pass
+
+
+def number(value):
+    return int(value, 0)
+
+
+def parse_args(tokens, line_number):
+    """ Splits 'key=value' tokens, bare tokens are returned positionally """
+    positional = []
+    keywords = {}
+    for token in tokens:
+        if '=' in token:
+            key, value = token.split('=', 1)
+            keywords[key] = value
+        else:
+            positional.append(token)
+    return positional, keywords
+
+
+def require(keywords, key, line_number, default=None):
+    if key in keywords:
+        return keywords[key]
+    if default is not None:
+        return default
+    raise SpecError('line %d: missing "%s"' % (line_number, key))
+
+
+class Descriptor(object):
+    """ A descriptor as a list of (bytes, C expression, field name) """
+
+    def __init__(self, title):
+        self.title = title
+        self.fields = []
+
+        # ASCII string descriptors are stored with one byte per character,
+        # the EP0 packetizer expands them to UTF-16LE
+        self.ascii = False
+
+    def byte(self, name, value, expression=None):
+        if expression is None:
+            expression = '0x%02X' % (value & 0xFF)
+        self.fields.append(([value & 0xFF], expression, name))
+
+    def word(self, name, value):
+        self.fields.append(([value & 0xFF, (value >> 8) & 0xFF],
+                            'USB_DESC_WORD(0x%04X)' % value, name))
+
+    def raw(self, name, values, expression):
+        self.fields.append((list(values), expression, name))
+
+    def size(self):
+        """ Bytes taken by the descriptor in the blob """
+        return sum(len(values) for values, expression, name in self.fields)
+
+    def length(self):
+        """ Bytes sent to the host """
+        if self.ascii:
+            return 2 + 2 * (self.size() - 2)
+        return self.size()
+
+
+class Spec(object):
+    """ One device personality: a complete descriptors set """
+
+    def __init__(self, name):
+        self.name = name
+        self.device = None
+        self.language = 0x0409
+        self.strings = []
+        self.string_names = {}
+        self.configuration = None
+        self.interfaces = []
+
+    def string_index(self, text):
+        """ Returns the string descriptor index for TEXT (0 if no text) """
+        if text is None:
+            return 0
+        if text not in self.strings:
+            self.strings.append(text)
+        return self.strings.index(text) + 1
+
+
+def check_spec(spec):
+    where = 'personality "%s": ' % spec.name
+    if spec.device is None:
+        raise SpecError(where + 'missing "device" line')
+    if spec.configuration is None:
+        raise SpecError(where + 'missing "configuration" line')
+    if not spec.interfaces:
+        raise SpecError(where + 'the configuration has no interfaces')
+
+    # String indexes follow the order: manufacturer, product, serial and then
+    # interface names in declaration order
+    for name in ('manufacturer', 'product', 'serial'):
+        spec.string_index(spec.string_names.get(name))
+    for interface in spec.interfaces:
+        spec.string_index(interface['keywords'].get('name'))
+
+
+def parse_spec(path):
+    """ Returns the list of personalities described by the spec file """
+    specs = []
+    spec = None
+    interface = None
+
+    with open(path) as spec_file:
+        lines = spec_file.readlines()
+
+    for line_number, line in enumerate(lines, 1):
+        tokens = shlex.split(line, comments=True)
+        if not tokens:
+            continue
+
+        keyword = tokens[0]
+        positional, keywords = parse_args(tokens[1:], line_number)
+
+        # A new descriptors set, a spec without 'personality' lines has a
+        # single 'default' personality
+        if keyword == 'personality':
+            if not positional or not positional[0].isidentifier():
+                raise SpecError('line %d: bad personality name' %
+                                line_number)
+            if positional[0] in [other.name for other in specs]:
+                raise SpecError('line %d: personality "%s" declared twice' %
+                                (line_number, positional[0]))
+            spec = Spec(positional[0])
+            specs.append(spec)
+            interface = None
+            continue
+
+        if spec is None:
+            spec = Spec('default')
+            specs.append(spec)
+
+        if keyword == 'device':
+            spec.device = keywords
+
+        elif keyword == 'language':
+            spec.language = number(positional[0])
+
+        elif keyword in ('manufacturer', 'product', 'serial'):
+            if not positional:
+                raise SpecError('line %d: missing %s text' %
+                                (line_number, keyword))
+            spec.string_names[keyword] = positional[0]
+
+        elif keyword == 'configuration':
+            spec.configuration = keywords
+
+        elif keyword == 'interface':
+            interface = {
+                'keywords': keywords,
+                'functional': [],
+                'endpoints': [],
+                'line': line_number,
+            }
+            spec.interfaces.append(interface)
+
+        elif keyword.startswith('cdc_') or keyword == 'endpoint':
+            if interface is None:
+                raise SpecError('line %d: "%s" outside of an interface' %
+                                (line_number, keyword))
+            if keyword == 'endpoint':
+                interface['endpoints'].append((keywords, line_number))
+            else:
+                interface['functional'].append(
+                    (keyword, keywords, line_number))
+
+        else:
+            raise SpecError('line %d: unknown keyword "%s"' %
+                            (line_number, keyword))
+
+    if not specs:
+        raise SpecError('empty spec')
+
+    for spec in specs:
+        check_spec(spec)
+
+    if len(set(ep0_size(spec) for spec in specs)) != 1:
+        raise SpecError('every personality must use the same ep0 size')
+
+    return specs
+
+
+def build_device(spec):
+    keywords = spec.device
+    desc = Descriptor('DEVICE DESCRIPTOR')
+    desc.byte('bLength', 18)
+    desc.byte('bDescriptorType', DESC_TYPE_DEVICE, 'USB_DESC_TYPE_DEVICE')
+    desc.word('bcdUSB', number(keywords.get('usb', '0x0200')))
+    desc.byte('bDeviceClass', number(keywords.get('class', '0x00')))
+    desc.byte('bDeviceSubClass', number(keywords.get('subclass', '0x00')))
+    desc.byte('bDeviceProtocol', number(keywords.get('protocol', '0x00')))
+    desc.byte('bMaxPacketSize0', ep0_size(spec))
+    desc.word('idVendor', number(require(keywords, 'vendor', 0)))
+    desc.word('idProduct', number(require(keywords, 'product', 0)))
+    desc.word('bcdDevice', number(keywords.get('release', '0x0000')))
+    desc.byte('iManufacturer',
+              spec.string_index(spec.string_names.get('manufacturer')))
+    desc.byte('iProduct', spec.string_index(spec.string_names.get('product')))
+    desc.byte('iSerialNumber',
+              spec.string_index(spec.string_names.get('serial')))
+    desc.byte('bNumConfigurations', 1)
+    return desc
+
+
+def ep0_size(spec):
+    size = number(spec.device.get('ep0', '8'))
+    if size not in (8, 16, 32, 64):
+        raise SpecError('ep0 size must be 8, 16, 32 or 64')
+    return size
+
+
+def build_functional(kind, keywords, line_number):
+    if kind == 'cdc_header':
+        desc = Descriptor('FUNCTIONAL DESCRIPTOR (Header)')
+        desc.byte('bFunctionalLength', 5)
+        desc.byte('bDescriptorType', CDC_CS_INTERFACE,
+                  'USB_CDC_FUNCTIONAL_CS_INTERFACE')
+        desc.byte('bDescriptorSubType', CDC_FUNCTIONAL_HEADER)
+        desc.word('bcdCDC', number(keywords.get('cdc', '0x0110')))
+
+    elif kind == 'cdc_acm':
+        desc = Descriptor('FUNCTIONAL DESCRIPTOR (ACM)')
+        desc.byte('bFunctionalLength', 4)
+        desc.byte('bDescriptorType', CDC_CS_INTERFACE,
+                  'USB_CDC_FUNCTIONAL_CS_INTERFACE')
+        desc.byte('bDescriptorSubType', CDC_FUNCTIONAL_ACM)
+        desc.byte('bmCapabilities',
+                  number(keywords.get('capabilities', '0x02')))
+
+    elif kind == 'cdc_union':
+        subordinates = [number(value) for value in
+                        require(keywords, 'subordinate',
+                                line_number).split(',')]
+        desc = Descriptor('FUNCTIONAL DESCRIPTOR (Union)')
+        desc.byte('bFunctionalLength', 4 + len(subordinates))
+        desc.byte('bDescriptorType', CDC_CS_INTERFACE,
+                  'USB_CDC_FUNCTIONAL_CS_INTERFACE')
+        desc.byte('bDescriptorSubType', CDC_FUNCTIONAL_UNION)
+        desc.byte('bControlInterface',
+                  number(require(keywords, 'control', line_number)))
+        for i, subordinate in enumerate(subordinates):
+            desc.byte('bSubordinateInterface%d' % i, subordinate)
+
+    elif kind == 'cdc_call_management':
+        desc = Descriptor('FUNCTIONAL DESCRIPTOR (Call Management)')
+        desc.byte('bFunctionalLength', 5)
+        desc.byte('bDescriptorType', CDC_CS_INTERFACE,
+                  'USB_CDC_FUNCTIONAL_CS_INTERFACE')
+        desc.byte('bDescriptorSubType', CDC_FUNCTIONAL_CALL_MANAGEMENT)
+        desc.byte('bmCapabilities',
+                  number(keywords.get('capabilities', '0x00')))
+        desc.byte('bDataInterface',
+                  number(require(keywords, 'data', line_number)))
+
+    else:
+        raise SpecError('line %d: unknown functional descriptor "%s"' %
+                        (line_number, kind))
+
+    return desc
+
+
+def build_endpoint(keywords, line_number, endpoints):
+    address = number(require(keywords, 'address', line_number))
+    ep_type = require(keywords, 'type', line_number)
+    size = number(require(keywords, 'size', line_number))
+
+    if ep_type not in EP_TYPES or ep_type == 'control':
+        raise SpecError('line %d: bad endpoint type "%s"' %
+                        (line_number, ep_type))
+    if not 1 <= (address & 0x0F) < MAX_ENDPOINTS or address & 0x70:
+        raise SpecError('line %d: bad endpoint address 0x%02X' %
+                        (line_number, address))
+    if address in endpoints:
+        raise SpecError('line %d: endpoint 0x%02X declared twice' %
+                        (line_number, address))
+    limit = 1023 if ep_type == 'isochronous' else 64
+    if not 0 < size <= limit:
+        raise SpecError('line %d: endpoint size must be 1..%d' %
+                        (line_number, limit))
+
+    endpoints[address] = (ep_type, size)
+
+    direction = 'In' if address & 0x80 else 'Out'
+    desc = Descriptor('ENDPOINT DESCRIPTOR (%s endpoint %d)' %
+                      (direction, address & 0x0F))
+    desc.byte('bLength', 7)
+    desc.byte('bDescriptorType', DESC_TYPE_ENDPOINT,
+              'USB_DESC_TYPE_ENDPOINT')
+    desc.byte('bEndpointAddress', address)
+    desc.byte('bmAttributes', EP_TYPES[ep_type])
+    desc.word('wMaxPacketSize', size)
+    desc.byte('bInterval', number(keywords.get('interval', '0')))
+    return desc
+
+
+def build_configuration(spec, endpoints):
+    keywords = spec.configuration
+    hierarchy = []
+
+    for number_, interface in enumerate(spec.interfaces):
+        ikeywords = interface['keywords']
+        desc = Descriptor('INTERFACE DESCRIPTOR (Interface %d)' % number_)
+        desc.byte('bLength', 9)
+        desc.byte('bDescriptorType', DESC_TYPE_INTERFACE,
+                  'USB_DESC_TYPE_INTERFACE')
+        desc.byte('bInterfaceNumber', number_)
+        desc.byte('bAlternateSetting', 0)
+        desc.byte('bNumEndpoints', len(interface['endpoints']))
+        desc.byte('bInterfaceClass', number(ikeywords.get('class', '0x00')))
+        desc.byte('bInterfaceSubClass',
+                  number(ikeywords.get('subclass', '0x00')))
+        desc.byte('bInterfaceProtocol',
+                  number(ikeywords.get('protocol', '0x00')))
+        desc.byte('iInterface', spec.string_index(ikeywords.get('name')))
+        hierarchy.append(desc)
+
+        for kind, fkeywords, line_number in interface['functional']:
+            hierarchy.append(build_functional(kind, fkeywords, line_number))
+
+        for ekeywords, line_number in interface['endpoints']:
+            hierarchy.append(build_endpoint(ekeywords, line_number,
+                                            endpoints))
+
+    attributes = 0
+    for name in keywords.get('attributes', 'buspowered').split(','):
+        if name not in CONFIGURATION_ATTRIBUTES:
+            raise SpecError('unknown configuration attribute "%s"' % name)
+        attributes |= CONFIGURATION_ATTRIBUTES[name]
+
+    power = number(keywords.get('power', '100'))
+    if not 0 <= power <= 500:
+        raise SpecError('configuration power must be 0..500 mA')
+
+    desc = Descriptor('CONFIGURATION DESCRIPTOR')
+    total = 9 + sum(child.size() for child in hierarchy)
+    desc.byte('bLength', 9)
+    desc.byte('bDescriptorType', DESC_TYPE_CONFIGURATION,
+              'USB_DESC_TYPE_CONFIGURATION')
+    desc.word('wTotalLength', total)
+    desc.byte('bNumInterfaces', len(spec.interfaces))
+    desc.byte('bConfigurationValue', number(keywords.get('value', '1')))
+    desc.byte('iConfiguration', spec.string_index(keywords.get('name')))
+    desc.byte('bmAttributes', attributes)
+    desc.byte('bMaxPower', (power + 1) // 2)
+
+    return [desc] + hierarchy
+
+
+def build_strings(spec):
+    strings = []
+
+    desc = Descriptor('STRING DESCRIPTOR 0 (Supported languages)')
+    desc.byte('bLength', 4)
+    desc.byte('bDescriptorType', DESC_TYPE_STRING, 'USB_DESC_TYPE_STRING')
+    desc.word('wLANGID[0]', spec.language)
+    strings.append(desc)
+
+    for index, text in enumerate(spec.strings, 1):
+        try:
+            text.encode('ascii')
+        except UnicodeEncodeError:
+            raise SpecError('string "%s" is not ASCII' % text)
+        if any(not ' ' <= character <= '~' for character in text):
+            raise SpecError('string "%s" has non printable characters' %
+                            text)
+
+        desc = Descriptor('STRING DESCRIPTOR %d' % index)
+        desc.ascii = True
+        desc.byte('bLength', 2 + 2 * len(text),
+                  'USB_DESC_STRING_LENGTH(%d)' % len(text))
+        desc.byte('bDescriptorType', DESC_TYPE_STRING, 'USB_DESC_TYPE_STRING')
+        for character in text:
+            escaped = character.replace('\\', '\\\\').replace("'", "\\'")
+            desc.raw('bString (ASCII)', [ord(character)], "'%s'" % escaped)
+        strings.append(desc)
+
+    if 2 + 2 * max([0] + [len(text) for text in spec.strings]) > 255:
+        raise SpecError('string descriptors are limited to 126 characters')
+
+    return strings
+
+
+class Personality(object):
+    """ A spec built into descriptors, ready to be written """
+
+    def __init__(self, number_, spec):
+        self.number = number_
+        self.spec = spec
+        self.endpoints = {}
+        self.entries = [(DESC_TYPE_DEVICE, 0, [build_device(spec)]),
+                        (DESC_TYPE_CONFIGURATION, 0,
+                         build_configuration(spec, self.endpoints))]
+        for index, desc in enumerate(build_strings(spec)):
+            self.entries.append((DESC_TYPE_STRING, index, [desc]))
+
+    def suffix(self):
+        return self.spec.name.upper()
+
+
+def write_blob(out, personalities):
+    out.append('/*')
+    out.append(' * DESCRIPTORS BLOB')
+    out.append(' *')
+    out.append(' * Every descriptor served by GET_DESCRIPTOR (all'
+               ' personalities), placed into')
+    out.append(' * code memory')
+    out.append(' */')
+    out.append('__code unsigned char USB_DESCRIPTORS[] =')
+    out.append('{')
+
+    offset = 0
+    for personality in personalities:
+        personality.offsets = []
+        out.append('             /****** PERSONALITY %d: %s ******/' %
+                   (personality.number, personality.spec.name))
+        out.append('')
+        for desc_type, desc_index, descriptors in personality.entries:
+            personality.offsets.append(offset)
+            for desc in descriptors:
+                out.append('                 /* %s [offset %d] */' %
+                           (desc.title, offset))
+                if desc_type == DESC_TYPE_STRING and desc_index > 0:
+                    out.append('    // "%s"' %
+                               personality.spec.strings[desc_index - 1])
+                for values, expression, name in desc.fields:
+                    out.append('    %s, // %s' % (expression, name))
+                    offset += len(values)
+                out.append('')
+    out[-1] = '};'
+
+
+def write_personality(out, personality):
+    suffix = personality.suffix()
+    entries = personality.entries
+
+    out.append('/*')
+    out.append(' * PERSONALITY %d: %s' % (personality.number,
+                                          personality.spec.name))
+    out.append(' *')
+    out.append(' * GET_DESCRIPTOR index: one entry per (type, index) pair,'
+               ' grouped by type so')
+    out.append(' * the requested entry is index[first[type] + index]')
+    out.append(' *')
+    out.append(' * { bDescriptorType, bIndex, bFlags, wOffset, wLength }')
+    out.append(' */')
+    out.append('static __code USB_DESC_INDEX_t USB_DESC_INDEX_%s[] =' % suffix)
+    out.append('{')
+
+    lines = []
+    for (desc_type, desc_index, descriptors), offset in \
+            zip(entries, personality.offsets):
+        length = sum(desc.length() for desc in descriptors)
+        if any(desc.ascii for desc in descriptors):
+            flags = 'USB_DESC_FLAG_ASCII'
+        else:
+            flags = '0'
+        lines.append('    { 0x%02X, %d, %s, %d, %d }' %
+                     (desc_type, desc_index, flags, offset, length))
+    out.append(',\n'.join(lines))
+    out.append('};')
+    out.append('')
+
+    firsts = [0] * (DESC_TYPE_STRING + 1)
+    counts = [0] * (DESC_TYPE_STRING + 1)
+    for position, (desc_type, desc_index, descriptors) in \
+            reversed(list(enumerate(entries))):
+        firsts[desc_type] = position
+        counts[desc_type] += 1
+
+    out.append('// First index entry by descriptor type')
+    out.append('static __code unsigned char USB_DESC_FIRST_%s[] = { %s };' %
+               (suffix, ', '.join(str(value) for value in firsts)))
+    out.append('')
+    out.append('// Number of index entries by descriptor type')
+    out.append('static __code unsigned char USB_DESC_COUNT_%s[] = { %s };' %
+               (suffix, ', '.join(str(value) for value in counts)))
+    out.append('')
+    out.append('// Enables every endpoint used by the configuration')
+    out.append('static void usb_setup_endpoints_%s(void)' %
+               personality.spec.name.lower())
+    out.append('{')
+
+    for ep in range(1, MAX_ENDPOINTS):
+        flags = []
+        comments = []
+        for address in (ep, ep | 0x80):
+            if address in personality.endpoints:
+                ep_type, size = personality.endpoints[address]
+                direction = 'IN' if address & 0x80 else 'OUT'
+                flags.append('USB_UEP_EP%sEN' % direction)
+                comments.append('%s %s %d bytes' % (direction, ep_type,
+                                                    size))
+        if flags:
+            out.append('    // Endpoint %d: %s' % (ep, ', '.join(comments)))
+            out.append('    UEP%d = USB_UEP_EPHSHK | USB_UEP_EPCONDIS | %s;' %
+                       (ep, ' | '.join(flags)))
+    out.append('}')
+
+
+def write_source(path, header_name, spec_name, personalities):
+    out = []
+    out.append('/*')
+    out.append(' * File: \t%s' % os.path.basename(path))
+    out.append(' * Compiler: sdcc (Version 3.4.0)')
+    out.append(' *')
+    out.append(' *')
+    out.append(' * [!] GENERATED FILE, DO NOT EDIT')
+    out.append(' *')
+    out.append(' * Generated by scripts/usb_descgen.py from %s' % spec_name)
+    out.append(' */')
+    out.append('')
+    out.append('')
+    out.append('#include <pic18f4550.h>')
+    out.append('#include "usb.h"')
+    out.append('#include "usb_cdc.h"')
+    out.append('#include "usb_pic.h"')
+    out.append('#include "%s"' % header_name)
+    out.append('')
+    out.append('')
+    out.append('')
+    write_blob(out, personalities)
+
+    for personality in personalities:
+        out.append('')
+        out.append('')
+        out.append('')
+        write_personality(out, personality)
+
+    out.append('')
+    out.append('')
+    out.append('')
+    out.append('/*')
+    out.append(' * PERSONALITIES')
+    out.append(' *')
+    out.append(' * Descriptors sets the device can switch between at run time,'
+               ' indexed by')
+    out.append(' * USB_PERSONALITY_<NAME>')
+    out.append(' */')
+    out.append('__code USB_PERSONALITY_t USB_PERSONALITIES[] =')
+    out.append('{')
+    lines = []
+    for personality in personalities:
+        suffix = personality.suffix()
+        lines.append('    // %s\n'
+                     '    {\n'
+                     '        USB_DESC_INDEX_%s,\n'
+                     '        USB_DESC_FIRST_%s,\n'
+                     '        USB_DESC_COUNT_%s,\n'
+                     '        %d,\n'
+                     '        usb_setup_endpoints_%s\n'
+                     '    }' %
+                     (personality.spec.name, suffix, suffix, suffix,
+                      number(personality.spec.configuration.get('value',
+                                                                '1')),
+                      personality.spec.name.lower()))
+    out.append(',\n\n'.join(lines))
+    out.append('};')
+
+    with open(path, 'w') as source:
+        source.write('\n'.join(out) + '\n')
+
+
+def write_header(path, spec_name, personalities):
+    guard = '_' + os.path.basename(path).upper().replace('.', '_')
+
+    out = []
+    out.append('/*')
+    out.append(' * File: \t%s' % os.path.basename(path))
+    out.append(' * Compiler: sdcc (Version 3.4.0)')
+    out.append(' *')
+    out.append(' *')
+    out.append(' * [!] GENERATED FILE, DO NOT EDIT')
+    out.append(' *')
+    out.append(' * Generated by scripts/usb_descgen.py from %s' % spec_name)
+    out.append(' */')
+    out.append('')
+    out.append('')
+    out.append('#ifndef %s' % guard)
+    out.append('#define %s' % guard)
+    out.append('')
+    out.append('')
+    out.append('')
+    out.append('// Endpoint 0 max packet size (bMaxPacketSize0)')
+    out.append('#define USB_EP0_SIZE %d' % ep0_size(personalities[0].spec))
+    out.append('')
+    out.append('// Personalities (descriptors sets)')
+    out.append('#define USB_PERSONALITY_COUNT %d' % len(personalities))
+    for personality in personalities:
+        out.append('#define USB_PERSONALITY_%s %d' %
+                   (personality.suffix(), personality.number))
+    out.append('')
+    last = max([0] + [address & 0x0F for personality in personalities
+                      for address in personality.endpoints])
+    out.append('// Highest endpoint number used (by any personality)')
+    out.append('#define USB_EP_LAST %d' % last)
+    out.append('')
+    out.append('// Endpoints max packet sizes (largest among personalities),'
+               ' 0 when the')
+    out.append('// endpoint is not used')
+    for ep in range(1, MAX_ENDPOINTS):
+        for address, direction in ((ep, 'OUT'), (ep | 0x80, 'IN')):
+            size = max(personality.endpoints.get(address, (None, 0))[1]
+                       for personality in personalities)
+            out.append('#define USB_EP%d_%s_SIZE %d' % (ep, direction, size))
+    out.append('')
+    out.append('// Highest descriptor type found in the first/count tables')
+    out.append('#define USB_DESC_TYPE_LAST 0x%02X' % DESC_TYPE_STRING)
+    out.append('')
+    out.append('// Descriptors blob and personalities table')
+    out.append('extern __code unsigned char USB_DESCRIPTORS[];')
+    out.append('extern __code USB_PERSONALITY_t USB_PERSONALITIES[];')
+    out.append('')
+    out.append('')
+    out.append('#endif // %s' % guard)
+
+    with open(path, 'w') as header:
+        header.write('\n'.join(out) + '\n')
+
+
+def main(argv):
+    if len(argv) != 4:
+        sys.stderr.write('Usage: %s <spec> <output .c> <output .h>\n' %
+                         argv[0])
+        return 1
+
+    spec_path, source_path, header_path = argv[1:]
+
+    try:
+        personalities = [Personality(number_, spec) for number_, spec in
+                         enumerate(parse_spec(spec_path))]
+    except SpecError as error:
+        sys.stderr.write('%s: %s\n' % (spec_path, error))
+        return 1
+
+    spec_name = os.path.basename(spec_path)
+    write_source(source_path, os.path.basename(header_path), spec_name,
+                 personalities)
+    write_header(header_path, spec_name, personalities)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,193 @@
+#! /usr/bin/env python3
+#
+# Memory peek / poke
+#
+# Reads and writes device memory with the PEEK / POKE vendor requests (see
+# src/usb_vendor.h). The firmware must be built with USB_PEEK_POKE=1
+#
+# Usage: usb_peek.py [options] ADDRESS [LENGTH]
+#        usb_peek.py [options] --write ADDRESS HEXBYTES
+#
+# Options:
+#   --program       Program memory (flash) instead of data memory (RAM, SFRs)
+#   --stream        Read through the data IN endpoint (PEEK_STREAM), one
+#                   transfer however long, instead of endpoint 0
+#   --key KEY       Send UNLOCK first (firmware built with USB_PEEK_POKE_KEY)
+#   --device V:P    vid:pid, defaults to the CDC personality (04d8:0111)
+#
+# Reads are hex dumped (LENGTH defaults to 16), or written raw to stdout when
+# it isn't a terminal. Program memory writes are whole 64 bytes rows. Streams
+# take the data interface from its driver (cdc_acm) for the transfer.
+# Needs pyusb (and access to the device node)
+#
+# Example, RAM and USB RAM at once: usb_peek.py --stream 0x000 0x800
+#
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+import sys
+
+import usb.core
+import usb.util
+
+
+VENDOR_ID = 0x04D8
+PRODUCT_ID = 0x0111
+
+# Vendor requests (src/usb_vendor.h)
+REQ_PEEK = 0x0D
+REQ_POKE = 0x0E
+REQ_PEEK_STREAM = 0x0F
+REQ_PEEK_STREAM_PROGRAM = 0x10
+REQ_UNLOCK = 0x11
+
+# bmRequestType: vendor, device, IN / OUT
+REQ_TYPE_IN = 0xC0
+REQ_TYPE_OUT = 0x40
+
+# Memory spaces (wIndex low byte)
+SPACE_DATA = 0x00
+SPACE_PROGRAM = 0x01
+
+# Program memory write row
+ROW_SIZE = 64
+
+# Data IN endpoint (src/usb_device.spec)
+DATA_IN_EP = 0x83
+
+# Bulk transfer time-out, ms
+TIMEOUT = 5000
+
+USAGE = '''Usage: %s [--program] [--stream] [--key KEY] [--device V:P] \
+ADDRESS [LENGTH]
+       %s [--program] [--key KEY] [--device V:P] --write ADDRESS HEXBYTES
+'''
+
+
+def data_interface(device):
+    """ Number of the interface holding the data IN endpoint """
+    for interface in device.get_active_configuration():
+        for endpoint in interface:
+            if endpoint.bEndpointAddress == DATA_IN_EP:
+                return interface.bInterfaceNumber
+    raise usb.core.USBError('no data IN endpoint')
+
+
+def peek(device, space, address, length):
+    """ PEEK: endpoint 0 IN transfer """
+    return bytes(device.ctrl_transfer(REQ_TYPE_IN, REQ_PEEK, address & 0xFFFF,
+                                      space | ((address >> 8) & 0xFF00),
+                                      length))
+
+
+def peek_stream(device, space, address, length):
+    """ PEEK_STREAM: the dump comes through the data IN endpoint """
+    interface = data_interface(device)
+    if device.is_kernel_driver_active(interface):
+        device.detach_kernel_driver(interface)
+    usb.util.claim_interface(device, interface)
+
+    request = REQ_PEEK_STREAM_PROGRAM if space == SPACE_PROGRAM \
+        else REQ_PEEK_STREAM
+    device.ctrl_transfer(REQ_TYPE_OUT, request, address, length)
+
+    data = bytearray()
+    while len(data) < length:
+        data += device.read(DATA_IN_EP, length - len(data), TIMEOUT)
+
+    usb.util.release_interface(device, interface)
+    return bytes(data)
+
+
+def poke(device, space, address, data):
+    """ POKE, by rows in program memory """
+    step = ROW_SIZE if space == SPACE_PROGRAM else len(data)
+    if space == SPACE_PROGRAM and (address % ROW_SIZE or len(data) % ROW_SIZE):
+        raise ValueError('program memory is written by %d bytes rows'
+                         % ROW_SIZE)
+
+    for offset in range(0, len(data), step):
+        at = address + offset
+        device.ctrl_transfer(REQ_TYPE_OUT, REQ_POKE, at & 0xFFFF,
+                             space | ((at >> 8) & 0xFF00),
+                             data[offset:offset + step])
+
+
+def dump(address, data):
+    for offset in range(0, len(data), 16):
+        line = data[offset:offset + 16]
+        print('%06X  %-48s %s' % (address + offset,
+                                  ' '.join('%02X' % byte for byte in line),
+                                  ''.join(chr(byte) if 32 <= byte < 127
+                                          else '.' for byte in line)))
+
+
+def main(argv):
+    args = argv[1:]
+    options = {}
+    for flag in ('--program', '--stream', '--write'):
+        options[flag] = flag in args
+        args = [arg for arg in args if arg != flag]
+    for option in ('--key', '--device'):
+        if option in args:
+            index = args.index(option)
+            options[option] = args[index + 1:index + 2]
+            del args[index:index + 2]
+
+    try:
+        address = int(args[0], 0)
+        if options['--write']:
+            data = bytes.fromhex(''.join(args[1:]))
+            if not data:
+                raise ValueError
+        else:
+            length = int(args[1], 0) if len(args) > 1 else 16
+        vendor, product = VENDOR_ID, PRODUCT_ID
+        if '--device' in options:
+            vendor, product = (int(value, 16)
+                               for value in options['--device'][0].split(':'))
+        key = int(options['--key'][0], 0) if '--key' in options else None
+    except (IndexError, ValueError):
+        sys.stderr.write(USAGE % (argv[0], argv[0]))
+        return 1
+
+    space = SPACE_PROGRAM if options['--program'] else SPACE_DATA
+
+    device = usb.core.find(idVendor=vendor, idProduct=product)
+    if device is None:
+        sys.stderr.write('peek: no %04x:%04x device\n' % (vendor, product))
+        return 1
+
+    try:
+        if key is not None:
+            device.ctrl_transfer(REQ_TYPE_OUT, REQ_UNLOCK, key & 0xFFFF,
+                                 ~key & 0xFFFF)
+
+        if options['--write']:
+            poke(device, space, address, data)
+            return 0
+
+        if options['--stream']:
+            data = peek_stream(device, space, address, length)
+        else:
+            data = peek(device, space, address, length)
+    except usb.core.USBError as error:
+        sys.stderr.write('peek: %s (no USB_PEEK_POKE, or locked?)\n' % error)
+        return 1
+    except ValueError as error:
+        sys.stderr.write('peek: %s\n' % error)
+        return 1
+
+    if sys.stdout.isatty():
+        dump(address, data)
+    else:
+        sys.stdout.buffer.write(data)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
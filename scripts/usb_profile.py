@@ -0,0 +1,96 @@
+#! /usr/bin/env python3
+#
+# Handlers profile
+#
+# Reads the USB_PROFILE table of a device (GET_PROFILE vendor request, see
+# src/usb_vendor.h) and prints, per handler: calls, worst case, total and
+# average instruction cycles. The firmware must be built with USB_PROFILE=1
+#
+# Usage: usb_profile.py [--clear] [vid:pid]
+#
+# vid:pid defaults to the CDC personality (04d8:0111). --clear starts the
+# table over after printing it. Needs pyusb (and access to the device node)
+#
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+import struct
+import sys
+
+import usb.core
+
+
+VENDOR_ID = 0x04D8
+PRODUCT_ID = 0x0111
+
+# Vendor requests (src/usb_vendor.h)
+REQ_GET_PROFILE = 0x08
+REQ_CLEAR_PROFILE = 0x09
+
+# bmRequestType: vendor, device, IN / OUT
+REQ_TYPE_IN = 0xC0
+REQ_TYPE_OUT = 0x40
+
+# Reply entry: calls, max, total (little endian)
+ENTRY = struct.Struct('<HHI')
+
+# Slots before the transaction handlers (USB_PROFILE_* in src/usb_vendor.h)
+SLOTS = ['handler', 'reset', 'standard', 'class', 'vendor', 'get_descriptor']
+
+# Largest reply asked for, the firmware sends its whole table
+MAX_REPLY = 255
+
+
+def slot_name(slot):
+    """ Name of a reply slot: a handler or an endpoint direction """
+    if slot < len(SLOTS):
+        return SLOTS[slot]
+    index = slot - len(SLOTS)
+    return 'ep%d.%s' % (index // 2, 'in' if index % 2 else 'out')
+
+
+def main(argv):
+    args = argv[1:]
+    clear = '--clear' in args
+    args = [arg for arg in args if arg != '--clear']
+
+    vendor, product = VENDOR_ID, PRODUCT_ID
+    if args:
+        try:
+            vendor, product = (int(value, 16) for value in args[0].split(':'))
+        except ValueError:
+            sys.stderr.write('Usage: %s [--clear] [vid:pid]\n' % argv[0])
+            return 1
+
+    device = usb.core.find(idVendor=vendor, idProduct=product)
+    if device is None:
+        sys.stderr.write('profile: no %04x:%04x device\n' % (vendor, product))
+        return 1
+
+    try:
+        reply = bytes(device.ctrl_transfer(REQ_TYPE_IN, REQ_GET_PROFILE, 0, 0,
+                                           MAX_REPLY))
+    except usb.core.USBError:
+        sys.stderr.write('profile: request stalled (no USB_PROFILE?)\n')
+        return 1
+
+    print('%-16s %8s %8s %12s %8s' % ('handler', 'calls', 'max', 'total',
+                                       'average'))
+    for slot in range(len(reply) // ENTRY.size):
+        calls, worst, total = ENTRY.unpack_from(reply, slot * ENTRY.size)
+        if not calls:
+            continue
+        print('%-16s %8d %8d %12d %8d' % (slot_name(slot), calls, worst, total,
+                                          total // calls))
+
+    if clear:
+        device.ctrl_transfer(REQ_TYPE_OUT, REQ_CLEAR_PROFILE, 0, 0)
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
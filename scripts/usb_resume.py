@@ -0,0 +1,93 @@
+#! /usr/bin/env python3
+#
+# Resume latency
+#
+# Reads the USB_RESUME_STATS counters of a device (GET_RESUME_STATS vendor
+# request, see src/usb_vendor.h) and prints the last and worst resume to first
+# transaction latency and the resumes measured. The firmware must be built
+# with USB_RESUME_STATS=1
+#
+# Usage: usb_resume.py [vid:pid]
+#
+# vid:pid defaults to the CDC personality (04d8:0111). Suspend the device
+# first (e.g. echo auto > /sys/bus/usb/devices/<port>/power/control, or
+# suspend the host) then wake it, from the host or by remote wakeup with
+# data queued. Needs pyusb (and access to the device node)
+#
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+import struct
+import sys
+
+import usb.core
+
+
+VENDOR_ID = 0x04D8
+PRODUCT_ID = 0x0111
+
+# Vendor requests (src/usb_vendor.h)
+REQ_GET_RESUME_STATS = 0x07
+
+# bmRequestType: vendor, device, IN
+REQ_TYPE_IN = 0xC0
+
+# Reply: last, worst, count (USB_RESUME_* slots, little endian)
+REPLY = struct.Struct('<HHH')
+
+# Instruction cycles per tick (USB_RESUME_TICK_CYCLES) and per microsecond
+TICK_CYCLES = 8
+CYCLES_PER_US = 12
+
+# Latency over the Timer 3 range
+OVERFLOW = 0xFFFF
+
+
+def latency(ticks):
+    """ Latency text of a tick count """
+    if ticks == OVERFLOW:
+        return 'over %.1fms' % (OVERFLOW * TICK_CYCLES / CYCLES_PER_US / 1000)
+    return '%.1fus' % (ticks * TICK_CYCLES / CYCLES_PER_US)
+
+
+def main(argv):
+    args = argv[1:]
+
+    vendor, product = VENDOR_ID, PRODUCT_ID
+    if args:
+        try:
+            vendor, product = (int(value, 16) for value in args[0].split(':'))
+        except ValueError:
+            sys.stderr.write('Usage: %s [vid:pid]\n' % argv[0])
+            return 1
+
+    device = usb.core.find(idVendor=vendor, idProduct=product)
+    if device is None:
+        sys.stderr.write('resume: no %04x:%04x device\n' % (vendor, product))
+        return 1
+
+    try:
+        reply = bytes(device.ctrl_transfer(REQ_TYPE_IN, REQ_GET_RESUME_STATS,
+                                           0, 0, REPLY.size))
+    except usb.core.USBError:
+        sys.stderr.write('resume: request stalled (no USB_RESUME_STATS?)\n')
+        return 1
+
+    if len(reply) < REPLY.size:
+        sys.stderr.write('resume: short reply (%d bytes)\n' % len(reply))
+        return 1
+
+    last, worst, count = REPLY.unpack(reply)
+    print('resumes: %d' % count)
+    if count:
+        print('last:    %s' % latency(last))
+        print('worst:   %s' % latency(worst))
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,108 @@
+#! /usr/bin/env python3
+#
+# USB trace decoder
+#
+# Turns the binary trace the firmware sends to the UART (USB_TRACE, see
+# usb_trace_drain() in src/usbcdc.h) into one line per event
+#
+# Usage: usb_trace.py [capture]
+#
+# Reads the capture file, or the serial port given as capture, or stdin. Set
+# the port up raw first, e.g.: stty -F /dev/ttyUSB0 115200 raw -echo
+#
+#
+# This is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+
+import sys
+
+
+# Record start, then 4 bytes (src/usbcdc.h)
+SYNC = 0xA5
+RECORD_SIZE = 4
+
+# USB_TRACE_* event ids
+EVENTS = {
+    0x01: 'TRN',
+    0x02: 'ARM',
+    0x03: 'RESET',
+    0x04: 'SUSPEND',
+    0x05: 'RESUME',
+    0x06: 'STALL',
+    0x07: 'ERROR',
+    0x08: 'LOST',
+}
+
+# BD STAT written by the SIE: token PID in bits 5:2 (src/usb_pic.h)
+PIDS = {0x1: 'OUT', 0x9: 'IN', 0xD: 'SETUP'}
+
+# BD STAT written by the CPU
+BD_FLAGS = [(0x80, 'UOWN'), (0x40, 'DATA1'), (0x08, 'DTSEN'), (0x04, 'BSTALL')]
+
+# UEIR bits (src/usb_pic.h)
+UEIR_FLAGS = [(0x01, 'PID'), (0x02, 'CRC5'), (0x04, 'CRC16'), (0x08, 'DFN8'),
+              (0x10, 'BTO'), (0x80, 'BTS')]
+
+
+def flags(value, names):
+    return '|'.join(name for bit, name in names if value & bit) or '-'
+
+
+def endpoint(ustat):
+    """ Endpoint, direction and ping-pong buffer of a USTAT value """
+    return 'EP%d %-3s %s' % ((ustat >> 3) & 0x0F,
+                             'IN' if ustat & 0x04 else 'OUT',
+                             'odd' if ustat & 0x02 else 'even')
+
+
+def describe(event, ustat, stat):
+    if event == 'TRN':
+        pid = PIDS.get((stat >> 2) & 0x0F, 'PID %X' % ((stat >> 2) & 0x0F))
+        return '%s %s' % (endpoint(ustat), pid)
+    if event == 'ARM':
+        return '%s %s' % (endpoint(ustat), flags(stat, BD_FLAGS))
+    if event == 'ERROR':
+        return flags(ustat, UEIR_FLAGS)
+    if event == 'LOST':
+        return '%d events%s' % (ustat, ' or more' if ustat == 0xFF else '')
+    return ''
+
+
+def records(stream):
+    """ Yields the 4 bytes records, resynchronized on SYNC after garbage """
+    pending = bytearray()
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            return
+        pending += chunk
+        while len(pending) > RECORD_SIZE:
+            if pending[0] != SYNC or (pending[1] >> 3) not in EVENTS:
+                del pending[0]
+                continue
+            yield bytes(pending[1:RECORD_SIZE + 1])
+            del pending[:RECORD_SIZE + 1]
+
+
+def main(argv):
+    if len(argv) > 2:
+        sys.stderr.write('Usage: %s [capture]\n' % argv[0])
+        return 1
+
+    stream = open(argv[1], 'rb', buffering=0) if len(argv) > 1 \
+        else sys.stdin.buffer
+
+    for record in records(stream):
+        event = EVENTS[record[0] >> 3]
+        frame = ((record[0] & 0x07) << 8) | record[3]
+        print('%4d  %-8s %s' % (frame, event,
+                                describe(event, record[1], record[2])))
+        sys.stdout.flush()
+
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,30 @@
+#!/bin/sh
+#
+# Runs N (default 1) simulated devices as real USB devices of this machine,
+# one usbgadget on each Dummy UDC (see usbgadget.c). Needs root and a kernel
+# with CONFIG_USB_DUMMY_HCD and CONFIG_USB_RAW_GADGET (modules)
+#
+#     ./gadget.sh [N]
+#
+# dummy_hcd takes the number of UDCs when it is loaded: unload it first
+# (rmmod dummy_hcd) to run more devices than a previous run. In the CDC
+# personality each device shows up as a /dev/ttyACM port (echo application)
+
+set -e
+
+COUNT=${1:-1}
+cd "$(dirname "$0")"
+
+modprobe dummy_hcd num="$COUNT"
+modprobe raw_gadget
+
+PIDS=
+i=0
+while [ "$i" -lt "$COUNT" ]; do
+    ./usbgadget -u "dummy_udc.$i" &
+    PIDS="$PIDS $!"
+    i=$((i + 1))
+done
+
+trap 'kill $PIDS 2>/dev/null' INT TERM EXIT
+wait
@@ -0,0 +1,361 @@
+/*
+ * File: 	host.c
+ * Compiler: gcc
+ *
+ *
+ * [!] Host controller on top of the SIE model, see host.h
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <pic18fregs.h>
+#include <stdio.h>
+#include <string.h>
+#include "usb.h"
+#include "usb_pic.h"
+#include "usb_config.h"
+#include "usb_descriptors.h"
+#include "usb_ram.h"
+#include "sie.h"
+#include "host.h"
+
+
+
+unsigned char host_verbose;
+unsigned char host_toggle[16][2];
+unsigned long host_naks;
+USBMON_FILE_t *host_capture_file;
+
+
+
+static void host_trace(const char *token, unsigned char address,
+        unsigned char ep, unsigned char handshake, unsigned char data1,
+        const unsigned char *data, unsigned short size);
+static unsigned char host_error(const char *what, unsigned char data1,
+        unsigned char expected);
+
+
+
+static void host_trace(const char *token, unsigned char address,
+        unsigned char ep, unsigned char handshake, unsigned char data1,
+        const unsigned char *data, unsigned short size)
+{
+    unsigned short i;
+
+    if( !host_verbose )
+    {
+        return;
+    }
+
+    printf("%10lu %-5s %d/%d %-5s", sim_cycles, token, address, ep,
+            sie_handshake_name(handshake));
+    if( handshake == SIE_ACK && data )
+    {
+        printf(" DATA%d", data1);
+        for( i=0; i<size; i++ )
+        {
+            printf(" %02X", data[i]);
+        }
+    }
+    printf("\n");
+}
+
+
+/* Unexpected data toggle: a model error */
+static unsigned char host_error(const char *what, unsigned char data1,
+        unsigned char expected)
+{
+    fprintf(stderr, "host: %s DATA%d, expected DATA%d\n", what, data1,
+            expected);
+    sim_errors++;
+    return SIE_NONE;
+}
+
+
+
+              /***************  Transactions  *************/
+
+void host_reset(void)
+{
+    memset(host_toggle, 0, sizeof(host_toggle));
+    sie_bus_reset();
+}
+
+
+unsigned char host_setup(unsigned char address, const unsigned char *packet)
+{
+    unsigned char handshake = sie_setup(address, 0, packet);
+
+    host_trace("SETUP", address, 0, handshake, 0, packet, 8);
+    if( handshake == SIE_ACK )
+    {
+        host_toggle[0][USB_DIR_OUT] = 1;
+        host_toggle[0][USB_DIR_IN] = 1;
+    }
+    return handshake;
+}
+
+
+unsigned char host_out(unsigned char address, unsigned char ep,
+        unsigned char data1, const unsigned char *data, unsigned char size)
+{
+    unsigned char handshake = sie_out(address, ep, data1, data, size);
+
+    host_trace("OUT", address, ep, handshake, data1, data, size);
+    if( handshake == SIE_ACK )
+    {
+        host_toggle[ep & 0x0F][USB_DIR_OUT] = !data1;
+    }
+    return handshake;
+}
+
+
+unsigned char host_in(unsigned char address, unsigned char ep,
+        unsigned char *data, unsigned char *size, unsigned char *data1)
+{
+    unsigned char handshake = sie_in(address, ep, data, size, data1);
+
+    host_trace("IN", address, ep, handshake, *data1, data, *size);
+    if( handshake == SIE_ACK )
+    {
+        host_toggle[ep & 0x0F][USB_DIR_IN] = !*data1;
+    }
+    return handshake;
+}
+
+
+
+              /***************  Transfers  *************/
+
+unsigned char host_control(unsigned char address, const unsigned char *setup,
+        const unsigned char *out, unsigned char *in, unsigned short *in_size)
+{
+    unsigned short length = setup[6] | (setup[7] << 8);
+    unsigned short offset = 0;
+    unsigned char toggle = 1;
+    unsigned char handshake;
+    unsigned char retries;
+    unsigned char size;
+    unsigned char data1;
+    unsigned char dir_in = (setup[0] & USB_REQ_DIR_IN) != 0;
+
+    *in_size = 0;
+
+    for( retries=0; (handshake = host_setup(address, setup)) == SIE_NAK &&
+            retries < HOST_NAK_RETRIES; retries++ )
+    {
+        host_naks++;
+        sie_sof();
+    }
+    if( handshake != SIE_ACK )
+    {
+        return handshake;
+    }
+
+    // Data stage
+    retries = 0;
+    while( offset < length )
+    {
+        if( dir_in )
+        {
+            handshake = host_in(address, 0, in + offset, &size, &data1);
+        }
+        else
+        {
+            size = length - offset < USB_EP0_SIZE ?
+                length - offset : USB_EP0_SIZE;
+            handshake = host_out(address, 0, toggle, out + offset, size);
+            data1 = toggle;
+        }
+
+        if( handshake == SIE_NAK && retries++ < HOST_NAK_RETRIES )
+        {
+            host_naks++;
+            sie_sof();
+            continue;
+        }
+        if( handshake != SIE_ACK )
+        {
+            return handshake;
+        }
+        if( data1 != toggle )
+        {
+            return host_error("control data stage", data1, toggle);
+        }
+
+        retries = 0;
+        toggle ^= 1;
+        offset += size;
+        *in_size = dir_in ? offset : 0;
+
+        // Short packet ends the data stage
+        if( size < USB_EP0_SIZE )
+        {
+            break;
+        }
+    }
+
+    // Status stage, zero length DATA1 in the other direction
+    for( retries=0; retries <= HOST_NAK_RETRIES; retries++ )
+    {
+        if( dir_in && length )
+        {
+            handshake = host_out(address, 0, 1, 0, 0);
+            data1 = 1;
+            size = 0;
+        }
+        else
+        {
+            handshake = host_in(address, 0, in + *in_size, &size, &data1);
+        }
+
+        if( handshake != SIE_NAK )
+        {
+            break;
+        }
+        host_naks++;
+        sie_sof();
+    }
+    if( handshake != SIE_ACK )
+    {
+        return handshake;
+    }
+    if( size != 0 || data1 != 1 )
+    {
+        return host_error("control status stage (zero length)", data1, 1);
+    }
+
+    // New configuration: data endpoints start with DATA0
+    if( setup[0] == 0x00 && setup[1] == USB_REQ_SET_CONFIGURATION )
+    {
+        memset(host_toggle[1], 0,
+                sizeof(host_toggle) - sizeof(host_toggle[0]));
+    }
+
+    // Halt cleared: that endpoint restarts with DATA0
+    if( setup[0] == 0x02 && setup[1] == USB_REQ_CLEAR_FEATURE &&
+            setup[2] == USB_FEATURE_ENDPOINT_HALT )
+    {
+        host_toggle[setup[4] & 0x0F][setup[4] >> 7] = 0;
+    }
+
+    return SIE_ACK;
+}
+
+
+unsigned char host_bulk_out(unsigned char address, unsigned char ep,
+        const unsigned char *data, unsigned short size, unsigned short *sent)
+{
+    unsigned char handshake = SIE_ACK;
+    unsigned char retries = 0;
+    unsigned char packet;
+    unsigned char zlp = size == 0; // Zero length transfer: one empty packet
+
+    *sent = 0;
+    while( *sent < size || zlp )
+    {
+        packet = size - *sent < HOST_BULK_SIZE ?
+            size - *sent : HOST_BULK_SIZE;
+        handshake = host_out(address, ep, host_toggle[ep][USB_DIR_OUT],
+                data + *sent, packet);
+
+        if( handshake == SIE_NAK && retries++ < HOST_NAK_RETRIES )
+        {
+            host_naks++;
+            sie_sof();
+            continue;
+        }
+        if( handshake != SIE_ACK )
+        {
+            break;
+        }
+
+        retries = 0;
+        zlp = 0;
+        *sent += packet;
+    }
+
+    return handshake;
+}
+
+
+unsigned char host_bulk_in(unsigned char address, unsigned char ep,
+        unsigned char *data, unsigned short length, unsigned short *received)
+{
+    unsigned char packet[HOST_BULK_SIZE];
+    unsigned char handshake = SIE_ACK;
+    unsigned char retries = 0;
+    unsigned char expected;
+    unsigned char size;
+    unsigned char data1;
+
+    *received = 0;
+    while( *received < length )
+    {
+        expected = host_toggle[ep][USB_DIR_IN];
+        handshake = host_in(address, ep, packet, &size, &data1);
+
+        if( handshake == SIE_NAK && retries++ < HOST_NAK_RETRIES )
+        {
+            host_naks++;
+            sie_sof();
+            continue;
+        }
+        if( handshake != SIE_ACK )
+        {
+            break;
+        }
+
+        // Repeated packet (our ACK was lost): dropped
+        retries = 0;
+        if( data1 != expected )
+        {
+            continue;
+        }
+
+        if( size > length - *received )
+        {
+            size = length - *received;
+        }
+        memcpy(data + *received, packet, size);
+        *received += size;
+
+        if( size < HOST_BULK_SIZE )
+        {
+            break;
+        }
+    }
+
+    return handshake;
+}
+
+
+
+              /***************  Capture  *************/
+
+void host_capture(USBMON_RECORD_t *record)
+{
+    // Simulated time: 12 instruction cycles per microsecond
+    record->ts_sec = sim_cycles / 12000000UL;
+    record->ts_usec = (sim_cycles % 12000000UL) / 12;
+
+    if( host_capture_file && usbmon_write(host_capture_file, record) < 0 )
+    {
+        usbmon_close(host_capture_file);
+        host_capture_file = 0;
+    }
+}
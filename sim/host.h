@@ -0,0 +1,99 @@
+/*
+ * File: 	host.h
+ * Compiler: gcc
+ *
+ *
+ * [!] Host controller on top of the SIE model: transactions with host side
+ * data toggles, whole control and bulk transfers retrying NAKed transactions
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _HOST_H
+#define _HOST_H
+
+#include "usbmon.h"
+
+
+
+/*******************************************************************************
+                                     STATE
+*******************************************************************************/
+
+// NAKed transactions retried by transfers, one SOF apart, before giving up
+#define HOST_NAK_RETRIES 32
+
+// Full speed bulk max packet size
+#define HOST_BULK_SIZE 64
+
+// Traces every transaction to stdout
+extern unsigned char host_verbose;
+
+// Next data toggle by endpoint and direction (reset on bus reset and
+// SET_CONFIGURATION)
+extern unsigned char host_toggle[16][2];
+
+// NAKed transactions retried by transfers
+extern unsigned long host_naks;
+
+// Transfers capture (see host_capture()), zero: none
+extern USBMON_FILE_t *host_capture_file;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                   TRANSFERS
+
+    Results are SIE_* handshakes (sie.h): ACK when the whole transfer went
+    through, a protocol error (bad data toggle...) is a model error
+    (sim_errors) reported as SIE_NONE
+*******************************************************************************/
+
+// Bus reset, every data toggle back to DATA0
+void host_reset(void);
+
+// Single transactions, ACKed ones update host_toggle
+unsigned char host_setup(unsigned char address, const unsigned char *packet);
+unsigned char host_out(unsigned char address, unsigned char ep,
+        unsigned char data1, const unsigned char *data, unsigned char size);
+unsigned char host_in(unsigned char address, unsigned char ep,
+        unsigned char *data, unsigned char *size, unsigned char *data1);
+
+// Control transfer on EP0: SETUP, data stage (OUT from 'out', IN to 'in', up
+// to wLength + 64 bytes) and status stage
+unsigned char host_control(unsigned char address, const unsigned char *setup,
+        const unsigned char *out, unsigned char *in, unsigned short *in_size);
+
+// Bulk (or interrupt) transfers, split in HOST_BULK_SIZE packets. IN ends on
+// a short packet or after 'length' bytes
+unsigned char host_bulk_out(unsigned char address, unsigned char ep,
+        const unsigned char *data, unsigned short size, unsigned short *sent);
+unsigned char host_bulk_in(unsigned char address, unsigned char ep,
+        unsigned char *data, unsigned short length, unsigned short *received);
+
+// Writes 'record' to host_capture_file (if any), time stamped with the
+// simulated time
+void host_capture(USBMON_RECORD_t *record);
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+#endif // _HOST_H
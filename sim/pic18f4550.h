@@ -0,0 +1,388 @@
+/*
+ * File: 	pic18f4550.h
+ * Compiler: gcc
+ *
+ *
+ * [!] Host build stand-in for the SDCC PIC18F4550 device header: the special
+ * function registers the USB stack touches, as plain memory at their
+ * addresses in the data memory array (USB_DATA_MEMORY, see usb_ram.h), so
+ * PEEK / POKE reach them. Registers with side effects (UIR and USTAT FIFO,
+ * UCON, table writes and EECON1) go through the SIE model, see sie.c
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _PIC18F4550_H
+#define _PIC18F4550_H
+
+
+
+/*******************************************************************************
+                                 SDCC KEYWORDS
+*******************************************************************************/
+
+// Storage qualifiers: everything is plain memory on the host
+#define __code
+#define __data
+#define __at(address)
+
+// Instructions
+#define Nop() do { } while(0)
+#define ClrWdt() do { } while(0)
+#define Sleep() sim_sleep()
+#define TBLWT() sim_tblwt(0)
+#define TBLWT_POSTINC() sim_tblwt(1)
+
+void sim_sleep(void);
+void sim_tblwt(unsigned char increment);
+
+// Special function register of 'type' at 'address'
+extern volatile unsigned char USB_DATA_MEMORY[];
+
+#define SIM_SFR(type, address) (*(volatile type *) &USB_DATA_MEMORY[address])
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                 USB REGISTERS
+
+                       See PIC18F4550 datasheet: page 165
+*******************************************************************************/
+
+typedef union
+{
+    struct
+    {
+        unsigned char :1;
+        unsigned char SUSPND:1;
+        unsigned char RESUME:1;
+        unsigned char USBEN:1;
+        unsigned char PKTDIS:1;
+        unsigned char SE0:1;
+        unsigned char PPBRST:1;
+        unsigned char :1;
+    };
+    unsigned char byte;
+} UCONbits_t;
+
+typedef union
+{
+    struct
+    {
+        unsigned char PPB0:1;
+        unsigned char PPB1:1;
+        unsigned char FSEN:1;
+        unsigned char UTRDIS:1;
+        unsigned char UPUEN:1;
+        unsigned char :1;
+        unsigned char UOEMON:1;
+        unsigned char UTEYE:1;
+    };
+    unsigned char byte;
+} UCFGbits_t;
+
+typedef union
+{
+    struct
+    {
+        unsigned char URSTIF:1;
+        unsigned char UERRIF:1;
+        unsigned char ACTVIF:1;
+        unsigned char TRNIF:1;
+        unsigned char IDLEIF:1;
+        unsigned char STALLIF:1;
+        unsigned char SOFIF:1;
+        unsigned char :1;
+    };
+    unsigned char byte;
+} UIRbits_t;
+
+typedef union
+{
+    struct
+    {
+        unsigned char URSTIE:1;
+        unsigned char UERRIE:1;
+        unsigned char ACTVIE:1;
+        unsigned char TRNIE:1;
+        unsigned char IDLEIE:1;
+        unsigned char STALLIE:1;
+        unsigned char SOFIE:1;
+        unsigned char :1;
+    };
+    unsigned char byte;
+} UIEbits_t;
+
+typedef union
+{
+    struct
+    {
+        unsigned char EPSTALL:1;
+        unsigned char EPINEN:1;
+        unsigned char EPOUTEN:1;
+        unsigned char EPCONDIS:1;
+        unsigned char EPHSHK:1;
+        unsigned char :3;
+    };
+    unsigned char byte;
+} UEPbits_t;
+
+// Registers with side effects, every access lets the SIE model catch up
+// (clearing TRNIF advances the USTAT FIFO, PPBRST resets ping-pong pointers)
+volatile UCONbits_t *sim_ucon(void);
+volatile UIRbits_t *sim_uir(void);
+volatile unsigned char *sim_ustat(void);
+
+#define UCONbits (*sim_ucon())
+#define UCON (sim_ucon()->byte)
+#define UIRbits (*sim_uir())
+#define UIR (sim_uir()->byte)
+#define USTAT (*sim_ustat())
+
+// UART transmit register, each access takes one byte (written to the -u
+// file, see usbsim.c). Not in the data memory array
+volatile unsigned char *sim_txreg(void);
+
+#define TXREG (*sim_txreg())
+
+#define UCFGbits SIM_SFR(UCFGbits_t, 0xF6F)
+#define UIEbits SIM_SFR(UIEbits_t, 0xF69)
+#define UEPbits (&SIM_SFR(UEPbits_t, 0xF70))
+#define UEIR SIM_SFR(unsigned char, 0xF6A)
+#define UEIE SIM_SFR(unsigned char, 0xF6B)
+#define UADDR SIM_SFR(unsigned char, 0xF6E)
+#define UFRML SIM_SFR(unsigned char, 0xF66)
+#define UFRMH SIM_SFR(unsigned char, 0xF67)
+
+#define UCFG (UCFGbits.byte)
+#define UIE (UIEbits.byte)
+
+#define UEP0bits (UEPbits[0])
+#define UEP0 (UEPbits[0].byte)
+#define UEP1 (UEPbits[1].byte)
+#define UEP2 (UEPbits[2].byte)
+#define UEP3 (UEPbits[3].byte)
+#define UEP4 (UEPbits[4].byte)
+#define UEP5 (UEPbits[5].byte)
+#define UEP6 (UEPbits[6].byte)
+#define UEP7 (UEPbits[7].byte)
+#define UEP8 (UEPbits[8].byte)
+#define UEP9 (UEPbits[9].byte)
+#define UEP10 (UEPbits[10].byte)
+#define UEP11 (UEPbits[11].byte)
+#define UEP12 (UEPbits[12].byte)
+#define UEP13 (UEPbits[13].byte)
+#define UEP14 (UEPbits[14].byte)
+#define UEP15 (UEPbits[15].byte)
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                              INTERRUPTS AND CORE
+*******************************************************************************/
+
+typedef union
+{
+    struct
+    {
+        unsigned char RBIF:1;
+        unsigned char INT0IF:1;
+        unsigned char TMR0IF:1;
+        unsigned char RBIE:1;
+        unsigned char INT0IE:1;
+        unsigned char TMR0IE:1;
+        unsigned char PEIE:1;
+        unsigned char GIE:1;
+    };
+    struct
+    {
+        unsigned char :6;
+        unsigned char GIEL:1;
+        unsigned char GIEH:1;
+    };
+    unsigned char byte;
+} INTCONbits_t;
+
+// PIR1, the UART transmitter flag only
+typedef union
+{
+    struct
+    {
+        unsigned char :4;
+        unsigned char TXIF:1;
+        unsigned char RCIF:1;
+        unsigned char :2;
+    };
+    unsigned char byte;
+} PIR1bits_t;
+
+// PIR2 / PIE2 / IPR2 share their layout
+typedef union
+{
+    struct
+    {
+        unsigned char CCP2IF:1;
+        unsigned char TMR3IF:1;
+        unsigned char HLVDIF:1;
+        unsigned char BCLIF:1;
+        unsigned char EEIF:1;
+        unsigned char USBIF:1;
+        unsigned char CMIF:1;
+        unsigned char OSCFIF:1;
+    };
+    struct
+    {
+        unsigned char CCP2IE:1;
+        unsigned char TMR3IE:1;
+        unsigned char HLVDIE:1;
+        unsigned char BCLIE:1;
+        unsigned char EEIE:1;
+        unsigned char USBIE:1;
+        unsigned char CMIE:1;
+        unsigned char OSCFIE:1;
+    };
+    struct
+    {
+        unsigned char CCP2IP:1;
+        unsigned char TMR3IP:1;
+        unsigned char HLVDIP:1;
+        unsigned char BCLIP:1;
+        unsigned char EEIP:1;
+        unsigned char USBIP:1;
+        unsigned char CMIP:1;
+        unsigned char OSCFIP:1;
+    };
+    unsigned char byte;
+} PIR2bits_t;
+
+typedef union
+{
+    struct
+    {
+        unsigned char NOT_BOR:1;
+        unsigned char NOT_POR:1;
+        unsigned char NOT_PD:1;
+        unsigned char NOT_TO:1;
+        unsigned char NOT_RI:1;
+        unsigned char :1;
+        unsigned char SBOREN:1;
+        unsigned char IPEN:1;
+    };
+    unsigned char byte;
+} RCONbits_t;
+
+typedef union
+{
+    struct
+    {
+        unsigned char SCS:2;
+        unsigned char IOFS:1;
+        unsigned char OSTS:1;
+        unsigned char IRCF:3;
+        unsigned char IDLEN:1;
+    };
+    unsigned char byte;
+} OSCCONbits_t;
+
+#define INTCONbits SIM_SFR(INTCONbits_t, 0xFF2)
+#define PIR1bits SIM_SFR(PIR1bits_t, 0xF9E)
+#define PIR2bits SIM_SFR(PIR2bits_t, 0xFA1)
+#define PIE2bits SIM_SFR(PIR2bits_t, 0xFA0)
+#define IPR2bits SIM_SFR(PIR2bits_t, 0xFA2)
+#define RCONbits SIM_SFR(RCONbits_t, 0xFD0)
+#define OSCCONbits SIM_SFR(OSCCONbits_t, 0xFD3)
+
+#define INTCON (INTCONbits.byte)
+#define PIR2 (PIR2bits.byte)
+#define PIE2 (PIE2bits.byte)
+#define IPR2 (IPR2bits.byte)
+#define RCON (RCONbits.byte)
+#define OSCCON (OSCCONbits.byte)
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                    TIMERS
+
+    Timer 1 and Timer 3 count simulated instruction cycles (see sim_advance())
+*******************************************************************************/
+
+#define T1CON SIM_SFR(unsigned char, 0xFCD)
+#define T3CON SIM_SFR(unsigned char, 0xFB1)
+#define TMR1L SIM_SFR(unsigned char, 0xFCE)
+#define TMR1H SIM_SFR(unsigned char, 0xFCF)
+#define TMR3L SIM_SFR(unsigned char, 0xFB2)
+#define TMR3H SIM_SFR(unsigned char, 0xFB3)
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                PROGRAM MEMORY
+
+    Table writes fill the holding registers, EECON1 WR starts the erase or the
+    write after the EECON2 sequence (see sim_tblwt() and the flash model in
+    sie.c). Program memory reads are USB_PROGRAM_MEMORY reads
+
+                       See PIC18F4550 datasheet: page 93
+*******************************************************************************/
+
+typedef union
+{
+    struct
+    {
+        unsigned char RD:1;
+        unsigned char WR:1;
+        unsigned char WREN:1;
+        unsigned char WRERR:1;
+        unsigned char FREE:1;
+        unsigned char :1;
+        unsigned char CFGS:1;
+        unsigned char EEPGD:1;
+    };
+    unsigned char byte;
+} EECON1bits_t;
+
+// Every access lets the flash model catch up (a WR set runs the cycle)
+volatile EECON1bits_t *sim_eecon1(void);
+volatile unsigned char *sim_eecon2(void);
+
+#define EECON1bits (*sim_eecon1())
+#define EECON1 (sim_eecon1()->byte)
+#define EECON2 (*sim_eecon2())
+
+#define TABLAT SIM_SFR(unsigned char, 0xFF5)
+#define TBLPTRL SIM_SFR(unsigned char, 0xFF6)
+#define TBLPTRH SIM_SFR(unsigned char, 0xFF7)
+#define TBLPTRU SIM_SFR(unsigned char, 0xFF8)
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+#endif // _PIC18F4550_H
@@ -0,0 +1,31 @@
+/*
+ * File: 	pic18fregs.h
+ * Compiler: gcc
+ *
+ *
+ * [!] Host build stand-in for the SDCC generic PIC18 header, only the
+ * PIC18F4550 is modeled (see pic18f4550.h)
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _PIC18FREGS_H
+#define _PIC18FREGS_H
+
+#include "pic18f4550.h"
+
+#endif // _PIC18FREGS_H
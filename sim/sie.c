@@ -0,0 +1,769 @@
+/*
+ * File: 	sie.c
+ * Compiler: gcc
+ *
+ *
+ * [!] Behavioral model of the PIC18F4550 USB Serial Interface Engine
+ *
+ *  - USTAT is a 4 entries FIFO: clearing TRNIF shows the next entry and sets
+ *    TRNIF again, a full FIFO NAKs every token
+ *  - Buffer descriptors are handed off with UOWN: tokens to a BD the CPU owns
+ *    are NAKed, BSTALL sends STALL, DTSEN drops (but ACKs) out of sync packets
+ *  - SETUP tokens set PKTDIS, other tokens are NAKed until it's cleared
+ *  - Ping-pong BD pointers follow UCFG PPB1:PPB0 and PPBRST
+ *
+ * Only bus time (8 instruction cycles per byte at full speed) advances the
+ * timers, the stack itself runs in no simulated time
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <pic18fregs.h>
+#include <stdio.h>
+#include <string.h>
+#include "usb.h"
+#include "usb_pic.h"
+#include "usb_config.h"
+#include "usb_ram.h"
+#include "usbcdc.h"
+#include "sie.h"
+
+
+
+/*******************************************************************************
+                                   REGISTERS
+*******************************************************************************/
+
+// Data memory: RAM, USB RAM (0x400 - 0x7FF) and the SFRs (see USB_RAM_ARRAY
+// in usb_config.h). Program memory, erased at power on
+volatile unsigned char USB_DATA_MEMORY[USB_DATA_MEMORY_LIMIT]
+    __attribute__((aligned(4)));
+unsigned char USB_PROGRAM_MEMORY[USB_PROGRAM_MEMORY_SIZE];
+
+// Accessed through sim_ucon() / sim_uir() / sim_ustat() / sim_eecon1() /
+// sim_eecon2()
+#define UCON_REG SIM_SFR(UCONbits_t, 0xF6D)
+#define UIR_REG SIM_SFR(UIRbits_t, 0xF68)
+#define USTAT_REG SIM_SFR(unsigned char, 0xF6C)
+#define EECON1_REG SIM_SFR(EECON1bits_t, 0xFA6)
+#define EECON2_REG SIM_SFR(unsigned char, 0xFA7)
+
+// The BDT is overlaid on USB_RAM: 4 bytes entries (needs -fpack-struct)
+USB_STATIC_ASSERT(bd_is_4_bytes, sizeof(BUFFER_DESC_t) == 4);
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                   SIE STATE
+*******************************************************************************/
+
+// Bus time per byte and per transaction (token, PIDs, CRC, handshake, gaps)
+#define SIE_BYTE_CYCLES 8
+#define SIE_TRANSACTION_BYTES 16
+
+// Instruction cycles per frame
+#define SIE_FRAME_CYCLES 12000
+
+// USTAT FIFO, entry 0 is the one USTAT shows while TRNIF is set
+#define SIE_USTAT_FIFO 4
+
+static unsigned char USTAT_FIFO[SIE_USTAT_FIFO];
+static unsigned char USTAT_COUNT;
+static unsigned char USTAT_SHOWN; // Entry 0 is in USTAT, TRNIF set
+
+// Next BD (odd) by endpoint and direction, ping-pong modes only
+static unsigned char PPBI[16][2];
+
+// Last RESUME bit seen, the frame number and its start time
+static unsigned char RESUME_LAST;
+static unsigned short FRAME;
+static unsigned long FRAME_START;
+
+// Timers prescaler remainders
+static unsigned long TMR1_REST;
+static unsigned long TMR3_REST;
+
+// Program memory row (erase) and holding registers (write) sizes, time
+// taken by each cycle (2ms)
+#define SIE_FLASH_ROW 64
+#define SIE_FLASH_BLOCK 32
+#define SIE_FLASH_CYCLES 24000
+
+// Table writes since the last write cycle, EECON2 before its last write
+static unsigned char FLASH_HOLDING[SIE_FLASH_BLOCK];
+static unsigned char EECON2_LAST;
+
+// Last TXREG write, not in sim_uart_file yet
+static volatile unsigned char UART_TX;
+static unsigned char UART_TX_PENDING;
+
+FILE *sim_uart_file;
+unsigned long sim_cycles;
+unsigned long sim_handler_calls;
+unsigned long sim_sleeps;
+unsigned long sim_errors;
+unsigned long sie_resume_signals;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+static void sie_sync(void);
+static unsigned char sie_accepts(unsigned char address, unsigned char ep,
+        unsigned char dir);
+static volatile BUFFER_DESC_t *sie_bd(unsigned char ep, unsigned char dir,
+        unsigned char *odd);
+static volatile unsigned char *sie_buffer(volatile BUFFER_DESC_t *bd);
+static void sie_complete(volatile BUFFER_DESC_t *bd, unsigned char ep,
+        unsigned char dir, unsigned char odd, unsigned char pid,
+        unsigned char data1);
+static void sie_activity(void);
+static void sim_flash_sync(void);
+static unsigned long sim_tblptr(void);
+static void sim_timer(unsigned char con, volatile unsigned char *low,
+        volatile unsigned char *high, unsigned long *rest,
+        unsigned long cycles, unsigned char is_timer3);
+
+
+
+              /***************  Registers access  *************/
+
+/*
+ * Catches up with the CPU writes before any access: a cleared TRNIF pops the
+ * USTAT FIFO, PPBRST resets the ping-pong pointers, RESUME is remote wakeup,
+ * UERRIF follows the enabled UEIR flags
+ */
+static void sie_sync(void)
+{
+    UIR_REG.UERRIF = (UEIR & UEIE) != 0;
+
+    if( USTAT_SHOWN && !UIR_REG.TRNIF )
+    {
+        USTAT_COUNT--;
+        memmove(USTAT_FIFO, USTAT_FIFO + 1, USTAT_COUNT);
+        USTAT_SHOWN = 0;
+    }
+
+    if( USTAT_COUNT && !USTAT_SHOWN )
+    {
+        UIR_REG.TRNIF = 1;
+        USTAT_REG = USTAT_FIFO[0];
+        USTAT_SHOWN = 1;
+    }
+
+    if( UCON_REG.PPBRST )
+    {
+        memset(PPBI, 0, sizeof(PPBI));
+    }
+
+    if( UCON_REG.RESUME && !RESUME_LAST )
+    {
+        sie_resume_signals++;
+    }
+    RESUME_LAST = UCON_REG.RESUME;
+}
+
+
+volatile UCONbits_t *sim_ucon(void)
+{
+    sie_sync();
+    return &UCON_REG;
+}
+
+
+volatile UIRbits_t *sim_uir(void)
+{
+    sie_sync();
+    return &UIR_REG;
+}
+
+
+volatile unsigned char *sim_ustat(void)
+{
+    sie_sync();
+    return &USTAT_REG;
+}
+
+
+/* The byte written by the previous access goes out, then the next one */
+volatile unsigned char *sim_txreg(void)
+{
+    sim_uart_flush();
+    UART_TX_PENDING = 1;
+    return &UART_TX;
+}
+
+
+void sim_uart_flush(void)
+{
+    if( UART_TX_PENDING && sim_uart_file )
+    {
+        fputc(UART_TX, sim_uart_file);
+    }
+    UART_TX_PENDING = 0;
+}
+
+
+volatile EECON1bits_t *sim_eecon1(void)
+{
+    sim_flash_sync();
+    return &EECON1_REG;
+}
+
+
+/* The previous value is kept: the unlock sequence is 0x55 then 0xAA */
+volatile unsigned char *sim_eecon2(void)
+{
+    EECON2_LAST = EECON2_REG;
+    return &EECON2_REG;
+}
+
+
+/* SLEEP instruction, the simulation goes on */
+void sim_sleep(void)
+{
+    sim_sleeps++;
+}
+
+
+
+              /***************  Program memory  *************/
+
+/* TBLPTR, 22 bits */
+static unsigned long sim_tblptr(void)
+{
+    return ((unsigned long) (TBLPTRU & 0x3F) << 16) |
+        ((unsigned short) TBLPTRH << 8) | TBLPTRL;
+}
+
+
+/* TBLWT instruction: TABLAT to the holding register, TBLPTR++ if 'increment' */
+void sim_tblwt(unsigned char increment)
+{
+    unsigned long tblptr = sim_tblptr();
+
+    FLASH_HOLDING[tblptr & (SIE_FLASH_BLOCK - 1)] = TABLAT;
+
+    if( increment )
+    {
+        tblptr++;
+        TBLPTRU = (tblptr >> 16) & 0x3F;
+        TBLPTRH = (tblptr >> 8) & 0xFF;
+        TBLPTRL = tblptr & 0xFF;
+    }
+}
+
+
+/*
+ * Runs the cycle a WR set started: erases the row TBLPTR is in (FREE) or
+ * writes the holding registers to its block, bits can only be cleared there.
+ * The CPU stalls meanwhile, WR clears at the end
+ */
+static void sim_flash_sync(void)
+{
+    unsigned long tblptr;
+    unsigned char i;
+
+    if( !EECON1_REG.WR )
+    {
+        return;
+    }
+    EECON1_REG.WR = 0;
+
+    tblptr = sim_tblptr();
+    if( !EECON1_REG.EEPGD || EECON1_REG.CFGS || !EECON1_REG.WREN ||
+            EECON2_LAST != 0x55 || EECON2_REG != 0xAA ||
+            tblptr >= USB_PROGRAM_MEMORY_SIZE )
+    {
+        fprintf(stderr, "sim: program memory cycle refused (EECON1 0x%02X, "
+                "TBLPTR 0x%06lX)\n", EECON1_REG.byte, tblptr);
+        EECON1_REG.WRERR = 1;
+        sim_errors++;
+        return;
+    }
+    EECON2_REG = 0;
+
+    if( EECON1_REG.FREE )
+    {
+        memset(USB_PROGRAM_MEMORY + (tblptr & ~(SIE_FLASH_ROW - 1UL)), 0xFF,
+                SIE_FLASH_ROW);
+    }
+    else
+    {
+        tblptr &= ~(SIE_FLASH_BLOCK - 1UL);
+        for( i=0; i<SIE_FLASH_BLOCK; i++ )
+        {
+            USB_PROGRAM_MEMORY[tblptr + i] &= FLASH_HOLDING[i];
+        }
+        memset(FLASH_HOLDING, 0xFF, sizeof(FLASH_HOLDING));
+    }
+
+    sim_advance(SIE_FLASH_CYCLES);
+}
+
+
+
+              /***************  Simulation  *************/
+
+/* Power on reset values */
+void sim_init(void)
+{
+    // Registers cleared, but the ones below
+    memset((void*) USB_DATA_MEMORY, 0, sizeof(USB_DATA_MEMORY));
+    PIR1bits.TXIF = sim_uart_file != 0; // Transmitter always ready
+    IPR2 = 0xFF;
+
+    memset(USB_PROGRAM_MEMORY, 0xFF, sizeof(USB_PROGRAM_MEMORY));
+    memset(FLASH_HOLDING, 0xFF, sizeof(FLASH_HOLDING));
+    EECON2_LAST = 0;
+
+    USTAT_COUNT = 0;
+    USTAT_SHOWN = 0;
+    memset(PPBI, 0, sizeof(PPBI));
+    RESUME_LAST = 0;
+    FRAME = 0;
+    FRAME_START = 0;
+    TMR1_REST = 0;
+    TMR3_REST = 0;
+
+    sim_cycles = 0;
+    sim_handler_calls = 0;
+    sim_sleeps = 0;
+    sim_errors = 0;
+    sie_resume_signals = 0;
+}
+
+
+/*
+ * Interrupt entries while the USB interrupt is pending, the way the
+ * application ISR wrappers (or main loop) call the stack. Deferred events are
+ * processed after each entry, as a main loop would
+ */
+void sim_service(void)
+{
+    unsigned char guard;
+
+    for( guard=0; guard<64; guard++ )
+    {
+        if( (UIR & UIE) == 0 )
+        {
+#if USB_DEFERRED_EVENTS
+            if( USB_HOT.ev_head != USB_HOT.ev_tail )
+            {
+                usb_process_events();
+                continue;
+            }
+#endif
+            return;
+        }
+
+        PIR2bits.USBIF = 1;
+        sim_handler_calls++;
+
+#if USB_POLLING
+        usb_task();
+#else
+        // Masked (USB_LOCK() left on), nothing runs
+        if( !PIE2bits.USBIE )
+        {
+            return;
+        }
+
+#if USB_INTERRUPT_PRIORITY
+        if( IPR2bits.USBIP )
+        {
+            usb_handler_high();
+        }
+        else
+        {
+            usb_handler_low();
+        }
+#else
+        usb_handler();
+        PIR2bits.USBIF = 0;
+#endif
+#endif
+
+        // Main loop
+#if !USB_POLLING
+        usb_process_events();
+#endif
+    }
+
+    fprintf(stderr, "sim: USB interrupt still pending (UIR 0x%02X)\n", UIR);
+    sim_errors++;
+}
+
+
+/* Timer 'con' counting, 16 bits, prescaler from bits 5:4 */
+static void sim_timer(unsigned char con, volatile unsigned char *low,
+        volatile unsigned char *high, unsigned long *rest,
+        unsigned long cycles, unsigned char is_timer3)
+{
+    unsigned char shift = (con >> 4) & 0x03;
+    unsigned long value;
+
+    if( (con & 0x01) == 0 )
+    {
+        return;
+    }
+
+    *rest += cycles;
+    value = (((unsigned long) *high << 8) | *low) + (*rest >> shift);
+    *rest &= (1UL << shift) - 1;
+
+    if( value > 0xFFFF && is_timer3 )
+    {
+        PIR2bits.TMR3IF = 1;
+    }
+
+    *low = value & 0xFF;
+    *high = (value >> 8) & 0xFF;
+}
+
+
+void sim_advance(unsigned long cycles)
+{
+    sim_cycles += cycles;
+    sim_timer(T1CON, &TMR1L, &TMR1H, &TMR1_REST, cycles, 0);
+    sim_timer(T3CON, &TMR3L, &TMR3H, &TMR3_REST, cycles, 1);
+}
+
+
+
+              /***************  Bus events  *************/
+
+const char *sie_handshake_name(unsigned char handshake)
+{
+    switch( handshake )
+    {
+        case SIE_ACK: return "ACK";
+        case SIE_NAK: return "NAK";
+        case SIE_STALL: return "STALL";
+        default: return "NONE";
+    }
+}
+
+
+/* Any bus activity wakes a suspended SIE up */
+static void sie_activity(void)
+{
+    if( UCON_REG.SUSPND )
+    {
+        UIR_REG.ACTVIF = 1;
+    }
+}
+
+
+void sie_bus_reset(void)
+{
+    sim_advance(10 * SIE_FRAME_CYCLES); // 10ms SE0
+    sie_activity();
+
+    UADDR = 0;
+    if( UCON_REG.USBEN )
+    {
+        UIR_REG.URSTIF = 1;
+    }
+
+    sim_service();
+}
+
+
+void sie_sof(void)
+{
+    // SOFs come on frame boundaries
+    if( sim_cycles - FRAME_START < SIE_FRAME_CYCLES )
+    {
+        sim_advance(SIE_FRAME_CYCLES - (sim_cycles - FRAME_START));
+    }
+    FRAME_START = sim_cycles;
+    FRAME = (FRAME + 1) & 0x7FF;
+    sie_activity();
+
+    if( UCON_REG.USBEN && !UCON_REG.SUSPND )
+    {
+        UFRML = FRAME & 0xFF;
+        UFRMH = FRAME >> 8;
+        UIR_REG.SOFIF = 1;
+    }
+
+    sim_service();
+}
+
+
+void sie_idle(void)
+{
+    sim_advance(3 * SIE_FRAME_CYCLES);
+
+    if( UCON_REG.USBEN && !UCON_REG.SUSPND )
+    {
+        UIR_REG.IDLEIF = 1;
+    }
+
+    sim_service();
+}
+
+
+void sie_error(unsigned char ueir)
+{
+    UEIR |= ueir;
+    sim_service();
+}
+
+
+void sie_resume(void)
+{
+    sim_advance(20 * SIE_FRAME_CYCLES); // 20ms K state
+    sie_activity();
+    sim_service();
+}
+
+
+
+              /***************  Transactions  *************/
+
+/* The device answers tokens to its address and enabled endpoints only */
+static unsigned char sie_accepts(unsigned char address, unsigned char ep,
+        unsigned char dir)
+{
+    if( !UCON_REG.USBEN || UCON_REG.SUSPND || ep > 15 || address != UADDR )
+    {
+        return 0;
+    }
+
+    if( dir == USB_DIR_OUT )
+    {
+        return UEPbits[ep].EPOUTEN;
+    }
+    return UEPbits[ep].EPINEN;
+}
+
+
+/* Buffer descriptor the next token to endpoint 'ep' direction 'dir' uses */
+static volatile BUFFER_DESC_t *sie_bd(unsigned char ep, unsigned char dir,
+        unsigned char *odd)
+{
+    unsigned char mode = UCFG & 0x03;
+    unsigned char index;
+
+    *odd = 0;
+    if( USB_PP_BUFFERS(mode, ep, dir) > 1 )
+    {
+        *odd = PPBI[ep][dir];
+    }
+
+    index = USB_BD_INDEX(mode, ep, dir, *odd);
+    if( 4 * (index + 1) > USB_RAM_BUFFERS_ADDR - USB_BDT_ADDR )
+    {
+        fprintf(stderr, "sim: EP%d %s BD %d beyond the BDT\n", ep,
+                dir ? "IN" : "OUT", index);
+        sim_errors++;
+        return 0;
+    }
+
+    return &USB_BDT[index];
+}
+
+
+/* Buffer of 'bd', zero (a model error) if it isn't in USB RAM */
+static volatile unsigned char *sie_buffer(volatile BUFFER_DESC_t *bd)
+{
+    if( bd->ADDR < USB_BDT_ADDR || bd->ADDR + bd->CNT > USB_RAM_LIMIT )
+    {
+        fprintf(stderr, "sim: BD buffer 0x%04X (%d bytes) outside USB RAM\n",
+                bd->ADDR, bd->CNT);
+        sim_errors++;
+        return 0;
+    }
+
+    return &USB_RAM[bd->ADDR - USB_BDT_ADDR];
+}
+
+
+/*
+ * Gives 'bd' back to the CPU (SIE mode STAT: PID and data toggle) and reports
+ * the transaction in USTAT
+ */
+static void sie_complete(volatile BUFFER_DESC_t *bd, unsigned char ep,
+        unsigned char dir, unsigned char odd, unsigned char pid,
+        unsigned char data1)
+{
+    bd->STAT.stat = (data1 ? USB_BD_DTS : 0) | (pid << 2);
+
+    USTAT_FIFO[USTAT_COUNT++] = (ep << 3) | (dir << 2) | (odd << 1);
+    sie_sync();
+
+    if( USB_PP_BUFFERS(UCFG & 0x03, ep, dir) > 1 )
+    {
+        PPBI[ep][dir] ^= 1;
+    }
+}
+
+
+unsigned char sie_setup(unsigned char address, unsigned char ep,
+        const unsigned char *packet)
+{
+    volatile BUFFER_DESC_t *bd;
+    volatile unsigned char *buffer;
+    unsigned char odd;
+    unsigned char handshake = SIE_NAK;
+
+    sim_advance(SIE_BYTE_CYCLES * (8 + SIE_TRANSACTION_BYTES));
+    sie_activity();
+
+    if( !sie_accepts(address, ep, USB_DIR_OUT) )
+    {
+        handshake = SIE_NONE;
+    }
+    else if( USTAT_COUNT < SIE_USTAT_FIFO &&
+            (bd = sie_bd(ep, USB_DIR_OUT, &odd)) != 0 &&
+            (bd->STAT.stat & USB_BD_UOWN) )
+    {
+        // SETUP packets get in even if the BD is stalled
+        if( bd->CNT < 8 || (buffer = sie_buffer(bd)) == 0 )
+        {
+            sim_errors++;
+        }
+        else
+        {
+            memcpy((void*) buffer, packet, 8);
+            bd->CNT = 8;
+            sie_complete(bd, ep, USB_DIR_OUT, odd, USB_PID_TOKEN_SETUP, 0);
+            UCON_REG.PKTDIS = 1;
+            handshake = SIE_ACK;
+        }
+    }
+
+    sim_service();
+    return handshake;
+}
+
+
+unsigned char sie_out(unsigned char address, unsigned char ep,
+        unsigned char data1, const unsigned char *data, unsigned char size)
+{
+    volatile BUFFER_DESC_t *bd;
+    volatile unsigned char *buffer;
+    unsigned char odd;
+    unsigned char handshake = SIE_NAK;
+
+    sim_advance(SIE_BYTE_CYCLES * (size + SIE_TRANSACTION_BYTES));
+    sie_activity();
+
+    if( !sie_accepts(address, ep, USB_DIR_OUT) )
+    {
+        handshake = SIE_NONE;
+    }
+    else if( UEPbits[ep].EPSTALL )
+    {
+        handshake = SIE_STALL;
+    }
+    else if( !UCON_REG.PKTDIS && USTAT_COUNT < SIE_USTAT_FIFO &&
+            (bd = sie_bd(ep, USB_DIR_OUT, &odd)) != 0 &&
+            (bd->STAT.stat & USB_BD_UOWN) )
+    {
+        if( bd->STAT.stat & USB_BD_BSTALL )
+        {
+            handshake = SIE_STALL;
+        }
+        // Out of sync packet: ACKed and dropped, the BD stays armed
+        else if( (bd->STAT.stat & USB_BD_DTSEN) &&
+                ((bd->STAT.stat & USB_BD_DTS) != 0) != (data1 != 0) )
+        {
+            handshake = SIE_ACK;
+        }
+        else if( size > bd->CNT || (buffer = sie_buffer(bd)) == 0 )
+        {
+            fprintf(stderr, "sim: EP%d OUT %d bytes packet, %d bytes BD\n",
+                    ep, size, bd->CNT);
+            sim_errors++;
+        }
+        else
+        {
+            memcpy((void*) buffer, data, size);
+            bd->CNT = size;
+            sie_complete(bd, ep, USB_DIR_OUT, odd, USB_PID_TOKEN_OUT, data1);
+            handshake = SIE_ACK;
+        }
+    }
+
+    if( handshake == SIE_STALL )
+    {
+        UIR_REG.STALLIF = 1;
+    }
+
+    sim_service();
+    return handshake;
+}
+
+
+unsigned char sie_in(unsigned char address, unsigned char ep,
+        unsigned char *data, unsigned char *size, unsigned char *data1)
+{
+    volatile BUFFER_DESC_t *bd;
+    volatile unsigned char *buffer;
+    unsigned char odd;
+    unsigned char handshake = SIE_NAK;
+
+    *size = 0;
+    *data1 = 0;
+    sie_activity();
+
+    if( !sie_accepts(address, ep, USB_DIR_IN) )
+    {
+        handshake = SIE_NONE;
+    }
+    else if( UEPbits[ep].EPSTALL )
+    {
+        handshake = SIE_STALL;
+    }
+    else if( !UCON_REG.PKTDIS && USTAT_COUNT < SIE_USTAT_FIFO &&
+            (bd = sie_bd(ep, USB_DIR_IN, &odd)) != 0 &&
+            (bd->STAT.stat & USB_BD_UOWN) )
+    {
+        if( bd->STAT.stat & USB_BD_BSTALL )
+        {
+            handshake = SIE_STALL;
+        }
+        else if( bd->CNT > 64 || (buffer = sie_buffer(bd)) == 0 )
+        {
+            sim_errors++;
+        }
+        else
+        {
+            *size = bd->CNT;
+            *data1 = (bd->STAT.stat & USB_BD_DTS) ? 1 : 0;
+            memcpy(data, (void*) buffer, *size);
+            sie_complete(bd, ep, USB_DIR_IN, odd, USB_PID_TOKEN_IN, *data1);
+            handshake = SIE_ACK;
+        }
+    }
+
+    if( handshake == SIE_STALL )
+    {
+        UIR_REG.STALLIF = 1;
+    }
+
+    sim_advance(SIE_BYTE_CYCLES * (*size + SIE_TRANSACTION_BYTES));
+    sim_service();
+    return handshake;
+}
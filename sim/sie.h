@@ -0,0 +1,120 @@
+/*
+ * File: 	sie.h
+ * Compiler: gcc
+ *
+ *
+ * [!] Behavioral model of the PIC18F4550 USB Serial Interface Engine, plus the
+ * host controller side that drives it with bus events and tokens
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _SIE_H
+#define _SIE_H
+
+
+
+/*******************************************************************************
+                                    RESULTS
+*******************************************************************************/
+
+// Handshakes seen by the host
+#define SIE_ACK 0
+#define SIE_NAK 1
+#define SIE_STALL 2
+#define SIE_NONE 3 // No answer: wrong address, endpoint off, suspended...
+
+// Data PIDs
+#define SIE_DATA0 0
+#define SIE_DATA1 1
+
+// Handshake name, for traces and errors
+const char *sie_handshake_name(unsigned char handshake);
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                   SIMULATION
+
+    Firmware side: registers, interrupts and time. The stack runs only when
+    sim_service() is called (after every bus event by default)
+*******************************************************************************/
+
+// Power on: registers cleared, SIE idle
+void sim_init(void);
+
+// Runs the interrupt handler (or usb_task()) while USB events are pending
+void sim_service(void);
+
+// Advances the simulated time, Timer 1 and Timer 3 count instruction cycles
+void sim_advance(unsigned long cycles);
+
+// UART output (TXREG writes) file, if any: the transmitter is always ready.
+// sim_uart_flush() writes the last byte out
+extern FILE *sim_uart_file;
+void sim_uart_flush(void);
+
+// Simulated instruction cycles since sim_init()
+extern unsigned long sim_cycles;
+
+// Interrupt handler calls, SLEEP instructions, model errors (bad BD setups)
+extern unsigned long sim_handler_calls;
+extern unsigned long sim_sleeps;
+extern unsigned long sim_errors;
+
+// Resume signaling (remote wakeup) driven by the device
+extern unsigned long sie_resume_signals;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                HOST CONTROLLER
+
+    Each call is one bus event or transaction, the data buffers are up to 64
+    bytes (full speed max packet size)
+*******************************************************************************/
+
+// Bus events
+void sie_bus_reset(void);
+void sie_sof(void);
+void sie_idle(void); // 3ms without activity
+void sie_resume(void); // Host resume signaling
+void sie_error(unsigned char ueir); // Bus errors (UEIR flags) detected
+
+// SETUP transaction, 8 bytes DATA0 packet
+unsigned char sie_setup(unsigned char address, unsigned char ep,
+        const unsigned char *packet);
+
+// OUT transaction, 'data1' selects the DATA1 PID
+unsigned char sie_out(unsigned char address, unsigned char ep,
+        unsigned char data1, const unsigned char *data, unsigned char size);
+
+// IN transaction, the packet (if ACK) is copied to 'data'
+unsigned char sie_in(unsigned char address, unsigned char ep,
+        unsigned char *data, unsigned char *size, unsigned char *data1);
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+#endif // _SIE_H
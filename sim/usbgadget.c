@@ -0,0 +1,591 @@
+/*
+ * File: 	usbgadget.c
+ * Compiler: gcc (Linux)
+ *
+ *
+ * [!] Runs the stack on the SIE model as a real USB device of the local
+ * machine, through the Linux Raw Gadget interface and a Dummy UDC/HCD pair:
+ *
+ *     usbgadget [-v] [-u dummy_udc.N] [-a echo|none]
+ *
+ * The host side of the machine enumerates it like the hardware: every control
+ * request (descriptors, SET_CONFIGURATION, CDC class and vendor requests) is
+ * answered by the stack, in the CDC personality cdc_acm binds it as a
+ * /dev/ttyACM port. -a picks the application side: echo (default, received
+ * bytes are sent back) or none. See gadget.sh to load the modules and run
+ * several devices (one Dummy UDC each)
+ *
+ * Raw Gadget instead of FunctionFS: FunctionFS only takes interface and
+ * endpoint descriptors, the CDC functional descriptors (CS_INTERFACE) are
+ * rejected and cdc_acm would not bind. Raw Gadget hands every ep0 request
+ * but SET_ADDRESS (the Dummy UDC handles it) to user space
+ *
+ * The model keeps the firmware pace, not the host one: SOFs are ticked every
+ * millisecond and NAKed OUT packets retried on the next one. Each data
+ * endpoint has its own thread blocked on the Raw Gadget I/O, the model is
+ * shared under a lock
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <pic18fregs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/usb/raw_gadget.h>
+#include "usb_config.h"
+#include "usb_hot.h"
+#include "usbcdc.h"
+#include "sie.h"
+#include "host.h"
+
+
+
+/*******************************************************************************
+                                  DEFINITIONS
+*******************************************************************************/
+
+// Address of the device on the model, the Dummy UDC keeps the real one
+#define GADGET_ADDRESS 1
+
+// Raw Gadget events newer than some kernel headers
+#define GADGET_EVENT_DISCONNECT 3
+#define GADGET_EVENT_RESET 4
+#define GADGET_EVENT_SUSPEND 5
+#define GADGET_EVENT_RESUME 6
+
+// host_toggle[] directions (as usb_ram.h, linux/usb/ch9.h has its own)
+#define GADGET_TOGGLE_OUT 0
+#define GADGET_TOGGLE_IN 1
+
+// Data endpoints, at most, and I/O buffers size
+#define GADGET_EP_MAX 8
+#define GADGET_IO_SIZE 4096
+
+// Control transfers data, at most (wLength)
+#define GADGET_CONTROL_SIZE 0xFFFF
+
+// Application side
+#define GADGET_APP_NONE 0
+#define GADGET_APP_ECHO 1
+
+// A data endpoint, as enabled on the Raw Gadget
+typedef struct
+{
+    struct usb_endpoint_descriptor descriptor;
+    int handle;
+} GADGET_EP_t;
+
+// Raw Gadget I/O requests with their data
+typedef struct
+{
+    struct usb_raw_event event;
+    union
+    {
+        struct usb_ctrlrequest setup;
+        unsigned char data[sizeof(struct usb_ctrlrequest)];
+    };
+} GADGET_EVENT_t;
+
+typedef struct
+{
+    struct usb_raw_ep_io io;
+    unsigned char data[GADGET_CONTROL_SIZE + HOST_BULK_SIZE];
+} GADGET_IO_t;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                     STATE
+*******************************************************************************/
+
+static int FD;
+
+// Model (and application) lock, held while a thread drives the SIE. Aligned
+// by hand: the sim is built with -fpack-struct, initialized in main()
+static pthread_mutex_t MODEL __attribute__((aligned(8)));
+
+static GADGET_EP_t EPS[GADGET_EP_MAX];
+static unsigned char EPS_COUNT;
+
+// SET_CONFIGURATION done on the model, bus suspended (no SOFs)
+static volatile unsigned char CONFIGURED;
+static volatile unsigned char SUSPENDED;
+
+static unsigned char APP = GADGET_APP_ECHO;
+
+static GADGET_IO_t CONTROL;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+static void fail(const char *what);
+static void check_io(int result, const char *what);
+static void run_app(void);
+static void model_reset(void);
+static void enable_endpoints(void);
+static void handle_control(const struct usb_ctrlrequest *setup);
+static void *out_thread(void *ep);
+static void *in_thread(void *ep);
+static void *sof_thread(void *unused);
+
+
+
+static void fail(const char *what)
+{
+    perror(what);
+    exit(1);
+}
+
+
+/*
+ * Data endpoint I/O result: requests cut by a bus reset or disconnection
+ * come again once the host configures the device
+*/
+static void check_io(int result, const char *what)
+{
+    if( result < 0 && errno != ESHUTDOWN && errno != ECONNRESET )
+    {
+        fail(what);
+    }
+    if( result < 0 )
+    {
+        usleep(1000);
+    }
+}
+
+
+/* Application side, with the model lock held */
+static void run_app(void)
+{
+    if( APP != GADGET_APP_ECHO )
+    {
+        return;
+    }
+
+    while( USB_HOT.rx_head != USB_HOT.rx_tail &&
+            (unsigned char) (USB_HOT.tx_head - USB_HOT.tx_tail) <
+            USB_TX_RING_SIZE )
+    {
+        usb_cdc_putc(usb_cdc_getc());
+    }
+    sim_service();
+}
+
+
+
+              /***************  Model  *************/
+
+/* Bus reset, then the device addressed (the real SET_ADDRESS never comes) */
+static void model_reset(void)
+{
+    unsigned char setup[8] = { 0x00, USB_REQ_SET_ADDRESS, GADGET_ADDRESS };
+    unsigned short size;
+
+    CONFIGURED = 0;
+    SUSPENDED = 0;
+    host_reset();
+    sie_sof();
+    if( host_control(0, setup, 0, CONTROL.data, &size) != SIE_ACK )
+    {
+        fprintf(stderr, "usbgadget: SET_ADDRESS failed on the model\n");
+        exit(1);
+    }
+}
+
+
+/*
+ * Enables the endpoints of the configuration descriptor (read from the
+ * model) on the Raw Gadget and starts their threads, only once: Raw Gadget
+ * endpoints stay enabled while the gadget runs
+ */
+static void enable_endpoints(void)
+{
+    unsigned char setup[8] = { 0x80, USB_REQ_GET_DESCRIPTOR, 0x00,
+        USB_DT_CONFIG, 0x00, 0x00, 0xFF, 0x00 };
+    unsigned short size;
+    unsigned short i;
+    GADGET_EP_t *ep;
+    pthread_t thread;
+
+    if( EPS_COUNT )
+    {
+        return;
+    }
+
+    if( host_control(GADGET_ADDRESS, setup, 0, CONTROL.data, &size) !=
+            SIE_ACK )
+    {
+        fprintf(stderr, "usbgadget: no configuration descriptor\n");
+        exit(1);
+    }
+
+    for( i=0; i + 1 < size && CONTROL.data[i] >= 2; i += CONTROL.data[i] )
+    {
+        if( CONTROL.data[i + 1] != USB_DT_ENDPOINT ||
+                EPS_COUNT == GADGET_EP_MAX )
+        {
+            continue;
+        }
+
+        ep = &EPS[EPS_COUNT++];
+        memset(&ep->descriptor, 0, sizeof(ep->descriptor));
+        memcpy(&ep->descriptor, CONTROL.data + i, USB_DT_ENDPOINT_SIZE);
+
+        ep->handle = ioctl(FD, USB_RAW_IOCTL_EP_ENABLE, &ep->descriptor);
+        if( ep->handle < 0 )
+        {
+            fail("USB_RAW_IOCTL_EP_ENABLE");
+        }
+
+        // The interrupt endpoint (notifications) is never used by the stack
+        if( usb_endpoint_xfer_bulk(&ep->descriptor) &&
+                pthread_create(&thread, 0,
+                    usb_endpoint_dir_in(&ep->descriptor) ?
+                    in_thread : out_thread, ep) != 0 )
+        {
+            fail("pthread_create");
+        }
+    }
+}
+
+
+
+              /***************  Endpoint 0  *************/
+
+/* Runs a control request on the model and answers it */
+static void handle_control(const struct usb_ctrlrequest *setup)
+{
+    unsigned short length = setup->wLength;
+    unsigned short size = 0;
+    unsigned char handshake;
+    int result = 0;
+
+    CONTROL.io.ep = 0;
+    CONTROL.io.flags = 0;
+
+    // OUT data stage: Raw Gadget hands the data over (and acknowledges it)
+    // first, the model can only stall the STATUS stage
+    if( !(setup->bRequestType & USB_DIR_IN) && length )
+    {
+        CONTROL.io.length = length;
+        if( ioctl(FD, USB_RAW_IOCTL_EP0_READ, &CONTROL) < 0 )
+        {
+            perror("USB_RAW_IOCTL_EP0_READ");
+            return;
+        }
+    }
+
+    pthread_mutex_lock(&MODEL);
+    handshake = host_control(GADGET_ADDRESS, (const unsigned char*) setup,
+            CONTROL.data, CONTROL.data, &size);
+    if( handshake == SIE_ACK && setup->bRequestType == 0x00 &&
+            setup->bRequest == USB_REQ_SET_CONFIGURATION )
+    {
+        CONFIGURED = setup->wValue != 0;
+        if( CONFIGURED )
+        {
+            enable_endpoints();
+            result = ioctl(FD, USB_RAW_IOCTL_CONFIGURE, 0);
+        }
+    }
+    pthread_mutex_unlock(&MODEL);
+
+    if( result < 0 )
+    {
+        fail("USB_RAW_IOCTL_CONFIGURE");
+    }
+
+    if( handshake != SIE_ACK )
+    {
+        if( host_verbose )
+        {
+            printf("request %02X %02X: %s\n", setup->bRequestType,
+                    setup->bRequest, sie_handshake_name(handshake));
+        }
+        result = ioctl(FD, USB_RAW_IOCTL_EP0_STALL, 0);
+    }
+    else if( setup->bRequestType & USB_DIR_IN )
+    {
+        // Short reply of a multiple of the packet size: zero length packet
+        CONTROL.io.length = size;
+        CONTROL.io.flags = size < length ? USB_RAW_IO_FLAGS_ZERO : 0;
+        result = ioctl(FD, USB_RAW_IOCTL_EP0_WRITE, &CONTROL);
+    }
+    else if( !length )
+    {
+        CONTROL.io.length = 0;
+        result = ioctl(FD, USB_RAW_IOCTL_EP0_READ, &CONTROL);
+    }
+
+    if( result < 0 )
+    {
+        perror("endpoint 0");
+    }
+}
+
+
+
+              /***************  Data endpoints  *************/
+
+/* Host to device: each transfer goes to the model packet by packet */
+static void *out_thread(void *ep)
+{
+    GADGET_EP_t *out = ep;
+    unsigned char number = usb_endpoint_num(&out->descriptor);
+    struct
+    {
+        struct usb_raw_ep_io io;
+        unsigned char data[GADGET_IO_SIZE];
+    } transfer;
+    unsigned offset;
+    unsigned char packet;
+    int received;
+
+    for( ;; )
+    {
+        transfer.io.ep = out->handle;
+        transfer.io.flags = 0;
+        transfer.io.length = sizeof(transfer.data);
+        received = ioctl(FD, USB_RAW_IOCTL_EP_READ, &transfer);
+        check_io(received, "USB_RAW_IOCTL_EP_READ");
+
+        offset = 0;
+        while( received > 0 && offset < (unsigned) received )
+        {
+            packet = received - offset < HOST_BULK_SIZE ?
+                received - offset : HOST_BULK_SIZE;
+
+            pthread_mutex_lock(&MODEL);
+            if( host_out(GADGET_ADDRESS, number,
+                    host_toggle[number][GADGET_TOGGLE_OUT],
+                    transfer.data + offset, packet) == SIE_ACK )
+            {
+                offset += packet;
+                run_app();
+                pthread_mutex_unlock(&MODEL);
+                continue;
+            }
+            pthread_mutex_unlock(&MODEL);
+
+            // NAK (RX ring full) or not configured: next frame
+            usleep(1000);
+        }
+    }
+
+    return 0;
+}
+
+
+/* Device to host: each packet of the model is a transfer */
+static void *in_thread(void *ep)
+{
+    GADGET_EP_t *in = ep;
+    unsigned char number = usb_endpoint_num(&in->descriptor);
+    struct
+    {
+        struct usb_raw_ep_io io;
+        unsigned char data[HOST_BULK_SIZE];
+    } transfer;
+    unsigned char handshake;
+    unsigned char expected;
+    unsigned char size = 0;
+    unsigned char data1;
+
+    for( ;; )
+    {
+        pthread_mutex_lock(&MODEL);
+        handshake = SIE_NONE;
+        if( CONFIGURED )
+        {
+            expected = host_toggle[number][GADGET_TOGGLE_IN];
+            handshake = host_in(GADGET_ADDRESS, number, transfer.data,
+                    &size, &data1);
+
+            // Repeated packet: dropped
+            if( handshake == SIE_ACK && data1 != expected )
+            {
+                handshake = SIE_NAK;
+            }
+            run_app();
+        }
+        pthread_mutex_unlock(&MODEL);
+
+        if( handshake != SIE_ACK )
+        {
+            usleep(1000);
+            continue;
+        }
+
+        transfer.io.ep = in->handle;
+        transfer.io.flags = 0;
+        transfer.io.length = size;
+        check_io(ioctl(FD, USB_RAW_IOCTL_EP_WRITE, &transfer),
+                "USB_RAW_IOCTL_EP_WRITE");
+    }
+
+    return 0;
+}
+
+
+/* Start of frames, every millisecond */
+static void *sof_thread(void *unused)
+{
+    for( ;; )
+    {
+        pthread_mutex_lock(&MODEL);
+        if( !SUSPENDED )
+        {
+            sie_sof();
+        }
+        run_app();
+        pthread_mutex_unlock(&MODEL);
+
+        usleep(1000);
+    }
+
+    return 0;
+}
+
+
+
+int main(int argc, char **argv)
+{
+    struct usb_raw_init init;
+    GADGET_EVENT_t event;
+    pthread_t sof;
+    const char *udc = "dummy_udc.0";
+    int i;
+
+    for( i=1; i<argc; i++ )
+    {
+        if( strcmp(argv[i], "-v") == 0 )
+        {
+            host_verbose = 1;
+        }
+        else if( strcmp(argv[i], "-u") == 0 && i + 1 < argc )
+        {
+            udc = argv[++i];
+        }
+        else if( strcmp(argv[i], "-a") == 0 && i + 1 < argc )
+        {
+            APP = strcmp(argv[++i], "none") == 0 ? GADGET_APP_NONE :
+                GADGET_APP_ECHO;
+        }
+        else
+        {
+            fprintf(stderr, "usage: usbgadget [-v] [-u dummy_udc.N] "
+                    "[-a echo|none]\n");
+            return 1;
+        }
+    }
+
+    pthread_mutex_init(&MODEL, 0);
+
+    // Device attached
+    sim_init();
+    usb_init();
+    sim_service();
+    model_reset();
+
+    FD = open("/dev/raw-gadget", O_RDWR);
+    if( FD < 0 )
+    {
+        fail("/dev/raw-gadget");
+    }
+
+    memset(&init, 0, sizeof(init));
+    strncpy((char*) init.driver_name, "dummy_udc", UDC_NAME_LENGTH_MAX - 1);
+    strncpy((char*) init.device_name, udc, UDC_NAME_LENGTH_MAX - 1);
+    init.speed = USB_SPEED_FULL;
+    if( ioctl(FD, USB_RAW_IOCTL_INIT, &init) < 0 )
+    {
+        fail("USB_RAW_IOCTL_INIT");
+    }
+    if( ioctl(FD, USB_RAW_IOCTL_RUN, 0) < 0 )
+    {
+        fail("USB_RAW_IOCTL_RUN");
+    }
+
+    if( pthread_create(&sof, 0, sof_thread, 0) != 0 )
+    {
+        fail("pthread_create");
+    }
+
+    for( ;; )
+    {
+        event.event.type = 0;
+        event.event.length = sizeof(event.data);
+        if( ioctl(FD, USB_RAW_IOCTL_EVENT_FETCH, &event) < 0 )
+        {
+            fail("USB_RAW_IOCTL_EVENT_FETCH");
+        }
+
+        switch( event.event.type )
+        {
+            case USB_RAW_EVENT_CONNECT:
+                printf("usbgadget: %s connected\n", udc);
+                break;
+
+            case USB_RAW_EVENT_CONTROL:
+                handle_control(&event.setup);
+                break;
+
+            case GADGET_EVENT_RESET:
+            case GADGET_EVENT_DISCONNECT:
+                pthread_mutex_lock(&MODEL);
+                model_reset();
+                pthread_mutex_unlock(&MODEL);
+                break;
+
+            case GADGET_EVENT_SUSPEND:
+                pthread_mutex_lock(&MODEL);
+                SUSPENDED = 1;
+                sie_idle();
+                pthread_mutex_unlock(&MODEL);
+                break;
+
+            case GADGET_EVENT_RESUME:
+                pthread_mutex_lock(&MODEL);
+                SUSPENDED = 0;
+                sie_resume();
+                pthread_mutex_unlock(&MODEL);
+                break;
+
+            default:
+                break;
+        }
+
+        if( sim_errors )
+        {
+            fprintf(stderr, "usbgadget: SIE model error\n");
+            return 1;
+        }
+    }
+
+    return 0;
+}
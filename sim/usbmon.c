@@ -0,0 +1,295 @@
+/*
+ * File: 	usbmon.c
+ * Compiler: gcc
+ *
+ *
+ * [!] Linux usbmon captures reading and writing, see usbmon.h
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include "usbmon.h"
+
+
+
+/*******************************************************************************
+                                  PCAP FORMAT
+*******************************************************************************/
+
+// File header magic: microseconds or nanoseconds timestamps
+#define PCAP_MAGIC 0xA1B2C3D4UL
+#define PCAP_MAGIC_NS 0xA1B23C4DUL
+
+// File and record headers size
+#define PCAP_HEADER_SIZE 24
+#define PCAP_RECORD_SIZE 16
+
+// usbmon header size, by link type
+#define USBMON_HEADER_SIZE 48
+#define USBMON_HEADER_SIZE_MMAPPED 64
+
+// ISO descriptors (mmapped link type, before the data)
+#define USBMON_ISO_DESC_SIZE 16
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+static unsigned long long get(const unsigned char *bytes, unsigned char size,
+        unsigned char swap);
+static void put(unsigned char *bytes, unsigned char size,
+        unsigned long long value);
+
+
+
+/* SIZE bytes integer, little endian unless SWAP */
+static unsigned long long get(const unsigned char *bytes, unsigned char size,
+        unsigned char swap)
+{
+    unsigned long long value = 0;
+    unsigned char i;
+
+    for( i=0; i<size; i++ )
+    {
+        value |= (unsigned long long) bytes[swap ? size - 1 - i : i] << (8 * i);
+    }
+    return value;
+}
+
+
+/* SIZE bytes little endian integer */
+static void put(unsigned char *bytes, unsigned char size,
+        unsigned long long value)
+{
+    unsigned char i;
+
+    for( i=0; i<size; i++ )
+    {
+        bytes[i] = value >> (8 * i);
+    }
+}
+
+
+
+              /***************  Reading  *************/
+
+int usbmon_open(USBMON_FILE_t *capture, const char *name)
+{
+    unsigned char header[PCAP_HEADER_SIZE];
+    unsigned long magic;
+
+    capture->file = fopen(name, "rb");
+    if( !capture->file )
+    {
+        perror(name);
+        return -1;
+    }
+
+    if( fread(header, 1, sizeof(header), capture->file) != sizeof(header) )
+    {
+        fprintf(stderr, "%s: not a pcap file\n", name);
+        usbmon_close(capture);
+        return -1;
+    }
+
+    capture->swap = 0;
+    magic = get(header, 4, 0);
+    if( magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS )
+    {
+        capture->swap = 1;
+        magic = get(header, 4, 1);
+    }
+    if( magic != PCAP_MAGIC && magic != PCAP_MAGIC_NS )
+    {
+        fprintf(stderr, "%s: not a pcap file (pcapng? see usbmon.h)\n",
+                name);
+        usbmon_close(capture);
+        return -1;
+    }
+    capture->nanoseconds = magic == PCAP_MAGIC_NS;
+
+    capture->linktype = get(header + 20, 4, capture->swap);
+    if( capture->linktype != USBMON_LINKTYPE &&
+            capture->linktype != USBMON_LINKTYPE_MMAPPED )
+    {
+        fprintf(stderr, "%s: link type %u, not a usbmon capture\n", name,
+                capture->linktype);
+        usbmon_close(capture);
+        return -1;
+    }
+
+    return 1;
+}
+
+
+int usbmon_read(USBMON_FILE_t *capture, USBMON_RECORD_t *record)
+{
+    unsigned char header[PCAP_RECORD_SIZE];
+    unsigned char urb[USBMON_HEADER_SIZE_MMAPPED];
+    unsigned char swap = capture->swap;
+    unsigned long size;
+    unsigned long urb_size = capture->linktype == USBMON_LINKTYPE_MMAPPED ?
+        USBMON_HEADER_SIZE_MMAPPED : USBMON_HEADER_SIZE;
+    unsigned long skip = 0;
+
+    if( fread(header, 1, sizeof(header), capture->file) != sizeof(header) )
+    {
+        return 0;
+    }
+
+    size = get(header + 8, 4, swap);
+    if( size < urb_size ||
+            fread(urb, 1, urb_size, capture->file) != urb_size )
+    {
+        fprintf(stderr, "usbmon: truncated record\n");
+        return -1;
+    }
+    size -= urb_size;
+
+    record->id = get(urb, 8, swap);
+    record->type = urb[8];
+    record->xfer_type = urb[9];
+    record->epnum = urb[10];
+    record->devnum = urb[11];
+    record->busnum = get(urb + 12, 2, swap);
+    record->flag_setup = urb[14];
+    record->flag_data = urb[15];
+    record->ts_sec = (long long) get(urb + 16, 8, swap);
+    record->ts_usec = (int) get(urb + 24, 4, swap);
+    record->status = (int) get(urb + 28, 4, swap);
+    record->length = get(urb + 32, 4, swap);
+    record->len_cap = get(urb + 36, 4, swap);
+    memcpy(record->setup, urb + 40, 8);
+
+    // ISO descriptors come before the data
+    if( capture->linktype == USBMON_LINKTYPE_MMAPPED &&
+            record->xfer_type == USBMON_ISO )
+    {
+        skip = USBMON_ISO_DESC_SIZE * get(urb + 60, 4, swap);
+    }
+    if( skip > size )
+    {
+        skip = size;
+    }
+    fseek(capture->file, skip, SEEK_CUR);
+    size -= skip;
+
+    // Snapped records: the data that is there
+    if( record->len_cap > size )
+    {
+        record->len_cap = size;
+    }
+    if( record->len_cap > USBMON_DATA_MAX )
+    {
+        record->len_cap = USBMON_DATA_MAX;
+    }
+    if( fread(record->data, 1, record->len_cap, capture->file) !=
+            record->len_cap )
+    {
+        fprintf(stderr, "usbmon: truncated record\n");
+        return -1;
+    }
+    fseek(capture->file, size - record->len_cap, SEEK_CUR);
+
+    return 1;
+}
+
+
+
+              /***************  Writing  *************/
+
+int usbmon_create(USBMON_FILE_t *capture, const char *name)
+{
+    unsigned char header[PCAP_HEADER_SIZE];
+
+    capture->file = fopen(name, "wb");
+    if( !capture->file )
+    {
+        perror(name);
+        return -1;
+    }
+    capture->linktype = USBMON_LINKTYPE_MMAPPED;
+    capture->swap = 0;
+    capture->nanoseconds = 0;
+
+    put(header, 4, PCAP_MAGIC);
+    put(header + 4, 2, 2); // Version 2.4
+    put(header + 6, 2, 4);
+    put(header + 8, 4, 0); // UTC
+    put(header + 12, 4, 0);
+    put(header + 16, 4, USBMON_HEADER_SIZE_MMAPPED + USBMON_DATA_MAX);
+    put(header + 20, 4, USBMON_LINKTYPE_MMAPPED);
+
+    if( fwrite(header, 1, sizeof(header), capture->file) != sizeof(header) )
+    {
+        perror(name);
+        return -1;
+    }
+    return 1;
+}
+
+
+int usbmon_write(USBMON_FILE_t *capture, const USBMON_RECORD_t *record)
+{
+    unsigned char header[PCAP_RECORD_SIZE];
+    unsigned char urb[USBMON_HEADER_SIZE_MMAPPED];
+    unsigned long size = USBMON_HEADER_SIZE_MMAPPED + record->len_cap;
+
+    put(header, 4, record->ts_sec);
+    put(header + 4, 4, record->ts_usec);
+    put(header + 8, 4, size);
+    put(header + 12, 4, size);
+
+    memset(urb, 0, sizeof(urb));
+    put(urb, 8, record->id);
+    urb[8] = record->type;
+    urb[9] = record->xfer_type;
+    urb[10] = record->epnum;
+    urb[11] = record->devnum;
+    put(urb + 12, 2, record->busnum);
+    urb[14] = record->flag_setup;
+    urb[15] = record->flag_data;
+    put(urb + 16, 8, record->ts_sec);
+    put(urb + 24, 4, record->ts_usec);
+    put(urb + 28, 4, (unsigned) record->status);
+    put(urb + 32, 4, record->length);
+    put(urb + 36, 4, record->len_cap);
+    memcpy(urb + 40, record->setup, 8);
+
+    if( fwrite(header, 1, sizeof(header), capture->file) != sizeof(header) ||
+            fwrite(urb, 1, sizeof(urb), capture->file) != sizeof(urb) ||
+            fwrite(record->data, 1, record->len_cap, capture->file) !=
+            record->len_cap )
+    {
+        perror("usbmon");
+        return -1;
+    }
+    return 1;
+}
+
+
+void usbmon_close(USBMON_FILE_t *capture)
+{
+    if( capture->file )
+    {
+        fclose(capture->file);
+        capture->file = 0;
+    }
+}
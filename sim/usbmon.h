@@ -0,0 +1,128 @@
+/*
+ * File: 	usbmon.h
+ * Compiler: gcc
+ *
+ *
+ * [!] Linux usbmon captures (pcap files from Wireshark, tcpdump or
+ * usbmon), one record per URB submission ('S') and completion ('C')
+ *
+ * Link types LINKTYPE_USB_LINUX (189) and LINKTYPE_USB_LINUX_MMAPPED (220)
+ * are read, the latter is written. pcapng files must be converted first:
+ *
+ *     editcap -F pcap capture.pcapng capture.pcap
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _USBMON_H
+#define _USBMON_H
+
+#include <stdio.h>
+
+
+
+/*******************************************************************************
+                                    RECORDS
+
+               See Linux kernel: Documentation/usb/usbmon.rst
+*******************************************************************************/
+
+// Link types
+#define USBMON_LINKTYPE 189
+#define USBMON_LINKTYPE_MMAPPED 220
+
+// Record type
+#define USBMON_SUBMIT 'S'
+#define USBMON_COMPLETE 'C'
+#define USBMON_ERROR 'E'
+
+// Transfer type
+#define USBMON_ISO 0
+#define USBMON_INTERRUPT 1
+#define USBMON_CONTROL 2
+#define USBMON_BULK 3
+
+// Endpoint direction bit
+#define USBMON_EP_IN 0x80
+
+// flag_setup / flag_data: 0 when the setup packet / data is there
+#define USBMON_PRESENT 0
+
+// Status (negative errno)
+#define USBMON_OK 0
+#define USBMON_ENOENT (-2)      // Killed (usb_kill_urb())
+#define USBMON_EINPROGRESS (-115) // Submission
+#define USBMON_ECONNRESET (-104) // Unlinked (usb_unlink_urb())
+#define USBMON_EPIPE (-32)      // STALL
+#define USBMON_EPROTO (-71)     // No handshake, bad toggle...
+#define USBMON_ETIMEDOUT (-110) // NAKed for too long
+
+// Data captured per record, at most
+#define USBMON_DATA_MAX 65536
+
+typedef struct
+{
+    unsigned long long id; // URB, the same for its submission and completion
+    unsigned char type;
+    unsigned char xfer_type;
+    unsigned char epnum;
+    unsigned char devnum;
+    unsigned short busnum;
+    unsigned char flag_setup;
+    unsigned char flag_data;
+    long long ts_sec;
+    long ts_usec;
+    int status;
+    unsigned length; // Requested (submission) or actual (completion) bytes
+    unsigned len_cap; // Bytes in 'data'
+    unsigned char setup[8];
+    unsigned char data[USBMON_DATA_MAX];
+} USBMON_RECORD_t;
+
+typedef struct
+{
+    FILE *file;
+    unsigned linktype;
+    unsigned char swap; // Other endianness
+    unsigned char nanoseconds;
+} USBMON_FILE_t;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                     FILES
+
+    Functions return 1 on success, 0 at the end of a file and -1 on errors
+    (reported to stderr)
+*******************************************************************************/
+
+int usbmon_open(USBMON_FILE_t *capture, const char *name);
+int usbmon_read(USBMON_FILE_t *capture, USBMON_RECORD_t *record);
+
+int usbmon_create(USBMON_FILE_t *capture, const char *name);
+int usbmon_write(USBMON_FILE_t *capture, const USBMON_RECORD_t *record);
+
+void usbmon_close(USBMON_FILE_t *capture);
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+#endif // _USBMON_H
@@ -0,0 +1,617 @@
+/*
+ * File: 	usbreplay.c
+ * Compiler: gcc
+ *
+ *
+ * [!] Replays a Linux usbmon capture (usbmon.h) of the host talking to the
+ * device against the stack on the SIE model:
+ *
+ *     usbreplay [-v] [-d BUS:DEV] [-a echo|none] [-p N] [-w out.pcap]
+ *               capture.pcap
+ *
+ * Host submissions are replayed as they come: control transfers and OUT
+ * transfers run right away, IN transfers when the capture completes them.
+ * Every completion is compared with the captured one (status, IN data) and
+ * the differences reported, exiting with 1 if there's any. -w writes the
+ * replayed traffic as a capture too (same URB ids) to diff in Wireshark
+ *
+ * Only the device -d (bus and device number) is replayed, by default the
+ * first one other than root hubs (device 1). Captures without SET_ADDRESS
+ * (xHCI addresses devices by itself) get one at the start. -a picks the
+ * application side: echo (default, received bytes are sent back) or none.
+ * -p selects the personality the capture was taken with (see
+ * usb_set_personality()), by default the one the stack starts with.
+ * Time gaps between records run as SOFs, up to REPLAY_GAP_FRAMES
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <pic18fregs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "usb.h"
+#include "usb_pic.h"
+#include "usb_config.h"
+#include "usb_hot.h"
+#include "usbcdc.h"
+#include "sie.h"
+#include "host.h"
+#include "usbmon.h"
+
+
+
+/*******************************************************************************
+                                  DEFINITIONS
+*******************************************************************************/
+
+// Frames run for a time gap between records, at most
+#define REPLAY_GAP_FRAMES 1000
+
+// URBs submitted and not completed yet, at most
+#define REPLAY_PENDING_MAX 64
+
+// Application side
+#define REPLAY_APP_NONE 0
+#define REPLAY_APP_ECHO 1
+
+// A submitted URB and, for control and OUT transfers, the replayed result
+typedef struct
+{
+    unsigned long long id;
+    unsigned char used;
+    unsigned char setup[8];
+    unsigned length;
+    int status;
+    unsigned actual;
+    unsigned char *data; // IN data stage
+} REPLAY_URB_t;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                     STATE
+*******************************************************************************/
+
+static USBMON_RECORD_t RECORD;
+static USBMON_RECORD_t REPLY;
+
+static REPLAY_URB_t PENDING[REPLAY_PENDING_MAX];
+
+// Device replayed, in the capture, and its address in the simulation
+static int BUS = -1;
+static int DEVICE = -1;
+static unsigned char ADDRESS;
+
+static unsigned char APP = REPLAY_APP_ECHO;
+
+// Capture record number (from 1) and time of the previous one
+static unsigned long NUMBER;
+static long long LAST_US = -1;
+
+static unsigned long URBS;
+static unsigned long MISMATCHES;
+static unsigned long SKIPPED;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+static unsigned char is_replayed(const USBMON_RECORD_t *record);
+static void scan(const char *name);
+static void run_gap(const USBMON_RECORD_t *record);
+static void run_app(void);
+static int status_of(unsigned char handshake);
+static REPLAY_URB_t *urb_new(unsigned long long id);
+static REPLAY_URB_t *urb_find(unsigned long long id);
+static void urb_free(REPLAY_URB_t *urb);
+static void mismatch(const USBMON_RECORD_t *record, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+static void reply(const USBMON_RECORD_t *record, int status, unsigned length,
+        const unsigned char *data, unsigned len_cap);
+static void compare(const USBMON_RECORD_t *record, int status,
+        const unsigned char *data, unsigned size);
+static void replay_submit(const USBMON_RECORD_t *record);
+static void replay_complete(const USBMON_RECORD_t *record);
+
+
+
+              /***************  Capture  *************/
+
+/* Records of the replayed device, its default address (0) included */
+static unsigned char is_replayed(const USBMON_RECORD_t *record)
+{
+    return record->busnum == BUS &&
+        (record->devnum == DEVICE || record->devnum == 0);
+}
+
+
+/*
+ * Picks the device (unless given) and addresses it now if the capture has no
+ * SET_ADDRESS for it
+ */
+static void scan(const char *name)
+{
+    USBMON_FILE_t capture;
+    unsigned char set_address = 0;
+    unsigned char setup[8] = { 0x00, USB_REQ_SET_ADDRESS };
+    unsigned char in[HOST_BULK_SIZE];
+    unsigned short in_size;
+    unsigned char pass;
+
+    for( pass=0; pass<2; pass++ )
+    {
+        if( usbmon_open(&capture, name) < 0 )
+        {
+            exit(1);
+        }
+
+        while( usbmon_read(&capture, &RECORD) > 0 )
+        {
+            if( DEVICE < 0 && RECORD.devnum != 1 && RECORD.devnum != 0 )
+            {
+                BUS = RECORD.busnum;
+                DEVICE = RECORD.devnum;
+            }
+
+            if( pass == 1 && RECORD.type == USBMON_SUBMIT &&
+                    RECORD.xfer_type == USBMON_CONTROL &&
+                    RECORD.flag_setup == USBMON_PRESENT &&
+                    is_replayed(&RECORD) &&
+                    RECORD.setup[0] == 0x00 &&
+                    RECORD.setup[1] == USB_REQ_SET_ADDRESS &&
+                    RECORD.setup[2] == DEVICE )
+            {
+                set_address = 1;
+            }
+        }
+        usbmon_close(&capture);
+
+        if( DEVICE < 0 )
+        {
+            fprintf(stderr, "%s: no device traffic\n", name);
+            exit(1);
+        }
+    }
+
+    if( !set_address )
+    {
+        setup[2] = DEVICE;
+        if( host_control(0, setup, 0, in, &in_size) != SIE_ACK )
+        {
+            fprintf(stderr, "usbreplay: SET_ADDRESS failed\n");
+            exit(1);
+        }
+        ADDRESS = DEVICE;
+    }
+}
+
+
+/* The time between records goes by, SOFs keep the bus awake */
+static void run_gap(const USBMON_RECORD_t *record)
+{
+    long long now = record->ts_sec * 1000000LL + record->ts_usec;
+    long long frames = LAST_US < 0 ? 0 : (now - LAST_US) / 1000;
+
+    if( frames > REPLAY_GAP_FRAMES )
+    {
+        frames = REPLAY_GAP_FRAMES;
+    }
+
+    for( ; frames > 0; frames-- )
+    {
+        sie_sof();
+    }
+    LAST_US = now;
+}
+
+
+/* Application main loop pass */
+static void run_app(void)
+{
+    if( APP != REPLAY_APP_ECHO )
+    {
+        return;
+    }
+
+    while( USB_HOT.rx_head != USB_HOT.rx_tail &&
+            (unsigned char) (USB_HOT.tx_head - USB_HOT.tx_tail) <
+            USB_TX_RING_SIZE )
+    {
+        usb_cdc_putc(usb_cdc_getc());
+    }
+    sim_service();
+}
+
+
+/* URB status for the host controller result */
+static int status_of(unsigned char handshake)
+{
+    switch( handshake )
+    {
+        case SIE_ACK: return USBMON_OK;
+        case SIE_STALL: return USBMON_EPIPE;
+        case SIE_NAK: return USBMON_ETIMEDOUT;
+        default: return USBMON_EPROTO;
+    }
+}
+
+
+
+              /***************  URBs  *************/
+
+static REPLAY_URB_t *urb_new(unsigned long long id)
+{
+    unsigned char i;
+
+    for( i=0; i<REPLAY_PENDING_MAX; i++ )
+    {
+        if( !PENDING[i].used )
+        {
+            memset(&PENDING[i], 0, sizeof(PENDING[i]));
+            PENDING[i].used = 1;
+            PENDING[i].id = id;
+            return &PENDING[i];
+        }
+    }
+
+    fprintf(stderr, "usbreplay: more than %d URBs pending\n",
+            REPLAY_PENDING_MAX);
+    exit(1);
+}
+
+
+static REPLAY_URB_t *urb_find(unsigned long long id)
+{
+    unsigned char i;
+
+    for( i=0; i<REPLAY_PENDING_MAX; i++ )
+    {
+        if( PENDING[i].used && PENDING[i].id == id )
+        {
+            return &PENDING[i];
+        }
+    }
+    return 0;
+}
+
+
+static void urb_free(REPLAY_URB_t *urb)
+{
+    free(urb->data);
+    urb->data = 0;
+    urb->used = 0;
+}
+
+
+
+              /***************  Replay  *************/
+
+static void mismatch(const USBMON_RECORD_t *record, const char *format, ...)
+{
+    va_list args;
+
+    fprintf(stderr, "record %lu: ep 0x%02X %s: ", NUMBER, record->epnum,
+            record->xfer_type == USBMON_CONTROL ? "control" :
+            record->xfer_type == USBMON_BULK ? "bulk" : "interrupt");
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    MISMATCHES++;
+}
+
+
+/* Replayed completion of 'record', to the output capture */
+static void reply(const USBMON_RECORD_t *record, int status, unsigned length,
+        const unsigned char *data, unsigned len_cap)
+{
+    REPLY.id = record->id;
+    REPLY.type = USBMON_COMPLETE;
+    REPLY.xfer_type = record->xfer_type;
+    REPLY.epnum = record->epnum;
+    REPLY.devnum = record->devnum;
+    REPLY.busnum = record->busnum;
+    REPLY.flag_setup = '-';
+    REPLY.flag_data = len_cap ? USBMON_PRESENT : '>';
+    REPLY.status = status;
+    REPLY.length = length;
+    REPLY.len_cap = len_cap;
+    memset(REPLY.setup, 0, sizeof(REPLY.setup));
+    memcpy(REPLY.data, data, len_cap);
+    host_capture(&REPLY);
+}
+
+
+/* Captured completion against the replayed one */
+static void compare(const USBMON_RECORD_t *record, int status,
+        const unsigned char *data, unsigned size)
+{
+    unsigned i;
+
+    if( record->status != status )
+    {
+        mismatch(record, "status %d, captured %d", status, record->status);
+        return;
+    }
+
+    if( !(record->epnum & USBMON_EP_IN) )
+    {
+        return;
+    }
+
+    if( size != record->length )
+    {
+        mismatch(record, "%u bytes, captured %u", size, record->length);
+        return;
+    }
+    for( i=0; i<record->len_cap; i++ )
+    {
+        if( data[i] != record->data[i] )
+        {
+            mismatch(record, "byte %u: 0x%02X, captured 0x%02X", i, data[i],
+                    record->data[i]);
+            return;
+        }
+    }
+}
+
+
+static void replay_submit(const USBMON_RECORD_t *record)
+{
+    REPLAY_URB_t *urb;
+    unsigned char ep = record->epnum & 0x0F;
+    unsigned short size;
+    unsigned char handshake;
+
+    if( record->xfer_type == USBMON_ISO )
+    {
+        SKIPPED++;
+        return;
+    }
+
+    URBS++;
+    urb = urb_new(record->id);
+    urb->length = record->length;
+    REPLY = *record;
+    host_capture(&REPLY);
+
+    if( record->xfer_type == USBMON_CONTROL )
+    {
+        if( record->flag_setup != USBMON_PRESENT )
+        {
+            SKIPPED++;
+            urb_free(urb);
+            return;
+        }
+        memcpy(urb->setup, record->setup, 8);
+
+        // The hub resets the port before addressing the device
+        if( record->setup[0] == 0x00 &&
+                record->setup[1] == USB_REQ_SET_ADDRESS )
+        {
+            host_reset();
+            ADDRESS = 0;
+        }
+
+        urb->data = malloc(record->length + HOST_BULK_SIZE);
+        handshake = host_control(ADDRESS, record->setup, record->data,
+                urb->data, &size);
+        urb->status = status_of(handshake);
+        urb->actual = record->setup[0] & USB_REQ_DIR_IN ? size :
+            record->length;
+
+        if( handshake == SIE_ACK && record->setup[0] == 0x00 &&
+                record->setup[1] == USB_REQ_SET_ADDRESS )
+        {
+            ADDRESS = record->setup[2];
+        }
+
+        reply(record, urb->status, urb->status ? 0 : urb->actual, urb->data,
+                record->setup[0] & USB_REQ_DIR_IN ? size : 0);
+    }
+    // OUT transfers, IN ones wait for the captured completion
+    else if( !(record->epnum & USBMON_EP_IN) )
+    {
+        handshake = host_bulk_out(ADDRESS, ep, record->data,
+                record->len_cap, &size);
+        urb->status = status_of(handshake);
+        urb->actual = size;
+        reply(record, urb->status, size, 0, 0);
+    }
+}
+
+
+static void replay_complete(const USBMON_RECORD_t *record)
+{
+    static unsigned char data[USBMON_DATA_MAX];
+    REPLAY_URB_t *urb = urb_find(record->id);
+    unsigned char ep = record->epnum & 0x0F;
+    unsigned length;
+    unsigned short size;
+    int status;
+
+    if( record->xfer_type == USBMON_ISO )
+    {
+        return;
+    }
+
+    // Control and OUT: already replayed
+    if( urb && (record->xfer_type == USBMON_CONTROL ||
+                !(record->epnum & USBMON_EP_IN)) )
+    {
+        compare(record, urb->status, urb->data, urb->actual);
+        urb_free(urb);
+        return;
+    }
+    if( !(record->epnum & USBMON_EP_IN) )
+    {
+        return; // Submitted before the capture started
+    }
+
+    // IN: the host gets the data now, unless the URB was cancelled
+    if( record->status == USBMON_ENOENT ||
+            record->status == USBMON_ECONNRESET )
+    {
+        reply(record, record->status, 0, 0, 0);
+    }
+    else
+    {
+        length = urb ? urb->length : USBMON_DATA_MAX - 1;
+        if( length > 0xFFFF )
+        {
+            length = 0xFFFF;
+        }
+
+        status = status_of(host_bulk_in(ADDRESS, ep, data, length, &size));
+        if( status == USBMON_ETIMEDOUT && size )
+        {
+            status = USBMON_OK; // Short of a packet, the data is there
+        }
+        reply(record, status, size, data, size);
+        compare(record, status, data, size);
+    }
+
+    if( urb )
+    {
+        urb_free(urb);
+    }
+}
+
+
+
+int main(int argc, char **argv)
+{
+    USBMON_FILE_t capture;
+    USBMON_FILE_t output;
+    const char *name = 0;
+    const char *output_name = 0;
+    unsigned bus;
+    unsigned device;
+    int personality = -1;
+    int i;
+
+    for( i=1; i<argc; i++ )
+    {
+        if( strcmp(argv[i], "-v") == 0 )
+        {
+            host_verbose = 1;
+        }
+        else if( strcmp(argv[i], "-d") == 0 && i + 1 < argc &&
+                sscanf(argv[i + 1], "%u:%u", &bus, &device) == 2 )
+        {
+            BUS = bus;
+            DEVICE = device;
+            i++;
+        }
+        else if( strcmp(argv[i], "-a") == 0 && i + 1 < argc )
+        {
+            APP = strcmp(argv[++i], "none") == 0 ? REPLAY_APP_NONE :
+                REPLAY_APP_ECHO;
+        }
+        else if( strcmp(argv[i], "-p") == 0 && i + 1 < argc )
+        {
+            personality = atoi(argv[++i]);
+        }
+        else if( strcmp(argv[i], "-w") == 0 && i + 1 < argc )
+        {
+            output_name = argv[++i];
+        }
+        else
+        {
+            name = argv[i];
+        }
+    }
+
+    if( !name )
+    {
+        fprintf(stderr, "usage: usbreplay [-v] [-d BUS:DEV] [-a echo|none] "
+                "[-p N] [-w out.pcap] capture.pcap\n");
+        return 1;
+    }
+
+    // Device attached
+    sim_init();
+    usb_init();
+    if( personality >= 0 && !usb_set_personality(personality) )
+    {
+        fprintf(stderr, "usbreplay: no personality %d\n", personality);
+        return 1;
+    }
+    sim_service();
+    host_reset();
+    sie_sof();
+
+    scan(name);
+
+    if( output_name )
+    {
+        if( usbmon_create(&output, output_name) < 0 )
+        {
+            return 1;
+        }
+        host_capture_file = &output;
+    }
+
+    if( usbmon_open(&capture, name) < 0 )
+    {
+        return 1;
+    }
+
+    while( usbmon_read(&capture, &RECORD) > 0 )
+    {
+        NUMBER++;
+        if( !is_replayed(&RECORD) )
+        {
+            continue;
+        }
+
+        run_gap(&RECORD);
+        if( RECORD.type == USBMON_SUBMIT )
+        {
+            replay_submit(&RECORD);
+        }
+        else
+        {
+            replay_complete(&RECORD);
+        }
+        run_app();
+
+        if( sim_errors )
+        {
+            fprintf(stderr, "record %lu: SIE model error\n", NUMBER);
+            return 1;
+        }
+    }
+
+    usbmon_close(&capture);
+    if( host_capture_file )
+    {
+        usbmon_close(host_capture_file);
+    }
+
+    printf("%s: %lu URBs, %lu mismatches, %lu skipped, %lu NAKs, "
+            "%lu cycles, %lu interrupts\n", name, URBS, MISMATCHES, SKIPPED,
+            host_naks, sim_cycles, sim_handler_calls);
+
+    return MISMATCHES ? 1 : 0;
+}
@@ -0,0 +1,876 @@
+/*
+ * File: 	usbsim.c
+ * Compiler: gcc
+ *
+ *
+ * [!] Runs the USB stack against the SIE model (sie.c) following scripts of
+ * host transactions and the expected device answers:
+ *
+ *     usbsim [-v] [-w out.pcap] [-u uart.bin] script.sim...
+ *
+ * One command per line, '#' starts a comment. Bytes are hex values (12 or
+ * 0x12) or "quoted strings" (\r \n \t \\ \" \xHH escapes). After ':' comes
+ * the expected answer, a transaction without one must be ACKed
+ *
+ *     reset                           Bus reset
+ *     sof [N]                         N (1) start of frames
+ *     idle                            3ms bus idle (suspend)
+ *     resume                          Host resume signaling
+ *     error UEIR                      Bus errors detected (UEIR flags)
+ *     setup ADDR EP BYTES [: HS]      SETUP transaction (8 bytes)
+ *     out ADDR EP [DATA0|DATA1] BYTES [: HS]
+ *     in ADDR EP [: HS [DATA0|DATA1] [BYTES]]
+ *     control ADDR SETUP [BYTES] [: STALL | : BYTES]
+ *                                     Whole control transfer: SETUP, data
+ *                                     stage (NAKs retried) and status stage
+ *     write BYTES                     Application: usb_cdc_putc()
+ *     read BYTES                      Application: usb_cdc_getc()
+ *     sleep                           Application: usb_sleep()
+ *     wakeup [: 0|1]                  Application: usb_remote_wakeup()
+ *     irq on|off                      USB interrupt unmasked / masked
+ *     personality N                   Application: usb_set_personality(),
+ *                                     scripts start with the one they test
+ *     expect NAME VALUE               Checks configured, suspended, address,
+ *                                     tx_queued, rx_queued, resume_signals,
+ *                                     sleeps, line_state, baud_rate
+ *     echo TEXT                       Prints TEXT
+ *     if OPTION...                    Runs the lines up to the matching 'end'
+ *     end                             only if the stack was built with every
+ *                                     OPTION set (USB_IE_STALL, USB_IE_UERR,
+ *                                     USB_IE_IDLE, USB_ERROR_STATS,
+ *                                     USB_REMOTE_WAKEUP)
+ *
+ * Data toggles are tracked per endpoint on the host side (reset on bus reset
+ * and SET_CONFIGURATION): 'out' without PID sends the next one, 'in' without
+ * PID expects it. -v traces every transaction, -w writes the transfers
+ * ('control', and 'out' / 'in' on data endpoints when ACKed) as a usbmon
+ * capture (see usbmon.h, usbreplay.c). -u writes the UART output, the trace
+ * ring (USB_TRACE) drained after every command as a main loop would
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <pic18fregs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include "usb.h"
+#include "usb_pic.h"
+#include "usb_config.h"
+#include "usb_descriptors.h"
+#include "usb_hot.h"
+#include "usb_ram.h"
+#include "usbcdc.h"
+#include "sie.h"
+#include "host.h"
+#include "usbmon.h"
+
+
+
+/*******************************************************************************
+                                  DEFINITIONS
+*******************************************************************************/
+
+// Line and bytes lists limits
+#define SIM_LINE_MAX 1024
+#define SIM_TOKENS_MAX 128
+#define SIM_BYTES_MAX 1024
+
+// A list of bytes from the script
+typedef struct
+{
+    unsigned char data[SIM_BYTES_MAX];
+    unsigned short size;
+} SIM_BYTES_t;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                     STATE
+*******************************************************************************/
+
+// Transfers capture (-w), last URB id
+static USBMON_FILE_t CAPTURE;
+static unsigned long long URB_ID;
+
+// Script position, for errors
+static const char *FILE_NAME;
+static unsigned LINE;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+static void fail(const char *format, ...) __attribute__((noreturn,
+            format(printf, 1, 2)));
+static unsigned char parse_handshake(const char *token);
+static unsigned long parse_option(const char *token);
+static unsigned long parse_number(const char *token);
+static void parse_bytes(char **tokens, unsigned count, SIM_BYTES_t *bytes);
+static unsigned split(char *line, char **tokens);
+static unsigned find_colon(char **tokens, unsigned count);
+static void check_handshake(const char *token, unsigned char handshake,
+        unsigned char expected);
+static void check_bytes(const char *what, const unsigned char *data,
+        unsigned short size, const SIM_BYTES_t *expected);
+static int status_of(unsigned char handshake);
+static void capture_urb(unsigned char xfer_type, unsigned char epnum,
+        unsigned char address, const unsigned char *setup,
+        const unsigned char *data, unsigned length, int status,
+        unsigned actual);
+static void run_command(char **tokens, unsigned count);
+static void run_script(const char *name);
+
+
+
+              /***************  Reports  *************/
+
+static void fail(const char *format, ...)
+{
+    va_list args;
+
+    fprintf(stderr, "%s:%u: ", FILE_NAME, LINE);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+
+              /***************  Parsing  *************/
+
+static unsigned char parse_handshake(const char *token)
+{
+    if( strcmp(token, "ACK") == 0 ) { return SIE_ACK; }
+    if( strcmp(token, "NAK") == 0 ) { return SIE_NAK; }
+    if( strcmp(token, "STALL") == 0 ) { return SIE_STALL; }
+    if( strcmp(token, "NONE") == 0 ) { return SIE_NONE; }
+    fail("bad handshake '%s'", token);
+}
+
+
+/* Stack build option value, for 'if' */
+static unsigned long parse_option(const char *token)
+{
+    if( strcmp(token, "USB_IE_STALL") == 0 ) { return USB_IE_STALL; }
+    if( strcmp(token, "USB_IE_UERR") == 0 ) { return USB_IE_UERR; }
+    if( strcmp(token, "USB_IE_IDLE") == 0 ) { return USB_IE_IDLE; }
+    if( strcmp(token, "USB_ERROR_STATS") == 0 ) { return USB_ERROR_STATS; }
+    if( strcmp(token, "USB_REMOTE_WAKEUP") == 0 )
+    {
+        return USB_REMOTE_WAKEUP;
+    }
+    fail("unknown option '%s'", token);
+}
+
+
+static unsigned long parse_number(const char *token)
+{
+    char *end;
+    unsigned long value = strtoul(token, &end, 0);
+
+    if( *token == '\0' || *end != '\0' )
+    {
+        fail("bad number '%s'", token);
+    }
+    return value;
+}
+
+
+/* Hex bytes and quoted strings (quotes kept by split()) */
+static void parse_bytes(char **tokens, unsigned count, SIM_BYTES_t *bytes)
+{
+    unsigned i;
+    const char *p;
+    char *end;
+    unsigned long value;
+
+    bytes->size = 0;
+    for( i=0; i<count; i++ )
+    {
+        if( tokens[i][0] == '"' )
+        {
+            for( p = tokens[i] + 1; *p && *p != '"'; p++ )
+            {
+                value = (unsigned char) *p;
+                if( *p == '\\' )
+                {
+                    switch( *++p )
+                    {
+                        case 'r': value = '\r'; break;
+                        case 'n': value = '\n'; break;
+                        case 't': value = '\t'; break;
+                        case 'x':
+                            value = strtoul(p + 1, &end, 16);
+                            p = end - 1;
+                            break;
+                        default: value = (unsigned char) *p; break;
+                    }
+                }
+
+                if( bytes->size == SIM_BYTES_MAX )
+                {
+                    fail("too many bytes");
+                }
+                bytes->data[bytes->size++] = value;
+            }
+            continue;
+        }
+
+        value = strtoul(tokens[i], &end, 16);
+        if( *end != '\0' || value > 0xFF )
+        {
+            fail("bad byte '%s'", tokens[i]);
+        }
+        if( bytes->size == SIM_BYTES_MAX )
+        {
+            fail("too many bytes");
+        }
+        bytes->data[bytes->size++] = value;
+    }
+}
+
+
+/* Splits LINE in place: words, quoted strings and ':' */
+static unsigned split(char *line, char **tokens)
+{
+    unsigned count = 0;
+    char *p = line;
+
+    while( *p )
+    {
+        while( isspace((unsigned char) *p) ) { p++; }
+        if( *p == '\0' || *p == '#' )
+        {
+            break;
+        }
+
+        if( count == SIM_TOKENS_MAX )
+        {
+            fail("too many tokens");
+        }
+        tokens[count++] = p;
+
+        if( *p == '"' )
+        {
+            for( p++; *p && *p != '"'; p++ )
+            {
+                if( *p == '\\' && p[1] ) { p++; }
+            }
+            if( *p != '"' )
+            {
+                fail("unterminated string");
+            }
+            p++;
+        }
+        else if( *p == ':' )
+        {
+            p++;
+        }
+        else
+        {
+            while( *p && !isspace((unsigned char) *p) && *p != ':' ) { p++; }
+        }
+
+        // Terminate the token, keeping a ':' right after it
+        if( *p == ':' )
+        {
+            memmove(p + 1, p, strlen(p) + 1);
+            *p++ = '\0';
+        }
+        else if( *p )
+        {
+            *p++ = '\0';
+        }
+    }
+
+    return count;
+}
+
+
+/* Index of the ':' token, COUNT if there's none */
+static unsigned find_colon(char **tokens, unsigned count)
+{
+    unsigned i;
+
+    for( i=0; i<count; i++ )
+    {
+        if( strcmp(tokens[i], ":") == 0 )
+        {
+            return i;
+        }
+    }
+    return count;
+}
+
+
+
+              /***************  Checks  *************/
+
+static void check_handshake(const char *token, unsigned char handshake,
+        unsigned char expected)
+{
+    if( handshake != expected )
+    {
+        fail("%s: %s, expected %s", token, sie_handshake_name(handshake),
+                sie_handshake_name(expected));
+    }
+}
+
+
+static void check_bytes(const char *what, const unsigned char *data,
+        unsigned short size, const SIM_BYTES_t *expected)
+{
+    unsigned short i;
+
+    if( size == expected->size && memcmp(data, expected->data, size) == 0 )
+    {
+        return;
+    }
+
+    fprintf(stderr, "%s:%u: %s:", FILE_NAME, LINE, what);
+    for( i=0; i<size; i++ )
+    {
+        fprintf(stderr, " %02X", data[i]);
+    }
+    fprintf(stderr, "\n%s:%u: expected:", FILE_NAME, LINE);
+    for( i=0; i<expected->size; i++ )
+    {
+        fprintf(stderr, " %02X", expected->data[i]);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+
+
+              /***************  Capture  *************/
+
+/* URB status for a transfer result */
+static int status_of(unsigned char handshake)
+{
+    switch( handshake )
+    {
+        case SIE_ACK: return USBMON_OK;
+        case SIE_STALL: return USBMON_EPIPE;
+        default: return USBMON_EPROTO;
+    }
+}
+
+
+/*
+ * Submission and completion records of a transfer, 'data' is the OUT data
+ * ('length' bytes) or the IN data ('actual' bytes)
+ */
+static void capture_urb(unsigned char xfer_type, unsigned char epnum,
+        unsigned char address, const unsigned char *setup,
+        const unsigned char *data, unsigned length, int status,
+        unsigned actual)
+{
+    static USBMON_RECORD_t record;
+    unsigned char in = (epnum & USBMON_EP_IN) != 0;
+
+    if( !host_capture_file )
+    {
+        return;
+    }
+
+    memset(&record, 0, sizeof(record));
+    record.id = ++URB_ID;
+    record.type = USBMON_SUBMIT;
+    record.xfer_type = xfer_type;
+    record.epnum = epnum;
+    record.devnum = address;
+    record.busnum = 1;
+    record.flag_setup = setup ? USBMON_PRESENT : '-';
+    record.flag_data = in ? '<' : USBMON_PRESENT;
+    record.status = USBMON_EINPROGRESS;
+    record.length = length;
+    if( setup )
+    {
+        memcpy(record.setup, setup, 8);
+    }
+    if( !in )
+    {
+        record.len_cap = length;
+        memcpy(record.data, data, length);
+    }
+    host_capture(&record);
+
+    record.type = USBMON_COMPLETE;
+    record.flag_setup = '-';
+    record.flag_data = in ? USBMON_PRESENT : '>';
+    record.status = status;
+    record.length = actual;
+    record.len_cap = in ? actual : 0;
+    memset(record.setup, 0, 8);
+    if( in )
+    {
+        memcpy(record.data, data, actual);
+    }
+    host_capture(&record);
+}
+
+
+
+              /***************  Commands  *************/
+
+static void run_command(char **tokens, unsigned count)
+{
+    static SIM_BYTES_t bytes;
+    static SIM_BYTES_t expected;
+    unsigned char data[64];
+    unsigned colon = find_colon(tokens, count);
+    unsigned char expected_hs = SIE_ACK;
+    unsigned char handshake;
+    unsigned char address = 0;
+    unsigned char ep = 0;
+    unsigned char data1;
+    unsigned char size;
+    unsigned long value = 0;
+    unsigned first = 1;
+    unsigned short i;
+    const char *command = tokens[0];
+
+    // ADDR EP for transactions
+    if( strcmp(command, "setup") == 0 || strcmp(command, "out") == 0 ||
+            strcmp(command, "in") == 0 )
+    {
+        if( colon < 3 )
+        {
+            fail("%s: address and endpoint expected", command);
+        }
+        address = parse_number(tokens[1]);
+        ep = parse_number(tokens[2]);
+        if( ep > 15 )
+        {
+            fail("bad endpoint %d", ep);
+        }
+        first = 3;
+        if( colon + 1 < count )
+        {
+            expected_hs = parse_handshake(tokens[colon + 1]);
+        }
+    }
+
+    if( strcmp(command, "reset") == 0 )
+    {
+        host_reset();
+    }
+    else if( strcmp(command, "sof") == 0 )
+    {
+        value = count > 1 ? parse_number(tokens[1]) : 1;
+        while( value-- )
+        {
+            sie_sof();
+        }
+    }
+    else if( strcmp(command, "idle") == 0 )
+    {
+        sie_idle();
+    }
+    else if( strcmp(command, "resume") == 0 )
+    {
+        sie_resume();
+    }
+    else if( strcmp(command, "error") == 0 && count > 1 )
+    {
+        sie_error(parse_number(tokens[1]));
+    }
+    else if( strcmp(command, "setup") == 0 )
+    {
+        parse_bytes(tokens + first, colon - first, &bytes);
+        if( bytes.size != 8 )
+        {
+            fail("setup: 8 bytes expected");
+        }
+        check_handshake("SETUP", host_setup(address, bytes.data),
+                expected_hs);
+    }
+    else if( strcmp(command, "out") == 0 )
+    {
+        data1 = host_toggle[ep][USB_DIR_OUT];
+        if( first < colon && strncmp(tokens[first], "DATA", 4) == 0 )
+        {
+            data1 = strcmp(tokens[first++], "DATA1") == 0;
+        }
+        parse_bytes(tokens + first, colon - first, &bytes);
+        if( bytes.size > 64 )
+        {
+            fail("out: packets are up to 64 bytes");
+        }
+        handshake = host_out(address, ep, data1, bytes.data, bytes.size);
+        check_handshake("OUT", handshake, expected_hs);
+        if( handshake == SIE_ACK && ep != 0 )
+        {
+            capture_urb(USBMON_BULK, ep, address, 0, bytes.data, bytes.size,
+                    USBMON_OK, bytes.size);
+        }
+    }
+    else if( strcmp(command, "in") == 0 )
+    {
+        unsigned char toggle = host_toggle[ep][USB_DIR_IN];
+
+        handshake = host_in(address, ep, data, &size, &data1);
+        check_handshake("IN", handshake, expected_hs);
+        if( handshake == SIE_ACK && ep != 0 )
+        {
+            capture_urb(USBMON_BULK, ep | USBMON_EP_IN, address, 0, data,
+                    HOST_BULK_SIZE, USBMON_OK, size);
+        }
+
+        // Expected packet: [DATA0|DATA1] BYTES
+        first = colon + 2;
+        if( first < count && strncmp(tokens[first], "DATA", 4) == 0 )
+        {
+            toggle = strcmp(tokens[first++], "DATA1") == 0;
+        }
+        if( expected_hs == SIE_ACK )
+        {
+            if( data1 != toggle )
+            {
+                fail("IN: DATA%d, expected DATA%d", data1, toggle);
+            }
+            if( first < count )
+            {
+                parse_bytes(tokens + first, count - first, &expected);
+                check_bytes("IN", data, size, &expected);
+            }
+        }
+    }
+    else if( strcmp(command, "control") == 0 )
+    {
+        static SIM_BYTES_t setup;
+        static SIM_BYTES_t in;
+        unsigned short length;
+
+        if( colon < 2 )
+        {
+            fail("control: address expected");
+        }
+        address = parse_number(tokens[1]);
+
+        parse_bytes(tokens + 2, colon - 2, &setup);
+        if( setup.size < 8 )
+        {
+            fail("control: 8 setup bytes expected");
+        }
+        memset(bytes.data, 0, sizeof(bytes.data));
+        memcpy(bytes.data, setup.data + 8, setup.size - 8);
+
+        length = setup.data[6] | (setup.data[7] << 8);
+        if( length > SIM_BYTES_MAX - 64 )
+        {
+            fail("control: wLength too long");
+        }
+
+        handshake = host_control(address, setup.data, bytes.data, in.data,
+                &length);
+        in.size = length;
+        length = setup.data[6] | (setup.data[7] << 8);
+
+        if( setup.data[0] & USB_REQ_DIR_IN )
+        {
+            capture_urb(USBMON_CONTROL, USBMON_EP_IN, address, setup.data,
+                    in.data, length, status_of(handshake), in.size);
+        }
+        else
+        {
+            capture_urb(USBMON_CONTROL, 0, address, setup.data, bytes.data,
+                    length, status_of(handshake),
+                    handshake == SIE_ACK ? length : 0);
+        }
+
+        if( colon + 1 < count && strcmp(tokens[colon + 1], "STALL") == 0 )
+        {
+            check_handshake("control", handshake, SIE_STALL);
+        }
+        else
+        {
+            check_handshake("control", handshake, SIE_ACK);
+            if( colon < count )
+            {
+                parse_bytes(tokens + colon + 1, count - colon - 1,
+                        &expected);
+                check_bytes("control", in.data, in.size, &expected);
+            }
+        }
+    }
+    else if( strcmp(command, "write") == 0 )
+    {
+        parse_bytes(tokens + 1, count - 1, &bytes);
+        for( i=0; i<bytes.size; i++ )
+        {
+            // The application would wait for room forever: no one sends
+            if( (unsigned char) (USB_HOT.tx_head - USB_HOT.tx_tail) >=
+                    USB_TX_RING_SIZE )
+            {
+                fail("write: TX ring full");
+            }
+            if( !usb_cdc_putc(bytes.data[i]) )
+            {
+                fail("write: usb_cdc_putc() failed");
+            }
+        }
+        sim_service();
+    }
+    else if( strcmp(command, "read") == 0 )
+    {
+        parse_bytes(tokens + 1, count - 1, &expected);
+        for( i=0; i<expected.size; i++ )
+        {
+            if( USB_HOT.rx_head == USB_HOT.rx_tail )
+            {
+                fail("read: %d bytes, expected %d", i, expected.size);
+            }
+            bytes.data[i] = usb_cdc_getc();
+        }
+        check_bytes("read", bytes.data, expected.size, &expected);
+        sim_service();
+    }
+    else if( strcmp(command, "sleep") == 0 )
+    {
+        usb_sleep();
+        sim_service();
+    }
+    else if( strcmp(command, "wakeup") == 0 )
+    {
+        value = usb_remote_wakeup();
+        if( colon + 1 < count && value != parse_number(tokens[colon + 1]) )
+        {
+            fail("wakeup: %lu", value);
+        }
+        sim_service();
+    }
+    else if( strcmp(command, "personality") == 0 )
+    {
+        if( count < 2 || !usb_set_personality(parse_number(tokens[1])) )
+        {
+            fail("personality: number expected");
+        }
+        sim_service();
+    }
+    else if( strcmp(command, "irq") == 0 )
+    {
+        if( count < 2 )
+        {
+            fail("irq: on or off expected");
+        }
+        PIE2bits.USBIE = strcmp(tokens[1], "on") == 0;
+        sim_service();
+    }
+    else if( strcmp(command, "expect") == 0 )
+    {
+        if( count < 3 )
+        {
+            fail("expect: name and value expected");
+        }
+
+        if( strcmp(tokens[1], "configured") == 0 )
+        {
+            value = usb_is_configured() != 0;
+        }
+        else if( strcmp(tokens[1], "suspended") == 0 )
+        {
+            value = usb_is_suspended() != 0;
+        }
+        else if( strcmp(tokens[1], "address") == 0 )
+        {
+            value = UADDR;
+        }
+        else if( strcmp(tokens[1], "tx_queued") == 0 )
+        {
+            value = (unsigned char) (USB_HOT.tx_head - USB_HOT.tx_tail);
+        }
+        else if( strcmp(tokens[1], "rx_queued") == 0 )
+        {
+            value = (unsigned char) (USB_HOT.rx_head - USB_HOT.rx_tail);
+        }
+        else if( strcmp(tokens[1], "resume_signals") == 0 )
+        {
+            value = sie_resume_signals;
+        }
+        else if( strcmp(tokens[1], "sleeps") == 0 )
+        {
+            value = sim_sleeps;
+        }
+        else if( strcmp(tokens[1], "line_state") == 0 )
+        {
+            value = usb_cdc_line_state();
+        }
+        else if( strcmp(tokens[1], "baud_rate") == 0 )
+        {
+            value = usb_cdc_baud_rate();
+        }
+        else
+        {
+            fail("expect: unknown '%s'", tokens[1]);
+        }
+
+        if( value != parse_number(tokens[2]) )
+        {
+            fail("expect %s: %lu, expected %s", tokens[1], value, tokens[2]);
+        }
+    }
+    else if( strcmp(command, "echo") == 0 )
+    {
+        for( i=1; i<count; i++ )
+        {
+            printf("%s%s", i > 1 ? " " : "", tokens[i]);
+        }
+        printf("\n");
+    }
+    else
+    {
+        fail("unknown command '%s'", command);
+    }
+
+    if( sim_errors )
+    {
+        fail("SIE model error");
+    }
+}
+
+
+/* Powers the device on and runs the script NAME */
+static void run_script(const char *name)
+{
+    char line[SIM_LINE_MAX];
+    char *tokens[SIM_TOKENS_MAX];
+    unsigned count;
+    unsigned depth = 0; // 'if' blocks open
+    unsigned skip = 0; // Depth of the 'if' block skipped, if any
+    unsigned i;
+    FILE *file = fopen(name, "r");
+
+    if( !file )
+    {
+        perror(name);
+        exit(1);
+    }
+
+    FILE_NAME = name;
+    LINE = 0;
+    memset(host_toggle, 0, sizeof(host_toggle));
+
+    sim_init();
+    usb_init();
+    sim_service();
+
+    while( fgets(line, sizeof(line) / 2, file) )
+    {
+        LINE++;
+        count = split(line, tokens);
+        if( count && strcmp(tokens[0], "if") == 0 )
+        {
+            depth++;
+            for( i=1; i<count && !skip; i++ )
+            {
+                if( !parse_option(tokens[i]) )
+                {
+                    skip = depth;
+                }
+            }
+        }
+        else if( count && strcmp(tokens[0], "end") == 0 )
+        {
+            if( depth == 0 )
+            {
+                fail("end without if");
+            }
+            if( skip == depth )
+            {
+                skip = 0;
+            }
+            depth--;
+        }
+        else if( count && !skip )
+        {
+            run_command(tokens, count);
+            usb_trace_drain();
+        }
+    }
+    if( depth )
+    {
+        fail("if without end");
+    }
+    sim_uart_flush();
+
+    fclose(file);
+    printf("%s: ok (%lu cycles, %lu interrupts)\n", name, sim_cycles,
+            sim_handler_calls);
+}
+
+
+
+int main(int argc, char **argv)
+{
+    int i;
+
+    for( i=1; i<argc; i++ )
+    {
+        if( strcmp(argv[i], "-v") == 0 )
+        {
+            host_verbose = 1;
+            continue;
+        }
+        if( strcmp(argv[i], "-u") == 0 && i + 1 < argc )
+        {
+            sim_uart_file = fopen(argv[++i], "wb");
+            if( !sim_uart_file )
+            {
+                perror(argv[i]);
+                return 1;
+            }
+            continue;
+        }
+        if( strcmp(argv[i], "-w") == 0 && i + 1 < argc )
+        {
+            if( usbmon_create(&CAPTURE, argv[++i]) < 0 )
+            {
+                return 1;
+            }
+            host_capture_file = &CAPTURE;
+            continue;
+        }
+        run_script(argv[i]);
+    }
+
+    if( argc < 2 )
+    {
+        fprintf(stderr, "usage: usbsim [-v] [-w out.pcap] [-u uart.bin] "
+                "script.sim...\n");
+        return 1;
+    }
+
+    if( host_capture_file )
+    {
+        usbmon_close(host_capture_file);
+    }
+    if( sim_uart_file )
+    {
+        fclose(sim_uart_file);
+    }
+    return 0;
+}
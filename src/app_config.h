@@ -0,0 +1,35 @@
+/*
+ * File: 	app_config.h
+ * Compiler: sdcc (Version 3.4.0)
+ *
+ *
+ * [!] This file contains the example application USB stack settings, see
+ * usb_config.h (included through USB_APP_CONFIG, see Makefile)
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _APP_CONFIG_H
+#define _APP_CONFIG_H
+
+
+// No USB_ON_SOF: the scheduler ticks on Timer 0 alone (see util/sched.h), SOF
+// interrupts would cost an entry every 1ms while the bus is up (see
+// USB_IE_SOF in usb_config.h)
+
+
+#endif // _APP_CONFIG_H
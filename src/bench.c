@@ -0,0 +1,370 @@
+/*
+ * File: 	bench.c
+ * Compiler: sdcc (Version 3.4.0)
+ *
+ *
+ * [!] Benchmark firmware, run under gpsim by 'make bench' (see
+ * scripts/gpsim_bench.py): instruction cycles of the stack hot paths and of
+ * the util/ UART output, written to the UART as "BENCH <name> <cycles>" lines
+ *
+ * gpsim has no USB module, so transactions are not driven through the SIE:
+ * the handlers are called directly with the buffer descriptors and USB_HOT
+ * as the SIE and usb_handler() leave them. This file includes usbcdc.c to
+ * reach its static handlers (the stack is not linked separately)
+ *
+ * Cycles are counted by Timer 1 (1:1, instruction clock) around an indirect
+ * call, minus the same measure of an empty function: the cost of the call
+ * and return themselves is not counted. Every case runs with interrupts off
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include "usbcdc.c"
+#include "util/uart.h"
+#include "util/printf.h"
+
+
+// Same configuration words as example.c (gpsim runs the instruction clock
+// it is given, 12MHz)
+#pragma config PLLDIV=5, USBDIV=2, CPUDIV=OSC1_PLL2
+#pragma config IESO=OFF, FCMEN=OFF, FOSC=HSPLL_HS
+#pragma config PWRT=ON, BOR=OFF, VREGEN=ON
+#pragma config WDT=OFF
+#pragma config MCLRE=ON, PBADEN=OFF, CCP2MX=ON
+#pragma config DEBUG=OFF, STVREN=OFF, LVP=OFF, ICPRT=OFF, XINST=OFF
+
+
+
+/*******************************************************************************
+                                  MEASUREMENT
+*******************************************************************************/
+
+typedef void (*BENCH_FUNCTION_t)(void);
+
+// Cycles of an empty function measured the same way
+static unsigned short BENCH_OVERHEAD;
+
+// Data stage totals of the last descriptor request
+static unsigned short BENCH_DATA_IN;
+static unsigned short BENCH_DATA_IN_MAX;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+static unsigned short bench_run(BENCH_FUNCTION_t function);
+static void bench_report(char *name, unsigned short cycles);
+static void bench_nothing(void);
+static void bench_descriptor(unsigned char type, unsigned char index);
+static void bench_descriptors(void);
+static void bench_rx_push(void);
+static void bench_dispatch(void);
+static void bench_data_endpoint(void);
+#if USB_DEFERRED_EVENTS
+static void bench_deferred(void);
+#endif
+#if USB_IE_IDLE
+static void bench_suspend(void);
+#endif
+static void bench_putchar(void);
+static void bench_printf(void);
+void bench_done(void);
+
+
+
+/*
+ * Instruction cycles spent in FUNCTION. Timer 1 runs in 16 bits mode: TMR1H
+ * is written through its buffer by the TMR1L write, and latched by the TMR1L
+ * read. Up to 65535 cycles, every case stays well below
+*/
+static unsigned short bench_run(BENCH_FUNCTION_t function)
+{
+    unsigned short cycles;
+
+    TMR1H = 0;
+    TMR1L = 0;
+    function();
+    cycles = TMR1L;
+    cycles |= (unsigned short) TMR1H << 8;
+
+    return cycles - BENCH_OVERHEAD;
+}
+
+
+/* One result line, read back from the UART by scripts/gpsim_bench.py */
+static void bench_report(char *name, unsigned short cycles)
+{
+    printf("BENCH %s %u\r\n", name, cycles);
+}
+
+
+static void bench_nothing(void)
+{
+}
+
+
+
+              /***************  Endpoint 0  *************/
+
+/*
+ * GET_DESCRIPTOR (TYPE, INDEX): the SETUP handling and the DATA IN stage
+ * packets (each control_in_handler() call the host ACKs), then the STATUS
+ * stage unmeasured
+*/
+static void bench_descriptor(unsigned char type, unsigned char index)
+{
+    volatile unsigned char *setup = USB_EP_BUFFER(0, OUT, 0);
+    unsigned short cycles;
+
+    setup[0] = USB_REQ_DIR_IN;
+    setup[1] = USB_REQ_GET_DESCRIPTOR;
+    setup[2] = index;
+    setup[3] = type;
+    setup[4] = type == USB_DESC_TYPE_STRING && index ? 0x09 : 0x00;
+    setup[5] = type == USB_DESC_TYPE_STRING && index ? 0x04 : 0x00;
+    setup[6] = 0xFF;
+    setup[7] = 0x00;
+
+    EP0_OUT.CNT = 8;
+    EP0_OUT.STAT.stat = USB_PID_TOKEN_SETUP << 2;
+    USB_HOT.ustat = 0x00;
+
+    cycles = bench_run(control_out_handler);
+    printf("BENCH get_descriptor.%u.%u.setup %u\r\n", type, index, cycles);
+
+    BENCH_DATA_IN = 0;
+    BENCH_DATA_IN_MAX = 0;
+    while( EP0_STAGE == EP0_STAGE_DATA_IN && (EP0_BYTES > 0 || EP0_ZLP) )
+    {
+        EP0_IN.STAT.stat = 0x00;
+        cycles = bench_run(control_in_handler);
+
+        BENCH_DATA_IN += cycles;
+        if( cycles > BENCH_DATA_IN_MAX )
+        {
+            BENCH_DATA_IN_MAX = cycles;
+        }
+    }
+    printf("BENCH get_descriptor.%u.%u.data_in %u\r\n", type, index,
+            BENCH_DATA_IN);
+    printf("BENCH get_descriptor.%u.%u.data_in_max %u\r\n", type, index,
+            BENCH_DATA_IN_MAX);
+
+    // STATUS stage (zero length OUT)
+    EP0_OUT.CNT = 0;
+    EP0_OUT.STAT.stat = USB_PID_TOKEN_OUT << 2;
+    control_out_handler();
+}
+
+
+/* Every descriptor of the current personality */
+static void bench_descriptors(void)
+{
+    unsigned char type;
+    unsigned char index;
+
+    for( type=USB_DESC_TYPE_DEVICE; type<=USB_DESC_TYPE_LAST; type++ )
+    {
+        for( index=0; index<USB_PERSONALITY->count[type]; index++ )
+        {
+            bench_descriptor(type, index);
+        }
+    }
+}
+
+
+
+              /***************  Data endpoint  *************/
+
+static void bench_rx_push(void)
+{
+    data_rx_push(0);
+}
+
+
+/* The transaction in USB_HOT.ustat through USB_EP_HANDLERS, as usb_service() */
+static void bench_dispatch(void)
+{
+    USB_EP_HANDLE();
+}
+
+
+/*
+ * Full size packets: the RX ring copy alone and within data_out_handler()
+ * (BD armed again), the TX ring copy to an IN BD and the IN completion. Then
+ * both handlers again through the endpoint table: the difference is the
+ * dispatch cost per transaction
+*/
+static void bench_data_endpoint(void)
+{
+    // OUT: even BD, empty ring
+    DATA_OUT(0).CNT = DATA_OUT_SIZE;
+    USB_HOT.rx_head = 0;
+    USB_HOT.rx_tail = 0;
+    USB_HOT.rx_held = 0;
+    bench_report("data_rx_push.64", bench_run(bench_rx_push));
+
+    USB_HOT.rx_head = 0;
+    USB_HOT.ustat = USB_DATA_EP << 3;
+    bench_report("data_out_handler.64", bench_run(data_out_handler));
+
+    // IN: a full packet queued, no BD armed
+    USB_HOT.tx_tail = 0;
+    USB_HOT.tx_send = 0;
+    USB_HOT.tx_head = DATA_IN_SIZE;
+    USB_HOT.in_armed = 0;
+    USB_HOT.in_odd = 0;
+    bench_report("data_tx_kick.64", bench_run(data_tx_kick));
+
+    // That packet acknowledged, nothing else queued
+    DATA_IN(0).STAT.stat = 0x00;
+    USB_HOT.ustat = (USB_DATA_EP << 3) | USB_USTAT_DIR;
+    bench_report("data_in_handler.64", bench_run(data_in_handler));
+
+    // OUT through the table: even BD, empty ring
+    USB_HOT.rx_head = 0;
+    USB_HOT.rx_tail = 0;
+    USB_HOT.ustat = USB_DATA_EP << 3;
+    bench_report("dispatch.data_out.64", bench_run(bench_dispatch));
+
+    // IN through the table: the same packet armed and acknowledged
+    USB_HOT.tx_tail = 0;
+    USB_HOT.tx_send = 0;
+    USB_HOT.tx_head = DATA_IN_SIZE;
+    USB_HOT.in_odd = 0;
+    data_tx_kick();
+    DATA_IN(0).STAT.stat = 0x00;
+    USB_HOT.ustat = (USB_DATA_EP << 3) | USB_USTAT_DIR;
+    bench_report("dispatch.data_in.64", bench_run(bench_dispatch));
+}
+
+
+
+#if USB_DEFERRED_EVENTS
+/*
+ * USB_DEFERRED_EVENTS (BENCH_CONFIG): a transaction queued by the interrupt,
+ * then a full size data OUT packet handled by usb_process_events()
+*/
+static void bench_deferred(void)
+{
+    USB_HOT.ev_head = 0;
+    USB_HOT.ev_tail = 0;
+    bench_report("usb_queue_event", bench_run(usb_queue_event));
+
+    USB_EVENTS[0] = USB_DATA_EP << 3;
+    USB_HOT.ev_head = 1;
+    USB_HOT.ev_tail = 0;
+    DATA_OUT(0).CNT = DATA_OUT_SIZE;
+    USB_HOT.rx_head = 0;
+    USB_HOT.rx_tail = 0;
+    USB_HOT.rx_held = 0;
+    bench_report("usb_process_events.data_out.64",
+            bench_run(usb_process_events));
+}
+#endif
+
+
+
+              /***************  Suspend  *************/
+
+#if USB_IE_IDLE
+/*
+ * IDLEIF and ACTVIF work: entering the suspended state and leaving it (SIE
+ * clock already stable). The resume latency the host sees needs the hardware,
+ * see USB_RESUME_STATS
+*/
+static void bench_suspend(void)
+{
+    bench_report("usb_suspend", bench_run(usb_suspend));
+    bench_report("usb_resume", bench_run(usb_resume));
+}
+#endif
+
+
+
+              /***************  UART output (util/)  *************/
+
+static void bench_putchar(void)
+{
+    putchar('.');
+}
+
+
+static void bench_printf(void)
+{
+    printf("%u\r\n", 12345);
+}
+
+
+
+/* End of the run, gpsim stops here */
+void bench_done(void)
+{
+    while(1);
+}
+
+
+
+void main(void)
+{
+    // All pins are digital (datasheet page 260)
+    ADCON1bits.PCFG = 0xF;
+
+    // UART at its fastest (Fosc/4 baud, BRG16 and BRGH): putchar() and
+    // printf() are measured for their instructions, not for the line time
+    uart_init();
+    BAUDCONbits.BRG16 = 1;
+    TXSTAbits.BRGH = 1;
+    SPBRGH = 0;
+    SPBRG = 0;
+
+    // Timer 1: 16 bits reads, 1:1 prescaler, instruction cycles clock
+    T1CON = 0x81;
+
+    usb_init();
+    INTCON = 0x00;
+    PIE2bits.USBIE = 0;
+
+    BENCH_OVERHEAD = 0;
+    BENCH_OVERHEAD = bench_run(bench_nothing);
+    bench_report("overhead", BENCH_OVERHEAD);
+
+    // Interrupt entry with nothing pending (an unrelated interrupt source),
+    // and the main loop poll finding nothing (USB_POLLING)
+    bench_report("usb_handler.idle", bench_run(usb_handler));
+    bench_report("usb_task.idle", bench_run(usb_task));
+
+    bench_descriptors();
+    bench_data_endpoint();
+#if USB_DEFERRED_EVENTS
+    bench_deferred();
+#endif
+#if USB_IE_IDLE
+    bench_suspend();
+#endif
+
+    // Transmitter idle: no wait for TXIF
+    while( !TXSTAbits.TRMT );
+    bench_report("putchar", bench_run(bench_putchar));
+    while( !TXSTAbits.TRMT );
+    bench_report("printf.u", bench_run(bench_printf));
+
+    printf("BENCH end 0\r\n");
+    while( !TXSTAbits.TRMT );
+    bench_done();
+}
@@ -0,0 +1,222 @@
+/*
+ * File: 	benchmark.c
+ * Compiler: sdcc (Version 3.4.0)
+ *
+ *
+ * [!] Loopback benchmark firmware ('make benchmark'), driven through the CDC
+ * data endpoint by the host tool tools/cdc_bench.c. The host picks the mode
+ * with the line coding bits per second (the tty speed), no reflashing:
+ *
+ *   - BENCHMARK_BAUD_SINK: received bytes are dropped (host to device
+ *     throughput)
+ *   - BENCHMARK_BAUD_SOURCE: a byte counter (0, 1 ... 255, 0 ...) is sent
+ *     while DTR is up, i.e. the port is open (device to host throughput). The
+ *     host checks it has no gap
+ *   - Any other speed: echo, received bytes are sent back (round trip
+ *     latency, a terminal sees what it types)
+ *
+ * The main loop only moves what the rings hold right now (usb_cdc_rx_count(),
+ * usb_cdc_tx_room()), so a mode change never waits behind a blocked call.
+ * Same stack configuration as example.c: the numbers are the release ones
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <pic18f4550.h>
+#include "usb.h"
+#include "usb_cdc.h"
+#include "usbcdc.h"
+
+
+// Same configuration words as example.c (20MHz crystal, 48MHz clock)
+#pragma config PLLDIV=5, USBDIV=2, CPUDIV=OSC1_PLL2
+#pragma config IESO=OFF, FCMEN=OFF, FOSC=HSPLL_HS
+#pragma config PWRT=ON, BOR=OFF, VREGEN=ON
+#pragma config WDT=OFF
+#pragma config MCLRE=ON, PBADEN=OFF, CCP2MX=ON
+#pragma config DEBUG=OFF, STVREN=OFF, LVP=OFF, ICPRT=OFF, XINST=OFF
+
+
+
+/*******************************************************************************
+                                     MODES
+
+             Keep the speeds in sync with tools/cdc_bench.c
+*******************************************************************************/
+
+#define BENCHMARK_ECHO 0
+#define BENCHMARK_SINK 1
+#define BENCHMARK_SOURCE 2
+
+// Line coding bits per second selecting each mode, echo otherwise
+#define BENCHMARK_BAUD_SINK 19200
+#define BENCHMARK_BAUD_SOURCE 38400
+
+// Next byte of the source mode counter
+static unsigned char BENCHMARK_COUNTER;
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+static unsigned char benchmark_mode(void);
+static void benchmark_echo(void);
+static void benchmark_sink(void);
+static void benchmark_source(void);
+
+
+
+/* Mode set by the host */
+static unsigned char benchmark_mode(void)
+{
+    unsigned long baud = usb_cdc_baud_rate();
+
+    if( baud == BENCHMARK_BAUD_SINK )
+    {
+        return BENCHMARK_SINK;
+    }
+    if( baud == BENCHMARK_BAUD_SOURCE )
+    {
+        return BENCHMARK_SOURCE;
+    }
+    return BENCHMARK_ECHO;
+}
+
+
+/* Sends back the received bytes there's room for */
+static void benchmark_echo(void)
+{
+    unsigned char count = usb_cdc_rx_count();
+    unsigned char room = usb_cdc_tx_room();
+
+    if( count > room )
+    {
+        count = room;
+    }
+
+    while( count-- )
+    {
+        usb_cdc_putc(usb_cdc_getc());
+    }
+}
+
+
+/* Drops the received bytes */
+static void benchmark_sink(void)
+{
+    unsigned char count = usb_cdc_rx_count();
+
+    while( count-- )
+    {
+        usb_cdc_getc();
+    }
+}
+
+
+/* Fills the TX ring with the counter while the port is open */
+static void benchmark_source(void)
+{
+    unsigned char room;
+
+    if( !(usb_cdc_line_state() & USB_CDC_LINE_DTR) )
+    {
+        return;
+    }
+
+    room = usb_cdc_tx_room();
+    while( room-- )
+    {
+        usb_cdc_putc(BENCHMARK_COUNTER++);
+    }
+}
+
+
+
+#if USB_INTERRUPT_PRIORITY
+
+// Data endpoints at high priority
+void usb_isr_high(void) __shadowregs __interrupt 1
+{
+    if( PIR2bits.USBIF && IPR2bits.USBIP )
+    {
+        usb_handler_high();
+    }
+}
+
+// EP0 and bus events at low priority
+void usb_isr_low(void) __interrupt 2
+{
+    if( PIR2bits.USBIF && !IPR2bits.USBIP )
+    {
+        usb_handler_low();
+    }
+}
+
+#else
+
+void usb_isr(void) __shadowregs __interrupt 1
+{
+    if( PIR2bits.USBIF )
+    {
+        usb_handler();
+        PIR2bits.USBIF = 0;
+    }
+}
+
+#endif
+
+
+void main(void)
+{
+    // Oscillator config
+    OSCCONbits.SCS = 0; // Primary (Crystal) oscillator (datasheet page 32)
+
+    // All pins are digital (datasheet page 260)
+    ADCON1bits.PCFG = 0xF;
+
+    usb_init();
+
+    while(1)
+    {
+#if USB_POLLING
+        usb_task();
+#else
+        usb_process_events();
+#endif
+
+        if( !usb_is_configured() )
+        {
+            continue;
+        }
+
+        switch( benchmark_mode() )
+        {
+            case BENCHMARK_SINK:
+                benchmark_sink();
+                break;
+
+            case BENCHMARK_SOURCE:
+                benchmark_source();
+                break;
+
+            default:
+                benchmark_echo();
+                break;
+        }
+    }
+}
@@ -1,5 +1,7 @@
 #include <pic18f4550.h>
 #include "usb.h"
+#include "usbcdc.h"
+#include "util/sched.h"
 
 /*************************************************************************************************
   PIC18F4550 CONFIGURATION - Crystal used: 20MHz  (Datasheet page 286 - 295)
@@ -48,22 +50,50 @@
 /*************************************************************************************************
 *************************************************************************************************/
 
-void delay(unsigned int delay)
+/* Blinks the debug LEDs, every 500ms */
+void blink_task(void)
 {
-	unsigned int a = 0;
-	unsigned int i=0;
-
-	for(i=0;i<delay;i++)
-	{
-		while(a < 10)
-		{
-			a = a+1;
-		}
-		a=0;
-	}
+    PORTB ^= 0xFF;
 }
 
 
+/* Sends a heartbeat to the host, every second */
+void heartbeat_task(void)
+{
+    if( usb_is_configured() )
+    {
+        usb_cdc_puts("tick\r\n");
+    }
+}
+
+
+#if USB_INTERRUPT_PRIORITY
+
+// Data endpoints at high priority
+void usb_isr_high(void) __shadowregs __interrupt 1
+{
+    if( PIR2bits.USBIF && IPR2bits.USBIP )
+    {
+        usb_handler_high();
+    }
+}
+
+// EP0, bus events and the scheduler timer (low priority, see sched_init())
+void usb_isr_low(void) __interrupt 2
+{
+    if( PIR2bits.USBIF && !IPR2bits.USBIP )
+    {
+        usb_handler_low();
+    }
+
+    if( INTCONbits.TMR0IF )
+    {
+        sched_timer_isr();
+    }
+}
+
+#else
+
 void usb_isr(void) __shadowregs __interrupt 1
 {
     if( PIR2bits.USBIF )
@@ -71,8 +101,15 @@ void usb_isr(void) __shadowregs __interrupt 1
         usb_handler();
         PIR2bits.USBIF = 0;
     }
+
+    if( INTCONbits.TMR0IF )
+    {
+        sched_timer_isr();
+    }
 }
 
+#endif
+
 
 void main(void)
 {
@@ -86,11 +123,27 @@ void main(void)
     TRISB=0;
     PORTB=0;
 
+    // Periodic tasks, ticking on Timer 0
+    sched_init();
+    sched_add(blink_task, 500);
+    sched_add(heartbeat_task, 1000);
+
     // Init USB
     usb_init();
 
     while(1)
     {
-        // DO something
-    } 
+        // USB work left to the main loop (SET_PERSONALITY, deferred events)
+#if USB_POLLING
+        usb_task();
+#else
+        usb_process_events();
+#endif
+
+        // Run due tasks, idle until the next tick
+        sched_run();
+
+        // Stop while the bus is suspended
+        usb_sleep();
+    }
 } 
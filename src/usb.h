@@ -33,10 +33,9 @@
                  See USB 2.0 specification: page 241 table 9-1
 *******************************************************************************/
 
-// DEVICE CURRENT STATE
-extern volatile unsigned char USB_DEVICE_STATE;
-extern volatile unsigned char USB_DEVICE_ADDRESS;
-extern volatile unsigned char USB_DEVICE_CURRENT_CONFIGURATION;
+// DEVICE CURRENT STATE (USB_DEVICE_STATE, USB_DEVICE_ADDRESS and
+// USB_DEVICE_CURRENT_CONFIGURATION live in the hot state struct)
+#include "usb_hot.h"
 
 // STATES
 #define USB_STATE_DETACHED 0x00
@@ -105,6 +104,23 @@ extern volatile unsigned char USB_DEVICE_CURRENT_CONFIGURATION;
 #define USB_REQ_SET_INTERFACE 0x0B
 #define USB_REQ_SYNCH_FRAME 0x0C
 
+// Field: bmRequestType
+// Data transfer direction, type and recipient masks (USB 2.0 spec: page 248)
+#define USB_REQ_DIR_MASK 0x80
+#define USB_REQ_DIR_IN 0x80
+#define USB_REQ_TYPE_MASK 0x60
+#define USB_REQ_TYPE_STANDARD 0x00
+#define USB_REQ_TYPE_CLASS 0x20
+#define USB_REQ_TYPE_VENDOR 0x40
+#define USB_REQ_RECIPIENT_MASK 0x1F
+#define USB_REQ_RECIPIENT_DEVICE 0x00
+#define USB_REQ_RECIPIENT_INTERFACE 0x01
+#define USB_REQ_RECIPIENT_ENDPOINT 0x02
+
+// Standard feature selectors (USB 2.0 spec: page 252 table 9-6)
+#define USB_FEATURE_ENDPOINT_HALT 0x00
+#define USB_FEATURE_DEVICE_REMOTE_WAKEUP 0x01
+
 /*******************************************************************************
 *******************************************************************************/
 
@@ -294,6 +310,50 @@ typedef struct
 	unsigned char bInterval;
 } USB_DESC_EP_t;
 
+
+
+/*
+ * ----------------------------------------------
+ *           DESCRIPTORS INDEX TABLE
+ *
+ * Generated by scripts/usb_descgen.py, see usb_device.spec
+ * ----------------------------------------------
+ */
+
+// String descriptor bLength for a N characters string (2 bytes per character)
+#define USB_DESC_STRING_LENGTH(n) (2 + 2 * (n))
+
+// Little endian bytes of a 16 bits descriptor field
+#define USB_DESC_WORD(w) ((w) & 0xFF), (((w) >> 8) & 0xFF)
+
+
+// Field: bFlags
+// String descriptor stored as ASCII, the zero high bytes of the UTF-16LE
+// characters are inserted while the descriptor is sent
+#define USB_DESC_FLAG_ASCII 0x01
+
+
+// One entry per GET_DESCRIPTOR (type, index) pair
+typedef struct
+{
+	unsigned char bDescriptorType;
+	unsigned char bIndex;
+	unsigned char bFlags;
+	unsigned short wOffset; // Offset in the descriptors blob
+	unsigned short wLength; // Total descriptor size sent to the host
+} USB_DESC_INDEX_t;
+
+
+// One entry per device personality (complete descriptors set)
+typedef struct
+{
+	__code USB_DESC_INDEX_t *index; // GET_DESCRIPTOR index
+	__code unsigned char *first; // First index entry by descriptor type
+	__code unsigned char *count; // Number of index entries by descriptor type
+	unsigned char bConfigurationValue;
+	void (*setup_endpoints)(void); // Enables the configuration endpoints
+} USB_PERSONALITY_t;
+
 /*******************************************************************************
 *******************************************************************************/
 
@@ -82,6 +82,38 @@ extern volatile unsigned char USB_CDC_TX_BUFFER;
 
 
 
+/*******************************************************************************
+                                  LINE CODING
+
+              See USB 2.0: PSTN specification page 24 table 17
+
+    SET_LINE_CODING / GET_LINE_CODING data: dwDTERate (bits per second, little
+    endian), bCharFormat, bParityType, bDataBits
+*******************************************************************************/
+
+#define USB_CDC_LINE_CODING_SIZE 7
+
+// Field: bCharFormat
+#define USB_CDC_STOP_BITS_1 0x00
+#define USB_CDC_STOP_BITS_1_5 0x01
+#define USB_CDC_STOP_BITS_2 0x02
+
+// Field: bParityType
+#define USB_CDC_PARITY_NONE 0x00
+#define USB_CDC_PARITY_ODD 0x01
+#define USB_CDC_PARITY_EVEN 0x02
+#define USB_CDC_PARITY_MARK 0x03
+#define USB_CDC_PARITY_SPACE 0x04
+
+// SET_CONTROL_LINE_STATE wValue bits
+#define USB_CDC_LINE_DTR 0x01
+#define USB_CDC_LINE_RTS 0x02
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
 /*******************************************************************************
                              CDC/ACM NOTIFICATIONS
 
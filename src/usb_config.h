@@ -0,0 +1,408 @@
+/*
+ * File: 	usb_config.h
+ * Compiler: sdcc (Version 3.4.0)
+ *
+ *
+ * [!] This file contains the USB stack compile time configuration, override
+ * any value with -D<NAME>=<value> in the Makefile CFLAGS
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _USB_CONFIG_H
+#define _USB_CONFIG_H
+
+// Application settings first, -DUSB_APP_CONFIG='"app_config.h"'
+#ifdef USB_APP_CONFIG
+#include USB_APP_CONFIG
+#endif
+
+
+
+/*******************************************************************************
+                                  PERSONALITIES
+
+         Descriptors sets declared in usb_device.spec, see usb_set_personality()
+*******************************************************************************/
+
+// Personality used after usb_init()
+#ifndef USB_PERSONALITY_DEFAULT
+#define USB_PERSONALITY_DEFAULT USB_PERSONALITY_CDC
+#endif
+
+// Milliseconds the device stays detached while switching personality, long
+// enough for the host (and hubs) to notice the disconnection
+#ifndef USB_DETACH_MS
+#define USB_DETACH_MS 100
+#endif
+
+// Busy wait loop iterations per millisecond (48MHz clock: 12 MIPS)
+#ifndef USB_DELAY_LOOPS_PER_MS
+#define USB_DELAY_LOOPS_PER_MS 1200
+#endif
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+
+/*******************************************************************************
+                                    USB RAM
+
+           Buffer descriptors and endpoint buffers layout, see usb_ram.h
+*******************************************************************************/
+
+// Ping-pong buffering mode (USB_PP_* in usb_pic.h). The control transfer
+// handler uses single EP0 buffers: only USB_PP_NONE and USB_PP_ALL_BUT_EP0
+#ifndef USB_PING_PONG_MODE
+#define USB_PING_PONG_MODE USB_PP_NONE
+#endif
+
+// Endpoint buffers start address, right after the BDT by default
+#ifndef USB_RAM_BUFFERS_ADDR
+#define USB_RAM_BUFFERS_ADDR \
+    (USB_BDT_ADDR + 4 * USB_BDT_ENTRIES(USB_PING_PONG_MODE, USB_EP_LAST))
+#endif
+
+// Extra bytes reserved in USB RAM after the endpoint buffers (USB_RAM_EXTRA),
+// for application buffers that don't fit in the general purpose RAM
+#ifndef USB_RAM_EXTRA_SIZE
+#define USB_RAM_EXTRA_SIZE 0
+#endif
+
+// Non PIC targets (the host build in sim/) provide the data memory (USB RAM
+// included) and the program memory as arrays instead of the absolute
+// USB_BDT / USB_RAM_BUFFERS arrays
+#ifndef USB_RAM_ARRAY
+#define USB_RAM_ARRAY 0
+#endif
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+
+/*******************************************************************************
+                                   HOT STATE
+
+            State accessed by the interrupt handler, see usb_hot.h
+*******************************************************************************/
+
+// Place the hot state in the access bank (0 lets SDCC place it anywhere,
+// paying a bank switch on most accesses)
+#ifndef USB_HOT_ACCESS_BANK
+#define USB_HOT_ACCESS_BANK 1
+#endif
+
+// Hot state address, the whole struct must fit below 0x60. SDCC allocates its
+// temporaries (r0x00...) from the start of the access bank, the linker places
+// them around this absolute section
+#ifndef USB_HOT_ADDR
+#define USB_HOT_ADDR 0x30
+#endif
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+
+/*******************************************************************************
+                                 DATA ENDPOINT
+
+          Bulk endpoint behind usb_cdc_putc() / usb_cdc_getc(), see usbcdc.c
+*******************************************************************************/
+
+// Data endpoint number (OUT and IN), the same in every personality
+#ifndef USB_DATA_EP
+#define USB_DATA_EP 3
+#endif
+
+// Received bytes queue size, power of 2 up to 128
+#ifndef USB_RX_RING_SIZE
+#define USB_RX_RING_SIZE 64
+#endif
+
+// Bytes to send queue size, power of 2 up to 128
+#ifndef USB_TX_RING_SIZE
+#define USB_TX_RING_SIZE 64
+#endif
+
+// Both rings survive bus resets: received bytes stay for usb_cdc_getc(),
+// queued bytes (unacknowledged IN packets included) are sent once the device
+// is configured again, unless that took longer than USB_TX_STALE_MS since the
+// reset (measured with the 11 bits frame number: up to 2047ms, a gap of over
+// 2s may pass for a short one). 0: always dropped, 0xFFFF: always sent
+#ifndef USB_TX_STALE_MS
+#define USB_TX_STALE_MS 1000
+#endif
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                               INTERRUPT HANDLER
+
+                                See usb_handler()
+*******************************************************************************/
+
+// Completed transactions handled per usb_handler() call, up to the USTAT FIFO
+// depth (4) drains it in a single interrupt entry
+#ifndef USB_TRNIF_MAX_PER_ENTRY
+#define USB_TRNIF_MAX_PER_ENTRY 4
+#endif
+
+// Two interrupt priority levels (RCONbits.IPEN = 1): data endpoints
+// transactions are handled by usb_handler_high() from the high priority
+// vector, everything else (EP0, reset, idle, errors...) by usb_handler_low()
+// from the low priority vector. See usbcdc.h
+#ifndef USB_INTERRUPT_PRIORITY
+#define USB_INTERRUPT_PRIORITY 0
+#endif
+
+// Polling mode: the USB interrupt (PIE2bits.USBIE) is never enabled, the
+// application main loop calls usb_task() instead (see usbcdc.h)
+#ifndef USB_POLLING
+#define USB_POLLING 0
+#endif
+
+// Deferred events: usb_handler() only queues completed transactions (their
+// USTAT, the BD stays CPU owned), the application main loop handles them
+// calling usb_process_events() (see usbcdc.h). Bus reset, idle and activity
+// are still handled in the interrupt. The interrupt time in either mode is the
+// usb_handler() worst case with USB_CYCLES (scripts/usb_cycles.py)
+#ifndef USB_DEFERRED_EVENTS
+#define USB_DEFERRED_EVENTS 0
+#endif
+
+// Deferred events queue size, power of 2 up to 128
+#ifndef USB_EVENT_QUEUE_SIZE
+#define USB_EVENT_QUEUE_SIZE 8
+#endif
+
+// Frame clock: 32 bits frame counter extended from UFRM on every SOF, plus
+// the sub-frame phase from Timer 1 (taken by the stack), see usb_timestamp()
+// and the GET_TIMESTAMPS vendor request (see scripts/usb_clock.py). Enables
+// the SOF source
+#ifndef USB_FRAME_CLOCK
+#define USB_FRAME_CLOCK 0
+#endif
+
+// SOF samples (frame, Timer 1) kept for GET_TIMESTAMPS
+#ifndef USB_FRAME_SAMPLES
+#define USB_FRAME_SAMPLES 4
+#endif
+
+// Measure the worst case instruction cycles per usb_handler() / usb_task()
+// call with Timer 3 (taken by the stack), read with the GET_CYCLES vendor
+// request or usb_get_max_cycles()
+#ifndef USB_CYCLES
+#define USB_CYCLES 0
+#endif
+
+// Profile usb_handler(), the transaction handlers (by endpoint) and the
+// requests handlers: calls, total and worst case instruction cycles, with
+// Timer 3 (taken by the stack), read with the GET_PROFILE vendor request
+// (see scripts/usb_profile.py). 0 compiles every measure out
+#ifndef USB_PROFILE
+#define USB_PROFILE 0
+#endif
+
+// Log2 histograms of the time buffer descriptors wait for the host, from
+// armed (UOWN set) to their transaction completion, per endpoint direction,
+// with Timer 1 (taken by the stack, 0.67us ticks), read with the
+// GET_LATENCY vendor request. Not along with USB_FRAME_CLOCK
+#ifndef USB_LATENCY
+#define USB_LATENCY 0
+#endif
+
+// Count usb_handler() calls by number of transactions handled, read with the
+// GET_TRN_STATS vendor request (see usb_vendor.h)
+#ifndef USB_TRN_STATS
+#define USB_TRN_STATS 0
+#endif
+
+// Count bus errors (UEIR, by type), STALL handshakes (with USB_IE_STALL),
+// OUT BDs armed again after NAKing, endpoint 0 recoveries, bus resets and
+// suspends, read with the GET_ERRORS vendor request or usb_get_errors()
+#ifndef USB_ERROR_STATS
+#define USB_ERROR_STATS 1
+#endif
+
+// usb_print_errors() writes the USB_ERROR_STATS counters through
+// util/printf.c, from the application main loop (the UART blocks)
+#ifndef USB_ERROR_PRINTF
+#define USB_ERROR_PRINTF 0
+#endif
+
+// Binary trace of the stack events (transactions, BDs armed, bus events) in
+// a RAM ring, written by the interrupt handler, sent to the UART by
+// usb_trace_drain() from the main loop (see usbcdc.h, scripts/usb_trace.py)
+#ifndef USB_TRACE
+#define USB_TRACE 0
+#endif
+
+// Trace ring records (4 bytes each), power of 2 up to 64. Events are dropped
+// while it is full
+#ifndef USB_TRACE_SIZE
+#define USB_TRACE_SIZE 32
+#endif
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+
+/*******************************************************************************
+                               INTERRUPT SOURCES
+
+    Bus reset (URSTIF) and transactions (TRNIF) are always enabled, every other
+    UIE source costs an interrupt entry each time it fires (SOF: every 1ms)
+
+                 See PIC18F4550 datasheet: page 182 register 17-8
+*******************************************************************************/
+
+// Start Of Frame, enabled anyway if USB_ON_SOF is defined (or USB_FRAME_CLOCK).
+// Cost: an interrupt entry every 1ms while the bus is up, 1000 per second on
+// top of the traffic, each one waking the core from Idle mode. A periodic tick
+// is cheaper from a timer, SOF is for work tied to the host frames
+#ifndef USB_IE_SOF
+#define USB_IE_SOF 0
+#endif
+
+// STALL handshake sent (unsupported requests, halted endpoints): counted
+// (USB_ERROR_STATS) and endpoint 0 checked for the next SETUP. Fires only on
+// stalls, no cost while the host and the device agree
+#ifndef USB_IE_STALL
+#define USB_IE_STALL 1
+#endif
+
+// USB errors (UEIR, every type): counted (USB_ERROR_STATS) and endpoint 0
+// checked for the next SETUP. Fires only on a noisy bus. 0 leaves endpoint 0
+// to the next bus reset if an error costs it the SETUP BD
+#ifndef USB_IE_UERR
+#define USB_IE_UERR 1
+#endif
+
+// Bus idle, the device suspends (bus activity, ACTVIF, is enabled only while
+// suspended to resume)
+#ifndef USB_IE_IDLE
+#define USB_IE_IDLE 1
+#endif
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+
+/*******************************************************************************
+                                    SUSPEND
+
+    After 3ms of bus idle the SIE is suspended (USB_IE_IDLE). A suspended bus
+    powered device must draw 2.5mA at most: the application main loop calls
+    usb_sleep(), which stops the core until the bus resumes. RAM, and so the
+    whole device state, is kept: the host sees the device as it left it
+
+                       See USB 2.0 specification: page 250
+*******************************************************************************/
+
+// usb_sleep() stops the core (Sleep mode) while suspended. Oscillator start-up
+// and PLL lock take ~2ms, well within the 10ms resume recovery time
+#ifndef USB_SUSPEND_SLEEP
+#define USB_SUSPEND_SLEEP 1
+#endif
+
+// Remote wakeup: once the host enables it (SET_FEATURE), queued TX data wakes
+// the bus up from usb_sleep() / usb_remote_wakeup(). The configuration must
+// also advertise it (attributes=remotewakeup in usb_device.spec)
+#ifndef USB_REMOTE_WAKEUP
+#define USB_REMOTE_WAKEUP 1
+#endif
+
+// Resume signaling length driven by remote wakeup (1 to 15ms)
+#ifndef USB_RESUME_SIGNAL_MS
+#define USB_RESUME_SIGNAL_MS 10
+#endif
+
+// Measure resume to first transaction latency with Timer 3 (taken by the
+// stack, not together with USB_CYCLES), read with the GET_RESUME_STATS vendor
+// request (see usb_vendor.h, scripts/usb_resume.py)
+#ifndef USB_RESUME_STATS
+#define USB_RESUME_STATS 0
+#endif
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                 MEMORY ACCESS
+
+     PEEK / POKE vendor requests for field diagnostics, see usb_vendor.h
+*******************************************************************************/
+
+// Read and write any data memory (RAM, SFRs) and program memory address with
+// vendor requests, dumps streamed through the data IN endpoint. Anything can
+// be overwritten: keep it out of release builds, or behind a key
+#ifndef USB_PEEK_POKE
+#define USB_PEEK_POKE 0
+#endif
+
+// 16 bits unlock key: the memory requests stall until the UNLOCK request
+// gives it, until the next bus reset. 0: no unlock needed
+#ifndef USB_PEEK_POKE_KEY
+#define USB_PEEK_POKE_KEY 0
+#endif
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                   CALLBACKS
+
+    Application functions called by the stack on USB events, define any of
+    them as a function name (void name(void)) to compile it in:
+
+        #define USB_ON_SOF app_on_sof
+
+    They run from usb_handler() (interrupt context) or usb_task(), keep them
+    short. USB_ON_CONFIGURED runs from usb_process_events() in deferred mode
+*******************************************************************************/
+
+// USB_ON_SOF: Start Of Frame received (every 1ms)
+// USB_ON_SUSPEND: the device has been suspended (bus idle)
+// USB_ON_RESUME: bus activity after a suspension, or remote wakeup (from
+//     usb_remote_wakeup(), application context)
+// USB_ON_RESET: bus reset, the host will enumerate the device again
+// USB_ON_CONFIGURED: SET_CONFIGURATION done, data endpoints are ready
+// USB_ON_LINE_STATE: SET_CONTROL_LINE_STATE or SET_LINE_CODING done, see
+//     usb_cdc_line_state()
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+#endif // _USB_CONFIG_H
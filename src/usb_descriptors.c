@@ -0,0 +1,359 @@
+/*
+ * File: 	usb_descriptors.c
+ * Compiler: sdcc (Version 3.4.0)
+ *
+ *
+ * [!] GENERATED FILE, DO NOT EDIT
+ *
+ * Generated by scripts/usb_descgen.py from usb_device.spec
+ */
+
+
+#include <pic18f4550.h>
+#include "usb.h"
+#include "usb_cdc.h"
+#include "usb_pic.h"
+#include "usb_descriptors.h"
+
+
+
+/*
+ * DESCRIPTORS BLOB
+ *
+ * Every descriptor served by GET_DESCRIPTOR (all personalities), placed into
+ * code memory
+ */
+__code unsigned char USB_DESCRIPTORS[] =
+{
+             /****** PERSONALITY 0: cdc ******/
+
+                 /* DEVICE DESCRIPTOR [offset 0] */
+    0x12, // bLength
+    USB_DESC_TYPE_DEVICE, // bDescriptorType
+    USB_DESC_WORD(0x0200), // bcdUSB
+    0x02, // bDeviceClass
+    0x00, // bDeviceSubClass
+    0x00, // bDeviceProtocol
+    0x08, // bMaxPacketSize0
+    USB_DESC_WORD(0x04D8), // idVendor
+    USB_DESC_WORD(0x0111), // idProduct
+    USB_DESC_WORD(0x0000), // bcdDevice
+    0x01, // iManufacturer
+    0x02, // iProduct
+    0x00, // iSerialNumber
+    0x01, // bNumConfigurations
+
+                 /* CONFIGURATION DESCRIPTOR [offset 18] */
+    0x09, // bLength
+    USB_DESC_TYPE_CONFIGURATION, // bDescriptorType
+    USB_DESC_WORD(0x0043), // wTotalLength
+    0x02, // bNumInterfaces
+    0x01, // bConfigurationValue
+    0x00, // iConfiguration
+    0xA0, // bmAttributes
+    0x64, // bMaxPower
+
+                 /* INTERFACE DESCRIPTOR (Interface 0) [offset 27] */
+    0x09, // bLength
+    USB_DESC_TYPE_INTERFACE, // bDescriptorType
+    0x00, // bInterfaceNumber
+    0x00, // bAlternateSetting
+    0x01, // bNumEndpoints
+    0x02, // bInterfaceClass
+    0x02, // bInterfaceSubClass
+    0x01, // bInterfaceProtocol
+    0x00, // iInterface
+
+                 /* FUNCTIONAL DESCRIPTOR (Header) [offset 36] */
+    0x05, // bFunctionalLength
+    USB_CDC_FUNCTIONAL_CS_INTERFACE, // bDescriptorType
+    0x00, // bDescriptorSubType
+    USB_DESC_WORD(0x0110), // bcdCDC
+
+                 /* FUNCTIONAL DESCRIPTOR (ACM) [offset 41] */
+    0x04, // bFunctionalLength
+    USB_CDC_FUNCTIONAL_CS_INTERFACE, // bDescriptorType
+    0x02, // bDescriptorSubType
+    0x02, // bmCapabilities
+
+                 /* FUNCTIONAL DESCRIPTOR (Union) [offset 45] */
+    0x05, // bFunctionalLength
+    USB_CDC_FUNCTIONAL_CS_INTERFACE, // bDescriptorType
+    0x06, // bDescriptorSubType
+    0x00, // bControlInterface
+    0x01, // bSubordinateInterface0
+
+                 /* FUNCTIONAL DESCRIPTOR (Call Management) [offset 50] */
+    0x05, // bFunctionalLength
+    USB_CDC_FUNCTIONAL_CS_INTERFACE, // bDescriptorType
+    0x01, // bDescriptorSubType
+    0x00, // bmCapabilities
+    0x01, // bDataInterface
+
+                 /* ENDPOINT DESCRIPTOR (In endpoint 2) [offset 55] */
+    0x07, // bLength
+    USB_DESC_TYPE_ENDPOINT, // bDescriptorType
+    0x82, // bEndpointAddress
+    0x03, // bmAttributes
+    USB_DESC_WORD(0x0040), // wMaxPacketSize
+    0x02, // bInterval
+
+                 /* INTERFACE DESCRIPTOR (Interface 1) [offset 62] */
+    0x09, // bLength
+    USB_DESC_TYPE_INTERFACE, // bDescriptorType
+    0x01, // bInterfaceNumber
+    0x00, // bAlternateSetting
+    0x02, // bNumEndpoints
+    0x0A, // bInterfaceClass
+    0x00, // bInterfaceSubClass
+    0x00, // bInterfaceProtocol
+    0x00, // iInterface
+
+                 /* ENDPOINT DESCRIPTOR (Out endpoint 3) [offset 71] */
+    0x07, // bLength
+    USB_DESC_TYPE_ENDPOINT, // bDescriptorType
+    0x03, // bEndpointAddress
+    0x02, // bmAttributes
+    USB_DESC_WORD(0x0040), // wMaxPacketSize
+    0x00, // bInterval
+
+                 /* ENDPOINT DESCRIPTOR (In endpoint 3) [offset 78] */
+    0x07, // bLength
+    USB_DESC_TYPE_ENDPOINT, // bDescriptorType
+    0x83, // bEndpointAddress
+    0x02, // bmAttributes
+    USB_DESC_WORD(0x0040), // wMaxPacketSize
+    0x00, // bInterval
+
+                 /* STRING DESCRIPTOR 0 (Supported languages) [offset 85] */
+    0x04, // bLength
+    USB_DESC_TYPE_STRING, // bDescriptorType
+    USB_DESC_WORD(0x0409), // wLANGID[0]
+
+                 /* STRING DESCRIPTOR 1 [offset 89] */
+    // "Silly-Bytes"
+    USB_DESC_STRING_LENGTH(11), // bLength
+    USB_DESC_TYPE_STRING, // bDescriptorType
+    'S', // bString (ASCII)
+    'i', // bString (ASCII)
+    'l', // bString (ASCII)
+    'l', // bString (ASCII)
+    'y', // bString (ASCII)
+    '-', // bString (ASCII)
+    'B', // bString (ASCII)
+    'y', // bString (ASCII)
+    't', // bString (ASCII)
+    'e', // bString (ASCII)
+    's', // bString (ASCII)
+
+                 /* STRING DESCRIPTOR 2 [offset 102] */
+    // "Virtual COM port"
+    USB_DESC_STRING_LENGTH(16), // bLength
+    USB_DESC_TYPE_STRING, // bDescriptorType
+    'V', // bString (ASCII)
+    'i', // bString (ASCII)
+    'r', // bString (ASCII)
+    't', // bString (ASCII)
+    'u', // bString (ASCII)
+    'a', // bString (ASCII)
+    'l', // bString (ASCII)
+    ' ', // bString (ASCII)
+    'C', // bString (ASCII)
+    'O', // bString (ASCII)
+    'M', // bString (ASCII)
+    ' ', // bString (ASCII)
+    'p', // bString (ASCII)
+    'o', // bString (ASCII)
+    'r', // bString (ASCII)
+    't', // bString (ASCII)
+
+             /****** PERSONALITY 1: vendor ******/
+
+                 /* DEVICE DESCRIPTOR [offset 120] */
+    0x12, // bLength
+    USB_DESC_TYPE_DEVICE, // bDescriptorType
+    USB_DESC_WORD(0x0200), // bcdUSB
+    0x00, // bDeviceClass
+    0x00, // bDeviceSubClass
+    0x00, // bDeviceProtocol
+    0x08, // bMaxPacketSize0
+    USB_DESC_WORD(0x04D8), // idVendor
+    USB_DESC_WORD(0x0112), // idProduct
+    USB_DESC_WORD(0x0000), // bcdDevice
+    0x01, // iManufacturer
+    0x02, // iProduct
+    0x00, // iSerialNumber
+    0x01, // bNumConfigurations
+
+                 /* CONFIGURATION DESCRIPTOR [offset 138] */
+    0x09, // bLength
+    USB_DESC_TYPE_CONFIGURATION, // bDescriptorType
+    USB_DESC_WORD(0x0020), // wTotalLength
+    0x01, // bNumInterfaces
+    0x01, // bConfigurationValue
+    0x00, // iConfiguration
+    0xA0, // bmAttributes
+    0x64, // bMaxPower
+
+                 /* INTERFACE DESCRIPTOR (Interface 0) [offset 147] */
+    0x09, // bLength
+    USB_DESC_TYPE_INTERFACE, // bDescriptorType
+    0x00, // bInterfaceNumber
+    0x00, // bAlternateSetting
+    0x02, // bNumEndpoints
+    0xFF, // bInterfaceClass
+    0x00, // bInterfaceSubClass
+    0x00, // bInterfaceProtocol
+    0x00, // iInterface
+
+                 /* ENDPOINT DESCRIPTOR (Out endpoint 3) [offset 156] */
+    0x07, // bLength
+    USB_DESC_TYPE_ENDPOINT, // bDescriptorType
+    0x03, // bEndpointAddress
+    0x02, // bmAttributes
+    USB_DESC_WORD(0x0040), // wMaxPacketSize
+    0x00, // bInterval
+
+                 /* ENDPOINT DESCRIPTOR (In endpoint 3) [offset 163] */
+    0x07, // bLength
+    USB_DESC_TYPE_ENDPOINT, // bDescriptorType
+    0x83, // bEndpointAddress
+    0x02, // bmAttributes
+    USB_DESC_WORD(0x0040), // wMaxPacketSize
+    0x00, // bInterval
+
+                 /* STRING DESCRIPTOR 0 (Supported languages) [offset 170] */
+    0x04, // bLength
+    USB_DESC_TYPE_STRING, // bDescriptorType
+    USB_DESC_WORD(0x0409), // wLANGID[0]
+
+                 /* STRING DESCRIPTOR 1 [offset 174] */
+    // "Silly-Bytes"
+    USB_DESC_STRING_LENGTH(11), // bLength
+    USB_DESC_TYPE_STRING, // bDescriptorType
+    'S', // bString (ASCII)
+    'i', // bString (ASCII)
+    'l', // bString (ASCII)
+    'l', // bString (ASCII)
+    'y', // bString (ASCII)
+    '-', // bString (ASCII)
+    'B', // bString (ASCII)
+    'y', // bString (ASCII)
+    't', // bString (ASCII)
+    'e', // bString (ASCII)
+    's', // bString (ASCII)
+
+                 /* STRING DESCRIPTOR 2 [offset 187] */
+    // "Bulk data port"
+    USB_DESC_STRING_LENGTH(14), // bLength
+    USB_DESC_TYPE_STRING, // bDescriptorType
+    'B', // bString (ASCII)
+    'u', // bString (ASCII)
+    'l', // bString (ASCII)
+    'k', // bString (ASCII)
+    ' ', // bString (ASCII)
+    'd', // bString (ASCII)
+    'a', // bString (ASCII)
+    't', // bString (ASCII)
+    'a', // bString (ASCII)
+    ' ', // bString (ASCII)
+    'p', // bString (ASCII)
+    'o', // bString (ASCII)
+    'r', // bString (ASCII)
+    't', // bString (ASCII)
+};
+
+
+
+/*
+ * PERSONALITY 0: cdc
+ *
+ * GET_DESCRIPTOR index: one entry per (type, index) pair, grouped by type so
+ * the requested entry is index[first[type] + index]
+ *
+ * { bDescriptorType, bIndex, bFlags, wOffset, wLength }
+ */
+static __code USB_DESC_INDEX_t USB_DESC_INDEX_CDC[] =
+{
+    { 0x01, 0, 0, 0, 18 },
+    { 0x02, 0, 0, 18, 67 },
+    { 0x03, 0, 0, 85, 4 },
+    { 0x03, 1, USB_DESC_FLAG_ASCII, 89, 24 },
+    { 0x03, 2, USB_DESC_FLAG_ASCII, 102, 34 }
+};
+
+// First index entry by descriptor type
+static __code unsigned char USB_DESC_FIRST_CDC[] = { 0, 0, 1, 2 };
+
+// Number of index entries by descriptor type
+static __code unsigned char USB_DESC_COUNT_CDC[] = { 0, 1, 1, 3 };
+
+// Enables every endpoint used by the configuration
+static void usb_setup_endpoints_cdc(void)
+{
+    // Endpoint 2: IN interrupt 64 bytes
+    UEP2 = USB_UEP_EPHSHK | USB_UEP_EPCONDIS | USB_UEP_EPINEN;
+    // Endpoint 3: OUT bulk 64 bytes, IN bulk 64 bytes
+    UEP3 = USB_UEP_EPHSHK | USB_UEP_EPCONDIS | USB_UEP_EPOUTEN | USB_UEP_EPINEN;
+}
+
+
+
+/*
+ * PERSONALITY 1: vendor
+ *
+ * GET_DESCRIPTOR index: one entry per (type, index) pair, grouped by type so
+ * the requested entry is index[first[type] + index]
+ *
+ * { bDescriptorType, bIndex, bFlags, wOffset, wLength }
+ */
+static __code USB_DESC_INDEX_t USB_DESC_INDEX_VENDOR[] =
+{
+    { 0x01, 0, 0, 120, 18 },
+    { 0x02, 0, 0, 138, 32 },
+    { 0x03, 0, 0, 170, 4 },
+    { 0x03, 1, USB_DESC_FLAG_ASCII, 174, 24 },
+    { 0x03, 2, USB_DESC_FLAG_ASCII, 187, 30 }
+};
+
+// First index entry by descriptor type
+static __code unsigned char USB_DESC_FIRST_VENDOR[] = { 0, 0, 1, 2 };
+
+// Number of index entries by descriptor type
+static __code unsigned char USB_DESC_COUNT_VENDOR[] = { 0, 1, 1, 3 };
+
+// Enables every endpoint used by the configuration
+static void usb_setup_endpoints_vendor(void)
+{
+    // Endpoint 3: OUT bulk 64 bytes, IN bulk 64 bytes
+    UEP3 = USB_UEP_EPHSHK | USB_UEP_EPCONDIS | USB_UEP_EPOUTEN | USB_UEP_EPINEN;
+}
+
+
+
+/*
+ * PERSONALITIES
+ *
+ * Descriptors sets the device can switch between at run time, indexed by
+ * USB_PERSONALITY_<NAME>
+ */
+__code USB_PERSONALITY_t USB_PERSONALITIES[] =
+{
+    // cdc
+    {
+        USB_DESC_INDEX_CDC,
+        USB_DESC_FIRST_CDC,
+        USB_DESC_COUNT_CDC,
+        1,
+        usb_setup_endpoints_cdc
+    },
+
+    // vendor
+    {
+        USB_DESC_INDEX_VENDOR,
+        USB_DESC_FIRST_VENDOR,
+        USB_DESC_COUNT_VENDOR,
+        1,
+        usb_setup_endpoints_vendor
+    }
+};
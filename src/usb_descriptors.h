@@ -0,0 +1,69 @@
+/*
+ * File: 	usb_descriptors.h
+ * Compiler: sdcc (Version 3.4.0)
+ *
+ *
+ * [!] GENERATED FILE, DO NOT EDIT
+ *
+ * Generated by scripts/usb_descgen.py from usb_device.spec
+ */
+
+
+#ifndef _USB_DESCRIPTORS_H
+#define _USB_DESCRIPTORS_H
+
+
+
+// Endpoint 0 max packet size (bMaxPacketSize0)
+#define USB_EP0_SIZE 8
+
+// Personalities (descriptors sets)
+#define USB_PERSONALITY_COUNT 2
+#define USB_PERSONALITY_CDC 0
+#define USB_PERSONALITY_VENDOR 1
+
+// Highest endpoint number used (by any personality)
+#define USB_EP_LAST 3
+
+// Endpoints max packet sizes (largest among personalities), 0 when the
+// endpoint is not used
+#define USB_EP1_OUT_SIZE 0
+#define USB_EP1_IN_SIZE 0
+#define USB_EP2_OUT_SIZE 0
+#define USB_EP2_IN_SIZE 64
+#define USB_EP3_OUT_SIZE 64
+#define USB_EP3_IN_SIZE 64
+#define USB_EP4_OUT_SIZE 0
+#define USB_EP4_IN_SIZE 0
+#define USB_EP5_OUT_SIZE 0
+#define USB_EP5_IN_SIZE 0
+#define USB_EP6_OUT_SIZE 0
+#define USB_EP6_IN_SIZE 0
+#define USB_EP7_OUT_SIZE 0
+#define USB_EP7_IN_SIZE 0
+#define USB_EP8_OUT_SIZE 0
+#define USB_EP8_IN_SIZE 0
+#define USB_EP9_OUT_SIZE 0
+#define USB_EP9_IN_SIZE 0
+#define USB_EP10_OUT_SIZE 0
+#define USB_EP10_IN_SIZE 0
+#define USB_EP11_OUT_SIZE 0
+#define USB_EP11_IN_SIZE 0
+#define USB_EP12_OUT_SIZE 0
+#define USB_EP12_IN_SIZE 0
+#define USB_EP13_OUT_SIZE 0
+#define USB_EP13_IN_SIZE 0
+#define USB_EP14_OUT_SIZE 0
+#define USB_EP14_IN_SIZE 0
+#define USB_EP15_OUT_SIZE 0
+#define USB_EP15_IN_SIZE 0
+
+// Highest descriptor type found in the first/count tables
+#define USB_DESC_TYPE_LAST 0x03
+
+// Descriptors blob and personalities table
+extern __code unsigned char USB_DESCRIPTORS[];
+extern __code USB_PERSONALITY_t USB_PERSONALITIES[];
+
+
+#endif // _USB_DESCRIPTORS_H
@@ -0,0 +1,107 @@
+#
+# USB DEVICE SPECIFICATION
+#
+# Describes the device personalities, each one with 1 configuration only. The
+# descriptors in usb_descriptors.c / usb_descriptors.h are generated from this
+# file by scripts/usb_descgen.py (run 'make' after editing it)
+#
+# Syntax: one keyword per line followed by key=value pairs, '#' starts a
+# comment. Lengths, counts and string indexes are computed by the generator
+#
+# Every 'personality <name>' line starts a complete descriptors set, the
+# firmware can switch between them at run time (see usb_set_personality()).
+# The first personality is the default one
+#
+#
+#                      /****** PERSONALITY: cdc ******/
+#
+# CDC/ACM device (virtual COM port)
+#
+# CONFIGURATION DESCRIPTOR hierarchy (USB/CDC):
+#     - Configuration Descriptor
+#         - Interface Descriptor (Communications)
+#             - Functional Descriptor (Header)
+#             - Functional Descriptor (ACM)
+#             - Functional Descriptor (Union)
+#             - Functional Descriptor (Call Management)
+#             - EndPoint Descriptor (Notification Element)
+#         - Interface Descriptor (Data)
+#             - EndPoint Descriptor (Data Out)
+#             - EndPoint Descriptor (Data In)
+#
+
+
+personality cdc
+
+# CDC device class, using the "Microchip" Vendor ID and an arbitrary Product ID
+# Endpoint 0 max packet size is 8 bytes (SetUp packet size)
+device vendor=0x04D8 product=0x0111 release=0x0000 class=0x02 ep0=8
+
+# English (USB languages specification: page 5)
+language 0x0409
+
+manufacturer "Silly-Bytes"
+product "Virtual COM port"
+
+# Bus powered configuration, takes up to 200mA from the bus, can wake the host
+# up (see USB_REMOTE_WAKEUP in usb_config.h)
+configuration value=1 attributes=buspowered,remotewakeup power=200
+
+
+# Communications interface, Abstract Control Model with V250 protocol
+interface class=0x02 subclass=0x02 protocol=0x01
+
+    # USB CDC 1.2 compliant
+    cdc_header cdc=0x0110
+
+    # Support "line" requests
+    cdc_acm capabilities=0x02
+
+    # Interface 0 is the control interface, interface 1 is subordinate
+    cdc_union control=0 subordinate=1
+
+    # Don't handle call management, interface 1 is data class
+    cdc_call_management capabilities=0x00 data=1
+
+    # Notification element: In endpoint 2, poll every 2 milliseconds
+    endpoint address=0x82 type=interrupt size=64 interval=2
+
+
+# Data interface
+interface class=0x0A subclass=0x00 protocol=0x00
+
+    # Data Out: Out endpoint 3
+    endpoint address=0x03 type=bulk size=64
+
+    # Data In: In endpoint 3
+    endpoint address=0x83 type=bulk size=64
+
+
+
+#                     /****** PERSONALITY: vendor ******/
+#
+# Vendor specific device with a single bulk interface, same data endpoints as
+# the CDC data interface, without the CDC/ACM control overhead
+
+personality vendor
+
+# Vendor specific class, a different Product ID so the host binds another
+# driver
+device vendor=0x04D8 product=0x0112 release=0x0000 class=0x00 ep0=8
+
+language 0x0409
+
+manufacturer "Silly-Bytes"
+product "Bulk data port"
+
+configuration value=1 attributes=buspowered,remotewakeup power=200
+
+
+# Vendor specific interface
+interface class=0xFF subclass=0x00 protocol=0x00
+
+    # Data Out: Out endpoint 3
+    endpoint address=0x03 type=bulk size=64
+
+    # Data In: In endpoint 3
+    endpoint address=0x83 type=bulk size=64
@@ -0,0 +1,112 @@
+/*
+ * File: 	usb_hot.h
+ * Compiler: sdcc (Version 3.4.0)
+ *
+ *
+ * [!] This file contains the USB state accessed by the interrupt handler on
+ * every transaction, collected in one struct placed in the access bank so the
+ * handler reaches it without bank switching (BANKSEL/MOVLB)
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _USB_HOT_H
+#define _USB_HOT_H
+
+#include "usb_config.h"
+
+
+
+/*******************************************************************************
+                                   HOT STATE
+
+                 See PIC18F4550 datasheet: page 66 section 5.3.2
+*******************************************************************************/
+
+typedef struct
+{
+    // Device current state (USB_STATE_* in usb.h)
+    volatile unsigned char device_state;
+    volatile unsigned char device_address;
+    volatile unsigned char current_configuration;
+
+    // Control transfer current state (see usbcdc.c)
+    unsigned char ep0_stage;
+    unsigned char ep0_ascii;
+    unsigned char ep0_zlp;
+    unsigned char ep0_in_dts;
+    unsigned char ep0_pending_address;
+    unsigned char ep0_pending_personality;
+    unsigned short ep0_offset;
+    unsigned short ep0_bytes;
+    const unsigned char *ep0_data;
+
+    // Last transaction status (USTAT), read by the endpoint handlers
+    unsigned char ustat;
+
+    // Frame clock: extended frame number and Timer 1 at its SOF
+    unsigned long frame;
+    unsigned short frame_timer;
+
+    // Deferred events queue, free running indexes (see usbcdc.c)
+    volatile unsigned char ev_head;
+    volatile unsigned char ev_tail;
+
+    // Data endpoint rings, free running indexes (see usbcdc.c)
+    volatile unsigned char rx_head;
+    volatile unsigned char rx_tail;
+    volatile unsigned char tx_head;
+    volatile unsigned char tx_tail; // Oldest byte not acknowledged yet
+    unsigned char tx_send; // Next byte to copy to an IN BD
+
+    // Data endpoint buffer descriptors state
+    volatile unsigned char rx_held; // OUT BDs waiting for RX ring room
+    unsigned char rx_held_odd; // First held OUT BD
+    volatile unsigned char in_armed; // IN BDs owned by the SIE
+    unsigned char in_odd; // Next IN BD to arm
+    unsigned char out_dts; // Data toggle of the next OUT BD armed
+    unsigned char in_dts; // Data toggle of the next IN BD armed
+    unsigned char out_odd; // Next OUT BD the SIE fills
+
+    // ENDPOINT_HALT set, one bit per endpoint direction (USB_USTAT_INDEX)
+    unsigned short ep_halted;
+
+} USB_HOT_t;
+
+
+// Placement: absolute address in the access bank or wherever SDCC chooses
+#if USB_HOT_ACCESS_BANK
+#define USB_HOT_PLACEMENT __at(USB_HOT_ADDR)
+#else
+#define USB_HOT_PLACEMENT __data
+#endif
+
+// Access bank end (exclusive), General Purpose Registers part
+#define USB_ACCESS_BANK_LIMIT 0x60
+
+extern USB_HOT_t USB_HOT_PLACEMENT USB_HOT;
+
+// Device current state
+#define USB_DEVICE_STATE (USB_HOT.device_state)
+#define USB_DEVICE_ADDRESS (USB_HOT.device_address)
+#define USB_DEVICE_CURRENT_CONFIGURATION (USB_HOT.current_configuration)
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+#endif // _USB_HOT_H
@@ -77,34 +77,130 @@ typedef struct
 } BUFFER_DESC_t;
 
 
+// STAT bits (CPU mode), used to arm a buffer descriptor with a single write
+#define USB_BD_UOWN 0x80 // The SIE owns the buffer descriptor
+#define USB_BD_DTS 0x40 // DATA1 packet (DATA0 if not set)
+#define USB_BD_KEN 0x20 // The SIE keeps ownership forever
+#define USB_BD_INCDIS 0x10 // Address increment disabled
+#define USB_BD_DTSEN 0x08 // Data toggle synchronization enabled
+#define USB_BD_BSTALL 0x04 // Buffer stall enabled
+
+
 
 /*
  * ----------------------------------------------------------------
- *                       BUFFER DESCRIPTORS
+ *                   BUFFER DESCRIPTORS TABLE (BDT)
  *
- * See PIC18F4550 datasheet: page 175 figure 17-7
+ * See PIC18F4550 datasheet: page 175 figure 17-7 and page 177 table 17-4
  *
- * - Endpoints buffer descriptors are allocated after 400h
+ * - Endpoints buffer descriptors are allocated from 400h
  * - Each BD take 4 bytes
+ * - The table layout depends on the ping-pong buffering mode (UCFG PPB1:PPB0)
  *
- * Memory position formula: (base_direction + endpoint_number * 8)
+ * BD index formula (dir: OUT = 0, IN = 1; odd: ping-pong buffer):
  *
- * Base direction: (OUT endpoint = 400), (IN endpoint = 404)
+ *   Mode 0 (no ping-pong):                  2 * ep + dir
+ *   Mode 1 (ping-pong on EP0 OUT only):     EP0: (dir ? 2 : odd)
+ *                                           EPn: 2 * ep + 1 + dir
+ *   Mode 2 (ping-pong on all endpoints):    4 * ep + 2 * dir + odd
+ *   Mode 3 (ping-pong on all but EP0):      EP0: dir
+ *                                           EPn: 4 * ep - 2 + 2 * dir + odd
  *
  *------------------------------------------------------------------
  */
 
-// Endpoint 0 buffer descriptors
-extern volatile BUFFER_DESC_t __at(0x0400 + (0 * 8)) EP0_OUT;
-extern volatile BUFFER_DESC_t __at(0x0404 + (0 * 8)) EP0_IN;
-
-// Unused Endpoint 1-3 buffer descriptors
-//extern volatile BUFFER_DESC_t __at(0x0400 + 1 * 8) EP1_OUT;
-//extern volatile BUFFER_DESC_t __at(0x0404 + 1 * 8) EP1_IN;
-//extern volatile BUFFER_DESC_t __at(0x0400 + 2 * 8) EP2_OUT;
-//extern volatile BUFFER_DESC_t __at(0x0404 + 2 * 8) EP2_IN;
-//extern volatile BUFFER_DESC_t __at(0x0400 + 3 * 8) EP3_OUT;
-//extern volatile BUFFER_DESC_t __at(0x0404 + 3 * 8) EP3_IN;
+// BDT base address (USB RAM start)
+#define USB_BDT_ADDR 0x0400
+
+// USB RAM end (exclusive), dual port RAM banks 4 to 7
+#define USB_RAM_LIMIT 0x0800
+
+// Data memory end (exclusive, SFRs from 0xF60) and program memory size
+#define USB_DATA_MEMORY_LIMIT 0x1000
+#define USB_PROGRAM_MEMORY_SIZE 0x8000
+
+// Ping-pong buffering modes, UCFG PPB1:PPB0 value
+#define USB_PP_NONE 0
+#define USB_PP_EP0_OUT 1
+#define USB_PP_ALL 2
+#define USB_PP_ALL_BUT_EP0 3
+
+// BD index of endpoint 'ep' direction 'dir' (ping-pong buffer 'odd')
+#define USB_BD_INDEX(mode, ep, dir, odd) \
+    ( (mode) == USB_PP_NONE ? 2 * (ep) + (dir) : \
+      (mode) == USB_PP_EP0_OUT ? \
+        ( (ep) == 0 ? ( (dir) ? 2 : (odd) ) : 2 * (ep) + 1 + (dir) ) : \
+      (mode) == USB_PP_ALL ? 4 * (ep) + 2 * (dir) + (odd) : \
+        ( (ep) == 0 ? (dir) : 4 * (ep) - 2 + 2 * (dir) + (odd) ) )
+
+// Number of buffers (1 or 2) of endpoint 'ep' direction 'dir'
+#define USB_PP_BUFFERS(mode, ep, dir) \
+    ( (mode) == USB_PP_ALL || \
+      ( (mode) == USB_PP_EP0_OUT && (ep) == 0 && (dir) == 0 ) || \
+      ( (mode) == USB_PP_ALL_BUT_EP0 && (ep) != 0 ) ? 2 : 1 )
+
+// BDT entries needed when 'last' is the highest endpoint in use
+#define USB_BDT_ENTRIES(mode, last) \
+    ( USB_BD_INDEX(mode, last, 1, USB_PP_BUFFERS(mode, last, 1) - 1) + 1 )
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                            ENDPOINT CONTROL REGISTER
+
+                 See PIC18F4550 datasheet: page 169 register 17-3
+*******************************************************************************/
+
+// UEPn bits
+#define USB_UEP_EPSTALL 0x01 // Endpoint stalled
+#define USB_UEP_EPINEN 0x02 // Endpoint input enabled
+#define USB_UEP_EPOUTEN 0x04 // Endpoint output enabled
+#define USB_UEP_EPCONDIS 0x08 // Control (SETUP) transfers disabled
+#define USB_UEP_EPHSHK 0x10 // Endpoint handshake enabled
+
+// Control register of endpoint 'ep' (UEP0 to UEP15 are consecutive)
+#define USB_UEP(ep) ((&UEP0)[ep])
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+
+/*******************************************************************************
+                             USB INTERRUPT REGISTERS
+
+           See PIC18F4550 datasheet: page 181 register 17-7, page 169 17-4
+*******************************************************************************/
+
+// UIR / UIE bits
+#define USB_UIR_URSTIF 0x01 // USB reset
+#define USB_UIR_UERRIF 0x02 // USB error (see UEIR)
+#define USB_UIR_ACTVIF 0x04 // Bus activity detected
+#define USB_UIR_TRNIF 0x08 // Transaction complete (see USTAT)
+#define USB_UIR_IDLEIF 0x10 // Idle (3 ms) detected
+#define USB_UIR_STALLIF 0x20 // A STALL handshake was sent
+#define USB_UIR_SOFIF 0x40 // Start Of Frame token received
+
+// UEIR / UEIE bits
+#define USB_UEIR_PIDEF 0x01 // PID check failure
+#define USB_UEIR_CRC5EF 0x02 // Token packet CRC5 error
+#define USB_UEIR_CRC16EF 0x04 // Data packet CRC16 error
+#define USB_UEIR_DFN8EF 0x08 // Data field size not a whole number of bytes
+#define USB_UEIR_BTOEF 0x10 // Bus turnaround time-out
+#define USB_UEIR_BTSEF 0x80 // Bit stuff error
+#define USB_UEIR_ALL 0x9F
+
+// USTAT bits
+#define USB_USTAT_PPBI 0x02 // Odd ping-pong buffer
+#define USB_USTAT_DIR 0x04 // IN transaction (OUT or SETUP if not set)
+#define USB_USTAT_ENDP 0x78 // Endpoint number (bits 6:3)
+
+// USTAT endpoint and direction as an index: 2 * ENDP + DIR
+#define USB_USTAT_INDEX(ustat) ((ustat) >> 2)
 
 /*******************************************************************************
 *******************************************************************************/
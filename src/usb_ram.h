@@ -0,0 +1,226 @@
+/*
+ * File: 	usb_ram.h
+ * Compiler: sdcc (Version 3.4.0)
+ *
+ *
+ * [!] This file contains the compile time USB RAM allocator: buffer descriptors
+ * table and endpoint buffers are laid out from the endpoints max packet sizes
+ * (usb_descriptors.h, generated from usb_device.spec) and the ping-pong mode
+ * (usb_config.h). Layout errors are reported at compile time
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _USB_RAM_H
+#define _USB_RAM_H
+
+#include "usb.h"
+#include "usb_pic.h"
+#include "usb_config.h"
+#include "usb_descriptors.h"
+
+
+// Compile time check, a negative array size breaks the build
+#define USB_STATIC_ASSERT(name, condition) \
+    typedef char USB_ASSERT_##name[(condition) ? 1 : -1]
+
+
+
+/*******************************************************************************
+                                     LAYOUT
+
+     [ BDT | EP0 OUT | EP0 IN | EP1 OUT | EP1 IN | ... | EP15 IN | EXTRA ]
+
+ Both buffers of a ping-pong pair are contiguous (even first), unused endpoints
+ take no space
+*******************************************************************************/
+
+// EP0 sizes, with the same naming as the other endpoints
+#define USB_EP0_OUT_SIZE USB_EP0_SIZE
+#define USB_EP0_IN_SIZE USB_EP0_SIZE
+
+// BDT entries in use
+#define USB_BDT_SIZE USB_BDT_ENTRIES(USB_PING_PONG_MODE, USB_EP_LAST)
+
+// Bytes taken by endpoint 'ep' direction 'dir' (OUT or IN) buffers
+#define USB_RAM_SPAN(ep, dir) \
+    ( USB_EP##ep##_##dir##_SIZE * \
+      USB_PP_BUFFERS(USB_PING_PONG_MODE, ep, USB_DIR_##dir) )
+
+#define USB_DIR_OUT 0
+#define USB_DIR_IN 1
+
+// Endpoint buffers addresses (PIC data memory)
+#define USB_RAM_EP0_OUT_ADDR USB_RAM_BUFFERS_ADDR
+#define USB_RAM_EP0_IN_ADDR \
+    (USB_RAM_EP0_OUT_ADDR + USB_RAM_SPAN(0, OUT))
+#define USB_RAM_EP1_OUT_ADDR \
+    (USB_RAM_EP0_IN_ADDR + USB_RAM_SPAN(0, IN))
+#define USB_RAM_EP1_IN_ADDR \
+    (USB_RAM_EP1_OUT_ADDR + USB_RAM_SPAN(1, OUT))
+#define USB_RAM_EP2_OUT_ADDR \
+    (USB_RAM_EP1_IN_ADDR + USB_RAM_SPAN(1, IN))
+#define USB_RAM_EP2_IN_ADDR \
+    (USB_RAM_EP2_OUT_ADDR + USB_RAM_SPAN(2, OUT))
+#define USB_RAM_EP3_OUT_ADDR \
+    (USB_RAM_EP2_IN_ADDR + USB_RAM_SPAN(2, IN))
+#define USB_RAM_EP3_IN_ADDR \
+    (USB_RAM_EP3_OUT_ADDR + USB_RAM_SPAN(3, OUT))
+#define USB_RAM_EP4_OUT_ADDR \
+    (USB_RAM_EP3_IN_ADDR + USB_RAM_SPAN(3, IN))
+#define USB_RAM_EP4_IN_ADDR \
+    (USB_RAM_EP4_OUT_ADDR + USB_RAM_SPAN(4, OUT))
+#define USB_RAM_EP5_OUT_ADDR \
+    (USB_RAM_EP4_IN_ADDR + USB_RAM_SPAN(4, IN))
+#define USB_RAM_EP5_IN_ADDR \
+    (USB_RAM_EP5_OUT_ADDR + USB_RAM_SPAN(5, OUT))
+#define USB_RAM_EP6_OUT_ADDR \
+    (USB_RAM_EP5_IN_ADDR + USB_RAM_SPAN(5, IN))
+#define USB_RAM_EP6_IN_ADDR \
+    (USB_RAM_EP6_OUT_ADDR + USB_RAM_SPAN(6, OUT))
+#define USB_RAM_EP7_OUT_ADDR \
+    (USB_RAM_EP6_IN_ADDR + USB_RAM_SPAN(6, IN))
+#define USB_RAM_EP7_IN_ADDR \
+    (USB_RAM_EP7_OUT_ADDR + USB_RAM_SPAN(7, OUT))
+#define USB_RAM_EP8_OUT_ADDR \
+    (USB_RAM_EP7_IN_ADDR + USB_RAM_SPAN(7, IN))
+#define USB_RAM_EP8_IN_ADDR \
+    (USB_RAM_EP8_OUT_ADDR + USB_RAM_SPAN(8, OUT))
+#define USB_RAM_EP9_OUT_ADDR \
+    (USB_RAM_EP8_IN_ADDR + USB_RAM_SPAN(8, IN))
+#define USB_RAM_EP9_IN_ADDR \
+    (USB_RAM_EP9_OUT_ADDR + USB_RAM_SPAN(9, OUT))
+#define USB_RAM_EP10_OUT_ADDR \
+    (USB_RAM_EP9_IN_ADDR + USB_RAM_SPAN(9, IN))
+#define USB_RAM_EP10_IN_ADDR \
+    (USB_RAM_EP10_OUT_ADDR + USB_RAM_SPAN(10, OUT))
+#define USB_RAM_EP11_OUT_ADDR \
+    (USB_RAM_EP10_IN_ADDR + USB_RAM_SPAN(10, IN))
+#define USB_RAM_EP11_IN_ADDR \
+    (USB_RAM_EP11_OUT_ADDR + USB_RAM_SPAN(11, OUT))
+#define USB_RAM_EP12_OUT_ADDR \
+    (USB_RAM_EP11_IN_ADDR + USB_RAM_SPAN(11, IN))
+#define USB_RAM_EP12_IN_ADDR \
+    (USB_RAM_EP12_OUT_ADDR + USB_RAM_SPAN(12, OUT))
+#define USB_RAM_EP13_OUT_ADDR \
+    (USB_RAM_EP12_IN_ADDR + USB_RAM_SPAN(12, IN))
+#define USB_RAM_EP13_IN_ADDR \
+    (USB_RAM_EP13_OUT_ADDR + USB_RAM_SPAN(13, OUT))
+#define USB_RAM_EP14_OUT_ADDR \
+    (USB_RAM_EP13_IN_ADDR + USB_RAM_SPAN(13, IN))
+#define USB_RAM_EP14_IN_ADDR \
+    (USB_RAM_EP14_OUT_ADDR + USB_RAM_SPAN(14, OUT))
+#define USB_RAM_EP15_OUT_ADDR \
+    (USB_RAM_EP14_IN_ADDR + USB_RAM_SPAN(14, IN))
+#define USB_RAM_EP15_IN_ADDR \
+    (USB_RAM_EP15_OUT_ADDR + USB_RAM_SPAN(15, OUT))
+#define USB_RAM_EXTRA_ADDR \
+    (USB_RAM_EP15_IN_ADDR + USB_RAM_SPAN(15, IN))
+#define USB_RAM_END (USB_RAM_EXTRA_ADDR + USB_RAM_EXTRA_SIZE)
+
+// Max packet size of endpoint 'ep' direction 'dir' ('ep' may be a macro)
+#define USB_EP_SIZE(ep, dir) USB_EP_SIZE_(ep, dir)
+#define USB_EP_SIZE_(ep, dir) USB_EP##ep##_##dir##_SIZE
+
+// Address of endpoint 'ep' direction 'dir' buffer 'odd' (0 without ping-pong)
+#define USB_RAM_EP_ADDR(ep, dir, odd) USB_RAM_EP_ADDR_(ep, dir, odd)
+#define USB_RAM_EP_ADDR_(ep, dir, odd) \
+    (USB_RAM_EP##ep##_##dir##_ADDR + (odd) * USB_EP##ep##_##dir##_SIZE)
+
+// Free USB RAM bytes
+#define USB_RAM_FREE (USB_RAM_LIMIT - USB_RAM_END)
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                     CHECKS
+*******************************************************************************/
+
+USB_STATIC_ASSERT(ping_pong_mode_is_valid, USB_PING_PONG_MODE <= 3);
+
+USB_STATIC_ASSERT(ep_last_is_valid, USB_EP_LAST <= 15);
+
+USB_STATIC_ASSERT(buffers_dont_overlap_bdt,
+    USB_RAM_BUFFERS_ADDR >= USB_BDT_ADDR + 4 * USB_BDT_SIZE);
+
+USB_STATIC_ASSERT(usb_ram_doesnt_overflow, USB_RAM_END <= USB_RAM_LIMIT);
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/*******************************************************************************
+                                  DECLARATIONS
+
+ Buffer descriptors and buffers are accessed through these two arrays only, so
+ the layout can be mapped on non PIC targets too. Defined in usbcdc.c
+*******************************************************************************/
+
+#if USB_RAM_ARRAY
+
+// The whole data memory (SFRs included) and program memory as arrays, defined
+// by the target (see sim/). The stack only reads the program memory
+extern volatile unsigned char USB_DATA_MEMORY[USB_DATA_MEMORY_LIMIT];
+extern unsigned char USB_PROGRAM_MEMORY[USB_PROGRAM_MEMORY_SIZE];
+
+// USB RAM (USB_BDT_ADDR to USB_RAM_LIMIT)
+#define USB_RAM (USB_DATA_MEMORY + USB_BDT_ADDR)
+
+#define USB_BDT ((volatile BUFFER_DESC_t *) USB_RAM)
+#define USB_RAM_BUFFERS (USB_RAM + (USB_RAM_BUFFERS_ADDR - USB_BDT_ADDR))
+
+#else
+
+// Buffer descriptors table
+extern volatile BUFFER_DESC_t __at(USB_BDT_ADDR) USB_BDT[USB_BDT_SIZE];
+
+// Endpoint buffers (and extra bytes)
+extern volatile unsigned char __at(USB_RAM_BUFFERS_ADDR)
+    USB_RAM_BUFFERS[USB_RAM_END - USB_RAM_BUFFERS_ADDR];
+
+#endif
+
+// Buffer descriptor of endpoint 'ep' direction 'dir' (OUT or IN) buffer 'odd'
+#define USB_BD(ep, dir, odd) \
+    (USB_BDT[USB_BD_INDEX(USB_PING_PONG_MODE, ep, USB_DIR_##dir, odd)])
+
+// BDT index of the transaction reported by USTAT value 'ustat'
+#define USB_USTAT_BD_INDEX(ustat) \
+    USB_BD_INDEX(USB_PING_PONG_MODE, (ustat) >> 3, ((ustat) >> 2) & 1, \
+        ((ustat) >> 1) & 1)
+
+// Buffer descriptor of the transaction reported by USTAT value 'ustat'
+#define USB_USTAT_BD(ustat) (USB_BDT[USB_USTAT_BD_INDEX(ustat)])
+
+// Pointer to the buffer at PIC address 'addr'
+#define USB_RAM_PTR(addr) (&USB_RAM_BUFFERS[(addr) - USB_RAM_BUFFERS_ADDR])
+
+// Pointer to endpoint 'ep' direction 'dir' buffer 'odd'
+#define USB_EP_BUFFER(ep, dir, odd) USB_RAM_PTR(USB_RAM_EP_ADDR(ep, dir, odd))
+
+// Application bytes reserved with USB_RAM_EXTRA_SIZE
+#define USB_RAM_EXTRA USB_RAM_PTR(USB_RAM_EXTRA_ADDR)
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+#endif // _USB_RAM_H
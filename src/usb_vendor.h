@@ -0,0 +1,259 @@
+/*
+ * File: 	usb_vendor.h
+ * Compiler: sdcc (Version 3.4.0)
+ *
+ *
+ * [!] This file contains the vendor specific control requests understood by
+ * the device firmware. Host tools include it too, so keep it free of PIC
+ * specific definitions
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _USB_VENDOR_H
+#define _USB_VENDOR_H
+
+
+
+/*******************************************************************************
+                                VENDOR REQUESTS
+
+    bmRequestType: 0x40 (OUT, vendor, device) or 0xC0 (IN, vendor, device)
+*******************************************************************************/
+
+// bmRequestType values
+#define USB_VENDOR_REQ_TYPE_OUT 0x40
+#define USB_VENDOR_REQ_TYPE_IN 0xC0
+
+
+/*
+ * SET_PERSONALITY (OUT, no data stage)
+ *
+ * wValue: personality number (see usb_device.spec)
+ *
+ * The device detaches from the bus after the status stage, on the next main
+ * loop pass (see usb_set_personality()), and attaches again with the new
+ * descriptors set
+ */
+#define USB_VENDOR_REQ_SET_PERSONALITY 0x01
+
+
+/*
+ * GET_PERSONALITY (IN, 1 byte)
+ *
+ * Returns the current personality number
+ */
+#define USB_VENDOR_REQ_GET_PERSONALITY 0x02
+
+
+/*
+ * GET_TRN_STATS (IN, 2 * (USB_TRNIF_MAX_PER_ENTRY + 2) bytes)
+ *
+ * Returns 16 bits little endian counters (wrapping), only if the firmware was
+ * built with USB_TRN_STATS (stalled otherwise):
+ *
+ *   [0]    Always 0: calls without transactions (other events) don't count
+ *   [n]    usb_handler() calls that handled n transactions, n from 1 to
+ *          USB_TRNIF_MAX_PER_ENTRY. With USB_INTERRUPT_PRIORITY each
+ *          transaction counts in the handler that drained it, high or low
+ *   [last] Calls that stopped at USB_TRNIF_MAX_PER_ENTRY with TRNIF still set
+ *
+ * Counters are never cleared, the host works with differences
+ */
+#define USB_VENDOR_REQ_GET_TRN_STATS 0x03
+
+
+/*
+ * GET_CYCLES (IN, 2 * USB_CYCLES_SLOTS bytes)
+ *
+ * Returns the worst case instruction cycles (83.3ns each) per call, 16 bits
+ * little endian, only if the firmware was built with USB_CYCLES (stalled
+ * otherwise). Interrupt context save and restore is not included
+ *
+ * CLEAR_CYCLES (OUT, no data stage) starts over
+ */
+#define USB_VENDOR_REQ_GET_CYCLES 0x04
+#define USB_VENDOR_REQ_CLEAR_CYCLES 0x05
+
+
+/*
+ * GET_TIMESTAMPS (IN, 6 * (USB_FRAME_SAMPLES + 1) bytes)
+ *
+ * Returns (frame, timer) pairs, frame: 32 bits, timer: 16 bits, both little
+ * endian, only if the firmware was built with USB_FRAME_CLOCK (stalled
+ * otherwise). Timer 1 counts instruction cycles (12 per microsecond, 12000
+ * per frame at the nominal clock)
+ *
+ *   [0 .. USB_FRAME_SAMPLES - 1]   Last SOFs, oldest first: extended frame
+ *                                  number and Timer 1 when its SOF was handled
+ *   [USB_FRAME_SAMPLES]            Now (SETUP handled): frame number of the
+ *                                  last SOF handled and Timer 1
+ *
+ * Every timer is raw Timer 1. Consecutive SOF samples give the device clock
+ * against the host frame clock. The last pair places device timestamps
+ * (usb_timestamp()) on it: the phase now is its timer minus the last sample
+ * timer, whole frames over it are SOFs not handled yet. scripts/usb_clock.py
+ * does both
+ */
+#define USB_VENDOR_REQ_GET_TIMESTAMPS 0x06
+#define USB_FRAME_CYCLES 12000
+
+
+/*
+ * GET_RESUME_STATS (IN, 2 * USB_RESUME_STATS_SLOTS bytes)
+ *
+ * Returns 16 bits little endian values, only if the firmware was built with
+ * USB_RESUME_STATS (stalled otherwise): Timer 3 ticks (8 instruction cycles,
+ * 0.67us each) from the resume (bus activity while suspended, or remote
+ * wakeup start) to the first transaction, 0xFFFF if over 43ms
+ *
+ * Counters are never cleared, the host works with differences
+ */
+#define USB_VENDOR_REQ_GET_RESUME_STATS 0x07
+#define USB_RESUME_TICK_CYCLES 8
+
+/*
+ * GET_PROFILE (IN, 8 * slots bytes)
+ *
+ * Returns one entry per profiled handler, only if the firmware was built with
+ * USB_PROFILE (stalled otherwise): calls (16 bits), worst case cycles (16
+ * bits) and total cycles (32 bits), little endian, all of them wrapping.
+ * Cycles include the handler callees (a request handler shows in its
+ * endpoint 0 handler too), not the interrupt context save and restore
+ *
+ * The table is read as it is sent: the request itself may show in the last
+ * entries. Slots from USB_PROFILE_EP on are the transaction handlers by USTAT
+ * endpoint and direction (2 * endpoint + 1 if IN), up to the last endpoint
+ * used by the firmware (the reply size tells)
+ *
+ * CLEAR_PROFILE (OUT, no data stage) starts over
+ */
+#define USB_VENDOR_REQ_GET_PROFILE 0x08
+#define USB_VENDOR_REQ_CLEAR_PROFILE 0x09
+
+// GET_PROFILE reply slots
+#define USB_PROFILE_HANDLER 0 // usb_handler() (also inside usb_task())
+#define USB_PROFILE_RESET 1 // handle_urstif()
+#define USB_PROFILE_STANDARD 2 // handle_standard_request()
+#define USB_PROFILE_CLASS 3 // handle_class_request()
+#define USB_PROFILE_VENDOR 4 // handle_vendor_request()
+#define USB_PROFILE_GET_DESCRIPTOR 5 // handle_req_get_descriptor()
+#define USB_PROFILE_EP 6 // Transaction handlers (USB_EP_HANDLERS in usbcdc.c)
+
+
+/*
+ * GET_LATENCY (IN, 2 * USB_LATENCY_BUCKETS * 2 * (USB_EP_LAST + 1) bytes)
+ *
+ * Returns one histogram per endpoint direction (2 * endpoint + 1 if IN), only
+ * if the firmware was built with USB_LATENCY (stalled otherwise): 16 bits
+ * little endian counters (wrapping) of transactions by the Timer 1 ticks (8
+ * instruction cycles, 0.67us each) their buffer descriptor was armed before
+ * completion. Bucket 0 counts 0 and 1 tick, bucket n from 2^n to 2^(n+1) - 1
+ * ticks, up to 43ms: longer waits (an idle bulk endpoint) wrap
+ *
+ * CLEAR_LATENCY (OUT, no data stage) starts over
+ */
+#define USB_VENDOR_REQ_GET_LATENCY 0x0A
+#define USB_VENDOR_REQ_CLEAR_LATENCY 0x0B
+#define USB_LATENCY_TICK_CYCLES 8
+#define USB_LATENCY_BUCKETS 16
+
+
+/*
+ * GET_ERRORS (IN, 2 * USB_ERRORS_SLOTS bytes)
+ *
+ * Returns 16 bits little endian counters (wrapping), only if the firmware was
+ * built with USB_ERROR_STATS (stalled otherwise), one per USB_ERRORS_* slot:
+ * bus errors by type (UEIR, noise on the cable), then protocol events
+ *
+ * Counters are never cleared, the host works with differences
+ */
+#define USB_VENDOR_REQ_GET_ERRORS 0x0C
+
+
+/*
+ * PEEK (IN, wLength bytes) / POKE (OUT, wLength bytes)
+ *
+ * Read / write memory, only if the firmware was built with USB_PEEK_POKE and
+ * unlocked (see UNLOCK), stalled otherwise. wValue is the address, wIndex low
+ * byte the memory space (USB_PEEK_*), wIndex high byte the program memory
+ * address bits 23:16
+ *
+ * Data memory (RAM and SFRs, 0x000 to 0xFFF) is written in place as the DATA
+ * stage packets come. Program memory is written by rows: wLength
+ * USB_PEEK_ROW_SIZE, wValue row aligned, erased and written by the main loop
+ * (usb_task() / usb_process_events()) once the DATA stage is done. The CPU
+ * stalls some 6ms, the STATUS stage is NAKed until the row is written
+ *
+ * PEEK_STREAM / PEEK_STREAM_PROGRAM (OUT, no data stage)
+ *
+ * Same as PEEK for wIndex bytes of data memory / program memory (below 64KB)
+ * from wValue, sent through the data IN endpoint instead of endpoint 0: the
+ * host reads exactly wIndex bytes there (max packet sized packets, bytes
+ * queued by usb_cdc_putc() wait behind them). Stalled while not configured
+ *
+ * UNLOCK (OUT, no data stage)
+ *
+ * With a USB_PEEK_POKE_KEY (stalled without), wValue the key and wIndex its
+ * complement unlock the memory requests until the next bus reset. Anything
+ * else is stalled and locks them
+ */
+#define USB_VENDOR_REQ_PEEK 0x0D
+#define USB_VENDOR_REQ_POKE 0x0E
+#define USB_VENDOR_REQ_PEEK_STREAM 0x0F
+#define USB_VENDOR_REQ_PEEK_STREAM_PROGRAM 0x10
+#define USB_VENDOR_REQ_UNLOCK 0x11
+
+
+// GET_RESUME_STATS reply slots
+#define USB_RESUME_LAST 0 // Last resume latency
+#define USB_RESUME_WORST 1 // Worst resume latency
+#define USB_RESUME_COUNT 2 // Resumes measured (wrapping)
+#define USB_RESUME_STATS_SLOTS 3
+
+// GET_ERRORS reply slots, bus errors in UEIR bits order
+#define USB_ERRORS_PID 0 // PID check failure (UEIR PIDEF)
+#define USB_ERRORS_CRC5 1 // Token CRC5 (CRC5EF)
+#define USB_ERRORS_CRC16 2 // Data CRC16 (CRC16EF)
+#define USB_ERRORS_DFN8 3 // Data not a whole number of bytes (DFN8EF)
+#define USB_ERRORS_BTO 4 // Bus turnaround time-out (BTOEF)
+#define USB_ERRORS_BTS 5 // Bit stuff error (BTSEF)
+#define USB_ERRORS_STALL 6 // STALL handshakes sent
+#define USB_ERRORS_NAK 7 // Held (NAKing) OUT BDs armed again
+#define USB_ERRORS_REARM 8 // Endpoint 0 OUT BD armed again by the recovery
+#define USB_ERRORS_RESET 9 // Bus resets
+#define USB_ERRORS_SUSPEND 10 // Suspends
+#define USB_ERRORS_SLOTS 11
+
+// PEEK / POKE memory spaces (wIndex low byte)
+#define USB_PEEK_DATA 0x00 // RAM and SFRs
+#define USB_PEEK_PROGRAM 0x01 // Flash
+
+// Program memory write row (PIC18F4550 erase block)
+#define USB_PEEK_ROW_SIZE 64
+
+// GET_CYCLES reply slots
+#define USB_CYCLES_HANDLER 0 // usb_handler() (also inside usb_task())
+#define USB_CYCLES_TASK 1 // usb_task()
+#define USB_CYCLES_EVENTS 2 // usb_process_events()
+#define USB_CYCLES_SLOTS 3
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+#endif // _USB_VENDOR_H
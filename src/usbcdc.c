@@ -24,11 +24,18 @@
  */
 
 
-#include <pic18f4550.h>
+#include <pic18fregs.h> // Device registers and Sleep()
 #include "usb.h"
 #include "usb_cdc.h"
 #include "usb_pic.h"
+#include "usb_config.h"
+#include "usb_descriptors.h"
+#include "usb_ram.h"
+#include "usb_vendor.h"
 #include "usbcdc.h"
+#if USB_ERROR_PRINTF
+#include "util/printf.h"
+#endif
 
 
 /*******************************************************************************
@@ -37,9 +44,19 @@
                  See USB 2.0 specification: page 241, table 9-1
 *******************************************************************************/
 
-volatile unsigned char USB_DEVICE_STATE;
-volatile unsigned char USB_DEVICE_ADDRESS;
-volatile unsigned char USB_DEVICE_CURRENT_CONFIGURATION;
+// Device state and control transfer state, hot in the interrupt handler
+USB_HOT_t USB_HOT_PLACEMENT USB_HOT;
+
+USB_STATIC_ASSERT(hot_state_fits_access_bank, !USB_HOT_ACCESS_BANK ||
+    USB_HOT_ADDR + sizeof(USB_HOT_t) <= USB_ACCESS_BANK_LIMIT);
+
+// Active descriptors set (see usb_device.spec)
+static __code USB_PERSONALITY_t *USB_PERSONALITY;
+static unsigned char USB_PERSONALITY_NUMBER;
+
+// SET_PERSONALITY done (STATUS stage sent), bit 7 flags it: the main loop
+// switches (see usb_personality_switch())
+static volatile unsigned char USB_PERSONALITY_SWITCH;
 
 /*******************************************************************************
 *******************************************************************************/
@@ -55,31 +72,134 @@ volatile unsigned char USB_DEVICE_CURRENT_CONFIGURATION;
 // General USB Handler
 void usb_handler(void);
 
-    // Interrupt handling
-    static void handle_actvif(void);
-    static void handle_idleif(void);
-    static void handle_stallif(void);
-    static void handle_uerrif(void);
-    static void handle_sofif(void);
+// Two priority levels USB Handlers
+void usb_handler_high(void);
+void usb_handler_low(void);
+
+// Polling mode USB Handler
+void usb_task(void);
+
+// Deferred events handler
+void usb_process_events(void);
+
+// Shared by every handler flavor
+static void usb_service(void);
+
+// SET_PERSONALITY, from the main loop (usb_task, usb_process_events)
+static void usb_personality_switch(void);
+
+// Frame clock
+#if USB_FRAME_CLOCK
+static void usb_frame_clock(void);
+#endif
+#if USB_FRAME_CLOCK || USB_LATENCY
+static unsigned short usb_timer1(void);
+#endif
+
+// Transfer latency (Timer 1)
+#if USB_LATENCY
+static void usb_latency_arm(unsigned char bd);
+static void usb_latency_done(unsigned char ustat);
+#endif
+#if USB_DEFERRED_EVENTS
+static void usb_queue_event(void);
+#endif
+
+// Cycles measurement (Timer 3)
+#if USB_CYCLES || USB_PROFILE
+static unsigned short usb_cycles_now(void);
+#endif
+#if USB_CYCLES
+static void usb_cycles_record(unsigned char which, unsigned short start);
+#endif
+#if USB_PROFILE
+static void usb_profile_record(unsigned char slot, unsigned short start);
+#endif
+
+// Bus attachment
+static void usb_attach(void);
+static void usb_detach(void);
+static void usb_delay_ms(unsigned short ms);
+
+// Suspend and resume
+#if USB_IE_IDLE
+static void usb_suspend(void);
+static void usb_resume(void);
+#endif
+#if USB_RESUME_STATS
+static void usb_resume_record(void);
+#endif
+
+    // Interrupt handling (rare events are handled inline by usb_handler)
     static void handle_urstif(void);
+#if USB_IE_UERR
+    static void handle_uerrif(void);
+#endif
+#if USB_IE_UERR || USB_IE_STALL
+    static void ep0_recover(void);
+#endif
 
-    // Transactions handling (By endpoint)
-    static void handle_trnif(void);
+    // Transactions handling (By endpoint, see USB_EP_HANDLERS)
+    static void ep_unused_handler(void);
 
         // Control transfers handling
-        static void control_transfer_handler(void);
+        static void control_out_handler(void);
+        static void control_in_handler(void);
+
+            // Endpoint 0 data and status stages
+            static void ep0_send(const unsigned char *data,
+                    unsigned short size);
+            static void ep0_ack(void);
+            static void ep0_receive(unsigned char *data,
+                    void (*done)(void));
+            static void ep0_send_packet(void);
+            static void ep0_receive_packet(void);
+            static void ep0_status_in(void);
+            static void ep0_arm_setup(void);
 
             // Requests handling
+            static void handle_standard_request(void);
+            static void handle_class_request(void);
+            static void handle_vendor_request(void);
             static void handle_req_get_status(void);
             static void handle_req_clear_feature(void);
             static void handle_req_set_feature(void);
             static void handle_req_set_address(void);
-            static void handle_req_get_descriptor(unsigned char
-                    **descriptor, unsigned char *size);
+            static void handle_req_get_descriptor(void);
             static void handle_req_get_configuration(void);
             static void handle_req_set_configuration(void);
             static void handle_req_get_interface(void);
             static void handle_req_set_interface(void);
+            static void cdc_line_coding_received(void);
+
+            // Endpoint halt (ENDPOINT_HALT feature)
+            static unsigned char ep_request_index(void);
+            static void ep_halt(unsigned char index, unsigned char halt);
+            static void ep_halt_reset(void);
+
+        // Data endpoint handling
+        static void data_out_handler(void);
+        static void data_in_handler(void);
+        static void data_reset(void);
+        static void data_bus_reset(void);
+        static void data_reset_trn(unsigned char ustat);
+        static void data_rx_hold(unsigned char odd);
+        static void data_arm_out(unsigned char odd);
+        static unsigned char data_rx_push(unsigned char odd);
+        static void data_rx_release(void);
+        static void data_tx_kick(void);
+        static void data_halt(unsigned char dir);
+
+        // Memory access (USB_PEEK_POKE)
+#if USB_PEEK_POKE
+        static unsigned long peek_request_address(void);
+        static const unsigned char *peek_pointer(unsigned char space,
+                unsigned long address);
+        static void poke_row_received(void);
+        static void poke_program_pending(void);
+        static void poke_program_row(void);
+        static void poke_flash_cycle(unsigned char eecon1);
+#endif
 
 
 /*******************************************************************************
@@ -87,35 +207,29 @@ void usb_handler(void);
 
 
 
-
-
 /*******************************************************************************
-                             ENDPOINT 0 definition
+                               ENDPOINT HANDLERS
 
-    Endpoint 0 out buffer starts at 0500h in data memory,
-    is 8 bytes long [0500h - 0507h]
+    Transaction handlers indexed by the USTAT endpoint and direction
+    (USB_USTAT_INDEX), the handlers read the whole USTAT from USB_HOT.ustat
 
-    Endpoint 0 out buffer starts at 0508h in data memory,
-    is 64 bytes long [0508h - 056Bh]
-
-                       See PIC18F4550 datasheet: page 170
+                       See PIC18F4550 datasheet: page 168
 *******************************************************************************/
 
-// EP0 Buffer size in bytes
-#define EP0_OUT_BUFFER_SIZE 8 // SetUp packet size
-#define EP0_IN_BUFFER_SIZE 64
-
-// Endpoint 0 buffers location
-#define EP0_OUT_BUFFER  0x0500
-#define EP0_IN_BUFFER  0x0508
+typedef void (*USB_EP_HANDLER_t)(void);
 
-// Endpoint 0 buffer descriptors allocation
-volatile BUFFER_DESC_t __at(0x0400 + (0 * 8)) EP0_OUT;
-volatile BUFFER_DESC_t __at(0x0404 + (0 * 8)) EP0_IN;
-
-// Setup Packet is allocated in the out endpoint 0 buffer
-volatile USB_SETUP_PACKET_t __at(EP0_OUT_BUFFER) SETUP_PACKET;
+static __code USB_EP_HANDLER_t USB_EP_HANDLERS[] =
+{
+    control_out_handler, control_in_handler, // EP0 OUT, IN
+    ep_unused_handler, ep_unused_handler, // EP1
+    ep_unused_handler, ep_unused_handler, // EP2 (CDC notifications)
+    data_out_handler, data_in_handler, // EP3 (USB_DATA_EP)
+};
 
+// One entry per endpoint direction up to USB_EP_LAST
+USB_STATIC_ASSERT(ep_handlers_cover_endpoints, sizeof(USB_EP_HANDLERS) ==
+    2 * (USB_EP_LAST + 1) * sizeof(USB_EP_HANDLER_t));
+USB_STATIC_ASSERT(ep_handlers_data_ep, USB_DATA_EP == 3);
 
 /*******************************************************************************
 *******************************************************************************/
@@ -125,452 +239,635 @@ volatile USB_SETUP_PACKET_t __at(EP0_OUT_BUFFER) SETUP_PACKET;
 
 
 /*******************************************************************************
-                             DESCRIPTORS definitions
+                                    USB RAM
 
-    Describe a CDC/ACM device with 1 configuration only
-
-    * Descriptors are placed into code memory so we can safe a lot of RAM
+    Buffer descriptors table and endpoint buffers, laid out by usb_ram.h
 
+                       See PIC18F4550 datasheet: page 170
 *******************************************************************************/
 
+// The control transfer handler uses single EP0 buffers
+USB_STATIC_ASSERT(ep0_has_no_ping_pong,
+    USB_PING_PONG_MODE == USB_PP_NONE ||
+    USB_PING_PONG_MODE == USB_PP_ALL_BUT_EP0);
 
-/*
- * DEVICE DESCRIPTOR
- *
- * This is a CDC Device class descriptor with one configuration only
-*/
-__code USB_DESC_DEVICE_t DEVICE_DESC =
-{
-    // bLength: Total device descriptor size
-    sizeof(USB_DESC_DEVICE_t),
-
-    // bDescriptorType: Device descriptor
-    USB_DESC_TYPE_DEVICE,
-
-    // bcdUSB: USB 2.0 compliant device
-    USB_DEVICE_BCDUSB,
-
-    // bDeviceClass: CDC device Class
-    USB_CDC_CLASS_DEVICE,
-
-    // bDeviceSubClass: No device SubClass
-    0x00,
-
-    // bDeviceProtocol: No device Protocol
-    0x00,
-
-    // bMaxPacketSize0: Max End Point 0 packet size is End Point 0 Buffer size
-    EP0_OUT_BUFFER_SIZE,
-
-    // idVendor: Using the "Microchip" Vendor ID
-    0x04D8,
-
-    // idProduct: Using arbitrary Product ID
-    0x0111,
-
-    // bcdDevice: No device version
-    0x0000,
-
-    // iManufacturer: Manufacturer description text
-    0x01,
+#if !USB_RAM_ARRAY
+volatile BUFFER_DESC_t __at(USB_BDT_ADDR) USB_BDT[USB_BDT_SIZE];
 
-    // iProduct: Product description text
-    0x02,
-
-    // iSerialNumber: No serial number text
-    0x00,
-
-    // bNumConfigurations: This device has one configuration only
-    0x01
-};
+volatile unsigned char __at(USB_RAM_BUFFERS_ADDR)
+    USB_RAM_BUFFERS[USB_RAM_END - USB_RAM_BUFFERS_ADDR];
+#endif
 
+/*******************************************************************************
+*******************************************************************************/
 
 
 
+/*******************************************************************************
+                             ENDPOINT 0 definition
 
-/*
- * CONFIGURATION DESCRIPTOR
- *
- * This device has one configuration only
- *
- * This a USB/CDC (Communications Device Class) configuration
- *
- * The configuration descriptor should contain the complete interface, endpoint
- * and class specific descriptors hierarchy
- *
- * CONFIGURATION DESCRIPTOR hierarchy (USB/CDC):
- *     - Configuration Descriptor
- *         - Interface Descriptor (Communications)
- *             - Functional Descriptor (Header)
- *             - Functional Descriptor (ACM)
- *             - Functional Descriptor (Union)
- *             - Functional Descriptor (Call Management)
- *             - EndPoint Descriptor (Notification Element)
- *         - Interface Descriptor (Data)
- *             - EndPoint Descriptor (Data Out)
- *             - EndPoint Descriptor (Data In)
-*/
+    Endpoint 0 out and in buffers are USB_EP0_SIZE bytes long
+    (bMaxPacketSize0, see usb_device.spec)
+*******************************************************************************/
 
-struct
-{
-    USB_DESC_CONFIGURATION_t CONFIGURATION_DESC;
+// EP0 Buffer size in bytes
+#define EP0_OUT_BUFFER_SIZE USB_EP0_SIZE // SetUp packet size
+#define EP0_IN_BUFFER_SIZE USB_EP0_SIZE
 
-        USB_DESC_INTERFACE_t INTERFACE_DESC_COMMUNICATIONS;
-            USB_CDC_DESC_FUNCTIONAL_HEADER_t FUNCTIONAL_DESC_HEADER;
-            USB_CDC_DESC_FUNCTIONAL_ABSTRACT_CONTROL_MANAGEMENT_t FUNCTIONAL_DESC_ACM;
-            USB_CDC_DESC_FUNCTIONAL_UNION_t FUNCTIONAL_DESC_UNION;
-            USB_CDC_DESC_FUNCTIONAL_CALL_MANAGEMENT_t FUNCTIONAL_DESC_CALL_MANAGEMENT;
-            USB_DESC_EP_t EP_DESC_NOTIFICATION_ELEMENT;
+// Endpoint 0 buffers location (PIC address, for the buffer descriptors)
+#define EP0_OUT_BUFFER USB_RAM_EP_ADDR(0, OUT, 0)
+#define EP0_IN_BUFFER USB_RAM_EP_ADDR(0, IN, 0)
 
-        USB_DESC_INTERFACE_t INTERFACE_DESC_DATA;
-            USB_DESC_EP_t EP_DESC_OUT;
-            USB_DESC_EP_t EP_DESC_IN;
-}
+// Endpoint 0 buffers
+#define EP0_IN_DATA USB_EP_BUFFER(0, IN, 0)
 
+// Endpoint 0 buffer descriptors
+#define EP0_OUT USB_BD(0, OUT, 0)
+#define EP0_IN USB_BD(0, IN, 0)
 
-/*
- * CONFIGURATION
- *
- * Contains whole configuration descriptors hierarchy
- */
-__code CONFIGURATION_0 =
-{
-                         /* CONFIGURATION_DESCRIPTOR */
-    {
-    // bLength:             Configuration Descriptor size
-    sizeof(USB_DESC_CONFIGURATION_t),
+// Setup Packet is allocated in the out endpoint 0 buffer
+#define SETUP_PACKET \
+    (*(volatile USB_SETUP_PACKET_t*) USB_EP_BUFFER(0, OUT, 0))
 
-    // bDescriptorType:     Configuration descriptor
-    USB_DESC_TYPE_CONFIGURATION,
 
-    // wTotalLength:        Whole configuration hierarchy size
-    sizeof(CONFIGURATION_0),
+/*******************************************************************************
+*******************************************************************************/
 
-    // bNumInterfaces:      This configuration has 2 interfaces
-    0x02,
 
-    // bConfigurationValue: Index value for this configuration
-    0x01,
 
-    // iConfiguration:      No configuration description text
-    0x00,
 
-    // bmAttributes:        Bus Powered configuration
-    USB_CONFIGURATION_BUSPOWERED,
 
-    // bMaxPower:           This configuration takes up to 200mA from the bus
-    USB_CONFIGURATION_MAXPOWER
-    },
+/*******************************************************************************
+                         CONTROL TRANSFER CURRENT STATE
 
+                 See USB 2.0 specification: page 225, section 8.5.3
+*******************************************************************************/
 
+// Control transfer stages
+#define EP0_STAGE_SETUP 0x00 // Waiting for a SETUP transaction
+#define EP0_STAGE_DATA_IN 0x01 // Sending the DATA IN stage
+#define EP0_STAGE_STATUS_IN 0x02 // Sending the zero length STATUS stage
+#define EP0_STAGE_STALL 0x03 // Request not supported
+#define EP0_STAGE_DATA_OUT 0x04 // Receiving the DATA OUT stage
 
-                   /* INTERFACE_DESCRIPTOR_COMMUNICATIONS */
-    {
-    // bLength: Interface Descriptor size
-    sizeof(USB_DESC_INTERFACE_t),
+// The per transfer variables live in the hot state struct (usb_hot.h)
 
-    // bDescriptorType: Interface descriptor
-    USB_DESC_TYPE_INTERFACE,
+// Current control transfer stage
+#define EP0_STAGE (USB_HOT.ep0_stage)
 
-    // bInterfaceNumber: This is interface 0
-    0x00,
+// Data to send during the control transfer
+#define EP0_DATA (USB_HOT.ep0_data)
 
-    // bAlternateSetting: Alternate setting number
-    0x00,
+// Position of the next byte to send (as seen by the host)
+#define EP0_OFFSET (USB_HOT.ep0_offset)
 
-    // bNumEndpoints: This interface has 1 endpoint
-    0x01,
+// Pending number of bytes to send during the control transfer
+#define EP0_BYTES (USB_HOT.ep0_bytes)
 
-    // bInterfaceClass: Communications interface class
-    USB_CDC_CLASS_INTERFACE_COM,
+// EP0_DATA is an ASCII string descriptor to be sent as UTF-16LE
+#define EP0_ASCII (USB_HOT.ep0_ascii)
 
-    // bInterfaceSubClass: Abstract Control Model sub class
-    USB_CDC_SUBCLASS_INTERFACE_ACM,
+// A zero length packet must end the DATA IN stage (USB 2.0 spec: page 256)
+#define EP0_ZLP (USB_HOT.ep0_zlp)
 
-    // bInterfaceProtocol: V250 protocol
-    USB_CDC_PROTOCOL_INTERFACE_V250,
+// Data toggle of the next IN packet (DATA1 follows the SETUP packet)
+#define EP0_IN_DTS (USB_HOT.ep0_in_dts)
 
-    // iInterface: No interface description text
-    0x00
-    },
+// Address set by SET_ADDRESS, applied once the STATUS stage is done
+#define EP0_PENDING_ADDRESS (USB_HOT.ep0_pending_address)
 
+// Personality set by SET_PERSONALITY, applied once the STATUS stage is done
+#define EP0_PENDING_PERSONALITY \
+    (USB_HOT.ep0_pending_personality)
 
+// Small replies built in RAM (GET_STATUS, GET_CONFIGURATION, GET_INTERFACE)
+static unsigned char EP0_REPLY[2];
 
-                       /* FUNCTIONAL_DESCRIPTOR_HEADER */
-    {
-    // bFunctionalLength: Header FD size
-    sizeof(USB_CDC_DESC_FUNCTIONAL_HEADER_t),
+// DATA OUT stage destination, EP0_BYTES are still to come
+static unsigned char *EP0_RECEIVE;
 
-    // bDescriptorType: Interface descriptor type
-    USB_CDC_FUNCTIONAL_CS_INTERFACE,
+// Called once the DATA OUT stage is received, before the STATUS stage
+static void (*EP0_RECEIVED)(void);
 
-    // bDescriptorSubType: Header FD
-    USB_CDC_FUNCTIONAL_HEADER,
+// No such endpoint (see ep_request_index())
+#define EP_NONE 0xFF
 
-    // bcdCDC: USB CDC 1.2 compliant
-    USB_CDC_HEADER_BCDUSB
-    },
+// USB_HOT.ep_halted bit of endpoint direction 'index' (USB_USTAT_INDEX)
+#define EP_HALT_BIT(index) ((unsigned short) 1 << (index))
 
+/*******************************************************************************
+*******************************************************************************/
 
 
-                        /* FUNCTIONAL_DESCRIPTOR_ACM */
-    {
-    // bFunctionalLength: ACM FD size
-    sizeof(USB_CDC_DESC_FUNCTIONAL_ABSTRACT_CONTROL_MANAGEMENT_t),
 
-    // bDescriptorType: Interface descriptor type
-    USB_CDC_FUNCTIONAL_CS_INTERFACE,
 
-    // bDescriptorSubType: ACM FD
-    USB_CDC_FUNCTIONAL_ACM,
 
-    // bmCapabilities: Support "line" requests
-    USB_CDC_ACM_BMCAPABILITIES
-    },
+/*******************************************************************************
+                                CDC LINE STATE
 
+    SET_LINE_CODING / SET_CONTROL_LINE_STATE class requests to the
+    communications interface (USB_PERSONALITY_CDC interface 0). Nothing uses
+    them on the device side (no UART behind), the host expects them to work:
+    Linux cdc_acm fails open() if SET_CONTROL_LINE_STATE is stalled
+*******************************************************************************/
 
+#define CDC_COMM_INTERFACE 0
 
-                       /* FUNCTIONAL_DESCRIPTOR_UNION */
-    {
-    // bFunctionalLength: Union FD size
-    sizeof(USB_CDC_DESC_FUNCTIONAL_UNION_t),
+// Line coding (see usb_cdc.h), 115200 8N1 until the host sets it
+static unsigned char CDC_LINE_CODING[USB_CDC_LINE_CODING_SIZE] =
+    { 0x00, 0xC2, 0x01, 0x00, USB_CDC_STOP_BITS_1, USB_CDC_PARITY_NONE, 8 };
 
-    // bDescriptorType: Interface descriptor type
-    USB_CDC_FUNCTIONAL_CS_INTERFACE,
+// USB_CDC_LINE_DTR / USB_CDC_LINE_RTS, dropped by bus resets
+static unsigned char CDC_LINE_STATE;
 
-    // bDescriptorSubType: Union FD
-    USB_CDC_FUNCTIONAL_UNION,
+/*******************************************************************************
+*******************************************************************************/
 
-    // bControlInterface: Interface 0 is the control interface
-    // (communication class)
-    0x00,
 
-    // bSubordinateInterface0: Interface 1 is subordinate (data class)
-    0x01
-    },
 
 
 
-                  /* FUNCTIONAL_DESCRIPTOR_CALL_MANAGEMENT */
-    {
-    // bFunctionalLength: CM FD size
-    sizeof(USB_CDC_DESC_FUNCTIONAL_CALL_MANAGEMENT_t),
+/*******************************************************************************
+                                 DATA ENDPOINT
 
-    // bDescriptorType: Interface descriptor type
-    USB_CDC_FUNCTIONAL_CS_INTERFACE,
+    Bulk OUT and IN endpoint USB_DATA_EP (see usb_device.spec), with one or
+    two (ping-pong) buffer descriptors per direction
 
-    // bDescriptorSubType: CM FD
-    USB_CDC_FUNCTIONAL_CALL_MANAGEMENT,
+    Received packets are copied to the RX ring, an OUT BD is held (the host
+    gets NAKs) while the ring hasn't room for its packet. The TX ring is copied
+    to the IN BDs as they complete, its bytes are freed once acknowledged. Ring
+    indexes are free running, the application moves RX tail / TX head, the
+    interrupt handler the other ones
 
-    // bmCapabilities: Don't handle call management
-    USB_CDC_CALL_MANAGEMENT_BMCAPABILITIES,
+    A bus reset only stops the endpoint: rings and held packets are kept,
+    unacknowledged IN packets go back to the TX ring (see USB_TX_STALE_MS)
+*******************************************************************************/
 
-    // bDataInterface: Interface 1 is data class
-    0x01
-    },
+// Max packet sizes
+#define DATA_OUT_SIZE USB_EP_SIZE(USB_DATA_EP, OUT)
+#define DATA_IN_SIZE USB_EP_SIZE(USB_DATA_EP, IN)
 
+// Buffer descriptors per direction (1 or 2), odd buffer toggle mask
+#define DATA_PP USB_PP_BUFFERS(USB_PING_PONG_MODE, USB_DATA_EP, 0)
+#define DATA_PP_MASK (DATA_PP - 1)
 
+// Buffer descriptors
+#define DATA_OUT(odd) USB_BD(USB_DATA_EP, OUT, odd)
+#define DATA_IN(odd) USB_BD(USB_DATA_EP, IN, odd)
 
-                 /* ENDPOINT_DESCRIPTOR_NOTIFICATION_ELEMENT */
-    {
-    // bLength: Endpoint descriptor size
-    sizeof(USB_DESC_EP_t),
+// USB_HOT.ep_halted bits (see data_halt())
+#define DATA_HALT_OUT EP_HALT_BIT(2 * USB_DATA_EP + USB_DIR_OUT)
+#define DATA_HALT_IN EP_HALT_BIT(2 * USB_DATA_EP + USB_DIR_IN)
 
-    // bDescriptorType: Endpoint descriptor
-    USB_DESC_TYPE_ENDPOINT,
+// Rings
+#define RX_RING_MASK (USB_RX_RING_SIZE - 1)
+#define TX_RING_MASK (USB_TX_RING_SIZE - 1)
 
-    // bEndpointAddress: In endpoint 2
-    USB_EP_02_IN,
+static unsigned char RX_RING[USB_RX_RING_SIZE];
+static unsigned char TX_RING[USB_TX_RING_SIZE];
 
-    // bmAttributes: Interrupt endpoint
-    USB_EP_INTERRUPT,
+USB_STATIC_ASSERT(data_ep_is_used,
+    DATA_OUT_SIZE > 0 && DATA_IN_SIZE > 0 && USB_DATA_EP <= USB_EP_LAST);
+USB_STATIC_ASSERT(rx_ring_size_is_valid, USB_RX_RING_SIZE <= 128 &&
+    (USB_RX_RING_SIZE & RX_RING_MASK) == 0 && USB_RX_RING_SIZE >= DATA_OUT_SIZE);
+USB_STATIC_ASSERT(tx_ring_size_is_valid, USB_TX_RING_SIZE <= 128 &&
+    (USB_TX_RING_SIZE & TX_RING_MASK) == 0);
+USB_STATIC_ASSERT(tx_stale_ms_is_valid,
+    USB_TX_STALE_MS < 2048 || USB_TX_STALE_MS == 0xFFFF);
 
-    // wMaxPacketSize: 64 bytes max packet
-    0x40,
+// Frame number (UFRM) of the last bus reset, for USB_TX_STALE_MS
+static unsigned short DATA_RESET_FRAME;
 
-    // bInterval: Poll every 2 milliseconds
-    0x02
-    },
+// usb_handler() calls by transactions handled (1 and up, [0] stays 0), plus
+// calls that hit the bound (see GET_TRN_STATS in usb_vendor.h)
+#if USB_TRN_STATS
+static unsigned short USB_TRN_STATS_COUNT[USB_TRNIF_MAX_PER_ENTRY + 2];
+#endif
 
+USB_STATIC_ASSERT(trnif_max_per_entry_is_valid, USB_TRNIF_MAX_PER_ENTRY >= 1);
 
+// Errors and protocol events (see GET_ERRORS in usb_vendor.h)
+#if USB_ERROR_STATS
+static unsigned short USB_ERRORS_COUNT[USB_ERRORS_SLOTS];
 
-                        /* INTERFACE_DESCRIPTOR_DATA */
-    {
-    // bLength: Interface descriptor size
-    sizeof(USB_DESC_INTERFACE_t),
+#define USB_ERROR_COUNT(slot) (USB_ERRORS_COUNT[slot]++)
+#else
+#define USB_ERROR_COUNT(slot)
+#endif
 
-    // bDescriptorType: Interface descriptor
-    USB_DESC_TYPE_INTERFACE,
+USB_STATIC_ASSERT(error_printf_has_stats, !USB_ERROR_PRINTF || USB_ERROR_STATS);
 
-    // bInterfaceNumber: This is interface 1
-    0x01,
+#if USB_CYCLES
+static unsigned short USB_CYCLES_MAX[USB_CYCLES_SLOTS];
+#endif
 
-    // bAlternateSetting: Alternate setting number
-    0x00,
+// Handlers profile (see GET_PROFILE in usb_vendor.h), USB_PROFILE_CALL()
+// measures CALL into SLOT and costs nothing when compiled out
+#if USB_PROFILE
+typedef struct
+{
+    unsigned short calls;
+    unsigned short max;
+    unsigned long total;
+} USB_PROFILE_t;
+
+#define USB_PROFILE_SLOTS (USB_PROFILE_EP + 2 * (USB_EP_LAST + 1))
+
+static USB_PROFILE_t USB_PROFILE_TABLE[USB_PROFILE_SLOTS];
+
+#define USB_PROFILE_CALL(slot, call) \
+    do \
+    { \
+        unsigned char profile_slot = (slot); \
+        unsigned short profile_start = usb_cycles_now(); \
+        call; \
+        usb_profile_record(profile_slot, profile_start); \
+    } while( 0 )
+#else
+#define USB_PROFILE_CALL(slot, call) call
+#endif
+
+// Trace ring (see usb_trace_drain()): USB_TRACE_EVENT() writes a record
+// inline, head and tail count records (wrapping)
+#if USB_TRACE
+#define USB_TRACE_MASK (USB_TRACE_SIZE - 1)
+
+static unsigned char USB_TRACE_RING[4 * USB_TRACE_SIZE];
+static volatile unsigned char USB_TRACE_HEAD;
+static volatile unsigned char USB_TRACE_TAIL;
+static volatile unsigned char USB_TRACE_DROPPED;
+static unsigned char USB_TRACE_SENT; // Bytes of the tail record sent
+
+#define USB_TRACE_EVENT(id, ustat, stat) \
+    do \
+    { \
+        if( (unsigned char) (USB_TRACE_HEAD - USB_TRACE_TAIL) < \
+                USB_TRACE_SIZE ) \
+        { \
+            unsigned char *trace_record = \
+                &USB_TRACE_RING[(USB_TRACE_HEAD & USB_TRACE_MASK) << 2]; \
+            trace_record[0] = ((id) << 3) | (UFRMH & 0x07); \
+            trace_record[1] = (ustat); \
+            trace_record[2] = (stat); \
+            trace_record[3] = UFRML; \
+            USB_TRACE_HEAD++; \
+        } \
+        else if( USB_TRACE_DROPPED != 0xFF ) \
+        { \
+            USB_TRACE_DROPPED++; \
+        } \
+    } while( 0 )
+#else
+#define USB_TRACE_EVENT(id, ustat, stat)
+#endif
+
+USB_STATIC_ASSERT(trace_size_is_valid, !USB_TRACE ||
+    (USB_TRACE_SIZE <= 64 && (USB_TRACE_SIZE & (USB_TRACE_SIZE - 1)) == 0));
+
+// Transfer latency (see GET_LATENCY in usb_vendor.h): Timer 1 when each BD
+// was armed, histograms by USTAT endpoint and direction
+#if USB_LATENCY
+static unsigned short USB_LATENCY_ARMED[USB_BDT_SIZE];
+static unsigned short
+    USB_LATENCY_HIST[2 * (USB_EP_LAST + 1)][USB_LATENCY_BUCKETS];
+
+#define USB_LATENCY_ARM(ep, dir, odd) \
+    usb_latency_arm(USB_BD_INDEX(USB_PING_PONG_MODE, ep, USB_DIR_##dir, odd))
+#define USB_LATENCY_DONE(ustat) usb_latency_done(ustat)
+#else
+#define USB_LATENCY_ARM(ep, dir, odd)
+#define USB_LATENCY_DONE(ustat)
+#endif
+
+USB_STATIC_ASSERT(frame_clock_owns_timer1, !(USB_FRAME_CLOCK && USB_LATENCY));
+
+// The BD of endpoint EP direction DIR (OUT or IN) buffer ODD was just given
+// to the SIE, the transaction reported by USTAT value 'ustat' completed
+#define USB_BD_ARMED(ep, dir, odd) \
+    do \
+    { \
+        USB_LATENCY_ARM(ep, dir, odd); \
+        USB_TRACE_EVENT(USB_TRACE_ARM, \
+            ((ep) << 3) | (USB_DIR_##dir << 2) | ((odd) << 1), \
+            USB_BD(ep, dir, odd).STAT.stat); \
+    } while( 0 )
+#define USB_TRN_DONE(ustat) \
+    do \
+    { \
+        USB_LATENCY_DONE(ustat); \
+        USB_TRACE_EVENT(USB_TRACE_TRN, ustat, \
+            USB_USTAT_BD(ustat).STAT.stat); \
+    } while( 0 )
+
+// Runs the transaction handler of USB_HOT.ustat
+#define USB_EP_HANDLE() USB_PROFILE_CALL( \
+    USB_PROFILE_EP + USB_USTAT_INDEX(USB_HOT.ustat), \
+    USB_EP_HANDLERS[USB_USTAT_INDEX(USB_HOT.ustat)]())
+
+USB_STATIC_ASSERT(polling_has_no_priorities,
+    !(USB_POLLING && USB_INTERRUPT_PRIORITY));
+
+// Deferred events queue (see usb_process_events()): the USTAT of each
+// transaction, the handlers read the rest from its buffer descriptor
+#if USB_DEFERRED_EVENTS
+#define USB_EVENT_QUEUE_MASK (USB_EVENT_QUEUE_SIZE - 1)
+
+static unsigned char USB_EVENTS[USB_EVENT_QUEUE_SIZE];
+#endif
+
+USB_STATIC_ASSERT(deferred_events_are_exclusive, !(USB_DEFERRED_EVENTS &&
+    (USB_POLLING || USB_INTERRUPT_PRIORITY)));
+USB_STATIC_ASSERT(event_queue_size_is_valid, USB_EVENT_QUEUE_SIZE <= 128 &&
+    (USB_EVENT_QUEUE_SIZE & (USB_EVENT_QUEUE_SIZE - 1)) == 0);
+
+// Enabled interrupt sources (see usb_config.h)
+#if defined(USB_ON_SOF) || USB_FRAME_CLOCK
+#undef USB_IE_SOF
+#define USB_IE_SOF 1
+#endif
+
+// Frame clock SOF samples (see GET_TIMESTAMPS in usb_vendor.h)
+#if USB_FRAME_CLOCK
+typedef struct
+{
+    unsigned long frame;
+    unsigned short timer;
+} USB_FRAME_SAMPLE_t;
+
+static USB_FRAME_SAMPLE_t USB_FRAME_RING[USB_FRAME_SAMPLES];
+static unsigned char USB_FRAME_RING_NEXT;
+
+// GET_TIMESTAMPS reply, a snapshot: SOFs keep coming during the DATA stage
+static USB_FRAME_SAMPLE_t USB_FRAME_REPLY[USB_FRAME_SAMPLES + 1];
+#endif
+
+#define USB_UIE_SOURCES ( USB_UIR_URSTIF | USB_UIR_TRNIF | \
+    ( USB_IE_SOF ? USB_UIR_SOFIF : 0 ) | \
+    ( USB_IE_STALL ? USB_UIR_STALLIF : 0 ) | \
+    ( USB_IE_UERR ? USB_UIR_UERRIF : 0 ) | \
+    ( USB_IE_IDLE ? USB_UIR_IDLEIF : 0 ) )
+
+// The SIE is suspended (low power), ACTVIF is enabled meanwhile
+static volatile unsigned char USB_SUSPENDED;
+
+// DEVICE_REMOTE_WAKEUP feature, set and cleared by the host
+static unsigned char USB_REMOTE_WAKEUP_ENABLED;
+
+USB_STATIC_ASSERT(resume_signal_is_valid,
+    USB_RESUME_SIGNAL_MS >= 1 && USB_RESUME_SIGNAL_MS <= 15);
+
+// Resume latency (see GET_RESUME_STATS in usb_vendor.h), measured from the
+// resume to the first transaction
+#if USB_RESUME_STATS
+static unsigned short USB_RESUME_REPLY[USB_RESUME_STATS_SLOTS];
+static volatile unsigned char USB_RESUME_PENDING;
+#endif
+
+USB_STATIC_ASSERT(resume_stats_owns_timer3,
+    !(USB_RESUME_STATS && (USB_CYCLES || USB_PROFILE)));
+
+// Application callbacks (see usb_config.h)
+#ifdef USB_ON_SOF
+void USB_ON_SOF(void);
+#endif
+#ifdef USB_ON_SUSPEND
+void USB_ON_SUSPEND(void);
+#endif
+#ifdef USB_ON_RESUME
+void USB_ON_RESUME(void);
+#endif
+#ifdef USB_ON_RESET
+void USB_ON_RESET(void);
+#endif
+#ifdef USB_ON_CONFIGURED
+void USB_ON_CONFIGURED(void);
+#endif
+#ifdef USB_ON_LINE_STATE
+void USB_ON_LINE_STATE(void);
+#endif
+
+// Blocks usb_handler() while the application touches the data BDs, USBIE is
+// saved to a local variable and restored so locks nest (and run inside the
+// handler or a callback). In polling mode nothing can preempt the application
+#if USB_POLLING
+#define USB_LOCK(usbie) ((usbie) = 0)
+#define USB_UNLOCK(usbie) ((void) (usbie))
+#else
+#define USB_LOCK(usbie) ((usbie) = PIE2bits.USBIE, PIE2bits.USBIE = 0)
+#define USB_UNLOCK(usbie) (PIE2bits.USBIE = (usbie))
+#endif
+
+// Runs the USB stack while the application waits for the data rings
+#if USB_POLLING
+#define USB_WAIT() usb_task()
+#elif USB_DEFERRED_EVENTS
+#define USB_WAIT() usb_process_events()
+#else
+#define USB_WAIT()
+#endif
 
-    // bNumEndpoints: This interface has 2 endpoints
-    0x02,
+/*******************************************************************************
+*******************************************************************************/
 
-    // bInterfaceClass: Data interface class
-    USB_CDC_CLASS_INTERFACE_DAT,
 
-    // bInterfaceSubClass: No interface class
-    USB_CDC_SUBCLASS_INTERFACE_NONE,
 
-    // bInterfaceProtocol: No interface protocol
-    USB_CDC_PROTOCOL_INTERFACE_NONE,
+/*******************************************************************************
+                                 MEMORY ACCESS
 
-    // iInterface: No interface description text
-    0x00
-    },
+    PEEK / POKE vendor requests (see usb_vendor.h), with USB_PEEK_POKE
 
+    Memory dumps (PEEK_STREAM) go through the data IN endpoint: data_tx_kick()
+    fills the IN BDs from the stream before the TX ring, and the BDs carrying
+    stream bytes are flagged so their completion frees nothing in the ring
+*******************************************************************************/
 
+#if USB_PEEK_POKE
+// Dump source (data or program memory), bytes not yet in an IN BD
+static const unsigned char *PEEK_STREAM_DATA;
+static unsigned short PEEK_STREAM_BYTES;
 
-                         /* ENDPOINT_DESCRIPTOR_OUT */
-    {
-    // bLength: Endpoint descriptor size
-    sizeof(USB_DESC_EP_t),
+// IN BDs (by ping-pong buffer) holding dump bytes
+static unsigned char PEEK_STREAM_BD[DATA_PP];
 
-    // bDescriptorType: Endpoint descriptor
-    USB_DESC_TYPE_ENDPOINT,
+// Program memory row received by POKE, written by poke_program_row()
+static unsigned char POKE_ROW[USB_PEEK_ROW_SIZE];
+static unsigned long POKE_ADDRESS;
 
-    // bEndpointAddress: Out endpoint 3
-    USB_EP_03_OUT,
+// POKE_ROW is in, waiting for the main loop (poke_program_pending()): the
+// STATUS stage isn't armed until it's written, the host gets NAKs meanwhile
+static volatile unsigned char POKE_PENDING;
 
-    // bmAttributes: Bulk endpoint
-    USB_EP_BULK,
+// UNLOCK request given since the last bus reset
+#if USB_PEEK_POKE_KEY
+static unsigned char PEEK_POKE_UNLOCKED;
 
-    // wMaxPacketSize: 64 bytes max packet
-    USB_CDC_RX_BUFFER_SIZE,
+#define PEEK_POKE_ALLOWED() (PEEK_POKE_UNLOCKED)
+#else
+#define PEEK_POKE_ALLOWED() 1
+#endif
 
-    // bInterval: Poll as fast as possible
-    0x00
-    },
+#define PEEK_STREAM_PENDING() (PEEK_STREAM_BYTES != 0)
+#define DATA_IN_RING_BYTES(odd) (PEEK_STREAM_BD[odd] ? 0 : DATA_IN(odd).CNT)
+#else
+#define PEEK_STREAM_PENDING() 0
+#define DATA_IN_RING_BYTES(odd) (DATA_IN(odd).CNT)
+#endif
 
+// Program memory erase and write (EECON1: EEPGD, FREE, WREN)
+#define POKE_EECON1_ERASE 0x94
+#define POKE_EECON1_WRITE 0x84
 
+// Program memory holding registers, written at once (datasheet page 98)
+#define POKE_WRITE_BLOCK 32
 
-                          /* ENDPOINT_DESCRIPTOR_IN */
-    {
-    // bLength: Endpoint descriptor size
-    sizeof(USB_DESC_EP_t),
+// Table writes, TABLAT to the holding register at TBLPTR (then TBLPTR++).
+// Host targets model them (see sim/)
+#ifndef TBLWT
+#define TBLWT() __asm__("tblwt*")
+#define TBLWT_POSTINC() __asm__("tblwt*+")
+#endif
 
-    // bDescriptorType: Endpoint descriptor
-    USB_DESC_TYPE_ENDPOINT,
+/*******************************************************************************
+*******************************************************************************/
 
-    // bEndpointAddress: In endpoint 3
-    USB_EP_03_IN,
 
-    // bmAttributes: Bulk endpoint
-    USB_EP_BULK,
 
-    // wMaxPacketSize: 64 bytes max packet
-    USB_CDC_TX_BUFFER_SIZE,
 
-    // bInterval: Poll as fast as possible
-    0x00
-    }
-};
 
+/* Initializes the USB hardware */
+void usb_init(void)
+{
+    // Start with the default descriptors set
+    USB_PERSONALITY_NUMBER = USB_PERSONALITY_DEFAULT;
+    USB_PERSONALITY = &USB_PERSONALITIES[USB_PERSONALITY_DEFAULT];
+    USB_PERSONALITY_SWITCH = 0;
+
+    // No USB interrupt sources yet
+    UIE = 0;
+    UEIE = 0;
+
+    // Empty events queue and data rings
+    USB_HOT.ev_head = 0;
+    USB_HOT.ev_tail = 0;
+    USB_HOT.rx_head = 0;
+    USB_HOT.rx_tail = 0;
+    USB_HOT.tx_head = 0;
+    USB_HOT.tx_tail = 0;
+    USB_HOT.tx_send = 0;
+    USB_HOT.rx_held = 0;
+    USB_HOT.rx_held_odd = 0;
+    USB_HOT.in_armed = 0;
+    USB_HOT.in_odd = 0;
+    USB_HOT.out_odd = 0;
+    USB_HOT.ep_halted = 0;
+
+#if USB_CYCLES || USB_PROFILE
+    // Timer 3: 16 bits reads, 1:1 prescaler, instruction cycles clock
+    T3CON = 0x81;
+#endif
+
+#if USB_RESUME_STATS
+    // Timer 3: 16 bits reads, 1:8 prescaler (43ms range), instruction cycles
+    // clock
+    T3CON = 0xB1;
+    USB_RESUME_PENDING = 0;
+#endif
+
+#if USB_LATENCY
+    // Timer 1: 16 bits reads, 1:8 prescaler (43ms range), instruction cycles
+    // clock
+    T1CON = 0xB1;
+#endif
+
+#if USB_FRAME_CLOCK
+    // Timer 1: 16 bits reads, 1:1 prescaler, instruction cycles clock
+    T1CON = 0x81;
+    USB_HOT.frame = 0;
+    USB_FRAME_RING_NEXT = 0;
+#endif
+
+    // Attach to the bus
+    usb_attach();
+
+#if !USB_POLLING
+    // Enable interrupts (GIE/GIEH and PEIE/GIEL)
+    INTCON=0xC0;
+#endif
+#if USB_INTERRUPT_PRIORITY
+    RCONbits.IPEN = 1; // High and low priority levels
+    IPR2bits.USBIP = 1; // USB starts at high priority (data endpoints)
+#else
+    RCONbits.IPEN = 0; // No interrupts priority levels
+#endif
+    UIE = USB_UIE_SOURCES; // Reset, transactions and configured sources
+#if USB_IE_UERR
+    UEIE = USB_UEIR_ALL; // Every error type sets UERRIF
+#endif
+#if !USB_POLLING
+    PIE2bits.USBIE = 1; // USB interrupts
+#endif
+}
 
 
 
 /*
- * STRING DESCRIPTORS
- *
- * 2 bytes coding characters
+ * Switches to another descriptors set
  *
- * String descriptor 0 = Supported Languages
- * String descriptor 1 = iManufacturer
- * String descriptor 2 = iProduct
-*/
-__code unsigned char STRING_DESC_0[] =
-{
-    // bLength
-    0x04,
-
-    // bDescriptorType: String descriptor
-    USB_DESC_TYPE_STRING,
-
-    //wLANGID[0]: English (USB languages specification: page 5)
-    0x09, 0x04
-};
-
-
-__code unsigned char STRING_DESC_1[] =
+ * The device detaches from the bus for USB_DETACH_MS milliseconds and attaches
+ * again, so the host enumerates it from scratch with the new descriptors
+ */
+unsigned char usb_set_personality(unsigned char personality)
 {
-    // bLength
-    0x24,
+    unsigned char usbie;
 
-    // bDescriptorType: String descriptor
-    USB_DESC_TYPE_STRING,
-
-    // bString: "Silly-Bytes"
-    'S', 0x00,
-    'i', 0x00,
-    'l', 0x00,
-    'l', 0x00,
-    'y', 0x00,
-    '-', 0x00,
-    'B', 0x00,
-    'y', 0x00,
-    't', 0x00,
-    'e', 0x00,
-    's', 0x00
-};
+    if( personality >= USB_PERSONALITY_COUNT )
+    {
+        return 0;
+    }
 
+    // No USB interrupts while the module is down
+    USB_LOCK(usbie);
 
-__code unsigned char STRING_DESC_2[] =
-{
-    // bLength
-    0x34,
-
-    // bDescriptorType: String descriptor
-    USB_DESC_TYPE_STRING,
-
-    // bString: "Virtual COM port"
-    'V', 0x00,
-    'i', 0x00,
-    'r', 0x00,
-    't', 0x00,
-    'u', 0x00,
-    'a', 0x00,
-    'l', 0x00,
-    ' ', 0x00,
-    'C', 0x00,
-    'O', 0x00,
-    'M', 0x00,
-    ' ', 0x00,
-    'p', 0x00,
-    'o', 0x00,
-    'r', 0x00,
-    't', 0x00
-};
+    // Drop the pull-up so the host sees a disconnection
+    usb_detach();
+    usb_delay_ms(USB_DETACH_MS);
 
+    // Swap descriptors set
+    USB_PERSONALITY_NUMBER = personality;
+    USB_PERSONALITY = &USB_PERSONALITIES[personality];
 
+    // Attach again (interrupt enable bits in UIE are kept)
+    usb_attach();
+    USB_UNLOCK(usbie);
 
-/*******************************************************************************
-*******************************************************************************/
+    return 1;
+}
 
 
 
+/* Returns the current personality number */
+unsigned char usb_get_personality(void)
+{
+    return USB_PERSONALITY_NUMBER;
+}
 
 
 
-/* Initializes the USB hardware */
-void usb_init(void)
+/* Enables the USB module and the pull-up resistor so the host sees us */
+static void usb_attach(void)
 {
 	// Set current device state
 	USB_DEVICE_STATE = USB_STATE_DETACHED;
     USB_DEVICE_ADDRESS = 0x00;
     USB_DEVICE_CURRENT_CONFIGURATION = 0x00;
+    USB_SUSPENDED = 0;
+    USB_REMOTE_WAKEUP_ENABLED = 0;
 
 	// Clear all USB related registers
 	UCON = 0;
 	UCFG = 0;
 	UIR = 0;
-	UIE = 0;
 	UEIR = 0;
-	UEIE = 0;
 
     // Disable all Endpoints
 	UEP0 = 0; UEP1 = 0;	UEP2 = 0; UEP3 = 0;	UEP4 = 0; UEP5 = 0;
@@ -584,6 +881,9 @@ void usb_init(void)
 	UCFGbits.UPUEN = 1;
 	UCFGbits.FSEN = 1;
 
+    // Ping-pong buffering mode the BDT was laid out for
+    UCFG |= USB_PING_PONG_MODE;
+
 	// Enable USB module
 	UCONbits.USBEN = 1;
 	USB_DEVICE_STATE = USB_STATE_ATTACHED;
@@ -593,532 +893,2565 @@ void usb_init(void)
 
     // Device is now powered
     USB_DEVICE_STATE = USB_STATE_POWERED;
-
-    // Enable interrupts
-    INTCON=0xC0;
-    RCONbits.IPEN = 0; // No interrupts priority levels
-    UIEbits.ACTVIE = 1; // Activity interrupt
-    UIEbits.IDLEIE = 1; // Idle interrupt
-    UIEbits.STALLIE = 1; // Stall interrupt
-    UIEbits.UERRIE = 1; // USB errors interrupt
-    UIEbits.SOFIE = 1; // Start of frame interrupt
-    UIEbits.TRNIE = 1; // Transaction finish interrupt
-    UIEbits.URSTIE = 1; // Reset interrupt
-    PIE2bits.USBIE = 1; // USB interrupts
 }
 
 
-
-/*
- * Handles USB requests, states and transactions
- *
- *  Always call this function using an IRQ like this:
- *
- *  void usb_isr(void) __shadowregs __interrupt 1
- *	{
- *		if( PIR2bits.USBIF )
- *		{
- *			usb_handler();
- *			PIR2bits.USBIF = 0;
- *		}
- *	}
- *
- */
-void usb_handler(void)
+/* Disables the USB module and the pull-up resistor */
+static void usb_detach(void)
 {
-    // If the device isn't in powered state avoid interrupt handling
-    if( USB_DEVICE_STATE < USB_STATE_POWERED )
-    {
-        return;
-    }
+    UCON = 0; // USBEN = 0
+    UCFGbits.UPUEN = 0;
+    UIR = 0;
 
-	// Activity in the bus has been detected
-	if( UIRbits.ACTVIF && UIEbits.ACTVIE )
-    {
-        handle_actvif();
-        UIRbits.ACTVIF = 0;
-	}
+    USB_DEVICE_STATE = USB_STATE_DETACHED;
+}
 
-	// An idle condition has been detected
-	if( UIRbits.IDLEIF && UIEbits.IDLEIE )
-    {
-        // Do not suspend if the device is not addressed
-        if( USB_DEVICE_STATE < USB_STATE_ADDRESS )
-        {
-            UCONbits.SUSPND = 0;
-            UIRbits.IDLEIF = 0;
-        }
-        else
-        {
-            handle_idleif();
-            UIRbits.IDLEIF = 0;
-        }
-	}
 
-	// A stall condition has been detected
-	if( UIRbits.STALLIF && UIEbits.STALLIE )
-    {
-        // Do nothing
-        UIRbits.STALLIF = 0;
-	}
+/* Busy waits MS milliseconds (approximately, see USB_DELAY_LOOPS_PER_MS) */
+static void usb_delay_ms(unsigned short ms)
+{
+    volatile unsigned short loops;
 
-	// An error condition has been detected
-	if( UIRbits.UERRIF && UIEbits.UERRIE )
+    for( ; ms > 0; ms-- )
     {
-        // Do nothing
-        // TODO: I guess we should do something about this...
-
-        // UERRIF is Read Only, clear UEIR instead
-        UEIR = 0;
-	}
+        for( loops = USB_DELAY_LOOPS_PER_MS; loops > 0; loops-- );
+    }
+}
 
-	// A start of frame has been detected
-	if( UIRbits.SOFIF && UIEbits.SOFIE )
-    {
-        // Do nothing
-        UIRbits.SOFIF = 0;
-	}
 
-	// A transaction has finished
-	if( UIRbits.TRNIF && UIEbits.TRNIE )
-    {
-        handle_trnif();
-        UIRbits.TRNIF = 0;
-	}
 
-	// A reset signal has been achieved
-	if( UIRbits.URSTIF && UIEbits.URSTIE )
-    {
-        handle_urstif();
-        UIRbits.URSTIF = 0;
-	}
+/* Returns a non-zero value if the device has been configured by the host */
+unsigned char usb_is_configured(void)
+{
+    return USB_DEVICE_STATE == USB_STATE_CONFIGURED;
 }
 
 
 
+/* Returns a non-zero value while the bus is suspended */
+unsigned char usb_is_suspended(void)
+{
+    return USB_SUSPENDED;
+}
 
 
-              /***************  Interrupt Handlers  *************/
 
-/* Handles wake up events */
-static void handle_actvif(void)
+/*
+ * Wakes the suspended bus up (remote wakeup), only if the host enabled it
+ *
+ * Blocks for 2 + USB_RESUME_SIGNAL_MS milliseconds: the bus must have been
+ * idle for 5ms (IDLEIF fires after 3ms) before the K state is driven
+ */
+unsigned char usb_remote_wakeup(void)
 {
-    // Resume power to SIE
-    UCONbits.SUSPND = 0;
-
-    // Clear ACTVIF
-    while( UIRbits.ACTVIF ){ UIRbits.ACTVIF = 0; }
-}
+#if USB_IE_IDLE && USB_REMOTE_WAKEUP
+    unsigned char usbie;
 
+    if( !USB_SUSPENDED || !USB_REMOTE_WAKEUP_ENABLED )
+    {
+        return 0;
+    }
 
-/* Handles suspend events */
-static void handle_idleif(void)
-{
-    // Suspend power to SIE
-    UCONbits.SUSPND = 1;
+    USB_LOCK(usbie);
+    usb_delay_ms(2);
+    usb_resume();
+
+    // Resume signaling, the host takes over within 1ms and drives it for
+    // 20ms more (ACTVIF is not enabled anymore)
+    UCONbits.RESUME = 1;
+    usb_delay_ms(USB_RESUME_SIGNAL_MS);
+    UCONbits.RESUME = 0;
+    USB_UNLOCK(usbie);
+
+    return 1;
+#else
+    return 0;
+#endif
 }
 
 
-/* Handles reset events */
-static void handle_urstif(void)
-{
-    // Clear interrupt flags
-    UIR = 0x00;
-    UEIR = 0x00;
 
-    // Endpoint 0 configuration
-    UEP0bits.EPINEN = 1; // Endpoint 0 IN enabled
-    UEP0bits.EPOUTEN = 1; // Endpoint 0 OUT enabled
-    UEP0bits.EPHSHK = 1; // Endpoint 0 handshake enabled
-    UEP0bits.EPCONDIS = 0; // Endpoint 0 Control transfers allowed
-    UEP0bits.EPSTALL = 0; // Endpoint 0 is not stalled
+/*
+ * Main loop power hook: while suspended, wakes the bus up if TX data is
+ * queued (remote wakeup), otherwise stops the core until the bus resumes
+ * (USB_SUSPEND_SLEEP)
+ *
+ * Any other enabled interrupt wakes the core too, the function returns after
+ * every wake up
+ */
+void usb_sleep(void)
+{
+#if USB_SUSPEND_SLEEP
+    unsigned char gie;
+#endif
 
-    // Flush transactions queue
-    while( UIRbits.TRNIF ){ UIRbits.TRNIF = 0; }
+    if( !USB_SUSPENDED )
+    {
+        return;
+    }
 
-    // Enable SIE packet processing
-    UCONbits.PKTDIS = 0;
+    if( USB_HOT.tx_head != USB_HOT.tx_tail && usb_remote_wakeup() )
+    {
+        return;
+    }
 
+#if USB_SUSPEND_SLEEP
+    // Interrupts off so a resume can't slip in between the check and SLEEP,
+    // the wake up source still ends it (no vector, the ISR runs afterwards)
+    gie = INTCONbits.GIE;
+    INTCONbits.GIE = 0;
+#if USB_POLLING
+    PIE2bits.USBIE = 1; // USBIF wakes the core only with USBIE set
+#endif
 
-    // Configure endpoint 0 buffer descriptors so we're ready to
-    // receive the first control transfer
-    EP0_OUT.STAT.stat = 0x00; // Clear endpoint 0 buffer descriptors STAT
-    EP0_IN.STAT.stat = 0x00;
-    EP0_OUT.ADDR = EP0_OUT_BUFFER; // Buffer memory address for out ep0
-    EP0_IN.ADDR = EP0_IN_BUFFER; // Buffer memory address for in ep0
-    EP0_OUT.CNT = EP0_OUT_BUFFER_SIZE; // Receive up to EP0_OUT_BUFFER_SIZE bytes
-    EP0_OUT.STAT.UOWN = 1; // Give out buffer descriptor control to the SIE
-    EP0_IN.STAT.UOWN = 0; // Give in buffer descriptor control to the CORE
+    if( USB_SUSPENDED )
+    {
+        // Sleep mode, not Idle: the core and peripherals clocks stop
+        OSCCONbits.IDLEN = 0;
+        Sleep();
+    }
 
-    // Device is now in default state
-    USB_DEVICE_STATE = USB_STATE_DEFAULT;
+#if USB_POLLING
+    PIE2bits.USBIE = 0;
+#endif
+    INTCONbits.GIE = gie;
+#endif
 }
 
 
-/* Handles transactions by endpoint number */
-static void handle_trnif(void)
+
+/* Queues a character C to be sent through the data IN endpoint */
+unsigned char usb_cdc_putc(char c)
 {
-    // Transactions to ENDPOINT 0 (Control Transfers)
-    if( USTATbits.ENDP == 0 )
+    unsigned char head = USB_HOT.tx_head;
+    unsigned char usbie;
+
+    // Wait for room in the TX ring, queued bytes wait for the device to be
+    // configured (again, after a bus reset)
+    while( (unsigned char) (head - USB_HOT.tx_tail) >= USB_TX_RING_SIZE )
     {
-        control_transfer_handler();
+        if( !usb_is_configured() )
+        {
+            return 0;
+        }
+        USB_WAIT();
     }
 
-    /* PUT CLASS SPECIFIC EP HANDLERS HERE */
+    TX_RING[head & TX_RING_MASK] = c;
+    USB_HOT.tx_head = head + 1;
 
-    // Transactions to ENDPOINT 1
-    else if( USTATbits.ENDP == 1)
+    // Idle endpoint: start sending, otherwise the IN handler will
+    USB_LOCK(usbie);
+    if( USB_HOT.in_armed == 0 && usb_is_configured() )
     {
+        data_tx_kick();
     }
+    USB_UNLOCK(usbie);
 
-    // Transactions to ENDPOINT 2
-    else if( USTATbits.ENDP == 2)
+    // Suspended bus: wake the host up to send it (if it allows it)
+    if( USB_SUSPENDED )
     {
+        usb_remote_wakeup();
     }
 
+    return 1;
+}
 
 
-    // Transactions to ENDPOINT N
-
 
-}
+/* Returns the next character received through the data OUT endpoint */
+char usb_cdc_getc(void)
+{
+    unsigned char tail = USB_HOT.rx_tail;
+    unsigned char usbie;
+    char c;
 
+    // Wait for a character
+    while( USB_HOT.rx_head == tail )
+    {
+        USB_WAIT();
+    }
 
+    c = RX_RING[tail & RX_RING_MASK];
+    USB_HOT.rx_tail = tail + 1;
 
+    // Now there may be room for a held packet
+    if( USB_HOT.rx_held )
+    {
+        USB_LOCK(usbie);
+        data_rx_release();
+        USB_UNLOCK(usbie);
+    }
 
+    return c;
+}
 
-              /***************  Transfers Handlers  *************/
 
 
-/*
- * Handles control transfers
- *
- * Optional SET_DESCRIPTOR request not implemented here, so we don't need to
- * worry about any DATA OUT STAGE.
- *
- * Handle this 3 control transfer stages:
- *      - OUT direction transactions
- *          * SETUP stage
- *          * STATUS stage
- *      - IN direction transactions
- *          * DATA IN stage
-*/
-static void control_transfer_handler(void)
+/* Bytes in the RX ring */
+unsigned char usb_cdc_rx_count(void)
 {
-    // Pending data to send during the control transfer
-    static unsigned char *data_to_send;
+    return USB_HOT.rx_head - USB_HOT.rx_tail;
+}
+
 
-    // Pending number of bytes to send during the control transfer
-    static unsigned char bytes_to_send;
+
+/* Free bytes in the TX ring */
+unsigned char usb_cdc_tx_room(void)
+{
+    return USB_TX_RING_SIZE - (unsigned char) (USB_HOT.tx_head -
+            USB_HOT.tx_tail);
+}
 
 
 
-    /*****  OUT direction transactions  (SETUP or STATUS stage)  *****/
-	if (USTATbits.DIR == 0)
+/* Sends the character string STR */
+unsigned char usb_cdc_puts(char *str)
+{
+    while( *str )
     {
-        /*** SETUP transaction (SETUP stage) ***/
-		if (EP0_OUT.STAT.PID == USB_PID_TOKEN_SETUP)
+        if( !usb_cdc_putc(*str++) )
         {
-            // The CPU owns the endpoint 0 buffer descriptors
-            EP0_IN.STAT.UOWN = 0;
-            EP0_OUT.STAT.UOWN = 0;
-
+            return 0;
+        }
+    }
 
-            /*** Handle requests ***/
+    return 1;
+}
 
-            // GET_DESCRIPTOR request
-            if ( SETUP_PACKET.bRequest == USB_REQ_GET_DESCRIPTOR )
-            {
-                handle_req_get_descriptor(&data_to_send, &bytes_to_send);
 
-                // The descriptor fits in just one in transaction
-                if( bytes_to_send <= SETUP_PACKET.wLength )
-                {
-                    // Fill IN buffer with the whole descriptor
-                    int i=0;
-                    for( i; i<bytes_to_send; i++)
-                    {
-                        *( (__data unsigned char*) EP0_IN_BUFFER + i ) =
-                            *( (__code unsigned char*) data_to_send + i);
-                    }
 
+/* Reads a line (up to CR or LF, not included) into STR */
+unsigned char usb_cdc_gets(char *str)
+{
+    char c;
 
-                    // Prepare OUT buffer
-                    EP0_OUT.STAT.stat = 0x00;
-                    EP0_OUT.ADDR = EP0_OUT_BUFFER;
-                    EP0_OUT.CNT = EP0_OUT_BUFFER_SIZE;
+    while( (c = usb_cdc_getc()) != '\r' && c != '\n' )
+    {
+        *str++ = c;
+    }
+    *str = '\0';
 
-                    // Prepare IN buffer
-                    EP0_IN.STAT.stat = 0x00;
-                    EP0_IN.ADDR = (short)EP0_IN_BUFFER;
-                    EP0_IN.CNT = (unsigned char) bytes_to_send;
+    return 1;
+}
 
-                    // Update bytes_to_send, and data_to_send
-                    // to 0 (no more data to send)
-                    data_to_send = 0;
-                    bytes_to_send = 0;
 
-                    // Enable SIE packet processing
-                    UCONbits.PKTDIS = 0;
 
-                    // Give Buffer descriptors control to the SIE so the data
-                    // can be sent
-                    EP0_OUT.STAT.UOWN = 1;
-                    EP0_IN.STAT.UOWN = 1;
 
+/* Returns the control line state set by the host (USB_CDC_LINE_* bits) */
+unsigned char usb_cdc_line_state(void)
+{
+    return CDC_LINE_STATE;
+}
 
-                    return;
-                }
-                // The descriptor fits in multiple in transactions
-                else
-                {
-                    // Fill IN buffer with the first descriptor bytes
-                    int i=0;
-                    for( i; i<SETUP_PACKET.wLength; i++)
-                    {
-                        *( (__data unsigned char*) EP0_IN_BUFFER + i ) =
-                            *( data_to_send + i);
-                    }
-
-                    // Prepare OUT buffer
-                    EP0_OUT.STAT.stat = 0x00;
-                    EP0_OUT.ADDR = EP0_OUT_BUFFER;
-                    EP0_OUT.CNT = EP0_OUT_BUFFER_SIZE;
-
-                    // Prepare IN buffer
-                    EP0_IN.STAT.stat = 0x00;
-                    EP0_IN.ADDR = EP0_IN_BUFFER;
-                    EP0_IN.CNT = SETUP_PACKET.wLength;
-
-                    // Update bytes_to_send, and data_to_send
-                    data_to_send += SETUP_PACKET.wLength;
-                    bytes_to_send -= SETUP_PACKET.wLength;
-
-                    // Give Buffer descriptors control to the SIE so the data can be sent
-                    EP0_OUT.STAT.UOWN = 1;
-                    EP0_IN.STAT.UOWN = 1;
-
-                    return;
-                }
-            }
-        }
-        /*** OUT transaction (STATUS stage) ***/
-        else
-        {
-            /*
-             * The host has confirmed the end of the control transfer
-             * so we need to prepare everything for any future control transfer
-            */
-
-            // The CPU owns the endpoint 0 buffer descriptors
-            // (so we can modify them)
-            EP0_IN.STAT.UOWN = 0;
-            EP0_OUT.STAT.UOWN = 0;
-
-            // Configure endpoint 0 buffer descriptors so we're ready to
-            // receive the future control transfer
-            EP0_OUT.STAT.stat = 0x00;
-            EP0_IN.STAT.stat = 0x00;
-            EP0_OUT.ADDR = EP0_OUT_BUFFER;
-            EP0_IN.ADDR = EP0_IN_BUFFER;
-            EP0_OUT.CNT = EP0_OUT_BUFFER_SIZE;
-            EP0_OUT.STAT.UOWN = 1; // SIE controls OUT buffer
-            EP0_IN.STAT.UOWN = 0; // CORE controls IN buffer
 
-            return;
+
+/* Returns the bits per second set by the host (SET_LINE_CODING) */
+unsigned long usb_cdc_baud_rate(void)
+{
+    return CDC_LINE_CODING[0] | ((unsigned short) CDC_LINE_CODING[1] << 8) |
+        ((unsigned long) CDC_LINE_CODING[2] << 16) |
+        ((unsigned long) CDC_LINE_CODING[3] << 24);
+}
+
+
+
+/*
+ * Handles USB requests, states and transactions
+ *
+ *  Always call this function using an IRQ like this:
+ *
+ *  void usb_isr(void) __shadowregs __interrupt 1
+ *	{
+ *		if( PIR2bits.USBIF )
+ *		{
+ *			usb_handler();
+ *			PIR2bits.USBIF = 0;
+ *		}
+ *	}
+ *
+ */
+void usb_handler(void)
+{
+#if USB_CYCLES
+    unsigned short start = usb_cycles_now();
+#endif
+
+    USB_PROFILE_CALL(USB_PROFILE_HANDLER, usb_service());
+
+#if USB_CYCLES
+    usb_cycles_record(USB_CYCLES_HANDLER, start);
+#endif
+}
+
+
+
+/* Polls USB events from the application main loop (see usbcdc.h) */
+void usb_task(void)
+{
+#if USB_CYCLES
+    unsigned short start;
+#endif
+
+    // Nothing pending: cheap return
+    if( (UIR & UIE) == 0 )
+    {
+        return;
+    }
+
+#if USB_CYCLES
+    start = usb_cycles_now();
+#endif
+
+    PIR2bits.USBIF = 0;
+    usb_handler();
+
+#if USB_CYCLES
+    usb_cycles_record(USB_CYCLES_TASK, start);
+#endif
+
+#if USB_PEEK_POKE
+    poke_program_pending();
+#endif
+    usb_personality_switch();
+}
+
+
+
+#if USB_DEFERRED_EVENTS
+
+/*
+ * Records the transaction at the USTAT FIFO head and advances the FIFO, its
+ * buffer descriptor is owned by the CPU until usb_process_events() handles it
+ */
+static void usb_queue_event(void)
+{
+    unsigned char ustat = USTAT;
+
+    USB_EVENTS[USB_HOT.ev_head & USB_EVENT_QUEUE_MASK] = ustat;
+    USB_TRN_DONE(ustat);
+    UIRbits.TRNIF = 0;
+
+    USB_HOT.ev_head++;
+}
+
+#endif // USB_DEFERRED_EVENTS
+
+
+
+/* Handles the transactions queued by usb_handler() (see usbcdc.h) */
+void usb_process_events(void)
+{
+#if USB_DEFERRED_EVENTS
+    unsigned char usbie;
+#if USB_CYCLES
+    unsigned short start = usb_cycles_now();
+#endif
+
+    while( USB_HOT.ev_tail != USB_HOT.ev_head )
+    {
+        // A bus reset (in the interrupt) empties the queue, never preempts a
+        // handler
+        USB_LOCK(usbie);
+        if( USB_HOT.ev_tail != USB_HOT.ev_head )
+        {
+            USB_HOT.ustat =
+                USB_EVENTS[USB_HOT.ev_tail & USB_EVENT_QUEUE_MASK];
+            USB_EP_HANDLE();
+            USB_HOT.ev_tail++;
         }
+        USB_UNLOCK(usbie);
+    }
+
+    // There's room again (the interrupt may have stopped them)
+    UIEbits.TRNIE = 1;
+
+#if USB_CYCLES
+    usb_cycles_record(USB_CYCLES_EVENTS, start);
+#endif
+#endif // USB_DEFERRED_EVENTS
+
+#if USB_PEEK_POKE
+    poke_program_pending();
+#endif
+    usb_personality_switch();
+}
+
+
+
+/*
+ * Applies a SET_PERSONALITY request once its STATUS stage is done, outside
+ * the interrupt: usb_set_personality() busy waits USB_DETACH_MS
+ */
+static void usb_personality_switch(void)
+{
+    unsigned char personality = USB_PERSONALITY_SWITCH;
+
+    if( personality )
+    {
+        USB_PERSONALITY_SWITCH = 0;
+        usb_set_personality(personality & 0x7F);
+    }
+}
+
+
+
+/* Current frame and phase on the USB frame clock (see usbcdc.h) */
+void usb_timestamp(USB_TIMESTAMP_t *timestamp)
+{
+#if USB_FRAME_CLOCK
+    unsigned short phase;
+    unsigned char usbie;
+
+    // A SOF can't be handled in the middle
+    USB_LOCK(usbie);
+    timestamp->frame = USB_HOT.frame;
+    phase = usb_timer1() - USB_HOT.frame_timer;
+    USB_UNLOCK(usbie);
+
+    // SOFs not handled yet (USB interrupt blocked for a while)
+    while( phase >= USB_FRAME_CYCLES )
+    {
+        phase -= USB_FRAME_CYCLES;
+        timestamp->frame++;
+    }
+    timestamp->phase = phase;
+#else
+    timestamp->frame = 0;
+    timestamp->phase = 0;
+#endif
+}
+
+
+
+#if USB_FRAME_CLOCK || USB_LATENCY
+
+/* Timer 1 value, reading TMR1L latches TMR1H (RD16) */
+static unsigned short usb_timer1(void)
+{
+    unsigned char low = TMR1L;
+
+    return ((unsigned short) TMR1H << 8) | low;
+}
+
+#endif
+
+
+#if USB_FRAME_CLOCK
+
+
+/*
+ * Extends the 11 bits frame number (UFRM) to 32 bits and samples Timer 1,
+ * missed SOFs are still counted
+ */
+static void usb_frame_clock(void)
+{
+    unsigned short timer = usb_timer1();
+    unsigned short frame = ((unsigned short) UFRMH << 8) | UFRML;
+    USB_FRAME_SAMPLE_t *sample = &USB_FRAME_RING[USB_FRAME_RING_NEXT];
+
+    USB_HOT.frame += (frame - (unsigned short) USB_HOT.frame) & 0x07FF;
+    USB_HOT.frame_timer = timer;
+
+    sample->frame = USB_HOT.frame;
+    sample->timer = timer;
+    if( ++USB_FRAME_RING_NEXT == USB_FRAME_SAMPLES )
+    {
+        USB_FRAME_RING_NEXT = 0;
+    }
+}
+
+#endif // USB_FRAME_CLOCK
+
+
+
+#if USB_LATENCY
+
+/* BDT entry BD is given to the SIE now */
+static void usb_latency_arm(unsigned char bd)
+{
+    USB_LATENCY_ARMED[bd] = usb_timer1();
+}
+
+
+/* Accounts the wait of the BD whose transaction USTAT reports */
+static void usb_latency_done(unsigned char ustat)
+{
+    unsigned short ticks =
+        usb_timer1() - USB_LATENCY_ARMED[USB_USTAT_BD_INDEX(ustat)];
+    unsigned char bucket = 0;
+    unsigned char high;
+
+    // Log2, high byte first
+    high = ticks >> 8;
+    if( high )
+    {
+        bucket = 8;
     }
-    /*****  IN direction transactions  (DATA IN stage)  *****/
     else
     {
-        // The CPU owns the endpoint 0 buffer descriptors
-        EP0_IN.STAT.UOWN = 0;
-        EP0_OUT.STAT.UOWN = 0;
+        high = (unsigned char) ticks;
+    }
+    while( high > 1 )
+    {
+        high >>= 1;
+        bucket++;
+    }
 
-        // We have no more data to send, so send a 0 length packet to indicate
-        // the end of the data in stage (USB 2.0 spec: page 253)
-        if( bytes_to_send == 0 )
-        {
-            // Prepare OUT buffer
-            EP0_OUT.STAT.stat = 0x00;
-            EP0_OUT.ADDR = EP0_OUT_BUFFER;
-            EP0_OUT.CNT = EP0_OUT_BUFFER_SIZE;
+    USB_LATENCY_HIST[USB_USTAT_INDEX(ustat)][bucket]++;
+}
 
-            // Prepare IN buffer
-            EP0_IN.STAT.stat = 0x00;
-            EP0_IN.ADDR = EP0_IN_BUFFER;
-            EP0_IN.CNT = 0; // 0 length packet
+#endif // USB_LATENCY
 
-            // Enable SIE packet processing
-            UCONbits.PKTDIS = 0;
 
-            // Give Buffer descriptors control to the SIE so the data can be sent
-            EP0_OUT.STAT.UOWN = 1;
-            EP0_IN.STAT.UOWN = 1;
 
-        }
-        // No more data to send
-        else
-        {
-            // The data fits in just one in transaction
-            if( bytes_to_send <= EP0_IN_BUFFER_SIZE )
-            {
-                // Fill IN buffer with the complete data
-                int i=0;
-                for( i; i<bytes_to_send; i++)
-                {
-                    *( (__data unsigned char*) EP0_IN_BUFFER + i ) = *(
-                            data_to_send + i);
-                }
+/* Returns the worst case cycles per call for the slot WHICH */
+unsigned short usb_get_max_cycles(unsigned char which)
+{
+#if USB_CYCLES
+    if( which < USB_CYCLES_SLOTS )
+    {
+        return USB_CYCLES_MAX[which];
+    }
+#endif
 
-                // Prepare OUT buffer
-                EP0_OUT.STAT.stat = 0x00;
-                EP0_OUT.ADDR = EP0_OUT_BUFFER;
-                EP0_OUT.CNT = EP0_OUT_BUFFER_SIZE;
+    return 0;
+}
 
-                // Prepare IN buffer
-                EP0_IN.STAT.stat = 0x00;
-                EP0_IN.ADDR = EP0_IN_BUFFER;
-                EP0_IN.CNT = bytes_to_send;
 
-                // Update bytes_to_send, and data_to_send
-                // to 0 (no more data to send)
-                data_to_send = 0;
-                bytes_to_send = 0;
 
-                // Give Buffer descriptors control to the SIE so the data can be sent
-                EP0_OUT.STAT.UOWN = 1;
-                EP0_IN.STAT.UOWN = 1;
+/* Returns the errors counter WHICH (see usbcdc.h) */
+unsigned short usb_get_errors(unsigned char which)
+{
+    unsigned short count = 0;
+#if USB_ERROR_STATS
+    unsigned char usbie;
 
-                // Enable SIE packet processing
-                UCONbits.PKTDIS = 0;
+    if( which < USB_ERRORS_SLOTS )
+    {
+        // Not torn by an interrupt in the middle
+        USB_LOCK(usbie);
+        count = USB_ERRORS_COUNT[which];
+        USB_UNLOCK(usbie);
+    }
+#endif
+
+    return count;
+}
 
-                return;
-            }
-            // The data fits in multiple in transactions
-            else
-            {
-                // Fill IN buffer with the first data bytes
-                int i=0;
-                for( i; i<EP0_IN_BUFFER_SIZE; i++)
-                {
-                    *( (__data unsigned char*) EP0_IN_BUFFER + i ) = *( data_to_send + i);
-                }
 
-                // Prepare OUT buffer
-                EP0_OUT.STAT.stat = 0x00;
-                EP0_OUT.ADDR = EP0_OUT_BUFFER;
-                EP0_OUT.CNT = EP0_OUT_BUFFER_SIZE;
+#if USB_ERROR_PRINTF
+
+/* Prints every errors counter on one line (see usbcdc.h) */
+void usb_print_errors(void)
+{
+    printf("usb: pid %u crc5 %u crc16 %u dfn8 %u bto %u bts %u",
+            usb_get_errors(USB_ERRORS_PID), usb_get_errors(USB_ERRORS_CRC5),
+            usb_get_errors(USB_ERRORS_CRC16), usb_get_errors(USB_ERRORS_DFN8),
+            usb_get_errors(USB_ERRORS_BTO), usb_get_errors(USB_ERRORS_BTS));
+    printf(" stall %u nak %u rearm %u reset %u suspend %u\r\n",
+            usb_get_errors(USB_ERRORS_STALL), usb_get_errors(USB_ERRORS_NAK),
+            usb_get_errors(USB_ERRORS_REARM), usb_get_errors(USB_ERRORS_RESET),
+            usb_get_errors(USB_ERRORS_SUSPEND));
+}
 
-                // Prepare IN buffer
-                EP0_IN.STAT.stat = 0x00;
-                EP0_IN.ADDR = EP0_IN_BUFFER;
-                EP0_IN.CNT = EP0_IN_BUFFER_SIZE;
+#endif
 
-                // Update bytes_to_send, and data_to_send
-                data_to_send += SETUP_PACKET.wLength;
-                bytes_to_send -= SETUP_PACKET.wLength;
 
-                // Give Buffer descriptors control to the SIE so the data can be sent
-                EP0_OUT.STAT.UOWN = 1;
-                EP0_IN.STAT.UOWN = 1;
 
-                // Enable SIE packet processing
-                UCONbits.PKTDIS = 0;
+/* Sends the trace ring to the UART while it has room (see usbcdc.h) */
+void usb_trace_drain(void)
+{
+#if USB_TRACE
+    unsigned char *record;
+    unsigned char usbie;
 
+    while( PIR1bits.TXIF )
+    {
+        // Ring empty: report the dropped events in a record of their own
+        if( USB_TRACE_TAIL == USB_TRACE_HEAD )
+        {
+            if( USB_TRACE_DROPPED == 0 )
+            {
                 return;
             }
+
+            USB_LOCK(usbie);
+            USB_TRACE_EVENT(USB_TRACE_LOST, USB_TRACE_DROPPED, 0);
+            USB_TRACE_DROPPED = 0;
+            USB_UNLOCK(usbie);
+        }
+
+        record = &USB_TRACE_RING[(USB_TRACE_TAIL & USB_TRACE_MASK) << 2];
+        if( USB_TRACE_SENT == 0 )
+        {
+            TXREG = USB_TRACE_SYNC;
+        }
+        else
+        {
+            TXREG = record[USB_TRACE_SENT - 1];
+        }
+
+        if( ++USB_TRACE_SENT == 5 )
+        {
+            USB_TRACE_SENT = 0;
+            USB_TRACE_TAIL++;
         }
     }
+#endif
 }
 
 
 
+#if USB_CYCLES || USB_PROFILE
 
+/* Timer 3 value, reading TMR3L latches TMR3H (RD16) */
+static unsigned short usb_cycles_now(void)
+{
+    unsigned char low = TMR3L;
 
-              /***************  Requests Handlers  *************/
+    return ((unsigned short) TMR3H << 8) | low;
+}
 
+#endif
 
-/*
- * Handle GET_DESCRIPTOR request
- *
- * DESCRIPTOR pointer will point to the first byte of the requested descriptor
- *
- * SIZE will contain the total size in bytes of the requested descriptor
-*/
-static void handle_req_get_descriptor(unsigned char **descriptor, unsigned char *size)
-{
-    // Descriptor type is the high byte of wValue field of the setup packet
-    // (USB 2.0 spec: page 253)
-    unsigned char descriptor_type = SETUP_PACKET.wValue1;
 
-    // Descriptor index is the low byte of wValue field of the setup packet
-    // (USB 2.0 spec: page 253)
-    unsigned char descriptor_index = SETUP_PACKET.wValue0;
+#if USB_CYCLES
 
 
+/* Keeps the worst case cycles since START for the slot WHICH */
+static void usb_cycles_record(unsigned char which, unsigned short start)
+{
+    unsigned short cycles = usb_cycles_now() - start;
 
-    // DEVICE DESCRIPTOR
-    if( descriptor_type == USB_DESC_TYPE_DEVICE )
+    if( cycles > USB_CYCLES_MAX[which] )
     {
-        // Memory position of the descriptor
-        *descriptor = (unsigned char*) &DEVICE_DESC;
+        USB_CYCLES_MAX[which] = cycles;
+    }
+}
 
-        // Size of the descriptor
-        *size = sizeof(DEVICE_DESC);
+#endif // USB_CYCLES
 
-        return;
-    }
 
+#if USB_PROFILE
+
+/* Accounts the cycles since START to the profile SLOT */
+static void usb_profile_record(unsigned char slot, unsigned short start)
+{
+    unsigned short cycles = usb_cycles_now() - start;
+    USB_PROFILE_t *entry = &USB_PROFILE_TABLE[slot];
 
-    // CONFIGURATION DESCRIPTOR
-    if( descriptor_type == USB_DESC_TYPE_CONFIGURATION )
+    entry->calls++;
+    entry->total += cycles;
+    if( cycles > entry->max )
     {
-        // Memory position of the descriptor
-        *descriptor = (unsigned char*) &CONFIGURATION_0;
+        entry->max = cycles;
+    }
+}
+
+#endif // USB_PROFILE
 
-        // Size of the descriptor
-        *size = sizeof(CONFIGURATION_0);
 
+
+/*
+ * USB events handling, the same code for every handler flavor: interrupt
+ * (usb_handler, usb_handler_low) and polling (usb_task)
+ */
+static void usb_service(void)
+{
+    unsigned char pending;
+    unsigned char transactions;
+
+    // If the device isn't in powered state avoid interrupt handling
+    if( USB_DEVICE_STATE < USB_STATE_POWERED )
+    {
         return;
     }
 
+    // Pending and enabled events, read once
+    pending = UIR & UIE;
+
+	// A reset signal has been achieved, any other event is stale
+	if( pending & USB_UIR_URSTIF )
+    {
+        USB_PROFILE_CALL(USB_PROFILE_RESET, handle_urstif());
+        UIRbits.URSTIF = 0;
+#ifdef USB_ON_RESET
+        USB_ON_RESET();
+#endif
+        return;
+	}
+
+#if USB_IE_SOF
+	// A start of frame has been detected, before the transactions so the
+	// frame clock capture doesn't depend on them
+	if( pending & USB_UIR_SOFIF )
+    {
+#if USB_FRAME_CLOCK
+        usb_frame_clock();
+#endif
+        UIRbits.SOFIF = 0;
+#ifdef USB_ON_SOF
+        USB_ON_SOF();
+#endif
+	}
+#endif
 
-    // STRING DESCRIPTOR
-    if( descriptor_type == USB_DESC_TYPE_STRING )
+	// Transactions have finished, drain the USTAT FIFO. Clearing TRNIF
+	// advances the FIFO, the next entry (if any) sets TRNIF again within 6
+	// cycles so it's already valid once the handler returns
+    transactions = 0;
+	if( pending & USB_UIR_TRNIF )
     {
-        // String 0
-        if( descriptor_index == 0 )
+        do
         {
-            // Memory position of the descriptor
-            *descriptor = (unsigned char*) &STRING_DESC_0;
+#if USB_DEFERRED_EVENTS
+            // Queue full: stop transactions interrupts, TRNIF stays set
+            // until usb_process_events() makes room
+            if( (unsigned char) (USB_HOT.ev_head - USB_HOT.ev_tail) >=
+                    USB_EVENT_QUEUE_SIZE )
+            {
+                UIEbits.TRNIE = 0;
+                break;
+            }
 
-            // Size of the descriptor
-            *size = sizeof(STRING_DESC_0);
-        }
+            usb_queue_event();
+#else
+            USB_HOT.ustat = USTAT;
+            UIRbits.TRNIF = 0;
+            USB_TRN_DONE(USB_HOT.ustat);
+            USB_EP_HANDLE();
+#endif
+            transactions++;
+        } while( UIRbits.TRNIF && transactions < USB_TRNIF_MAX_PER_ENTRY );
+	}
 
+#if USB_RESUME_STATS
+    if( transactions && USB_RESUME_PENDING )
+    {
+        usb_resume_record();
+    }
+#endif
 
-        // String 1
-        if( descriptor_index == 1 )
+#if USB_TRN_STATS
+    // Calls that drained the FIFO only, usb_handler_high() counts its own
+    if( transactions )
+    {
+        USB_TRN_STATS_COUNT[transactions]++;
+        if( transactions == USB_TRNIF_MAX_PER_ENTRY && UIRbits.TRNIF )
         {
-            // Memory position of the descriptor
-            *descriptor = (unsigned char*) &STRING_DESC_1;
+            USB_TRN_STATS_COUNT[USB_TRNIF_MAX_PER_ENTRY + 1]++;
+        }
+    }
+#endif
 
-            // Size of the descriptor
-            *size = sizeof(STRING_DESC_1);
+    // Rare events
+    if( pending & (USB_UIR_ACTVIF | USB_UIR_IDLEIF | USB_UIR_UERRIF |
+                USB_UIR_STALLIF) )
+    {
+#if USB_IE_IDLE
+        // An idle condition has been detected, suspend (do not suspend if the
+        // device is not addressed). Idle first: a resume in this same call
+        // leaves a stale IDLEIF behind
+        if( pending & USB_UIR_IDLEIF )
+        {
+            UIRbits.IDLEIF = 0;
+            if( !USB_SUSPENDED && USB_DEVICE_STATE >= USB_STATE_ADDRESS )
+            {
+                usb_suspend();
+            }
         }
 
+        // Activity in the bus has been detected while suspended
+        if( pending & USB_UIR_ACTVIF )
+        {
+            usb_resume();
+        }
+#endif
 
-        // String 2
-        if( descriptor_index == 2 )
+#if USB_IE_UERR
+        // An error condition has been detected: the SIE drops the packet and
+        // keeps the BD, unless endpoint 0 lost the way to the next SETUP
+        if( pending & USB_UIR_UERRIF )
         {
-            // Memory position of the descriptor
-            *descriptor = (unsigned char*) &STRING_DESC_2;
+            USB_TRACE_EVENT(USB_TRACE_ERROR, UEIR, 0);
+            handle_uerrif();
+            ep0_recover();
+        }
+#endif
 
-            // Size of the descriptor
-            *size = sizeof(STRING_DESC_2);
+#if USB_IE_STALL
+        // A STALL handshake has been sent: endpoint 0 stalls until the next
+        // SETUP only (its BDs, never UEP0)
+        if( pending & USB_UIR_STALLIF )
+        {
+            UIRbits.STALLIF = 0;
+            USB_ERROR_COUNT(USB_ERRORS_STALL);
+            USB_TRACE_EVENT(USB_TRACE_STALL, 0, 0);
+            UEP0bits.EPSTALL = 0;
+            ep0_recover();
         }
+#endif
+    }
+}
+
+
+
+#if USB_INTERRUPT_PRIORITY
 
+/*
+ * Handles data endpoints transactions from the high priority vector, any
+ * other pending event is left to usb_handler_low() (see usbcdc.h)
+ */
+void usb_handler_high(void)
+{
+    unsigned char transactions = 0;
+
+    // Any event from now on sets it again
+    PIR2bits.USBIF = 0;
+
+    if( USB_DEVICE_STATE < USB_STATE_POWERED )
+    {
         return;
     }
+
+    // Data endpoints transactions at the USTAT FIFO head, while no reset is
+    // pending (TRNIF is set again within 6 cycles, see usb_handler())
+    while( (UIR & UIE & (USB_UIR_TRNIF | USB_UIR_URSTIF)) == USB_UIR_TRNIF &&
+            (USTAT & USB_USTAT_ENDP) != 0 &&
+            transactions < USB_TRNIF_MAX_PER_ENTRY )
+    {
+        USB_HOT.ustat = USTAT;
+        UIRbits.TRNIF = 0;
+        USB_TRN_DONE(USB_HOT.ustat);
+        USB_EP_HANDLE();
+        transactions++;
+    }
+
+#if USB_RESUME_STATS
+    if( transactions && USB_RESUME_PENDING )
+    {
+        usb_resume_record();
+    }
+#endif
+
+#if USB_TRN_STATS
+    if( transactions )
+    {
+        USB_TRN_STATS_COUNT[transactions]++;
+    }
+#endif
+
+    // Only data transactions left (bound reached): come back at high priority
+    if( (UIR & UIE) == USB_UIR_TRNIF && (USTAT & USB_USTAT_ENDP) != 0 )
+    {
+#if USB_TRN_STATS
+        USB_TRN_STATS_COUNT[USB_TRNIF_MAX_PER_ENTRY + 1]++;
+#endif
+        PIR2bits.USBIF = 1;
+    }
+    // Anything else (EP0, reset, idle...): demote to low priority
+    else if( UIR & UIE )
+    {
+        IPR2bits.USBIP = 0;
+        PIR2bits.USBIF = 1;
+    }
+}
+
+
+/*
+ * Handles every pending event from the low priority vector, then promotes the
+ * USB interrupt back to high priority (see usbcdc.h)
+ */
+void usb_handler_low(void)
+{
+    PIR2bits.USBIF = 0;
+
+    usb_handler();
+
+    IPR2bits.USBIP = 1;
+
+    // Events arrived meanwhile are handled at high priority
+    if( UIR & UIE )
+    {
+        PIR2bits.USBIF = 1;
+    }
+}
+
+#endif // USB_INTERRUPT_PRIORITY
+
+
+
+
+
+              /***************  Interrupt Handlers  *************/
+
+/* Handles reset events */
+static void handle_urstif(void)
+{
+    USB_ERROR_COUNT(USB_ERRORS_RESET);
+    USB_TRACE_EVENT(USB_TRACE_RESET, 0, 0);
+
+    // A reset ends a suspension, remote wakeup goes back to disabled
+    UCONbits.SUSPND = 0;
+    UIEbits.ACTVIE = 0;
+    USB_SUSPENDED = 0;
+    USB_REMOTE_WAKEUP_ENABLED = 0;
+
+    // Keep what the data endpoint holds, before the transactions are flushed
+    data_bus_reset();
+    CDC_LINE_STATE = 0;
+
+    // A dump in progress is dropped, memory access locks again
+#if USB_PEEK_POKE
+    PEEK_STREAM_BYTES = 0;
+    POKE_PENDING = 0;
+#if USB_PEEK_POKE_KEY
+    PEEK_POKE_UNLOCKED = 0;
+#endif
+#endif
+
+    // Clear interrupt flags
+    UIR = 0x00;
+    UEIR = 0x00;
+
+    // Endpoint 0 configuration
+    UEP0bits.EPINEN = 1; // Endpoint 0 IN enabled
+    UEP0bits.EPOUTEN = 1; // Endpoint 0 OUT enabled
+    UEP0bits.EPHSHK = 1; // Endpoint 0 handshake enabled
+    UEP0bits.EPCONDIS = 0; // Endpoint 0 Control transfers allowed
+    UEP0bits.EPSTALL = 0; // Endpoint 0 is not stalled
+
+    // Flush transactions queue
+    while( UIRbits.TRNIF ){ UIRbits.TRNIF = 0; }
+
+    // Enable SIE packet processing
+    UCONbits.PKTDIS = 0;
+
+
+    // Disable every other endpoint until the device gets configured
+    UEP1 = 0; UEP2 = 0; UEP3 = 0; UEP4 = 0; UEP5 = 0; UEP6 = 0; UEP7 = 0;
+    UEP8 = 0; UEP9 = 0; UEP10 = 0; UEP11 = 0; UEP12 = 0; UEP13 = 0;
+    UEP14 = 0; UEP15 = 0;
+
+    // Configure endpoint 0 buffer descriptors so we're ready to
+    // receive the first control transfer
+    EP0_IN.STAT.stat = 0x00; // Give in buffer descriptor control to the CORE
+    EP0_STAGE = EP0_STAGE_SETUP;
+    EP0_PENDING_ADDRESS = 0;
+    EP0_PENDING_PERSONALITY = 0;
+    ep0_arm_setup(); // Give out buffer descriptor control to the SIE
+
+    // Queued transactions are gone (see data_bus_reset()), transactions
+    // interrupts back on
+#if USB_DEFERRED_EVENTS
+    UIEbits.TRNIE = 1;
+#endif
+
+    // The host will address and configure the device again
+    USB_DEVICE_ADDRESS = 0x00;
+    USB_DEVICE_CURRENT_CONFIGURATION = 0x00;
+
+    // Device is now in default state
+    USB_DEVICE_STATE = USB_STATE_DEFAULT;
+}
+
+
+#if USB_IE_UERR
+
+/* Counts the errors flagged in UEIR and clears them */
+static void handle_uerrif(void)
+{
+    unsigned char errors = UEIR;
+#if USB_ERROR_STATS
+    unsigned char slot;
+#endif
+
+    // UERRIF is Read Only, clear UEIR instead: only the flags read, an error
+    // flagged meanwhile stays for the next call
+    UEIR &= ~errors;
+
+#if USB_ERROR_STATS
+    if( errors & USB_UEIR_BTSEF )
+    {
+        USB_ERRORS_COUNT[USB_ERRORS_BTS]++;
+    }
+
+    // The others follow the UEIR bits order
+    errors &= USB_UEIR_ALL & ~USB_UEIR_BTSEF;
+    for( slot=USB_ERRORS_PID; errors; slot++ )
+    {
+        if( errors & 0x01 )
+        {
+            USB_ERRORS_COUNT[slot]++;
+        }
+        errors >>= 1;
+    }
+#else
+    (void) errors;
+#endif
+}
+
+#endif // USB_IE_UERR
+
+
+#if USB_IE_UERR || USB_IE_STALL
+
+/*
+ * With no transaction left to handle, endpoint 0 must be waiting for a SETUP:
+ * its OUT BD owned by the SIE and packet processing enabled. Otherwise (a
+ * transaction lost to an error) they are given back
+ */
+static void ep0_recover(void)
+{
+    if( UIRbits.TRNIF )
+    {
+        return;
+    }
+#if USB_DEFERRED_EVENTS
+    if( USB_HOT.ev_head != USB_HOT.ev_tail )
+    {
+        return;
+    }
+#endif
+
+    if( !(EP0_OUT.STAT.stat & USB_BD_UOWN) )
+    {
+        ep0_arm_setup();
+        USB_ERROR_COUNT(USB_ERRORS_REARM);
+    }
+    UCONbits.PKTDIS = 0;
+}
+
+#endif // USB_IE_UERR || USB_IE_STALL
+
+
+#if USB_IE_IDLE
+
+/*
+ * Suspends the SIE after 3ms of bus idle. Device state, endpoints and rings
+ * are kept as they are, the application stops the core with usb_sleep()
+ */
+static void usb_suspend(void)
+{
+    // Bus activity resumes, ACTVIF can be cleared only once SUSPND is 0
+    UIEbits.ACTVIE = 1;
+    UCONbits.SUSPND = 1;
+    USB_SUSPENDED = 1;
+    USB_ERROR_COUNT(USB_ERRORS_SUSPEND);
+    USB_TRACE_EVENT(USB_TRACE_SUSPEND, 0, 0);
+
+#ifdef USB_ON_SUSPEND
+    USB_ON_SUSPEND();
+#endif
+}
+
+
+/* Leaves the suspended state, on bus activity or remote wakeup */
+static void usb_resume(void)
+{
+    UCONbits.SUSPND = 0;
+    UIEbits.ACTVIE = 0;
+
+    // The SIE clock needs a few cycles to be stable, ACTVIF is not cleared
+    // until then
+    while( UIRbits.ACTVIF ){ UIRbits.ACTVIF = 0; }
+    USB_SUSPENDED = 0;
+    USB_TRACE_EVENT(USB_TRACE_RESUME, 0, 0);
+
+#if USB_RESUME_STATS
+    // Timer 3 from zero, TMR3IF flags an overflow (43ms)
+    TMR3H = 0;
+    TMR3L = 0;
+    PIR2bits.TMR3IF = 0;
+    USB_RESUME_PENDING = 1;
+#endif
+
+#ifdef USB_ON_RESUME
+    USB_ON_RESUME();
+#endif
+}
+
+#endif // USB_IE_IDLE
+
+
+#if USB_RESUME_STATS
+
+/* First transaction since the resume: keeps the last and worst latencies */
+static void usb_resume_record(void)
+{
+    unsigned char low = TMR3L;
+    unsigned short ticks = ((unsigned short) TMR3H << 8) | low;
+
+    if( PIR2bits.TMR3IF )
+    {
+        ticks = 0xFFFF;
+    }
+
+    USB_RESUME_REPLY[USB_RESUME_LAST] = ticks;
+    if( ticks > USB_RESUME_REPLY[USB_RESUME_WORST] )
+    {
+        USB_RESUME_REPLY[USB_RESUME_WORST] = ticks;
+    }
+    USB_RESUME_REPLY[USB_RESUME_COUNT]++;
+    USB_RESUME_PENDING = 0;
+}
+
+#endif
+
+
+/* Transactions to endpoints without a handler, never happens */
+static void ep_unused_handler(void)
+{
+}
+
+
+
+
+
+              /***************  Transfers Handlers  *************/
+
+
+/*
+ * Handles control transfers
+ *
+ * Optional SET_DESCRIPTOR request not implemented here, so we don't need to
+ * worry about any DATA OUT STAGE.
+ *
+ * Handle this 3 control transfer stages:
+ *      - OUT direction transactions (control_out_handler)
+ *          * SETUP stage
+ *          * STATUS stage (after a DATA IN stage)
+ *      - IN direction transactions (control_in_handler)
+ *          * DATA IN stage
+ *          * STATUS stage (requests without DATA stage)
+*/
+static void control_out_handler(void)
+{
+    /*****  OUT direction transactions  (SETUP, DATA or STATUS stage)  *****/
+
+    /*** SETUP transaction (SETUP stage) ***/
+    if (EP0_OUT.STAT.PID == USB_PID_TOKEN_SETUP)
+    {
+        // The CPU owns the endpoint 0 buffer descriptors, a SETUP
+        // transaction aborts any previous control transfer (and stall)
+        EP0_IN.STAT.stat = 0x00;
+        EP0_OUT.STAT.stat = 0x00;
+
+        // Requests handlers choose the next stage, anything they don't
+        // handle is stalled
+        EP0_STAGE = EP0_STAGE_STALL;
+        EP0_BYTES = 0;
+        EP0_ASCII = 0;
+        EP0_ZLP = 0;
+        EP0_IN_DTS = 1;
+
+        // A program memory row not written yet goes with its transfer
+#if USB_PEEK_POKE
+        POKE_PENDING = 0;
+#endif
+
+
+        /*** Handle requests ***/
+        if( (SETUP_PACKET.bmRequestType & USB_REQ_TYPE_MASK) ==
+                USB_REQ_TYPE_STANDARD )
+        {
+            USB_PROFILE_CALL(USB_PROFILE_STANDARD, handle_standard_request());
+        }
+        else if( (SETUP_PACKET.bmRequestType & USB_REQ_TYPE_MASK) ==
+                USB_REQ_TYPE_CLASS )
+        {
+            USB_PROFILE_CALL(USB_PROFILE_CLASS, handle_class_request());
+        }
+        else if( (SETUP_PACKET.bmRequestType & USB_REQ_TYPE_MASK) ==
+                USB_REQ_TYPE_VENDOR )
+        {
+            USB_PROFILE_CALL(USB_PROFILE_VENDOR, handle_vendor_request());
+        }
+
+
+        /*** Start the next stage ***/
+
+        // DATA IN stage: send the first packet, the OUT buffer waits for
+        // the STATUS stage
+        if( EP0_STAGE == EP0_STAGE_DATA_IN )
+        {
+            ep0_arm_setup();
+            ep0_send_packet();
+        }
+        // STATUS stage: send a zero length DATA1 packet
+        else if( EP0_STAGE == EP0_STAGE_STATUS_IN )
+        {
+            ep0_arm_setup();
+            ep0_status_in();
+        }
+        // DATA OUT stage: the OUT buffer takes the data packets, the STATUS
+        // stage comes after the last one
+        else if( EP0_STAGE == EP0_STAGE_DATA_OUT )
+        {
+            ep0_arm_setup();
+        }
+        // Unsupported request: stall both directions until the next
+        // SETUP transaction (USB 2.0 spec: page 256, section 8.5.3.4)
+        else
+        {
+            EP0_OUT.ADDR = EP0_OUT_BUFFER;
+            EP0_OUT.CNT = EP0_OUT_BUFFER_SIZE;
+            EP0_OUT.STAT.stat = USB_BD_UOWN | USB_BD_BSTALL;
+            EP0_IN.STAT.stat = USB_BD_UOWN | USB_BD_BSTALL;
+            USB_BD_ARMED(0, OUT, 0);
+        }
+
+        // Enable SIE packet processing (disabled by the SETUP token)
+        UCONbits.PKTDIS = 0;
+    }
+    /*** OUT transaction (DATA OUT stage) ***/
+    else if( EP0_STAGE == EP0_STAGE_DATA_OUT )
+    {
+        ep0_receive_packet();
+    }
+    /*** OUT transaction (STATUS stage) ***/
+    else
+    {
+        /*
+         * The host has confirmed the end of the control transfer
+         * so we need to prepare everything for any future control transfer
+        */
+        EP0_STAGE = EP0_STAGE_SETUP;
+        ep0_arm_setup();
+    }
+}
+
+
+/* Handles control transfers IN transactions (DATA IN or STATUS stage) */
+static void control_in_handler(void)
+{
+    // Keep sending the DATA IN stage, ends with a short (or zero length)
+    // packet (USB 2.0 spec: page 253)
+    if( EP0_STAGE == EP0_STAGE_DATA_IN )
+    {
+        if( EP0_BYTES > 0 || EP0_ZLP )
+        {
+            ep0_send_packet();
+        }
+    }
+    // STATUS stage finished, the request is complete
+    else if( EP0_STAGE == EP0_STAGE_STATUS_IN )
+    {
+        // SET_ADDRESS takes effect only now (USB 2.0 spec: page 256)
+        if( EP0_PENDING_ADDRESS )
+        {
+            UADDR = EP0_PENDING_ADDRESS & 0x7F;
+            USB_DEVICE_ADDRESS = UADDR;
+            EP0_PENDING_ADDRESS = 0;
+
+            if( USB_DEVICE_ADDRESS != 0 )
+            {
+                USB_DEVICE_STATE = USB_STATE_ADDRESS;
+            }
+            else
+            {
+                USB_DEVICE_STATE = USB_STATE_DEFAULT;
+            }
+        }
+
+        EP0_STAGE = EP0_STAGE_SETUP;
+
+        // SET_PERSONALITY: the main loop re-enumerates with the new
+        // descriptors set
+        if( EP0_PENDING_PERSONALITY )
+        {
+            USB_PERSONALITY_SWITCH = EP0_PENDING_PERSONALITY;
+            EP0_PENDING_PERSONALITY = 0;
+        }
+    }
+}
+
+
+
+/*
+ * Starts a DATA IN stage
+ *
+ * Sends SIZE bytes from DATA (code or data memory) truncated to the wLength
+ * field of the setup packet
+*/
+static void ep0_send(const unsigned char *data, unsigned short size)
+{
+    // Never send more bytes than the host asked for
+    if( size > SETUP_PACKET.wLength )
+    {
+        size = SETUP_PACKET.wLength;
+    }
+
+    EP0_DATA = data;
+    EP0_OFFSET = 0;
+    EP0_BYTES = size;
+
+    // A short reply that fills the last packet must end with a zero length
+    // packet so the host knows there is no more data
+    EP0_ZLP = ( size < SETUP_PACKET.wLength ) &&
+        ( (size % EP0_IN_BUFFER_SIZE) == 0 );
+
+    EP0_STAGE = EP0_STAGE_DATA_IN;
+}
+
+
+/* Accepts a request with no DATA stage (zero length STATUS stage) */
+static void ep0_ack(void)
+{
+    EP0_STAGE = EP0_STAGE_STATUS_IN;
+}
+
+
+/*
+ * Starts a DATA OUT stage
+ *
+ * The wLength bytes the host sends go to DATA, the caller checked they fit.
+ * DONE (if any) runs once they are all in
+*/
+static void ep0_receive(unsigned char *data, void (*done)(void))
+{
+    EP0_RECEIVE = data;
+    EP0_RECEIVED = done;
+    EP0_BYTES = SETUP_PACKET.wLength;
+    EP0_STAGE = EP0_STAGE_DATA_OUT;
+}
+
+
+/*
+ * Sends the next DATA IN stage packet
+ *
+ * Up to EP0_IN_BUFFER_SIZE bytes, with alternating DATA1/DATA0 toggle
+ *
+ * ASCII string descriptors are expanded to UTF-16LE here: after the 2 bytes
+ * header, even positions take the next character and odd positions are the
+ * zero high bytes. EP0_OFFSET keeps the position across packets, so packet
+ * boundaries and wLength truncation may fall anywhere in the string
+*/
+static void ep0_send_packet(void)
+{
+    unsigned char i;
+    unsigned char size;
+
+    // Bytes that fit in this packet
+    if( EP0_BYTES > EP0_IN_BUFFER_SIZE )
+    {
+        size = EP0_IN_BUFFER_SIZE;
+    }
+    else
+    {
+        size = (unsigned char) EP0_BYTES;
+    }
+
+    // Fill IN buffer
+    if( EP0_ASCII )
+    {
+        for( i=0; i<size; i++, EP0_OFFSET++)
+        {
+            // bLength and bDescriptorType
+            if( EP0_OFFSET < 2 )
+            {
+                EP0_IN_DATA[i] =
+                    EP0_DATA[EP0_OFFSET];
+            }
+            // High byte of a character
+            else if( EP0_OFFSET & 1 )
+            {
+                EP0_IN_DATA[i] = 0x00;
+            }
+            // Low byte of a character: the ASCII code
+            else
+            {
+                EP0_IN_DATA[i] =
+                    EP0_DATA[(EP0_OFFSET >> 1) + 1];
+            }
+        }
+    }
+    else
+    {
+        for( i=0; i<size; i++)
+        {
+            EP0_IN_DATA[i] =
+                EP0_DATA[EP0_OFFSET + i];
+        }
+        EP0_OFFSET += size;
+    }
+
+    // Update pending bytes
+    EP0_BYTES -= size;
+
+    // The zero length packet is being sent
+    if( size == 0 )
+    {
+        EP0_ZLP = 0;
+    }
+
+    // Prepare IN buffer
+    EP0_IN.ADDR = EP0_IN_BUFFER;
+    EP0_IN.CNT = size;
+
+    // Give IN buffer descriptor control to the SIE so the data can be sent
+    if( EP0_IN_DTS )
+    {
+        EP0_IN.STAT.stat = USB_BD_UOWN | USB_BD_DTSEN | USB_BD_DTS;
+    }
+    else
+    {
+        EP0_IN.STAT.stat = USB_BD_UOWN | USB_BD_DTSEN;
+    }
+    USB_BD_ARMED(0, IN, 0);
+    EP0_IN_DTS ^= 1;
+}
+
+
+/*
+ * Copies a DATA OUT stage packet, the last one (wLength reached or short
+ * packet) starts the STATUS stage
+*/
+static void ep0_receive_packet(void)
+{
+    unsigned char i;
+    unsigned char size = EP0_OUT.CNT;
+    unsigned char last = size < EP0_OUT_BUFFER_SIZE;
+
+    if( size > EP0_BYTES )
+    {
+        size = (unsigned char) EP0_BYTES;
+    }
+
+    for( i=0; i<size; i++ )
+    {
+        EP0_RECEIVE[i] = USB_EP_BUFFER(0, OUT, 0)[i];
+    }
+    EP0_RECEIVE += size;
+    EP0_BYTES -= size;
+
+    ep0_arm_setup();
+
+    if( last || EP0_BYTES == 0 )
+    {
+        if( EP0_RECEIVED )
+        {
+            EP0_RECEIVED();
+        }
+
+        // Program memory row: the main loop starts the STATUS stage
+#if USB_PEEK_POKE
+        if( POKE_PENDING )
+        {
+            return;
+        }
+#endif
+        ep0_status_in();
+    }
+}
+
+
+/* Starts the STATUS stage of a request without DATA IN stage */
+static void ep0_status_in(void)
+{
+    EP0_STAGE = EP0_STAGE_STATUS_IN;
+    EP0_IN.ADDR = EP0_IN_BUFFER;
+    EP0_IN.CNT = 0;
+    EP0_IN.STAT.stat = USB_BD_UOWN | USB_BD_DTSEN | USB_BD_DTS;
+    USB_BD_ARMED(0, IN, 0);
+}
+
+
+/* Prepares the OUT buffer to receive the next SETUP (or STATUS) transaction */
+static void ep0_arm_setup(void)
+{
+    EP0_OUT.ADDR = EP0_OUT_BUFFER;
+    EP0_OUT.CNT = EP0_OUT_BUFFER_SIZE;
+    EP0_OUT.STAT.stat = USB_BD_UOWN;
+    USB_BD_ARMED(0, OUT, 0);
+}
+
+
+
+
+
+              /***************  Requests Handlers  *************/
+
+
+/* Dispatches standard requests (USB 2.0 spec: page 250, section 9.4) */
+static void handle_standard_request(void)
+{
+    switch( SETUP_PACKET.bRequest )
+    {
+        case USB_REQ_GET_STATUS:
+            handle_req_get_status();
+            break;
+
+        case USB_REQ_CLEAR_FEATURE:
+            handle_req_clear_feature();
+            break;
+
+        case USB_REQ_SET_FEATURE:
+            handle_req_set_feature();
+            break;
+
+        case USB_REQ_SET_ADDRESS:
+            handle_req_set_address();
+            break;
+
+        case USB_REQ_GET_DESCRIPTOR:
+            USB_PROFILE_CALL(USB_PROFILE_GET_DESCRIPTOR,
+                    handle_req_get_descriptor());
+            break;
+
+        case USB_REQ_GET_CONFIGURATION:
+            handle_req_get_configuration();
+            break;
+
+        case USB_REQ_SET_CONFIGURATION:
+            handle_req_set_configuration();
+            break;
+
+        case USB_REQ_GET_INTERFACE:
+            handle_req_get_interface();
+            break;
+
+        case USB_REQ_SET_INTERFACE:
+            handle_req_set_interface();
+            break;
+
+        // SET_DESCRIPTOR and SYNCH_FRAME are not supported (stall)
+        default:
+            break;
+    }
+}
+
+
+/*
+ * Handle GET_STATUS request
+ *
+ * Bus powered device, bit 1 reports remote wakeup enabled. Endpoints report
+ * ENDPOINT_HALT in bit 0, missing ones are a request error
+*/
+static void handle_req_get_status(void)
+{
+    unsigned char index;
+
+    EP0_REPLY[0] = 0x00;
+    EP0_REPLY[1] = 0x00;
+    if( (SETUP_PACKET.bmRequestType & USB_REQ_RECIPIENT_MASK) ==
+            USB_REQ_RECIPIENT_DEVICE && USB_REMOTE_WAKEUP_ENABLED )
+    {
+        EP0_REPLY[0] = 0x02;
+    }
+    else if( (SETUP_PACKET.bmRequestType & USB_REQ_RECIPIENT_MASK) ==
+            USB_REQ_RECIPIENT_ENDPOINT )
+    {
+        index = ep_request_index();
+        if( index == EP_NONE )
+        {
+            return;
+        }
+        if( USB_HOT.ep_halted & EP_HALT_BIT(index) )
+        {
+            EP0_REPLY[0] = 0x01;
+        }
+    }
+    ep0_send(EP0_REPLY, 2);
+}
+
+
+/* Handle CLEAR_FEATURE request, ENDPOINT_HALT and DEVICE_REMOTE_WAKEUP */
+static void handle_req_clear_feature(void)
+{
+    unsigned char index;
+
+    if( (SETUP_PACKET.bmRequestType & USB_REQ_RECIPIENT_MASK) ==
+            USB_REQ_RECIPIENT_ENDPOINT &&
+        SETUP_PACKET.wValue0 == USB_FEATURE_ENDPOINT_HALT )
+    {
+        index = ep_request_index();
+        if( index != EP_NONE )
+        {
+            ep_halt(index, 0);
+            ep0_ack();
+        }
+    }
+#if USB_REMOTE_WAKEUP
+    else if( (SETUP_PACKET.bmRequestType & USB_REQ_RECIPIENT_MASK) ==
+            USB_REQ_RECIPIENT_DEVICE &&
+        SETUP_PACKET.wValue0 == USB_FEATURE_DEVICE_REMOTE_WAKEUP )
+    {
+        USB_REMOTE_WAKEUP_ENABLED = 0;
+        ep0_ack();
+    }
+#endif
+}
+
+
+/* Handle SET_FEATURE request, ENDPOINT_HALT and DEVICE_REMOTE_WAKEUP */
+static void handle_req_set_feature(void)
+{
+    unsigned char index;
+
+    if( (SETUP_PACKET.bmRequestType & USB_REQ_RECIPIENT_MASK) ==
+            USB_REQ_RECIPIENT_ENDPOINT &&
+        SETUP_PACKET.wValue0 == USB_FEATURE_ENDPOINT_HALT )
+    {
+        index = ep_request_index();
+        if( index != EP_NONE )
+        {
+            ep_halt(index, 1);
+            ep0_ack();
+        }
+    }
+#if USB_REMOTE_WAKEUP
+    else if( (SETUP_PACKET.bmRequestType & USB_REQ_RECIPIENT_MASK) ==
+            USB_REQ_RECIPIENT_DEVICE &&
+        SETUP_PACKET.wValue0 == USB_FEATURE_DEVICE_REMOTE_WAKEUP )
+    {
+        USB_REMOTE_WAKEUP_ENABLED = 1;
+        ep0_ack();
+    }
+#endif
+}
+
+
+/*
+ * Handle SET_ADDRESS request
+ *
+ * The new address is applied after the STATUS stage
+*/
+static void handle_req_set_address(void)
+{
+    // Bit 7 flags the pending address (USB addresses are 7 bits long)
+    EP0_PENDING_ADDRESS = SETUP_PACKET.wValue0 | 0x80;
+    ep0_ack();
+}
+
+
+/*
+ * Handle GET_DESCRIPTOR request
+ *
+ * The requested descriptor is looked up in the generated descriptors index of
+ * the active personality (see usb_device.spec), unknown descriptors are
+ * stalled
+*/
+static void handle_req_get_descriptor(void)
+{
+    // Descriptor type is the high byte of wValue field of the setup packet
+    // (USB 2.0 spec: page 253)
+    unsigned char descriptor_type = SETUP_PACKET.wValue1;
+
+    // Descriptor index is the low byte of wValue field of the setup packet
+    // (USB 2.0 spec: page 253)
+    unsigned char descriptor_index = SETUP_PACKET.wValue0;
+
+    __code USB_DESC_INDEX_t *descriptor;
+
+
+    if( descriptor_type > USB_DESC_TYPE_LAST ||
+        descriptor_index >= USB_PERSONALITY->count[descriptor_type] )
+    {
+        return;
+    }
+
+    descriptor = &USB_PERSONALITY->index[
+        USB_PERSONALITY->first[descriptor_type] + descriptor_index ];
+
+    ep0_send(USB_DESCRIPTORS + descriptor->wOffset, descriptor->wLength);
+
+    // String descriptors stored as ASCII are expanded while they are sent
+    EP0_ASCII = descriptor->bFlags & USB_DESC_FLAG_ASCII;
+}
+
+
+/* Handle GET_CONFIGURATION request */
+static void handle_req_get_configuration(void)
+{
+    EP0_REPLY[0] = USB_DEVICE_CURRENT_CONFIGURATION;
+    ep0_send(EP0_REPLY, 1);
+}
+
+
+/*
+ * Handle SET_CONFIGURATION request
+ *
+ * Configuration 0 takes the device back to the address state, the only
+ * configuration enables the endpoints the active personality describes
+*/
+static void handle_req_set_configuration(void)
+{
+    if( USB_DEVICE_STATE < USB_STATE_ADDRESS )
+    {
+        return;
+    }
+
+    if( SETUP_PACKET.wValue0 == 0 )
+    {
+        ep_halt_reset();
+        USB_DEVICE_CURRENT_CONFIGURATION = 0;
+        USB_DEVICE_STATE = USB_STATE_ADDRESS;
+        ep0_ack();
+    }
+    else if( SETUP_PACKET.wValue0 == USB_PERSONALITY->bConfigurationValue )
+    {
+        ep_halt_reset();
+        USB_PERSONALITY->setup_endpoints();
+        USB_DEVICE_CURRENT_CONFIGURATION = SETUP_PACKET.wValue0;
+        USB_DEVICE_STATE = USB_STATE_CONFIGURED;
+        data_reset();
+        ep0_ack();
+#ifdef USB_ON_CONFIGURED
+        USB_ON_CONFIGURED();
+#endif
+    }
+}
+
+
+/* Handle GET_INTERFACE request, only alternate setting 0 exists */
+static void handle_req_get_interface(void)
+{
+    if( USB_DEVICE_STATE == USB_STATE_CONFIGURED )
+    {
+        EP0_REPLY[0] = 0x00;
+        ep0_send(EP0_REPLY, 1);
+    }
+}
+
+
+/* Handle SET_INTERFACE request, only alternate setting 0 exists */
+static void handle_req_set_interface(void)
+{
+    if( USB_DEVICE_STATE == USB_STATE_CONFIGURED &&
+        SETUP_PACKET.wValue0 == 0 )
+    {
+        ep0_ack();
+    }
+}
+
+
+
+/*
+ * Dispatches CDC/ACM class requests (see CDC LINE STATE above)
+ *
+ * Other personalities, interfaces and requests are stalled
+*/
+static void handle_class_request(void)
+{
+    if( USB_PERSONALITY_NUMBER != USB_PERSONALITY_CDC ||
+            (SETUP_PACKET.bmRequestType & USB_REQ_RECIPIENT_MASK) !=
+            USB_REQ_RECIPIENT_INTERFACE ||
+            SETUP_PACKET.wIndex0 != CDC_COMM_INTERFACE ||
+            SETUP_PACKET.wIndex1 != 0 )
+    {
+        return;
+    }
+
+    switch( SETUP_PACKET.bRequest )
+    {
+        case USB_CDC_REQ_SET_LINE_CODING:
+            if( SETUP_PACKET.wLength == USB_CDC_LINE_CODING_SIZE )
+            {
+                ep0_receive(CDC_LINE_CODING, cdc_line_coding_received);
+            }
+            break;
+
+        case USB_CDC_REQ_GET_LINE_CODING:
+            ep0_send(CDC_LINE_CODING, USB_CDC_LINE_CODING_SIZE);
+            break;
+
+        case USB_CDC_REQ_SET_CONTROL_LINE_STATE:
+            CDC_LINE_STATE = SETUP_PACKET.wValue0 &
+                (USB_CDC_LINE_DTR | USB_CDC_LINE_RTS);
+#ifdef USB_ON_LINE_STATE
+            USB_ON_LINE_STATE();
+#endif
+            ep0_ack();
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+/* SET_LINE_CODING DATA stage received */
+static void cdc_line_coding_received(void)
+{
+#ifdef USB_ON_LINE_STATE
+    USB_ON_LINE_STATE();
+#endif
+}
+
+
+/*
+ * Dispatches vendor requests (see usb_vendor.h)
+ *
+ * Unknown vendor requests are stalled
+*/
+static void handle_vendor_request(void)
+{
+    switch( SETUP_PACKET.bRequest )
+    {
+        // Switch personality once the STATUS stage is done
+        case USB_VENDOR_REQ_SET_PERSONALITY:
+            if( SETUP_PACKET.wValue0 < USB_PERSONALITY_COUNT )
+            {
+                // Bit 7 flags the pending personality
+                EP0_PENDING_PERSONALITY = SETUP_PACKET.wValue0 | 0x80;
+                ep0_ack();
+            }
+            break;
+
+        case USB_VENDOR_REQ_GET_PERSONALITY:
+            EP0_REPLY[0] = USB_PERSONALITY_NUMBER;
+            ep0_send(EP0_REPLY, 1);
+            break;
+
+#if USB_CYCLES
+        case USB_VENDOR_REQ_GET_CYCLES:
+            ep0_send((const unsigned char*) USB_CYCLES_MAX,
+                    sizeof(USB_CYCLES_MAX));
+            break;
+
+        case USB_VENDOR_REQ_CLEAR_CYCLES:
+            USB_CYCLES_MAX[USB_CYCLES_HANDLER] = 0;
+            USB_CYCLES_MAX[USB_CYCLES_TASK] = 0;
+            USB_CYCLES_MAX[USB_CYCLES_EVENTS] = 0;
+            ep0_ack();
+            break;
+#endif
+
+#if USB_ERROR_STATS
+        case USB_VENDOR_REQ_GET_ERRORS:
+            ep0_send((const unsigned char*) USB_ERRORS_COUNT,
+                    sizeof(USB_ERRORS_COUNT));
+            break;
+#endif
+
+#if USB_LATENCY
+        case USB_VENDOR_REQ_GET_LATENCY:
+            ep0_send((const unsigned char*) USB_LATENCY_HIST,
+                    sizeof(USB_LATENCY_HIST));
+            break;
+
+        case USB_VENDOR_REQ_CLEAR_LATENCY:
+        {
+            unsigned short i;
+
+            for( i=0; i<sizeof(USB_LATENCY_HIST); i++ )
+            {
+                ((unsigned char*) USB_LATENCY_HIST)[i] = 0;
+            }
+            ep0_ack();
+            break;
+        }
+#endif
+
+#if USB_PROFILE
+        case USB_VENDOR_REQ_GET_PROFILE:
+            ep0_send((const unsigned char*) USB_PROFILE_TABLE,
+                    sizeof(USB_PROFILE_TABLE));
+            break;
+
+        case USB_VENDOR_REQ_CLEAR_PROFILE:
+        {
+            unsigned char i;
+
+            for( i=0; i<sizeof(USB_PROFILE_TABLE); i++ )
+            {
+                ((unsigned char*) USB_PROFILE_TABLE)[i] = 0;
+            }
+            ep0_ack();
+            break;
+        }
+#endif
+
+#if USB_FRAME_CLOCK
+        // SOF samples oldest first, then now
+        case USB_VENDOR_REQ_GET_TIMESTAMPS:
+        {
+            unsigned char i;
+            unsigned char next = USB_FRAME_RING_NEXT;
+
+            for( i=0; i<USB_FRAME_SAMPLES; i++ )
+            {
+                USB_FRAME_REPLY[i] = USB_FRAME_RING[next];
+                if( ++next == USB_FRAME_SAMPLES )
+                {
+                    next = 0;
+                }
+            }
+
+            // Raw Timer 1 like the samples, no SOF is handled meanwhile
+            USB_FRAME_REPLY[USB_FRAME_SAMPLES].frame = USB_HOT.frame;
+            USB_FRAME_REPLY[USB_FRAME_SAMPLES].timer = usb_timer1();
+
+            ep0_send((const unsigned char*) USB_FRAME_REPLY,
+                    sizeof(USB_FRAME_REPLY));
+            break;
+        }
+#endif
+
+#if USB_RESUME_STATS
+        case USB_VENDOR_REQ_GET_RESUME_STATS:
+            ep0_send((const unsigned char*) USB_RESUME_REPLY,
+                    sizeof(USB_RESUME_REPLY));
+            break;
+#endif
+
+#if USB_TRN_STATS
+        case USB_VENDOR_REQ_GET_TRN_STATS:
+            ep0_send((const unsigned char*) USB_TRN_STATS_COUNT,
+                    sizeof(USB_TRN_STATS_COUNT));
+            break;
+#endif
+
+#if USB_PEEK_POKE
+        case USB_VENDOR_REQ_PEEK:
+            if( PEEK_POKE_ALLOWED() &&
+                    SETUP_PACKET.wIndex0 <= USB_PEEK_PROGRAM )
+            {
+                ep0_send(peek_pointer(SETUP_PACKET.wIndex0,
+                            peek_request_address()), SETUP_PACKET.wLength);
+            }
+            break;
+
+        // Data memory is written in place, program memory once the whole
+        // row is received
+        case USB_VENDOR_REQ_POKE:
+            if( !PEEK_POKE_ALLOWED() )
+            {
+                break;
+            }
+
+            // Nothing to write: no DATA stage, the STATUS stage right away
+            if( SETUP_PACKET.wIndex0 == USB_PEEK_DATA &&
+                    SETUP_PACKET.wLength == 0 )
+            {
+                ep0_ack();
+            }
+            else if( SETUP_PACKET.wIndex0 == USB_PEEK_DATA )
+            {
+                ep0_receive((unsigned char*) peek_pointer(USB_PEEK_DATA,
+                            peek_request_address()), 0);
+            }
+            else if( SETUP_PACKET.wIndex0 == USB_PEEK_PROGRAM &&
+                    SETUP_PACKET.wLength == USB_PEEK_ROW_SIZE &&
+                    (SETUP_PACKET.wValue0 & (USB_PEEK_ROW_SIZE - 1)) == 0 )
+            {
+                POKE_ADDRESS = peek_request_address();
+                ep0_receive(POKE_ROW, poke_row_received);
+            }
+            break;
+
+        // wIndex is the length here, the address is below 64KB
+        case USB_VENDOR_REQ_PEEK_STREAM:
+        case USB_VENDOR_REQ_PEEK_STREAM_PROGRAM:
+            if( PEEK_POKE_ALLOWED() && !PEEK_STREAM_PENDING() &&
+                    USB_DEVICE_STATE == USB_STATE_CONFIGURED )
+            {
+                PEEK_STREAM_DATA = peek_pointer(SETUP_PACKET.bRequest ==
+                        USB_VENDOR_REQ_PEEK_STREAM_PROGRAM ?
+                        USB_PEEK_PROGRAM : USB_PEEK_DATA,
+                        ((unsigned short) SETUP_PACKET.wValue1 << 8) |
+                        SETUP_PACKET.wValue0);
+                PEEK_STREAM_BYTES =
+                    ((unsigned short) SETUP_PACKET.wIndex1 << 8) |
+                    SETUP_PACKET.wIndex0;
+                data_tx_kick();
+                ep0_ack();
+            }
+            break;
+
+#if USB_PEEK_POKE_KEY
+        // A wrong key locks too
+        case USB_VENDOR_REQ_UNLOCK:
+            PEEK_POKE_UNLOCKED =
+                SETUP_PACKET.wValue0 == (USB_PEEK_POKE_KEY & 0xFF) &&
+                SETUP_PACKET.wValue1 == ((USB_PEEK_POKE_KEY >> 8) & 0xFF) &&
+                SETUP_PACKET.wIndex0 == (~USB_PEEK_POKE_KEY & 0xFF) &&
+                SETUP_PACKET.wIndex1 == ((~USB_PEEK_POKE_KEY >> 8) & 0xFF);
+            if( PEEK_POKE_UNLOCKED )
+            {
+                ep0_ack();
+            }
+            break;
+#endif
+#endif
+
+        default:
+            break;
+    }
+}
+
+
+
+
+
+              /***************  Endpoint Halt  *************/
+
+
+/*
+ * USB_USTAT_INDEX of the endpoint a request is addressed to (wIndex), EP_NONE
+ * if the device has no such endpoint: endpoint 0 always, the others once
+ * configured and enabled in that direction
+*/
+static unsigned char ep_request_index(void)
+{
+    unsigned char ep = SETUP_PACKET.wIndex0 & 0x0F;
+    unsigned char dir = SETUP_PACKET.wIndex0 >> 7;
+
+    if( (SETUP_PACKET.wIndex0 & 0x70) || SETUP_PACKET.wIndex1 ||
+            ep > USB_EP_LAST )
+    {
+        return EP_NONE;
+    }
+
+    if( ep != 0 && (USB_DEVICE_STATE != USB_STATE_CONFIGURED ||
+            !(USB_UEP(ep) & (dir ? USB_UEP_EPINEN : USB_UEP_EPOUTEN))) )
+    {
+        return EP_NONE;
+    }
+
+    return 2 * ep + dir;
+}
+
+
+/*
+ * Sets (HALT) or clears ENDPOINT_HALT on endpoint direction 'index', either way
+ * it starts again with DATA0 (USB 2.0 spec: page 258). A halted direction
+ * answers STALL from its BDs (BSTALL), UEPn EPSTALL would stall both. Endpoint
+ * 0 has no halt state, it only stalls the requests it fails
+*/
+static void ep_halt(unsigned char index, unsigned char halt)
+{
+    unsigned char ep = index >> 1;
+    unsigned char dir = index & 1;
+    unsigned char odd;
+
+    if( ep == 0 )
+    {
+        return;
+    }
+
+    if( halt )
+    {
+        USB_HOT.ep_halted |= EP_HALT_BIT(index);
+    }
+    else
+    {
+        USB_HOT.ep_halted &= ~EP_HALT_BIT(index);
+    }
+
+    if( ep == USB_DATA_EP )
+    {
+        data_halt(dir);
+        return;
+    }
+
+    // Nothing else is ever armed (see ep_unused_handler())
+    for( odd=0; odd<USB_PP_BUFFERS(USB_PING_PONG_MODE, ep, dir); odd++ )
+    {
+        USB_BDT[USB_BD_INDEX(USB_PING_PONG_MODE, ep, dir, odd)].STAT.stat =
+            halt ? USB_BD_UOWN | USB_BD_BSTALL : 0x00;
+    }
+}
+
+
+/*
+ * SET_CONFIGURATION clears every halt, data_reset() starts the data endpoint
+ * again from scratch
+*/
+static void ep_halt_reset(void)
+{
+    unsigned char index;
+
+    for( index=2; index<2*(USB_EP_LAST+1); index++ )
+    {
+        if( (USB_HOT.ep_halted & EP_HALT_BIT(index)) &&
+                (index >> 1) != USB_DATA_EP )
+        {
+            ep_halt(index, 0);
+        }
+    }
+    USB_HOT.ep_halted = 0;
+}
+
+
+
+
+
+              /***************  Data Endpoint  *************/
+
+
+/*
+ * Starts the data endpoint once the device is configured: both data toggles
+ * back to DATA0 and every OUT BD not held armed. Queued bytes start flowing,
+ * unless they are stale (see USB_TX_STALE_MS)
+ */
+static void data_reset(void)
+{
+    unsigned char odd;
+    unsigned char i;
+#if USB_TX_STALE_MS != 0 && USB_TX_STALE_MS != 0xFFFF
+    unsigned short elapsed;
+#endif
+
+    // Unacknowledged IN packets back to the TX ring (SET_CONFIGURATION again)
+    for( odd=0; odd<DATA_PP; odd++ )
+    {
+        DATA_IN(odd).STAT.stat = 0x00;
+#if USB_PEEK_POKE
+        PEEK_STREAM_BD[odd] = 0;
+#endif
+    }
+    USB_HOT.tx_send = USB_HOT.tx_tail;
+
+    // Memory dumps are not sent again
+#if USB_PEEK_POKE
+    PEEK_STREAM_BYTES = 0;
+#endif
+
+#if USB_TX_STALE_MS == 0
+    USB_HOT.tx_tail = USB_HOT.tx_head;
+    USB_HOT.tx_send = USB_HOT.tx_head;
+#elif USB_TX_STALE_MS != 0xFFFF
+    // Milliseconds since the bus reset, modulo 2048
+    elapsed = ((((unsigned short) UFRMH << 8) | UFRML) - DATA_RESET_FRAME) &
+        0x7FF;
+    if( elapsed > USB_TX_STALE_MS )
+    {
+        USB_HOT.tx_tail = USB_HOT.tx_head;
+        USB_HOT.tx_send = USB_HOT.tx_head;
+    }
+#endif
+
+    // Ping-pong buffer pointers back to the even BDs
+    UCONbits.PPBRST = 1;
+    UCONbits.PPBRST = 0;
+
+    USB_HOT.in_armed = 0;
+    USB_HOT.in_odd = 0;
+    USB_HOT.in_dts = 0;
+    USB_HOT.out_odd = 0;
+
+    // Held OUT BDs keep their packets until usb_cdc_getc() makes room, the
+    // free ones follow them. BDs alternate from the even one with DATA0: the
+    // data toggle of a BD is its parity (always DATA0 without ping-pong)
+    odd = 0;
+    if( USB_HOT.rx_held )
+    {
+        odd = (USB_HOT.rx_held_odd + USB_HOT.rx_held) & DATA_PP_MASK;
+    }
+    USB_HOT.out_dts = odd;
+
+    for( i=USB_HOT.rx_held; i<DATA_PP; i++ )
+    {
+        data_arm_out(odd);
+        odd ^= DATA_PP_MASK;
+    }
+
+    data_tx_kick();
+}
+
+
+/*
+ * Bus reset: the endpoint stops, its data is kept. Data transactions done
+ * before the reset (still queued or in the USTAT FIFO) are accounted for,
+ * received packets stay held and unacknowledged IN packets are sent again by
+ * data_reset()
+ */
+static void data_bus_reset(void)
+{
+#if USB_DEFERRED_EVENTS
+    unsigned char tail;
+
+    for( tail = USB_HOT.ev_tail; tail != USB_HOT.ev_head; tail++ )
+    {
+        data_reset_trn(USB_EVENTS[tail & USB_EVENT_QUEUE_MASK]);
+    }
+    USB_HOT.ev_tail = tail;
+#endif
+
+    while( UIRbits.TRNIF )
+    {
+        USB_HOT.ustat = USTAT;
+        UIRbits.TRNIF = 0;
+        data_reset_trn(USB_HOT.ustat);
+    }
+
+    DATA_RESET_FRAME = ((unsigned short) UFRMH << 8) | UFRML;
+}
+
+
+/* Accounts for a data transaction found by data_bus_reset() */
+static void data_reset_trn(unsigned char ustat)
+{
+    unsigned char odd = ( ustat & USB_USTAT_PPBI ) ? 1 : 0;
+
+    if( USB_USTAT_INDEX(ustat) == USB_DATA_EP * 2 + USB_DIR_OUT )
+    {
+        USB_HOT.out_odd = odd ^ DATA_PP_MASK;
+        data_rx_hold(odd);
+    }
+    else if( USB_USTAT_INDEX(ustat) == USB_DATA_EP * 2 + USB_DIR_IN )
+    {
+        USB_HOT.tx_tail += DATA_IN_RING_BYTES(odd);
+        USB_HOT.in_armed--;
+    }
+}
+
+
+/*
+ * Gives an OUT BD to the SIE, BDs are armed in ping-pong order so the data
+ * toggle just alternates. A halted endpoint gets it stalled
+ */
+static void data_arm_out(unsigned char odd)
+{
+    DATA_OUT(odd).ADDR = USB_RAM_EP_ADDR(USB_DATA_EP, OUT, odd);
+    DATA_OUT(odd).CNT = DATA_OUT_SIZE;
+
+    if( USB_HOT.ep_halted & DATA_HALT_OUT )
+    {
+        DATA_OUT(odd).STAT.stat = USB_BD_UOWN | USB_BD_BSTALL;
+    }
+    else if( USB_HOT.out_dts )
+    {
+        DATA_OUT(odd).STAT.stat = USB_BD_UOWN | USB_BD_DTSEN | USB_BD_DTS;
+    }
+    else
+    {
+        DATA_OUT(odd).STAT.stat = USB_BD_UOWN | USB_BD_DTSEN;
+    }
+    USB_BD_ARMED(USB_DATA_EP, OUT, odd);
+
+    USB_HOT.out_dts ^= 1;
+}
+
+
+/* Copies the packet in OUT BD 'odd' to the RX ring, zero if there's no room */
+static unsigned char data_rx_push(unsigned char odd)
+{
+    volatile unsigned char *buffer = USB_EP_BUFFER(USB_DATA_EP, OUT, odd);
+    unsigned char count = DATA_OUT(odd).CNT;
+    unsigned char head = USB_HOT.rx_head;
+    unsigned char i;
+
+    if( (unsigned char) (USB_RX_RING_SIZE - (head - USB_HOT.rx_tail)) < count )
+    {
+        return 0;
+    }
+
+    for( i=0; i<count; i++ )
+    {
+        RX_RING[head & RX_RING_MASK] = buffer[i];
+        head++;
+    }
+    USB_HOT.rx_head = head;
+
+    return 1;
+}
+
+
+/* Moves held OUT BDs (in order) to the RX ring while there's room */
+static void data_rx_release(void)
+{
+    while( USB_HOT.rx_held && data_rx_push(USB_HOT.rx_held_odd) )
+    {
+        data_arm_out(USB_HOT.rx_held_odd);
+        USB_HOT.rx_held_odd ^= DATA_PP_MASK;
+        USB_HOT.rx_held--;
+        USB_ERROR_COUNT(USB_ERRORS_NAK);
+    }
+}
+
+
+/*
+ * Fills and arms the free IN BDs from the TX ring, or from a memory dump
+ * first (see MEMORY ACCESS above). Nothing while the endpoint is halted
+ */
+static void data_tx_kick(void)
+{
+    volatile unsigned char *buffer;
+    unsigned char tail;
+    unsigned char count;
+    unsigned char i;
+
+    if( USB_HOT.ep_halted & DATA_HALT_IN )
+    {
+        return;
+    }
+
+    while( USB_HOT.in_armed < DATA_PP &&
+            (PEEK_STREAM_PENDING() || USB_HOT.tx_head != USB_HOT.tx_send) )
+    {
+        buffer = USB_EP_BUFFER(USB_DATA_EP, IN, USB_HOT.in_odd);
+
+#if USB_PEEK_POKE
+        PEEK_STREAM_BD[USB_HOT.in_odd] = PEEK_STREAM_PENDING();
+        if( PEEK_STREAM_PENDING() )
+        {
+            count = DATA_IN_SIZE;
+            if( PEEK_STREAM_BYTES < DATA_IN_SIZE )
+            {
+                count = (unsigned char) PEEK_STREAM_BYTES;
+            }
+
+            for( i=0; i<count; i++ )
+            {
+                buffer[i] = PEEK_STREAM_DATA[i];
+            }
+            PEEK_STREAM_DATA += count;
+            PEEK_STREAM_BYTES -= count;
+        }
+        else
+#endif
+        {
+            tail = USB_HOT.tx_send;
+            count = USB_HOT.tx_head - tail;
+            if( count > DATA_IN_SIZE )
+            {
+                count = DATA_IN_SIZE;
+            }
+
+            for( i=0; i<count; i++ )
+            {
+                buffer[i] = TX_RING[tail & TX_RING_MASK];
+                tail++;
+            }
+            USB_HOT.tx_send = tail;
+        }
+
+        DATA_IN(USB_HOT.in_odd).ADDR =
+            USB_RAM_EP_ADDR(USB_DATA_EP, IN, USB_HOT.in_odd);
+        DATA_IN(USB_HOT.in_odd).CNT = count;
+
+        if( USB_HOT.in_dts )
+        {
+            DATA_IN(USB_HOT.in_odd).STAT.stat =
+                USB_BD_UOWN | USB_BD_DTSEN | USB_BD_DTS;
+        }
+        else
+        {
+            DATA_IN(USB_HOT.in_odd).STAT.stat = USB_BD_UOWN | USB_BD_DTSEN;
+        }
+        USB_BD_ARMED(USB_DATA_EP, IN, USB_HOT.in_odd);
+
+        USB_HOT.in_dts ^= 1;
+        USB_HOT.in_odd ^= DATA_PP_MASK;
+        USB_HOT.in_armed++;
+    }
+}
+
+
+/* Holds OUT BD 'odd' (the host gets NAKs), behind any other held one */
+static void data_rx_hold(unsigned char odd)
+{
+    if( USB_HOT.rx_held == 0 )
+    {
+        USB_HOT.rx_held_odd = odd;
+    }
+    USB_HOT.rx_held++;
+}
+
+
+/* A packet has been received, queue it or hold the BD (NAK) */
+static void data_out_handler(void)
+{
+    unsigned char odd = ( USB_HOT.ustat & USB_USTAT_PPBI ) ? 1 : 0;
+
+    USB_HOT.out_odd = odd ^ DATA_PP_MASK;
+
+    // Packets are queued in order, behind any held one
+    if( USB_HOT.rx_held == 0 && data_rx_push(odd) )
+    {
+        data_arm_out(odd);
+    }
+    else
+    {
+        data_rx_hold(odd);
+    }
+}
+
+
+/* A packet has been sent: its bytes are free, send more */
+static void data_in_handler(void)
+{
+    unsigned char odd = ( USB_HOT.ustat & USB_USTAT_PPBI ) ? 1 : 0;
+
+    USB_HOT.tx_tail += DATA_IN_RING_BYTES(odd);
+    USB_HOT.in_armed--;
+    data_tx_kick();
+}
+
+
+/*
+ * ENDPOINT_HALT set or cleared on direction 'dir' (USB_HOT.ep_halted), the
+ * direction starts again with DATA0 from the BD the SIE uses next. Armed IN
+ * packets go back to the TX ring (a memory dump is dropped), held OUT packets
+ * stay held. The host halts idle endpoints: transactions completed meanwhile
+ * are not looked for
+ */
+static void data_halt(unsigned char dir)
+{
+    unsigned char odd;
+    unsigned char i;
+
+    if( dir == USB_DIR_IN )
+    {
+        // The oldest armed BD is the next one
+        USB_HOT.in_odd ^= USB_HOT.in_armed & DATA_PP_MASK;
+        USB_HOT.in_armed = 0;
+        USB_HOT.in_dts = 0;
+        USB_HOT.tx_send = USB_HOT.tx_tail;
+#if USB_PEEK_POKE
+        PEEK_STREAM_BYTES = 0;
+#endif
+
+        for( odd=0; odd<DATA_PP; odd++ )
+        {
+#if USB_PEEK_POKE
+            PEEK_STREAM_BD[odd] = 0;
+#endif
+            if( USB_HOT.ep_halted & DATA_HALT_IN )
+            {
+                DATA_IN(odd).STAT.stat = USB_BD_UOWN | USB_BD_BSTALL;
+            }
+            else
+            {
+                DATA_IN(odd).STAT.stat = 0x00;
+            }
+        }
+
+        data_tx_kick();
+        return;
+    }
+
+    USB_HOT.out_dts = 0;
+    odd = USB_HOT.out_odd;
+    for( i=USB_HOT.rx_held; i<DATA_PP; i++ )
+    {
+        data_arm_out(odd);
+        odd ^= DATA_PP_MASK;
+    }
+}
+
+
+
+
+
+              /***************  Memory Access  *************/
+
+#if USB_PEEK_POKE
+/* PEEK / POKE address: wIndex high byte (bits 23:16) and wValue */
+static unsigned long peek_request_address(void)
+{
+    return ((unsigned long) SETUP_PACKET.wIndex1 << 16) |
+        ((unsigned short) SETUP_PACKET.wValue1 << 8) | SETUP_PACKET.wValue0;
+}
+
+
+/* Generic pointer to ADDRESS in data memory or program memory (SPACE) */
+static const unsigned char *peek_pointer(unsigned char space,
+        unsigned long address)
+{
+#if USB_RAM_ARRAY
+    // Host targets: offsets in the memory arrays
+    if( space == USB_PEEK_PROGRAM )
+    {
+        return USB_PROGRAM_MEMORY +
+            (address & (USB_PROGRAM_MEMORY_SIZE - 1));
+    }
+    return (const unsigned char*) USB_DATA_MEMORY +
+        (address & (USB_DATA_MEMORY_LIMIT - 1));
+#else
+    // Through unsigned short: data pointers are 16 bits wide
+    if( space == USB_PEEK_PROGRAM )
+    {
+        return (__code unsigned char*) address;
+    }
+    return (__data unsigned char*) (unsigned short) address;
+#endif
+}
+
+
+/* Program memory row DATA OUT stage done, see POKE_PENDING */
+static void poke_row_received(void)
+{
+    POKE_PENDING = 1;
+}
+
+
+/*
+ * Writes the received program memory row from the main loop (usb_task,
+ * usb_process_events), then sends the STATUS stage. The CPU stalls during
+ * the erase and the writes (about 6ms), the USB interrupt stays masked so a
+ * bus reset or a new SETUP can't come in between
+ */
+static void poke_program_pending(void)
+{
+    unsigned char usbie;
+
+    if( !POKE_PENDING )
+    {
+        return;
+    }
+
+    USB_LOCK(usbie);
+    if( POKE_PENDING )
+    {
+        POKE_PENDING = 0;
+        poke_program_row();
+        ep0_status_in();
+    }
+    USB_UNLOCK(usbie);
+}
+
+
+/*
+ * Erases the program memory row at POKE_ADDRESS and writes POKE_ROW there,
+ * by holding registers blocks: a write goes to the block TBLPTR is in, so the
+ * pointer stays on the last byte of each block until it's written
+ */
+static void poke_program_row(void)
+{
+    unsigned char i;
+
+    TBLPTRU = (unsigned char) (POKE_ADDRESS >> 16);
+    TBLPTRH = (unsigned char) (POKE_ADDRESS >> 8);
+    TBLPTRL = (unsigned char) POKE_ADDRESS;
+    poke_flash_cycle(POKE_EECON1_ERASE);
+
+    for( i=0; i<USB_PEEK_ROW_SIZE; i++ )
+    {
+        TABLAT = POKE_ROW[i];
+        if( (i & (POKE_WRITE_BLOCK - 1)) != POKE_WRITE_BLOCK - 1 )
+        {
+            TBLWT_POSTINC();
+            continue;
+        }
+
+        TBLWT();
+        poke_flash_cycle(POKE_EECON1_WRITE);
+        TBLPTRL++;
+    }
+}
+
+
+/*
+ * Starts a program memory erase or write (EECON1 value) with the EECON2
+ * unlock sequence, interrupts off. The CPU stalls until it's done
+ *
+ *                      See PIC18F4550 datasheet: page 96
+ */
+static void poke_flash_cycle(unsigned char eecon1)
+{
+    unsigned char gie = INTCONbits.GIE;
+
+    EECON1 = eecon1;
+    INTCONbits.GIE = 0;
+    EECON2 = 0x55;
+    EECON2 = 0xAA;
+    EECON1bits.WR = 1;
+    INTCONbits.GIE = gie;
+    EECON1bits.WREN = 0;
 }
+#endif // USB_PEEK_POKE
@@ -57,6 +57,204 @@ void usb_handler(void);
 
 
 
+/*
+ * Handles USB requests, states and transactions without interrupts, when
+ * built with USB_POLLING (see usb_config.h), instead of usb_handler()
+ *
+ * Call it from the application main loop, it does the same work as
+ * usb_handler() (same code) if any USB event is pending, otherwise it returns
+ * right away. usb_cdc_putc() / usb_cdc_getc() call it while they wait
+ *
+ * How often: the host, not the device, keeps the pace, so late calls mostly
+ * cost throughput (the SIE NAKs while the buffers are busy) but some USB
+ * timings must still hold (USB 2.0 specification: page 245, section 9.2.6):
+ *
+ *   - SET_ADDRESS: the new address is applied once its STATUS stage is done,
+ *     the host may use it 2ms later. Calls at least every 1ms while enumerating
+ *   - Control transfers: each DATA packet within 500ms, the STATUS stage
+ *     within 50ms. Stay well below, hosts retry only a few times
+ *   - Suspend: after 3ms of bus idle the device must be suspended before 10ms
+ *     (bus powered current limit), no more than ~5ms between calls
+ *   - Bulk data: up to USB_TRNIF_MAX_PER_ENTRY transactions (64 bytes each)
+ *     per call, plus what ping-pong buffering keeps armed. One call per
+ *     millisecond gives at most ~256KB/s
+ *
+ * Build with USB_CYCLES to get the worst case cycles per call (GET_CYCLES
+ * vendor request read by scripts/usb_cycles.py, usb_get_max_cycles())
+ */
+void usb_task(void);
+
+
+
+/*
+ * Handles the USB transactions queued by usb_handler(), when built with
+ * USB_DEFERRED_EVENTS (see usb_config.h), applies a SET_PERSONALITY request
+ * (see usb_set_personality()) and writes a program memory row sent by POKE
+ * (see usb_vendor.h). Interrupt driven applications call it
+ * from the main loop, with or without USB_DEFERRED_EVENTS
+ *
+ * The interrupt handler only records each completed transaction and leaves
+ * its buffer descriptor owned by the CPU (the host gets NAKs on that endpoint
+ * meanwhile, a SETUP packet stays in the EP0 OUT buffer), so descriptors
+ * copies, requests handling and data rings copies run here with every
+ * interrupt enabled. Only the USB interrupt is blocked while each transaction
+ * is handled
+ *
+ * Call it from the application main loop at least as often as usb_task()
+ * would be called (see above), usb_cdc_putc() / usb_cdc_getc() call it while
+ * they wait. Build with USB_CYCLES to get the worst case cycles per call
+ */
+void usb_process_events(void);
+
+
+
+/*
+ * Device time on the USB frame clock, when built with USB_FRAME_CLOCK (see
+ * usb_config.h): FRAME is the 32 bits frame number (1ms each, from the host
+ * SOFs), PHASE the instruction cycles since that frame started (0 to 11999)
+ *
+ * Timestamp application records with usb_timestamp(), the host aligns them
+ * with its own clock through the GET_TIMESTAMPS vendor request (usb_vendor.h)
+ * to sub-millisecond precision. The SOF is captured by the interrupt handler,
+ * its latency (a few microseconds, more if the USB interrupt is blocked or
+ * runs at low priority) is the precision limit
+ */
+typedef struct
+{
+    unsigned long frame;
+    unsigned short phase;
+} USB_TIMESTAMP_t;
+
+void usb_timestamp(USB_TIMESTAMP_t *timestamp);
+
+
+
+/*
+ * Returns the worst case instruction cycles per call measured so far for the
+ * slot WHICH (USB_CYCLES_* in usb_vendor.h), 0 if not built with USB_CYCLES
+ */
+unsigned short usb_get_max_cycles(unsigned char which);
+
+
+
+/*
+ * Returns the USB_ERROR_STATS counter WHICH (USB_ERRORS_* in usb_vendor.h), 0
+ * if not built with it. usb_print_errors() prints them all on one line, when
+ * built with USB_ERROR_PRINTF (util/printf.c, the UART set up by the
+ * application): never from the interrupt handler
+ */
+unsigned short usb_get_errors(unsigned char which);
+void usb_print_errors(void);
+
+
+
+/*
+ * Sends the trace ring (USB_TRACE, see usb_config.h) to the UART set up by
+ * the application (util/uart.h), only while the transmitter has room: it
+ * never waits. Call it from the main loop, scripts/usb_trace.py decodes the
+ * stream
+ *
+ * Each record goes out as USB_TRACE_SYNC then 4 bytes: event id (bits 7:3)
+ * with the frame number bits 10:8 (bits 2:0), USTAT (or the event value), BD
+ * STAT and the frame number bits 7:0. Events dropped while the ring was full
+ * are reported by a USB_TRACE_LOST record once it empties
+ */
+void usb_trace_drain(void);
+
+#define USB_TRACE_SYNC 0xA5
+
+// Trace events: USTAT field, STAT field
+#define USB_TRACE_TRN 0x01 // Transaction completed: USTAT, BD STAT (PID)
+#define USB_TRACE_ARM 0x02 // BD given to the SIE: its USTAT, BD STAT
+#define USB_TRACE_RESET 0x03 // Bus reset
+#define USB_TRACE_SUSPEND 0x04 // Suspended
+#define USB_TRACE_RESUME 0x05 // Resumed
+#define USB_TRACE_STALL 0x06 // STALL handshake sent
+#define USB_TRACE_ERROR 0x07 // Bus errors: UEIR
+#define USB_TRACE_LOST 0x08 // Events dropped (ring full): count, up to 255
+
+
+
+/*
+ * Handle USB events from two interrupt priority levels, when built with
+ * USB_INTERRUPT_PRIORITY (see usb_config.h), instead of usb_handler()
+ *
+ * The USB module has a single interrupt source (USBIF) so the handlers move
+ * it between both levels (IPR2bits.USBIP): usb_handler_high() handles only
+ * data endpoints transactions, any other event demotes the USB interrupt to
+ * low priority and re-triggers it. usb_handler_low() then handles everything
+ * pending (like usb_handler()) and promotes the USB interrupt back to high
+ * priority. Data transactions never wait for low priority application
+ * sources, at most for one usb_handler_low() pass while EP0 is busy
+ *
+ * Both handlers clear PIR2bits.USBIF themselves. Call them like this, only
+ * the high priority vector can use the shadow registers:
+ *
+ *	void usb_isr_high(void) __shadowregs __interrupt 1
+ *	{
+ *		if( PIR2bits.USBIF && IPR2bits.USBIP )
+ *		{
+ *			usb_handler_high();
+ *		}
+ *
+ *		// Time critical application sources (IPRx bits set)
+ *	}
+ *
+ *	void usb_isr_low(void) __interrupt 2
+ *	{
+ *		if( PIR2bits.USBIF && !IPR2bits.USBIP )
+ *		{
+ *			usb_handler_low();
+ *		}
+ *
+ *		// Any other application source (IPRx bits cleared)
+ *	}
+ */
+void usb_handler_high(void);
+void usb_handler_low(void);
+
+
+
+/*
+ * Switches the device to another PERSONALITY (descriptors set), see
+ * usb_device.spec and USB_PERSONALITY_<NAME> in usb_descriptors.h
+ *
+ * The device detaches from the bus, waits USB_DETACH_MS milliseconds (busy
+ * wait, with USB interrupts disabled) and attaches again, the host then
+ * enumerates it with the new descriptors
+ *
+ * The host can ask for the same through the SET_PERSONALITY vendor request
+ * (see usb_vendor.h). usb_handler() only records it, the switch runs from the
+ * main loop: usb_task() in polling mode, usb_process_events() otherwise
+ *
+ * Returns a non-zero value if success
+ */
+unsigned char usb_set_personality(unsigned char personality);
+
+
+
+/*
+ * Returns the current personality number
+ */
+unsigned char usb_get_personality(void);
+
+
+
+/*
+ * CDC line state set by the host on the communications interface: the
+ * control lines (USB_CDC_LINE_DTR / USB_CDC_LINE_RTS bits, see usb_cdc.h)
+ * and the line coding bits per second
+ *
+ * A terminal opening the port raises DTR (and RTS), closing it drops them, a
+ * bus reset drops them too. Define USB_ON_LINE_STATE (see usb_config.h) to be
+ * called when either changes. The device has no UART behind, the line coding
+ * is only kept for GET_LINE_CODING and the application
+ */
+unsigned char usb_cdc_line_state(void);
+unsigned long usb_cdc_baud_rate(void);
+
+
+
 /*
  * Returns a non-zero value if device has been enumerated by the pc, it's
  * configured and ready for send and receive data
@@ -65,10 +263,52 @@ unsigned char usb_is_configured(void);
 
 
 
+/*
+ * Returns a non-zero value while the bus is suspended (3ms without activity).
+ * The device stays configured, usb_cdc_putc() keeps queueing
+ */
+unsigned char usb_is_suspended(void);
+
+
+
+/*
+ * Wakes the suspended host up (remote wakeup) if it enabled it with
+ * SET_FEATURE(DEVICE_REMOTE_WAKEUP), blocks for about 12ms
+ *
+ * Returns a non-zero value if the resume signaling was sent
+ */
+unsigned char usb_remote_wakeup(void);
+
+
+
+/*
+ * Call it from the main loop: while the bus is suspended, wakes the host up
+ * if TX data is queued (see usb_remote_wakeup()), otherwise stops the core in
+ * Sleep mode until the bus resumes or another interrupt fires (see SUSPEND in
+ * usb_config.h). Returns at once if not suspended
+ *
+ *	while(1)
+ *	{
+ *		...
+ *		usb_sleep();
+ *	}
+ *
+ * Timers on the instruction clock (Timer 0, sched.c) stop meanwhile
+ */
+void usb_sleep(void);
+
+
+
 /*
  * Sends a character C to CDC virtual com port
  *
- * Returns a non-zero value if success
+ * The character is queued (USB_TX_RING_SIZE bytes, see usb_config.h) and sent
+ * by the interrupt handler, blocks while the queue is full. A suspended host is
+ * woken up if it allows remote wakeup (see usb_remote_wakeup()). The queue
+ * survives bus resets (see USB_TX_STALE_MS)
+ *
+ * Returns a non-zero value if success (zero if the queue is full and the
+ * device isn't configured)
  */
 unsigned char usb_cdc_putc(char c);
 
@@ -77,12 +317,23 @@ unsigned char usb_cdc_putc(char c);
 /*
  * Returns a character from CDC virtual com port
  *
- * Block until a character has been received
+ * Block until a character has been received. Received packets are queued
+ * (USB_RX_RING_SIZE bytes), the host is NAKed while the queue is full
  */
 char usb_cdc_getc(void);
 
 
 
+/*
+ * Bytes usb_cdc_getc() returns right away (received and queued) and bytes
+ * usb_cdc_putc() queues right away (free in the TX queue), so the main loop
+ * can move data without blocking
+ */
+unsigned char usb_cdc_rx_count(void);
+unsigned char usb_cdc_tx_room(void);
+
+
+
 /*
  * Sends a character string STR to CDC virtual com port
  *
@@ -95,6 +346,8 @@ unsigned char usb_cdc_puts(char *str);
 /*
  * Reads a character string STR from CDC virtual com port
  *
+ * Reads up to a CR or LF character (not stored), STR must be long enough
+ *
  * Returns a non-zero value if success
  */
 unsigned char usb_cdc_gets(char *str);
@@ -0,0 +1,127 @@
+#include <pic18fregs.h>
+#include "sched.h"
+
+// Timer 0 preload, 1ms: 12 MIPS / 8 (prescaler) = 1500 counts
+#define SCHED_TMR0_PRELOAD (65536 - 1500)
+
+// Timer ticks ignored after a SOF (ms), SOFs come back every 1ms
+#define SCHED_SOF_TIMEOUT 2
+
+static sched_task_t task[SCHED_MAX_TASKS];
+static unsigned int period[SCHED_MAX_TASKS];
+static unsigned int remaining[SCHED_MAX_TASKS];
+static unsigned char tasks;
+
+// Free running ticks (interrupt) and ticks already handled (main loop)
+static volatile unsigned char ticks;
+static unsigned char seen;
+
+static volatile unsigned char sof_alive;
+static unsigned int last_frame;
+
+
+void sched_init(void)
+{
+    tasks = 0;
+    ticks = 0;
+    seen = 0;
+    sof_alive = 0;
+
+    // Timer 0: 16 bits, instruction clock, 1:8 prescaler
+    T0CON = 0x02;
+    TMR0H = SCHED_TMR0_PRELOAD >> 8;
+    TMR0L = SCHED_TMR0_PRELOAD & 0xFF;
+    INTCONbits.TMR0IF = 0;
+    INTCON2bits.TMR0IP = 0; // Low priority (resets high), with IPEN set
+    INTCONbits.TMR0IE = 1;
+    T0CONbits.TMR0ON = 1;
+}
+
+
+unsigned char sched_add(sched_task_t t, unsigned int period_ms)
+{
+    if (tasks == SCHED_MAX_TASKS || period_ms == 0)
+    {
+        return 0;
+    }
+
+    task[tasks] = t;
+    period[tasks] = period_ms;
+    remaining[tasks] = period_ms;
+    tasks++;
+    return 1;
+}
+
+
+void sched_run(void)
+{
+    unsigned char elapsed = ticks - seen;
+    unsigned char i;
+
+    // Nothing to do until the next tick, idle the core (peripherals and
+    // interrupts keep running, any interrupt wakes it up)
+    if (elapsed == 0)
+    {
+        OSCCONbits.IDLEN = 1;
+        Sleep();
+        return;
+    }
+    seen += elapsed;
+
+    for (i = 0; i < tasks; i++)
+    {
+        if (remaining[i] > elapsed)
+        {
+            remaining[i] -= elapsed;
+            continue;
+        }
+
+        task[i]();
+
+        // Keep the phase, unless the task is already late by a period
+        if (remaining[i] + period[i] > elapsed)
+        {
+            remaining[i] = remaining[i] + period[i] - elapsed;
+        }
+        else
+        {
+            remaining[i] = period[i];
+        }
+    }
+}
+
+
+void sched_sof(void)
+{
+    // 11 bits frame number, missed SOFs still count
+    unsigned int frame = ((unsigned int) UFRMH << 8) | UFRML;
+
+    if (sof_alive)
+    {
+        ticks += (frame - last_frame) & 0x7FF;
+    }
+    else
+    {
+        ticks++;
+    }
+
+    last_frame = frame;
+    sof_alive = SCHED_SOF_TIMEOUT;
+}
+
+
+void sched_timer_isr(void)
+{
+    TMR0H = SCHED_TMR0_PRELOAD >> 8;
+    TMR0L = SCHED_TMR0_PRELOAD & 0xFF;
+    INTCONbits.TMR0IF = 0;
+
+    if (sof_alive)
+    {
+        sof_alive--;
+    }
+    else
+    {
+        ticks++;
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+/*
+ * Cooperative periodic tasks scheduler, 1ms tick
+ *
+ * Tick sources:
+ *   - Timer 0: call sched_timer_isr() from the interrupt handler when
+ *     INTCONbits.TMR0IF is set. sched_init() makes it a low priority
+ *     interrupt: with priorities (RCONbits.IPEN) that's the low priority
+ *     handler
+ *   - USB Start Of Frame (optional): build the USB stack with USB_ON_SOF
+ *     defined as sched_sof (the frame number UFRM keeps the count if a SOF is
+ *     missed), Timer 0 ticks are then ignored while SOFs arrive. It costs a
+ *     USB interrupt every 1ms (see USB_IE_SOF in usb_config.h)
+ *
+ * Tasks run from sched_run() (main loop), never from an interrupt
+ */
+
+#define SCHED_MAX_TASKS 8
+
+typedef void (*sched_task_t)(void);
+
+void sched_init(void);
+unsigned char sched_add(sched_task_t task, unsigned int period_ms);
+void sched_run(void);
+void sched_sof(void);
+void sched_timer_isr(void);
+
+#endif // SCHED_H
@@ -0,0 +1,487 @@
+/*
+ * File: 	cdc_bench.c
+ * Compiler: gcc
+ *
+ *
+ * [!] Host side of the loopback benchmark firmware (src/benchmark.c), the
+ * release acceptance test:
+ *
+ *     cdc_bench [-m echo|sink|source|all] [-s SIZES] [-n COUNT] [-t SECONDS]
+ *               DEVICE
+ *
+ * Drives the CDC tty DEVICE (/dev/ttyACM*) raw, selecting each firmware mode
+ * with the tty speed, once per packet size in SIZES (comma separated bytes,
+ * default 1,64,512):
+ *
+ *   - echo: COUNT round trips (default 1000), each a SIZE bytes write read
+ *     back whole and compared. Reports MB/s each way and p50 / p99 / p999 /
+ *     max round trip latency
+ *   - sink: SIZE bytes writes for SECONDS (default 2), until the tty has sent
+ *     them all. Reports host to device MB/s
+ *   - source: SIZE bytes reads for SECONDS. Reports device to host MB/s and
+ *     gaps in the firmware byte counter
+ *
+ * Exits with 1 if an echo differs, the counter has gaps or the device stops
+ * answering (TIMEOUT_MS). MB/s are 10^6 bytes per second
+ *
+ *
+ *
+ * This is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+
+
+/*******************************************************************************
+                                  DEFINITIONS
+*******************************************************************************/
+
+// Modes, tty speeds selecting them (see src/benchmark.c)
+#define BENCH_ECHO 0x01
+#define BENCH_SINK 0x02
+#define BENCH_SOURCE 0x04
+#define BENCH_ALL (BENCH_ECHO | BENCH_SINK | BENCH_SOURCE)
+
+#define BENCH_SPEED_ECHO B115200
+#define BENCH_SPEED_SINK B19200
+#define BENCH_SPEED_SOURCE B38400
+
+// Packet sizes, at most
+#define BENCH_SIZES_MAX 16
+#define BENCH_SIZE_MAX 65536
+
+// No byte from the device for that long is a failure
+#define TIMEOUT_MS 1000
+
+// Stale bytes are read until the device is quiet that long, or for SETTLE_MS
+// at most (the source mode never is) after a mode switch
+#define QUIET_MS 50
+#define SETTLE_MS 200
+
+static int FD;
+static unsigned char BUFFER[BENCH_SIZE_MAX];
+static unsigned char EXPECTED[BENCH_SIZE_MAX];
+
+/*******************************************************************************
+*******************************************************************************/
+
+
+
+/* Monotonic time, nanoseconds */
+static unsigned long long now_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long long) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+
+/* Raw tty at SPEED (the mode), without what the previous mode left */
+static int set_mode(speed_t speed)
+{
+    struct termios tty;
+    unsigned long long end;
+
+    if( tcgetattr(FD, &tty) < 0 )
+    {
+        return -1;
+    }
+
+    cfmakeraw(&tty);
+    tty.c_cflag |= CLOCAL | CREAD;
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = 0;
+    cfsetispeed(&tty, speed);
+    cfsetospeed(&tty, speed);
+
+    if( tcsetattr(FD, TCSANOW, &tty) < 0 )
+    {
+        return -1;
+    }
+
+    // Bytes queued under the previous mode
+    tcflush(FD, TCIOFLUSH);
+    end = now_ns() + SETTLE_MS * 1000000ULL;
+    while( now_ns() < end )
+    {
+        struct pollfd poll_fd = { FD, POLLIN, 0 };
+
+        if( poll(&poll_fd, 1, QUIET_MS) <= 0 ||
+                read(FD, BUFFER, sizeof(BUFFER)) <= 0 )
+        {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+
+/*
+ * Writes SIZE bytes from OUT and reads SIZE bytes to IN (either may be 0) at
+ * the same time, so echoes larger than the tty buffers keep flowing. -1 on
+ * error or time-out
+ */
+static int transfer(const unsigned char *out, unsigned char *in, size_t size)
+{
+    size_t sent = out ? 0 : size;
+    size_t received = in ? 0 : size;
+    ssize_t count;
+
+    while( sent < size || received < size )
+    {
+        struct pollfd poll_fd = { FD, 0, 0 };
+
+        poll_fd.events = (sent < size ? POLLOUT : 0) |
+            (received < size ? POLLIN : 0);
+        if( poll(&poll_fd, 1, TIMEOUT_MS) <= 0 )
+        {
+            fprintf(stderr, "cdc_bench: time-out, %zu of %zu bytes %s\n",
+                    sent < size ? sent : received, size,
+                    sent < size ? "written" : "read");
+            return -1;
+        }
+
+        if( poll_fd.revents & POLLOUT )
+        {
+            count = write(FD, out + sent, size - sent);
+            if( count < 0 && errno != EAGAIN && errno != EINTR )
+            {
+                perror("cdc_bench: write");
+                return -1;
+            }
+            if( count > 0 )
+            {
+                sent += count;
+            }
+        }
+
+        if( poll_fd.revents & POLLIN )
+        {
+            count = read(FD, in + received, size - received);
+            if( count < 0 && errno != EAGAIN && errno != EINTR )
+            {
+                perror("cdc_bench: read");
+                return -1;
+            }
+            if( count > 0 )
+            {
+                received += count;
+            }
+        }
+
+        if( poll_fd.revents & (POLLERR | POLLHUP) )
+        {
+            fprintf(stderr, "cdc_bench: device gone\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+static int compare_ns(const void *a, const void *b)
+{
+    unsigned long long x = *(const unsigned long long*) a;
+    unsigned long long y = *(const unsigned long long*) b;
+
+    return x < y ? -1 : x > y;
+}
+
+
+/* Percentile P (0 to 1) of the SORTED round trips, microseconds */
+static double percentile_us(const unsigned long long *sorted, unsigned count,
+        double p)
+{
+    unsigned index = (unsigned) (p * count + 0.999999);
+
+    if( index > 0 )
+    {
+        index--;
+    }
+    return sorted[index] / 1000.0;
+}
+
+
+static double mb_per_s(unsigned long long bytes, unsigned long long ns)
+{
+    return ns ? bytes * 1000.0 / ns : 0.0;
+}
+
+
+
+              /***************  Modes  *************/
+
+/* COUNT round trips of SIZE bytes */
+static int bench_echo(unsigned size, unsigned count)
+{
+    unsigned long long *trips;
+    unsigned long long start;
+    unsigned long long total = 0;
+    unsigned i;
+    unsigned j;
+    int status = 0;
+
+    trips = malloc(count * sizeof(*trips));
+    if( !trips || set_mode(BENCH_SPEED_ECHO) < 0 )
+    {
+        perror("cdc_bench: echo");
+        free(trips);
+        return -1;
+    }
+
+    for( i=0; i<count; i++ )
+    {
+        for( j=0; j<size; j++ )
+        {
+            EXPECTED[j] = (unsigned char) (i + j);
+        }
+
+        start = now_ns();
+        if( transfer(EXPECTED, BUFFER, size) < 0 )
+        {
+            free(trips);
+            return -1;
+        }
+        trips[i] = now_ns() - start;
+        total += trips[i];
+
+        if( memcmp(BUFFER, EXPECTED, size) != 0 )
+        {
+            fprintf(stderr, "cdc_bench: echo %u of %u bytes differs\n", i,
+                    size);
+            status = -1;
+        }
+    }
+
+    qsort(trips, count, sizeof(*trips), compare_ns);
+    printf("%-8s %6u %10.3f %10.1f %10.1f %10.1f %10.1f\n", "echo", size,
+            mb_per_s((unsigned long long) size * count, total),
+            percentile_us(trips, count, 0.50),
+            percentile_us(trips, count, 0.99),
+            percentile_us(trips, count, 0.999),
+            trips[count - 1] / 1000.0);
+
+    free(trips);
+    return status;
+}
+
+
+/* SIZE bytes writes for SECONDS, until sent */
+static int bench_sink(unsigned size, unsigned seconds)
+{
+    unsigned long long start;
+    unsigned long long end;
+    unsigned long long bytes = 0;
+
+    if( set_mode(BENCH_SPEED_SINK) < 0 )
+    {
+        perror("cdc_bench: sink");
+        return -1;
+    }
+
+    memset(BUFFER, 0x55, size);
+    start = now_ns();
+    end = start + seconds * 1000000000ULL;
+    while( now_ns() < end )
+    {
+        if( transfer(BUFFER, 0, size) < 0 )
+        {
+            return -1;
+        }
+        bytes += size;
+    }
+    tcdrain(FD);
+
+    printf("%-8s %6u %10.3f\n", "sink", size, mb_per_s(bytes,
+                now_ns() - start));
+    return 0;
+}
+
+
+/* SIZE bytes reads for SECONDS, the counter checked */
+static int bench_source(unsigned size, unsigned seconds)
+{
+    unsigned long long start;
+    unsigned long long end;
+    unsigned long long bytes = 0;
+    unsigned gaps = 0;
+    unsigned char next;
+    unsigned i;
+
+    if( set_mode(BENCH_SPEED_SOURCE) < 0 )
+    {
+        perror("cdc_bench: source");
+        return -1;
+    }
+
+    // The clock starts with the first byte, the counter goes on from it
+    if( transfer(0, BUFFER, 1) < 0 )
+    {
+        return -1;
+    }
+    next = BUFFER[0] + 1;
+
+    start = now_ns();
+    end = start + seconds * 1000000000ULL;
+    while( now_ns() < end )
+    {
+        if( transfer(0, BUFFER, size) < 0 )
+        {
+            return -1;
+        }
+
+        for( i=0; i<size; i++ )
+        {
+            if( BUFFER[i] != next )
+            {
+                gaps++;
+            }
+            next = BUFFER[i] + 1;
+        }
+        bytes += size;
+    }
+
+    printf("%-8s %6u %10.3f\n", "source", size, mb_per_s(bytes,
+                now_ns() - start));
+
+    if( gaps )
+    {
+        fprintf(stderr, "cdc_bench: %u gaps in the source counter\n", gaps);
+        return -1;
+    }
+    return 0;
+}
+
+
+
+/* Comma separated sizes, their number or 0 if invalid */
+static unsigned parse_sizes(char *list, unsigned *sizes)
+{
+    unsigned count = 0;
+    char *item;
+    char *end;
+    unsigned long size;
+
+    for( item = strtok(list, ","); item; item = strtok(0, ",") )
+    {
+        size = strtoul(item, &end, 0);
+        if( *end || size == 0 || size > BENCH_SIZE_MAX ||
+                count == BENCH_SIZES_MAX )
+        {
+            return 0;
+        }
+        sizes[count++] = (unsigned) size;
+    }
+
+    return count;
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *device = 0;
+    char default_sizes[] = "1,64,512";
+    unsigned sizes[BENCH_SIZES_MAX];
+    unsigned size_count;
+    unsigned modes = BENCH_ALL;
+    unsigned count = 1000;
+    unsigned seconds = 2;
+    char *size_list = default_sizes;
+    int status = 0;
+    unsigned i;
+    int j;
+
+    for( j=1; j<argc; j++ )
+    {
+        if( strcmp(argv[j], "-m") == 0 && j + 1 < argc )
+        {
+            j++;
+            modes = strcmp(argv[j], "echo") == 0 ? BENCH_ECHO :
+                strcmp(argv[j], "sink") == 0 ? BENCH_SINK :
+                strcmp(argv[j], "source") == 0 ? BENCH_SOURCE :
+                strcmp(argv[j], "all") == 0 ? BENCH_ALL : 0;
+        }
+        else if( strcmp(argv[j], "-s") == 0 && j + 1 < argc )
+        {
+            size_list = argv[++j];
+        }
+        else if( strcmp(argv[j], "-n") == 0 && j + 1 < argc )
+        {
+            count = (unsigned) strtoul(argv[++j], 0, 0);
+        }
+        else if( strcmp(argv[j], "-t") == 0 && j + 1 < argc )
+        {
+            seconds = (unsigned) strtoul(argv[++j], 0, 0);
+        }
+        else
+        {
+            device = argv[j];
+        }
+    }
+
+    size_count = parse_sizes(size_list, sizes);
+    if( !device || !modes || !size_count || !count || !seconds )
+    {
+        fprintf(stderr, "usage: cdc_bench [-m echo|sink|source|all] "
+                "[-s SIZES] [-n COUNT] [-t SECONDS] DEVICE\n");
+        return 1;
+    }
+
+    FD = open(device, O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if( FD < 0 )
+    {
+        perror(device);
+        return 1;
+    }
+
+    printf("%-8s %6s %10s %10s %10s %10s %10s\n", "mode", "size", "MB/s",
+            "p50 us", "p99 us", "p999 us", "max us");
+    fflush(stdout);
+
+    for( i=0; i<size_count && status == 0; i++ )
+    {
+        if( (modes & BENCH_ECHO) && bench_echo(sizes[i], count) < 0 )
+        {
+            status = 1;
+        }
+        if( (modes & BENCH_SINK) && bench_sink(sizes[i], seconds) < 0 )
+        {
+            status = 1;
+        }
+        if( (modes & BENCH_SOURCE) && bench_source(sizes[i], seconds) < 0 )
+        {
+            status = 1;
+        }
+        fflush(stdout);
+    }
+
+    // Back to echo: a terminal opening the port next sees the usual device
+    set_mode(BENCH_SPEED_ECHO);
+    close(FD);
+
+    return status;
+}